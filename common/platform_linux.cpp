@@ -105,7 +105,7 @@ size_t GetNumberOfProcessors()
 
 void SleepMS(size_t iMS)
 {
-	usleep(iMS);
+	usleep(iMS * 1000);
 }
 
 void OpenBrowser(const std::string& sURL)
@@ -0,0 +1,7 @@
+in vec3 vecPosition;
+
+void main()
+{
+	// The quad comes in already covering the screen, so there's nothing to transform.
+	gl_Position = vec4(vecPosition, 1.0);
+}
@@ -3,10 +3,8 @@ uniform sampler2D iDiffuse;
 uniform bool bNormal = false;
 uniform sampler2D iNormal;
 uniform vec4 vecColor = vec4(1.0, 1.0, 1.0, 1.0);
-uniform vec3 vecCameraPosition;
 
 uniform bool bLighted;
-uniform vec3 vecSunlight;
 
 uniform bool bRimLighting;
 
@@ -20,13 +18,26 @@ in vec3 vecFragmentTangent;
 in vec3 vecFragmentBitangent;
 in vec3 vecFragmentColor;
 
-uniform mat4 mView;
+#if defined(INSTANCED) || defined(SPRITE)
+in mat3 mFragmentGlobal3x3;
+in vec4 vecFragmentInstanceColor;
+#endif
+
 uniform mat4 mGlobal;
 
+#ifdef WEIGHTED
+// Drawn into two targets for weighted blended transparency, this is the second one.
+out vec4 vecOutputWeight;
+#endif
+
 void main()
 {
 	// This 3x3 matrix should have the rotation components only. We need it to transform the fragment normals into world space.
+#if defined(INSTANCED) || defined(SPRITE)
+	mat3 mGlobal3x3 = mFragmentGlobal3x3;
+#else
 	mat3 mGlobal3x3 = mat3(mGlobal);
+#endif
 
 	vec3 vecGlobalNormal;
 	if (bNormal)
@@ -88,7 +99,11 @@ void main()
 	vec3 vecToCameraNormalized = vecToCamera/flToCameraLength;
 
 	// Multiply that by the color to make a shadow
+#if defined(INSTANCED) || defined(SPRITE)
+	vec4 vecDiffuse = vecFragmentInstanceColor * flLight;
+#else
 	vec4 vecDiffuse = vecColor * flLight;
+#endif
 
 	if (bRimLighting)
 	{
@@ -107,15 +122,25 @@ void main()
 	// Add in some fog. http://youtu.be/YpKVXNPOXg8
 	float flDistance = flToCameraLength;
 
-	float flFogMin = 10.0;
-	float flFogMax = 50.0;
 	float flFog = RemapValClamped(flDistance, flFogMin, flFogMax, 0.0, 1.0);
 
-	vec4 vecFogColor = vec4(0.76, 0.8, 0.85, 1.0);
 	vec4 vecFoggedDiffuse = vecDiffuse * (1-flFog) + vecFogColor * flFog;
 
+#ifdef WEIGHTED
+	// Weighted blended transparency. http://jcgt.org/published/0002/02/09/
+	// Everything gets added up in whatever order it's drawn in, weighted so that nearer
+	// surfaces count for more, and weightedcomposite.fs divides the weights back out.
+	// The alpha of the first target gets multiplied by 1-a instead of added, which leaves
+	// how much of the background still shows through.
+	float flCoverage = vecFoggedDiffuse.a;
+	float flWeight = flCoverage * clamp(0.03 / (1e-5 + pow(flDistance / 200.0, 4.0)), 1e-2, 3e3);
+
+	vecOutputColor = vec4(vecFoggedDiffuse.rgb * flWeight, flCoverage);
+	vecOutputWeight = vec4(flWeight);
+#else
 	// Use that as our output color
 	vecOutputColor = vecFoggedDiffuse;
+#endif
 
 	if (vecDiffuse.a < 0.01)
 		discard;
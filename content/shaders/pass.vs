@@ -7,6 +7,21 @@ in vec3 vecBitangent;
 in vec2 vecTexCoord0;
 in vec3 vecVertexColor;
 
+#ifdef INSTANCED
+// One of each per instance instead of per vertex. They replace the mGlobal and vecColor uniforms.
+in mat4 mInstanceGlobal;
+in vec4 vecInstanceColor;
+#endif
+
+#ifdef SPRITE
+// One of each per sprite. The quad is turned to face the camera here instead of on the CPU.
+in vec4 vecSpriteCenter;	// The size is in w
+in vec4 vecInstanceColor;
+in float flSpriteShotTime;	// Negative if it's not spinning
+
+uniform float flSpriteSpinSpeed;
+#endif
+
 out vec3 vecFragmentLocalPosition;
 out vec3 vecFragmentGlobalPosition;
 out vec3 vecFragmentNormal;
@@ -15,13 +30,51 @@ out vec3 vecFragmentBitangent;
 out vec2 vecFragmentTexCoord0;
 out vec3 vecFragmentColor;
 
+#if defined(INSTANCED) || defined(SPRITE)
+out mat3 mFragmentGlobal3x3;
+out vec4 vecFragmentInstanceColor;
+#endif
+
 void main()
 {
+#ifdef INSTANCED
+	vec4 vecGlobal = mInstanceGlobal * vec4(vecPosition, 1.0);
+
+	mFragmentGlobal3x3 = mat3(mInstanceGlobal);
+	vecFragmentInstanceColor = vecInstanceColor;
+#elif defined(SPRITE)
+	// Create a billboard by creating basis vectors. https://www.youtube.com/watch?v=puOTwCrEm7Q
+	vec3 vecForward = vecSpriteCenter.xyz - vecCameraPosition;
+	vec3 vecRight = -normalize(cross(vec3(0.0, 1.0, 0.0), vecForward));
+	vec3 vecUp = normalize(cross(vecForward, -vecRight));
+
+	vec3 vecOffset = (vecPosition.x * vecRight + vecPosition.y * vecUp) * vecSpriteCenter.w;
+	vec3 vecSpriteNormal = cross(vecRight, vecUp);
+
+	// Spin it around the up axis if it was shot recently, once around and then it stops.
+	if (flSpriteShotTime >= 0.0)
+	{
+		float flSpin = min((flTime - flSpriteShotTime) * flSpriteSpinSpeed, 6.2831853);
+		mat3 mSpin = mat3(cos(flSpin), 0.0, sin(flSpin), 0.0, 1.0, 0.0, -sin(flSpin), 0.0, cos(flSpin));
+		vecOffset = mSpin * vecOffset;
+		vecSpriteNormal = mSpin * vecSpriteNormal;
+	}
+
+	vec4 vecGlobal = vec4(vecSpriteCenter.xyz + vecOffset, 1.0);
+
+	mFragmentGlobal3x3 = mat3(1.0);
+	vecFragmentInstanceColor = vecInstanceColor;
+#else
 	vec4 vecGlobal = mGlobal * vec4(vecPosition, 1.0);
+#endif
 
 	vecFragmentLocalPosition = vecPosition;
 	vecFragmentGlobalPosition = vecGlobal.xyz;
+#ifdef SPRITE
+	vecFragmentNormal = vecSpriteNormal;
+#else
 	vecFragmentNormal = vecNormal;
+#endif
 	vecFragmentTangent = vecTangent;
 	vecFragmentBitangent = vecBitangent;
 	vecFragmentTexCoord0 = vec2(vecTexCoord0.x, 1-vecTexCoord0.y);
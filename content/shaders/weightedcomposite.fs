@@ -0,0 +1,21 @@
+// What the WEIGHTED shaders added up. RenderMapFullscreen() binds the first one.
+uniform sampler2D iDiffuse;
+uniform sampler2D iWeight;
+
+void main()
+{
+	// One texel for each pixel, so there's no need for texture coordinates.
+	ivec2 vecPixel = ivec2(gl_FragCoord.xy);
+
+	vec4 vecAccumulated = texelFetch(iDiffuse, vecPixel, 0);
+	float flRevealed = vecAccumulated.a;
+
+	// Nothing transparent was drawn here.
+	if (flRevealed >= 1.0)
+		discard;
+
+	float flWeight = texelFetch(iWeight, vecPixel, 0).r;
+
+	// The weighted average of the colors, over whatever didn't show through.
+	vecOutputColor = vec4(vecAccumulated.rgb / clamp(flWeight, 1e-4, 5e4), 1.0 - flRevealed);
+}
@@ -0,0 +1,383 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "behavior.h"
+
+#include <common.h>
+
+#include "game.h"
+#include "character.h"
+
+CBehaviorWait NextTick()
+{
+	CBehaviorWait oWait;
+	oWait.m_eWait = BEHAVIOR_NEXT_TICK;
+	return oWait;
+}
+
+CBehaviorWait WaitSeconds(float flSeconds)
+{
+	CBehaviorWait oWait;
+	oWait.m_eWait = BEHAVIOR_WAIT_SECONDS;
+	oWait.m_flSeconds = flSeconds;
+	return oWait;
+}
+
+CBehaviorWait UntilPathReady(size_t iPath)
+{
+	CBehaviorWait oWait;
+	oWait.m_eWait = BEHAVIOR_PATH_READY;
+	oWait.m_iPath = iPath;
+	return oWait;
+}
+
+CBehaviorWait UntilWithinRange(CCharacter* pTarget, float flRange, float flMaxClosingSpeed)
+{
+	TAssert(flMaxClosingSpeed > 0);
+
+	CBehaviorWait oWait;
+	oWait.m_eWait = BEHAVIOR_WITHIN_RANGE;
+	oWait.m_hTarget = pTarget;
+	oWait.m_flRange = flRange;
+	oWait.m_flMaxClosingSpeed = flMaxClosingSpeed;
+	return oWait;
+}
+
+CBehaviorWait BehaviorDone()
+{
+	CBehaviorWait oWait;
+	oWait.m_eWait = BEHAVIOR_DONE;
+	return oWait;
+}
+
+CBehaviorPool::CBehaviorPool()
+{
+	m_pFirstFree = nullptr;
+}
+
+CBehaviorPool::~CBehaviorPool()
+{
+	for (size_t i = 0; i < m_apChunks.size(); i++)
+		delete[] m_apChunks[i];
+}
+
+void* CBehaviorPool::Allocate()
+{
+	if (!m_pFirstFree)
+	{
+		// Out of blocks, carve up a new chunk and thread them all onto the free list.
+		char* pChunk = new char[BEHAVIOR_BLOCK_SIZE * BEHAVIOR_BLOCKS_PER_CHUNK];
+		m_apChunks.push_back(pChunk);
+
+		for (size_t i = 0; i < BEHAVIOR_BLOCKS_PER_CHUNK; i++)
+			Free(pChunk + i * BEHAVIOR_BLOCK_SIZE);
+	}
+
+	void* pBlock = m_pFirstFree;
+	m_pFirstFree = *(void**)pBlock;
+	return pBlock;
+}
+
+void CBehaviorPool::Free(void* pBlock)
+{
+	*(void**)pBlock = m_pFirstFree;
+	m_pFirstFree = pBlock;
+}
+
+CBehaviorScheduler::CBehaviorScheduler()
+{
+	m_iFirstFreeSlot = ~0;
+	m_iBehaviors = 0;
+	m_iResumedLastRun = 0;
+}
+
+CBehaviorScheduler::~CBehaviorScheduler()
+{
+	// The game is going away. The pool takes the behaviors' memory with it, but
+	// their destructors still need to run to let go of whatever they hold.
+	for (size_t i = 0; i < m_aSlots.size(); i++)
+	{
+		if (m_aSlots[i].m_pBehavior)
+			Destroy(i);
+	}
+}
+
+void CBehaviorScheduler::Stop(CCharacter* pCharacter)
+{
+	if (pCharacter->m_iBehavior == ~0)
+		return;
+
+	Destroy(pCharacter->m_iBehavior);
+}
+
+void CBehaviorScheduler::Run(float dt)
+{
+	ProcessPathRequests();
+
+	m_iResumedLastRun = 0;
+
+	// Anything that gets readied while we're running goes on the fresh list and waits for the next tick.
+	m_aiRunning.swap(m_aiReady);
+	m_aiReady.clear();
+
+	for (size_t i = 0; i < m_aiRunning.size(); i++)
+	{
+		size_t iSlot = m_aiRunning[i];
+
+		m_aSlots[iSlot].m_bReady = false;
+
+		CBehavior* pBehavior = m_aSlots[iSlot].m_pBehavior;
+		if (!pBehavior)
+			continue;
+
+		CCharacter* pCharacter = m_aSlots[iSlot].m_hCharacter;
+		if (!pCharacter)
+		{
+			Destroy(iSlot);
+			continue;
+		}
+
+		// A range wait wakes up now and then to have another look. It only gets
+		// resumed once the target is actually in range.
+		if (m_aSlots[iSlot].m_oWait.m_eWait == BEHAVIOR_WITHIN_RANGE && Sleep(iSlot, pCharacter))
+			continue;
+
+		size_t iGeneration = m_aSlots[iSlot].m_iGeneration;
+
+		// Don't hold on to a reference to the slot over this call, the behavior may start others.
+		CBehaviorWait oWait = pBehavior->Resume(pCharacter, dt);
+		m_iResumedLastRun++;
+
+		// It was stopped while it was running. The pool may well have handed the same block
+		// to whatever took the slot over, so the pointer can't be trusted to tell.
+		if (m_aSlots[iSlot].m_iGeneration != iGeneration)
+			continue;
+
+		m_aSlots[iSlot].m_oWait = oWait;
+
+		if (oWait.m_eWait == BEHAVIOR_DONE)
+		{
+			Destroy(iSlot);
+			continue;
+		}
+
+		if (!Sleep(iSlot, pCharacter))
+			MakeReady(iSlot);
+	}
+
+	m_aiRunning.clear();
+}
+
+size_t CBehaviorScheduler::RequestPath(const Vector& vecStart, const Vector& vecGoal)
+{
+	size_t iPath;
+	if (m_aiFreePaths.size())
+	{
+		iPath = m_aiFreePaths.back();
+		m_aiFreePaths.pop_back();
+	}
+	else
+	{
+		m_aPaths.push_back(CPathRequest());
+		iPath = m_aPaths.size()-1;
+	}
+
+	CPathRequest& oPath = m_aPaths[iPath];
+	oPath.m_vecStart = vecStart;
+	oPath.m_vecGoal = vecGoal;
+	oPath.m_bInUse = true;
+	oPath.m_bReady = false;
+	oPath.m_iWaitingBehavior = ~0;
+	oPath.m_avecWaypoints.clear();
+
+	m_aiPathQueue.push_back(iPath);
+
+	return iPath;
+}
+
+const CPathRequest* CBehaviorScheduler::GetPath(size_t iPath) const
+{
+	TAssert(iPath < m_aPaths.size());
+	TAssert(m_aPaths[iPath].m_bInUse);
+
+	return &m_aPaths[iPath];
+}
+
+void CBehaviorScheduler::ReleasePath(size_t iPath)
+{
+	TAssert(iPath < m_aPaths.size());
+	TAssert(m_aPaths[iPath].m_bInUse);
+
+	m_aPaths[iPath].m_bInUse = false;
+	m_aPaths[iPath].m_iWaitingBehavior = ~0;
+	m_aiFreePaths.push_back(iPath);
+}
+
+void CBehaviorScheduler::Attach(CCharacter* pCharacter, CBehavior* pBehavior)
+{
+	Stop(pCharacter);
+
+	size_t iSlot;
+	if (m_iFirstFreeSlot != ~0)
+	{
+		iSlot = m_iFirstFreeSlot;
+		m_iFirstFreeSlot = m_aSlots[iSlot].m_iNextFree;
+	}
+	else
+	{
+		m_aSlots.push_back(CBehaviorSlot());
+		iSlot = m_aSlots.size()-1;
+		m_aSlots[iSlot].m_bReady = false;
+		m_aSlots[iSlot].m_iGeneration = 0;
+	}
+
+	CBehaviorSlot& oSlot = m_aSlots[iSlot];
+	oSlot.m_pBehavior = pBehavior;
+	oSlot.m_hCharacter = pCharacter;
+	oSlot.m_oWait = NextTick();
+	oSlot.m_iNextFree = ~0;
+
+	pCharacter->m_iBehavior = iSlot;
+
+	m_iBehaviors++;
+
+	MakeReady(iSlot);
+}
+
+void CBehaviorScheduler::Destroy(size_t iSlot)
+{
+	CBehaviorSlot& oSlot = m_aSlots[iSlot];
+
+	TAssert(oSlot.m_pBehavior);
+
+	Game()->GetTimers().Cancel(oSlot.m_hTimer);
+
+	if (oSlot.m_oWait.m_eWait == BEHAVIOR_PATH_READY && oSlot.m_oWait.m_iPath < m_aPaths.size())
+	{
+		CPathRequest& oPath = m_aPaths[oSlot.m_oWait.m_iPath];
+		if (oPath.m_iWaitingBehavior == iSlot)
+			oPath.m_iWaitingBehavior = ~0;
+	}
+
+	CCharacter* pCharacter = oSlot.m_hCharacter;
+	if (pCharacter && pCharacter->m_iBehavior == iSlot)
+		pCharacter->m_iBehavior = ~0;
+
+	CBehavior* pBehavior = oSlot.m_pBehavior;
+	oSlot.m_pBehavior = nullptr;
+	oSlot.m_hCharacter = nullptr;
+	oSlot.m_iNextFree = m_iFirstFreeSlot;
+	oSlot.m_iGeneration++;
+	m_iFirstFreeSlot = iSlot;
+
+	m_iBehaviors--;
+
+	// The slot is already free, so if the destructor stops or starts anything it won't trip over this one.
+	pBehavior->~CBehavior();
+	m_oPool.Free(pBehavior);
+}
+
+void CBehaviorScheduler::MakeReady(size_t iSlot)
+{
+	if (m_aSlots[iSlot].m_bReady)
+		return;
+
+	m_aSlots[iSlot].m_bReady = true;
+	m_aiReady.push_back(iSlot);
+}
+
+bool CBehaviorScheduler::Sleep(size_t iSlot, CCharacter* pCharacter)
+{
+	CBehaviorSlot& oSlot = m_aSlots[iSlot];
+	const CBehaviorWait& oWait = oSlot.m_oWait;
+
+	switch (oWait.m_eWait)
+	{
+	case BEHAVIOR_WAIT_SECONDS:
+		oSlot.m_hTimer = Game()->GetTimers().Schedule(pCharacter, oWait.m_flSeconds, &CBehaviorScheduler::WakeBehavior, iSlot);
+		return true;
+
+	case BEHAVIOR_PATH_READY:
+	{
+		TAssert(oWait.m_iPath < m_aPaths.size());
+		CPathRequest& oPath = m_aPaths[oWait.m_iPath];
+		if (!oPath.m_bInUse || oPath.m_bReady)
+			return false;
+
+		oPath.m_iWaitingBehavior = iSlot;
+		return true;
+	}
+
+	case BEHAVIOR_WITHIN_RANGE:
+	{
+		CCharacter* pTarget = oWait.m_hTarget;
+
+		// The target is gone. Let the behavior sort it out.
+		if (!pTarget)
+			return false;
+
+		float flDistance = (pTarget->GetGlobalOrigin() - pCharacter->GetGlobalOrigin()).Length();
+		if (flDistance <= oWait.m_flRange)
+			return false;
+
+		// They can't possibly be in range any sooner than this, so there's no point looking before then.
+		float flSleep = (flDistance - oWait.m_flRange) / oWait.m_flMaxClosingSpeed;
+
+		oSlot.m_hTimer = Game()->GetTimers().Schedule(pCharacter, flSleep, &CBehaviorScheduler::WakeBehavior, iSlot);
+		return true;
+	}
+
+	case BEHAVIOR_NEXT_TICK:
+	case BEHAVIOR_DONE:
+	default:
+		return false;
+	}
+}
+
+void CBehaviorScheduler::ProcessPathRequests()
+{
+	size_t iProcessed = 0;
+	while (iProcessed < PATH_REQUESTS_PER_TICK && m_aiPathQueue.size())
+	{
+		size_t iPath = m_aiPathQueue.front();
+		m_aiPathQueue.pop_front();
+		CPathRequest& oPath = m_aPaths[iPath];
+
+		// Released before we got to it.
+		if (!oPath.m_bInUse || oPath.m_bReady)
+			continue;
+
+		// There's no navigation data yet so every path is a straight line to the goal.
+		// Behaviors only ever see the waypoints, so a real planner can go in here later.
+		oPath.m_avecWaypoints.clear();
+		oPath.m_avecWaypoints.push_back(oPath.m_vecGoal);
+		oPath.m_bReady = true;
+
+		if (oPath.m_iWaitingBehavior != ~0)
+		{
+			MakeReady(oPath.m_iWaitingBehavior);
+			oPath.m_iWaitingBehavior = ~0;
+		}
+
+		iProcessed++;
+	}
+}
+
+void CBehaviorScheduler::WakeBehavior(CCharacter* pCharacter, size_t iSlot)
+{
+	Game()->GetBehaviors().MakeReady(iSlot);
+}
@@ -0,0 +1,213 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <new>
+#include <vector>
+#include <deque>
+
+#include <vector.h>
+
+#include "handle.h"
+#include "timers.h"
+
+// What a behavior is waiting on before it can run again.
+typedef enum
+{
+	BEHAVIOR_NEXT_TICK,
+	BEHAVIOR_WAIT_SECONDS,
+	BEHAVIOR_PATH_READY,
+	BEHAVIOR_WITHIN_RANGE,
+	BEHAVIOR_DONE,
+} behavior_wait_t;
+
+class CBehaviorWait
+{
+public:
+	behavior_wait_t m_eWait;
+
+	float           m_flSeconds;
+
+	size_t          m_iPath;
+
+	CHandle         m_hTarget;
+	float           m_flRange;
+	float           m_flMaxClosingSpeed;
+};
+
+// The things a behavior can wait on.
+CBehaviorWait NextTick();
+CBehaviorWait WaitSeconds(float flSeconds);
+CBehaviorWait UntilPathReady(size_t iPath);
+// flMaxClosingSpeed is the fastest the two characters could possibly be approaching
+// each other. It's used to work out how long we can sleep before we need to look again.
+CBehaviorWait UntilWithinRange(class CCharacter* pTarget, float flRange, float flMaxClosingSpeed);
+CBehaviorWait BehaviorDone();
+
+// These macros let a behavior be written as straight-line code that waits in the
+// middle, like a coroutine. Resume() picks up where the last BEHAVIOR_AWAIT left off.
+// Because Resume() returns at every wait, nothing on the stack survives a wait.
+// Anything that needs to should be a member of the behavior.
+#define BEHAVIOR_BEGIN() \
+	switch (m_iResumePoint) \
+	{ \
+	case 0: \
+
+#define BEHAVIOR_AWAIT(wait) BEHAVIOR_AWAIT_POINT(wait, __COUNTER__+1)
+
+#define BEHAVIOR_AWAIT_POINT(wait, point) \
+	do \
+	{ \
+		m_iResumePoint = point; \
+		return (wait); \
+	case point:; \
+	} while (0) \
+
+#define BEHAVIOR_END() \
+	} \
+	m_iResumePoint = -1; \
+	return BehaviorDone(); \
+
+// A behavior is a little program that runs on a character. The scheduler calls
+// Resume() only when whatever it's waiting on has happened, so a behavior that's
+// sleeping costs nothing.
+class CBehavior
+{
+public:
+	CBehavior()
+	{
+		m_iResumePoint = 0;
+	}
+
+	virtual ~CBehavior() {}
+
+public:
+	// Run until the next wait and return it.
+	virtual CBehaviorWait Resume(class CCharacter* pCharacter, float dt) = 0;
+
+protected:
+	int m_iResumePoint;
+};
+
+#define BEHAVIOR_BLOCK_SIZE       128
+#define BEHAVIOR_BLOCKS_PER_CHUNK 256
+
+// Fixed size blocks for behaviors so that spawning and killing thousands of
+// monsters doesn't go to the heap every time.
+class CBehaviorPool
+{
+public:
+	CBehaviorPool();
+	~CBehaviorPool();
+
+public:
+	void*   Allocate();
+	void    Free(void* pBlock);
+
+private:
+	std::vector<char*> m_apChunks;
+	void*   m_pFirstFree;
+};
+
+// A request for a path from one place to another. Requests are worked off a few at
+// a time each tick so that lots of monsters asking at once don't cause a hitch.
+class CPathRequest
+{
+public:
+	Vector              m_vecStart;
+	Vector              m_vecGoal;
+
+	bool                m_bInUse;
+	bool                m_bReady;
+	size_t              m_iWaitingBehavior;
+
+	std::vector<Vector> m_avecWaypoints;
+};
+
+#define PATH_REQUESTS_PER_TICK 32
+
+class CBehaviorScheduler
+{
+	class CBehaviorSlot
+	{
+	public:
+		CBehavior*    m_pBehavior;
+		CHandle       m_hCharacter;
+		CBehaviorWait m_oWait;
+		CTimerHandle  m_hTimer;
+		bool          m_bReady;
+		size_t        m_iNextFree;
+		size_t        m_iGeneration;	// Goes up every time the slot is freed, so a reused slot can be told apart.
+	};
+
+public:
+	CBehaviorScheduler();
+	~CBehaviorScheduler();
+
+public:
+	// Start a new behavior on a character, replacing any it already has. It first runs on the next tick.
+	template <class T>
+	T*                  Start(class CCharacter* pCharacter)
+	{
+		static_assert(sizeof(T) <= BEHAVIOR_BLOCK_SIZE, "Behavior is too big for the behavior pool. Raise BEHAVIOR_BLOCK_SIZE.");
+
+		T* pBehavior = new (m_oPool.Allocate()) T();
+		Attach(pCharacter, pBehavior);
+		return pBehavior;
+	}
+
+	void                Stop(class CCharacter* pCharacter);
+
+	// Resume every behavior whose wait is over.
+	void                Run(float dt);
+
+	size_t              RequestPath(const Vector& vecStart, const Vector& vecGoal);
+	const CPathRequest* GetPath(size_t iPath) const;
+	void                ReleasePath(size_t iPath);
+
+	size_t              GetNumBehaviors() const { return m_iBehaviors; }
+	size_t              GetNumResumedLastRun() const { return m_iResumedLastRun; }
+
+private:
+	void                Attach(class CCharacter* pCharacter, CBehavior* pBehavior);
+	void                Destroy(size_t iSlot);
+	void                MakeReady(size_t iSlot);
+
+	// Put a behavior to sleep on its wait. Returns false if the wait is already over.
+	bool                Sleep(size_t iSlot, class CCharacter* pCharacter);
+
+	void                ProcessPathRequests();
+
+	static void         WakeBehavior(class CCharacter* pCharacter, size_t iSlot);
+
+private:
+	CBehaviorPool               m_oPool;
+
+	std::vector<CBehaviorSlot>  m_aSlots;
+	size_t                      m_iFirstFreeSlot;
+	size_t                      m_iBehaviors;
+
+	std::vector<size_t>         m_aiReady;
+	std::vector<size_t>         m_aiRunning;
+
+	std::vector<CPathRequest>   m_aPaths;
+	std::vector<size_t>         m_aiFreePaths;
+	std::deque<size_t>          m_aiPathQueue;
+
+	size_t                      m_iResumedLastRun;
+};
@@ -32,7 +32,17 @@ CCharacter::CCharacter()
 	m_vecScaling = Vector(1, 1, 1);
 	m_bTakesDamage = false;
 	m_bDrawTransparent = false;
+	m_bStatic = false;
 	m_iHealth = 3;
+	m_iBehavior = ~0;
+	m_iRenderSlot = ~0;
+	m_bRenderTransparent = false;
+	m_bRenderStatic = false;
+	m_bRenderDirty = false;
+	m_eLOD = LOD_FULL;
+	m_bOccluded = false;
+	m_iOccludedResults = 0;
+	m_iOcclusionFrame = ~0;
 }
 
 void CCharacter::SetTransform(const Vector& vecScaling, float flTheta, const Vector& vecRotationAxis, const Vector& vecTranslation)
@@ -76,14 +86,32 @@ void CCharacter::BuildTransform()
 	SetGlobalTransform(mTranslation * mRotation * mScaling);
 }
 
-void CCharacter::ShotEffect(CRenderingContext* c)
+void CCharacter::StartShotEffect()
 {
+	m_flShotTime = Game()->GetTime();
+
+	// If we were already spinning start over, and schedule the end of the effect so
+	// that nothing has to check the clock while the character isn't spinning.
+	Game()->GetTimers().Cancel(m_hShotTimer);
+	m_hShotTimer = Game()->GetTimers().Schedule(this, 2*(float)M_PI/SHOT_EFFECT_SPEED, &CCharacter::EndShotEffect);
+}
+
+void CCharacter::EndShotEffect(CCharacter* pCharacter, size_t iData)
+{
+	pCharacter->m_flShotTime = -1;
+}
+
+void CCharacter::ShotEffect(Matrix4x4& mTransform) const
+{
+	if (m_flShotTime < 0)
+		return;
+
 	// flShotTime gets set to the time when the character was last shot.
 	// So, when the character is shot, it will ramp up from 0 to 2pi, or 360 degrees.
 	// (We need to use radians because our system sin/cos functions use radians.)
-	float flTime = (Game()->GetTime() - m_flShotTime) * 10;
-	if (m_flShotTime < 0 || flTime > 2*M_PI)
-		return;
+	float flTime = (Game()->GetTime() - m_flShotTime) * SHOT_EFFECT_SPEED;
+	if (flTime > 2*M_PI)
+		flTime = 2*(float)M_PI;
 
 	// Create three rotated basis vectors. The X and Z vectors spin around in a circle,
 	// but the Y vector remains facing straight up.
@@ -94,7 +122,7 @@ void CCharacter::ShotEffect(CRenderingContext* c)
 
 	// Load the three basis vectors into a matrix and transform our character with them.
 	Matrix4x4 mRotation(vecRotateX, vecRotateY, vecRotateZ);
-	c->Transform(mRotation);
+	mTransform *= mRotation;
 }
 
 void CCharacter::TakeDamage(int iDamage)
@@ -106,17 +134,9 @@ void CCharacter::TakeDamage(int iDamage)
 
 	if (m_iHealth <= 0)
 	{
-		// Spawn another baddy to take this guy's place.
-		CCharacter* pNew = Game()->CreateCharacter();
-
-		// Position the new monster in a random spot near the player.
-		pNew->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), Vector((float)(rand()%20)-10, 0, (float)(rand()%20)-10));
-
-		pNew->m_aabbSize.vecMin = Vector(-1, 0, -1);
-		pNew->m_aabbSize.vecMax = Vector(1, 2, 1);
-		pNew->m_iBillboardTexture = Game()->GetMonsterTexture();
-		pNew->m_bEnemyAI = true;
-		pNew->m_bTakesDamage = true;
+		// Have another baddy take this guy's place in a little while.
+		if (m_bEnemyAI)
+			Game()->ScheduleMonsterRespawn();
 
 		// We're at zero health, time to die.
 		Game()->RemoveCharacter(this);
@@ -142,6 +162,8 @@ void CCharacter::SetMoveParent(CCharacter* pParent)
 
 	m_hMoveParent = pParent;
 
+	Game()->MarkRenderDirty(this);
+
 	if (!pParent)
 		return;
 
@@ -171,6 +193,8 @@ const Matrix4x4 CCharacter::GetGlobalTransform() const
 
 void CCharacter::SetGlobalTransform(const Matrix4x4& mGlobal)
 {
+	Game()->MarkRenderDirty(this);
+
 	if (m_hMoveParent.Get())
 	{
 		// We're not using global coordinates so we have to transfer the global
@@ -189,6 +213,8 @@ const Vector CCharacter::GetGlobalOrigin() const
 
 void CCharacter::SetGlobalOrigin(const Vector& vecOrigin)
 {
+	Game()->MarkRenderDirty(this);
+
 	if (m_hMoveParent.Get())
 	{
 		m_mLocalTransform.SetTranslation(m_hMoveParent->GetGlobalTransform().InvertedTR() * vecOrigin);
@@ -223,3 +249,54 @@ const AABB CCharacter::GetGlobalAABB() const
 {
 	return m_aabbSize * m_vecScaling + GetGlobalOrigin();
 }
+
+const AABB CCharacter::GetRenderBounds() const
+{
+	Matrix4x4 mGlobal = GetGlobalTransform();
+
+	if (m_iBillboardTexture)
+	{
+		// Billboards turn to face the camera and spin when they're shot, so all that stays put is
+		// that the corners of the quad are never farther than this from its center.
+		Vector vecCenter = mGlobal * Vector(0, m_aabbSize.GetHeight() / 2, 0);
+		float flReach = m_aabbSize.vecMax.x * (float)M_SQRT2;
+		Vector vecReach(flReach, flReach, flReach);
+
+		return AABB(vecCenter - vecReach, vecCenter + vecReach);
+	}
+
+	// The box gets drawn turned with the character, so find the box around that.
+	Vector vecCenter = mGlobal * m_aabbSize.GetCenter();
+	Vector vecHalfSize = (m_aabbSize.vecMax - m_aabbSize.vecMin)/2;
+
+	Vector vecHalfBounds;
+	vecHalfBounds.x = fabs(mGlobal.m[0][0]) * vecHalfSize.x + fabs(mGlobal.m[1][0]) * vecHalfSize.y + fabs(mGlobal.m[2][0]) * vecHalfSize.z;
+	vecHalfBounds.y = fabs(mGlobal.m[0][1]) * vecHalfSize.x + fabs(mGlobal.m[1][1]) * vecHalfSize.y + fabs(mGlobal.m[2][1]) * vecHalfSize.z;
+	vecHalfBounds.z = fabs(mGlobal.m[0][2]) * vecHalfSize.x + fabs(mGlobal.m[1][2]) * vecHalfSize.y + fabs(mGlobal.m[2][2]) * vecHalfSize.z;
+
+	return AABB(vecCenter - vecHalfBounds, vecCenter + vecHalfBounds);
+}
+
+void CCharacter::SetAABBSize(const AABB& aabbSize)
+{
+	m_aabbSize = aabbSize;
+	Game()->MarkRenderDirty(this);
+}
+
+void CCharacter::SetTexture(size_t iTexture)
+{
+	m_iTexture = iTexture;
+	Game()->MarkRenderDirty(this);
+}
+
+void CCharacter::SetBillboardTexture(size_t iBillboardTexture)
+{
+	m_iBillboardTexture = iBillboardTexture;
+	Game()->MarkRenderDirty(this);
+}
+
+void CCharacter::SetDrawTransparent(bool bDrawTransparent)
+{
+	m_bDrawTransparent = bDrawTransparent;
+	Game()->MarkRenderDirty(this);
+}
@@ -26,9 +26,13 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <quaternion.h>
 
 #include "handle.h"
+#include "timers.h"
 
 using std::vector;
 
+// The shot effect spins the character around once at this rate.
+#define SHOT_EFFECT_SPEED 10
+
 // This class holds information for a single character - eg the position and velocity of the player
 class CCharacter
 {
@@ -41,11 +45,21 @@ public:
 	void SetRotation(const EAngle& angRotation);
 	void SetRotation(const Quaternion& qRotation);
 
-	void ShotEffect(class CRenderingContext* c);
+	void StartShotEffect();
+	// Spins the transform around if the character was shot recently.
+	void ShotEffect(Matrix4x4& mTransform) const;
 
 	void TakeDamage(int iDamage);
 
 	void SetMoveParent(CCharacter* pParent);
+	bool HasMoveParent() const { return !!m_hMoveParent.Get(); }
+
+	// Anything that changes how or where a character is drawn goes through a setter,
+	// so that the render lists find out about it.
+	void SetAABBSize(const AABB& aabbSize);
+	void SetTexture(size_t iTexture);
+	void SetBillboardTexture(size_t iBillboardTexture);
+	void SetDrawTransparent(bool bDrawTransparent);
 
 	const Matrix4x4 GetGlobalTransform() const;
 	void            SetGlobalTransform(const Matrix4x4& mGlobal);
@@ -58,10 +72,14 @@ public:
 	const Vector GetGlobalView() const;
 
 	const AABB   GetGlobalAABB() const;
+	// Everything that gets drawn for the character is inside this.
+	const AABB   GetRenderBounds() const;
 
 private:
 	void BuildTransform();
 
+	static void EndShotEffect(CCharacter* pCharacter, size_t iData);
+
 public:
 	int       m_iIndex;
 	int       m_iParity;
@@ -83,9 +101,24 @@ public:
 	bool      m_bEnemyAI;
 	bool      m_bTakesDamage;
 	bool      m_bDrawTransparent;
+	bool      m_bStatic;      // Never moves once it's placed, so it can go in the static render tree.
 	int       m_iHealth;
 
-	float     m_flShotTime;
+	float     m_flShotTime;   // Negative when the shot effect isn't playing.
+	CTimerHandle m_hShotTimer;
+
+	size_t    m_iBehavior;    // Slot in the behavior scheduler, or ~0 if none.
+
+	size_t    m_iRenderSlot;          // Slot in the render set we're in, or ~0 if none.
+	bool      m_bRenderTransparent;   // Which render set that is.
+	bool      m_bRenderStatic;        // Or it's in the static render tree instead.
+	bool      m_bRenderDirty;         // Waiting in the render journal.
+
+	lod_t     m_eLOD;
+
+	bool      m_bOccluded;            // Behind something, so it isn't drawn.
+	size_t    m_iOccludedResults;     // Occlusion queries in a row that came back with nothing.
+	size_t    m_iOcclusionFrame;      // The last frame it was in the frustum.
 
 private:
 	// If we have a move parent then we only use the local coordinates.
@@ -0,0 +1,305 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "client.h"
+
+#include <algorithm>
+
+#include <maths.h>
+
+#include "game.h"
+#include "character.h"
+
+CGameClient::CGameClient()
+{
+	m_flServerTimeOffset = 0;
+	m_bHaveServerTime = false;
+	m_iTargetTick = 0;
+	m_iEventsPlayedTick = 0;
+	m_iPlayer = 0xFFFF;
+	m_iJumps = 0;
+	m_iShots = 0;
+	m_flInterpolationBuffer = 0;
+}
+
+bool CGameClient::Connect(const std::string& sHost, unsigned short iPort)
+{
+	m_aRemoteCharacters.resize(MAX_CHARACTERS);
+
+	return m_oChannel.Connect(sHost, iPort);
+}
+
+void CGameClient::Update(float flTime, float flInterpolationDelay)
+{
+	ReadSnapshots(flTime);
+
+	if (m_bHaveServerTime)
+	{
+		// Draw a little in the past so there's usually a snapshot on either side of us.
+		float flRenderTime = flTime + m_flServerTimeOffset - flInterpolationDelay;
+
+		Interpolate(flRenderTime);
+		PlayEvents(flRenderTime);
+
+		const CSnapshot* pLatest = m_oHistory.Find(m_oHistory.GetLatestTick());
+		if (pLatest)
+			m_flInterpolationBuffer = pLatest->m_flTime - flRenderTime;
+	}
+
+	SendInput(flTime);
+}
+
+CCharacter* CGameClient::GetPlayer()
+{
+	return FindRemoteCharacter(m_iPlayer);
+}
+
+void CGameClient::ReadSnapshots(float flTime)
+{
+	while (m_oChannel.Receive(m_oMessage))
+	{
+		if (m_oMessage.ReadByte() != NET_MESSAGE_SNAPSHOT)
+			continue;
+
+		// Decode into a scratch copy first. The slot it's going into might be its own baseline.
+		CSnapshot oSnapshot;
+		if (!oSnapshot.Decode(m_oMessage, m_oHistory))
+		{
+			TAssert(!"Couldn't decode a snapshot.");
+			continue;
+		}
+
+		CSnapshot& oStored = m_oHistory.Add(oSnapshot.m_iTick);
+		oStored.m_flTime = oSnapshot.m_flTime;
+		oStored.m_iPlayer = oSnapshot.m_iPlayer;
+		oStored.m_aEntities.swap(oSnapshot.m_aEntities);
+		oStored.m_aEvents.swap(oSnapshot.m_aEvents);
+
+		// Snapshots that get here quickest show the real offset best. The rest have been held up somewhere.
+		float flOffset = oStored.m_flTime - flTime;
+		if (!m_bHaveServerTime || flOffset > m_flServerTimeOffset)
+			m_flServerTimeOffset = flOffset;
+		else
+			m_flServerTimeOffset += (flOffset - m_flServerTimeOffset) * 0.05f;
+
+		if (!m_bHaveServerTime)
+		{
+			// Don't replay whatever happened before we got here.
+			m_iEventsPlayedTick = oStored.m_iTick - 1;
+			m_bHaveServerTime = true;
+		}
+	}
+}
+
+void CGameClient::Interpolate(float flRenderTime)
+{
+	// Find the snapshots on either side of the render time.
+	const CSnapshot* pFrom = nullptr;
+	const CSnapshot* pTo = nullptr;
+
+	unsigned int iLatest = m_oHistory.GetLatestTick();
+	for (unsigned int iTick = iLatest; iTick > 0 && iLatest - iTick < SNAPSHOT_HISTORY; iTick--)
+	{
+		const CSnapshot* pSnapshot = m_oHistory.Find(iTick);
+		if (!pSnapshot)
+			break;
+
+		if (pSnapshot->m_flTime <= flRenderTime)
+		{
+			pFrom = pSnapshot;
+			break;
+		}
+
+		pTo = pSnapshot;
+	}
+
+	// Out past the newest one, hold there rather than guess. Or not caught up to the oldest yet, wait at it.
+	if (!pTo)
+		pTo = pFrom;
+	if (!pFrom)
+		pFrom = pTo;
+
+	if (!pTo)
+		return;
+
+	float flLerp = 1;
+	if (pTo != pFrom && pTo->m_flTime > pFrom->m_flTime)
+		flLerp = RemapClamp(flRenderTime, pFrom->m_flTime, pTo->m_flTime, 0, 1);
+
+	CGame* pGame = Game();
+
+	// Anybody who's not in the snapshot we're heading towards is gone.
+	if (pTo->m_iTick != m_iTargetTick)
+	{
+		m_iTargetTick = pTo->m_iTick;
+		m_iPlayer = pTo->m_iPlayer;
+
+		for (size_t i = 0; i < m_aRemoteCharacters.size(); i++)
+		{
+			CRemoteCharacter& oRemote = m_aRemoteCharacters[i];
+			if (!oRemote.m_hCharacter)
+				continue;
+
+			const CEntityState* pEntity = pTo->FindEntity(i);
+			if (pEntity && pEntity->m_iParity == oRemote.m_iParity && pEntity->m_iKind == oRemote.m_iKind)
+				continue;
+
+			pGame->RemoveCharacter(oRemote.m_hCharacter);
+			oRemote.m_hCharacter = nullptr;
+		}
+	}
+
+	for (size_t i = 0; i < pTo->m_aEntities.size(); i++)
+	{
+		const CEntityState& oEntity = pTo->m_aEntities[i];
+
+		Vector vecOrigin = oEntity.GetOrigin();
+		float flYaw = oEntity.GetYaw();
+
+		const CEntityState* pFromEntity = (pFrom == pTo) ? nullptr : pFrom->FindEntity(oEntity.m_iIndex);
+		if (pFromEntity && pFromEntity->IsSameEntity(oEntity))
+		{
+			vecOrigin = pFromEntity->GetOrigin() * (1 - flLerp) + vecOrigin * flLerp;
+
+			// The short way around.
+			float flFromYaw = pFromEntity->GetYaw();
+			float flDelta = flYaw - flFromYaw;
+			if (flDelta > 180)
+				flDelta -= 360;
+			else if (flDelta < -180)
+				flDelta += 360;
+
+			flYaw = flFromYaw + flDelta * flLerp;
+		}
+
+		CRemoteCharacter& oRemote = m_aRemoteCharacters[oEntity.m_iIndex];
+		CCharacter* pCharacter = oRemote.m_hCharacter;
+
+		bool bMoved = false;
+		if (!pCharacter || oRemote.m_iParity != oEntity.m_iParity || oRemote.m_iKind != oEntity.m_iKind)
+		{
+			if (pCharacter)
+				pGame->RemoveCharacter(pCharacter);
+
+			pCharacter = pGame->CreateRemoteCharacter((net_entity_t)oEntity.m_iKind);
+			oRemote.m_hCharacter = pCharacter;
+			if (!pCharacter)
+				continue;
+
+			oRemote.m_iParity = oEntity.m_iParity;
+			oRemote.m_iKind = oEntity.m_iKind;
+			bMoved = true;
+		}
+
+		// Most things don't move. Leave them be so they stay out of the render journal.
+		if (!bMoved && (vecOrigin - oRemote.m_vecOrigin).LengthSqr() == 0 && flYaw == oRemote.m_flYaw)
+			continue;
+
+		oRemote.m_vecOrigin = vecOrigin;
+		oRemote.m_flYaw = flYaw;
+
+		// Same basis as the server builds for the player. Everybody else has no rotation, which is a yaw of zero.
+		float flRadians = flYaw * (float)M_PI / 180;
+		Vector vecForward(cos(flRadians), 0, sin(flRadians));
+		Vector vecUp(0, 1, 0);
+		Vector vecRight = -vecUp.Cross(vecForward);
+
+		pCharacter->SetGlobalTransform(Matrix4x4(vecForward, vecUp, vecRight, vecOrigin));
+	}
+}
+
+void CGameClient::PlayEvents(float flRenderTime)
+{
+	CGame* pGame = Game();
+
+	unsigned int iLatest = m_oHistory.GetLatestTick();
+
+	// We've fallen so far behind that the events are gone. Skip them.
+	if (iLatest - m_iEventsPlayedTick >= SNAPSHOT_HISTORY)
+		m_iEventsPlayedTick = iLatest - SNAPSHOT_HISTORY + 1;
+
+	while (m_iEventsPlayedTick < iLatest)
+	{
+		const CSnapshot* pSnapshot = m_oHistory.Find(m_iEventsPlayedTick + 1);
+		if (pSnapshot && pSnapshot->m_flTime > flRenderTime)
+			break;
+
+		m_iEventsPlayedTick++;
+
+		if (!pSnapshot)
+			continue;
+
+		for (size_t i = 0; i < pSnapshot->m_aEvents.size(); i++)
+		{
+			const CNetEvent& oEvent = pSnapshot->m_aEvents[i];
+
+			switch (oEvent.m_iEvent)
+			{
+			case NET_EVENT_PUFF:
+				pGame->MakePuff(oEvent.m_vecStart);
+				break;
+
+			case NET_EVENT_TRACER:
+				pGame->MakeBulletTracer(oEvent.m_vecStart, oEvent.m_vecEnd);
+				break;
+
+			case NET_EVENT_SHOT:
+			{
+				CCharacter* pCharacter = FindRemoteCharacter(oEvent.m_iIndex);
+				if (pCharacter)
+					pCharacter->StartShotEffect();
+				break;
+			}
+			}
+		}
+	}
+}
+
+void CGameClient::SendInput(float flTime)
+{
+	if (!m_oChannel.IsConnected())
+		return;
+
+	CClientInput oInput;
+	oInput.m_iAckTick = m_oHistory.GetLatestTick();
+
+	CCharacter* pPlayer = GetPlayer();
+	if (pPlayer)
+	{
+		oInput.m_vecMovementGoal = pPlayer->m_vecMovementGoal;
+		oInput.m_angView = pPlayer->GetLocalView();
+	}
+
+	oInput.m_iJumps = (unsigned char)std::min(m_iJumps, 255u);
+	oInput.m_iShots = (unsigned char)std::min(m_iShots, 255u);
+	m_iJumps = 0;
+	m_iShots = 0;
+
+	m_oMessage.Clear();
+	oInput.Encode(m_oMessage);
+
+	m_oChannel.Send(m_oMessage, flTime);
+	m_oChannel.Flush(flTime);
+}
+
+CCharacter* CGameClient::FindRemoteCharacter(size_t iIndex)
+{
+	if (iIndex >= m_aRemoteCharacters.size())
+		return nullptr;
+
+	return m_aRemoteCharacters[iIndex].m_hCharacter;
+}
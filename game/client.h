@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "handle.h"
+#include "netchannel.h"
+#include "snapshot.h"
+
+// The render side of a client/server game. It doesn't simulate anything, it keeps
+// a copy of every character the server tells it about and moves them smoothly
+// between the snapshots it gets. Input goes back to the server.
+class CGameClient
+{
+	// Our copy of one of the server's characters.
+	class CRemoteCharacter
+	{
+	public:
+		CHandle         m_hCharacter;
+		unsigned short  m_iParity;
+		unsigned char   m_iKind;
+		Vector          m_vecOrigin;
+		float           m_flYaw;
+	};
+
+public:
+	CGameClient();
+
+public:
+	bool                Connect(const std::string& sHost, unsigned short iPort);
+	bool                IsConnected() const { return m_oChannel.IsConnected(); }
+
+	// Read what the server sent, put everybody where they should be right now and send our input.
+	void                Update(float flTime, float flInterpolationDelay);
+
+	// Our own character, once the server has told us which one it is.
+	class CCharacter*   GetPlayer();
+
+	void                QueueJump() { m_iJumps++; }
+	void                QueueShot() { m_iShots++; }
+
+	void                SetFakeLag(float flSeconds) { m_oChannel.SetFakeLag(flSeconds); }
+
+	size_t              GetBytesReceived() const { return m_oChannel.GetBytesReceived(); }
+	// How far behind the newest snapshot we're drawing, in seconds.
+	float               GetInterpolationBuffer() const { return m_flInterpolationBuffer; }
+
+private:
+	void                ReadSnapshots(float flTime);
+	void                Interpolate(float flRenderTime);
+	void                PlayEvents(float flRenderTime);
+	void                SendInput(float flTime);
+
+	class CCharacter*   FindRemoteCharacter(size_t iIndex);
+
+private:
+	CNetChannel         m_oChannel;
+
+	CSnapshotHistory    m_oHistory;
+
+	// Server clock minus ours, as best we can tell.
+	float               m_flServerTimeOffset;
+	bool                m_bHaveServerTime;
+
+	unsigned int        m_iTargetTick;
+	unsigned int        m_iEventsPlayedTick;
+	unsigned short      m_iPlayer;
+
+	std::vector<CRemoteCharacter> m_aRemoteCharacters;
+
+	unsigned int        m_iJumps;
+	unsigned int        m_iShots;
+
+	float               m_flInterpolationBuffer;
+
+	CNetMessage         m_oMessage;
+};
@@ -0,0 +1,199 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "depthsort.h"
+
+#include <string.h>
+
+#include <common.h>
+
+#include "character.h"
+
+// The insertion sort gives up after moving things this many spots per character on average.
+// Past about here the radix sort is quicker.
+#define DEPTH_SORT_MAX_SHIFTS   2
+
+// Keys are sorted this many bits at a time. Three passes cover all 32.
+#define DEPTH_SORT_RADIX_BITS   11
+#define DEPTH_SORT_RADIX_SIZE   (1<<DEPTH_SORT_RADIX_BITS)
+#define DEPTH_SORT_RADIX_PASSES 3
+
+CDepthSort::CDepthSort()
+{
+	m_iSort = 0;
+	m_bCoherent = false;
+}
+
+void CDepthSort::Sort(std::vector<CCharacter*>& apList, const Vector& vecCamera)
+{
+	m_iSort++;
+
+	size_t iSize = apList.size();
+
+	m_apUnsorted.assign(apList.begin(), apList.end());
+
+	for (size_t i = 0; i < iSize; i++)
+	{
+		size_t iIndex = apList[i]->m_iIndex;
+		if (iIndex >= m_aiListSort.size())
+		{
+			m_aiListSort.resize(iIndex+1, 0);
+			m_aiListSlot.resize(iIndex+1, ~0);
+		}
+
+		m_aiListSort[iIndex] = m_iSort;
+		m_aiListSlot[iIndex] = i;
+	}
+
+	m_aiKeys.resize(iSize);
+	m_aiSlots.resize(iSize);
+
+	// Whatever was here last time goes first, in the order it came out. Anything taken
+	// gets its slot cleared so that it doesn't go in again below.
+	size_t iOrdered = 0;
+	for (size_t i = 0; i < m_aiLastOrder.size(); i++)
+	{
+		unsigned int iIndex = m_aiLastOrder[i];
+		if (iIndex >= m_aiListSort.size() || m_aiListSort[iIndex] != m_iSort)
+			continue;
+
+		m_aiSlots[iOrdered++] = m_aiListSlot[iIndex];
+		m_aiListSlot[iIndex] = ~0;
+	}
+
+	// Then anything new.
+	for (size_t i = 0; i < iSize; i++)
+	{
+		if (m_aiListSlot[apList[i]->m_iIndex] == i)
+			m_aiSlots[iOrdered++] = i;
+	}
+
+	TAssert(iOrdered == iSize);
+
+	// Squared distances are never negative, and the bits of a positive float sort the same as the float does.
+	for (size_t i = 0; i < iSize; i++)
+	{
+		float flDistanceSqr = (m_apUnsorted[m_aiSlots[i]]->GetGlobalOrigin() - vecCamera).LengthSqr();
+		memcpy(&m_aiKeys[i], &flDistanceSqr, sizeof(unsigned int));
+	}
+
+	m_bCoherent = InsertionSort();
+	if (!m_bCoherent)
+		RadixSort();
+
+	m_aiLastOrder.resize(iSize);
+	for (size_t i = 0; i < iSize; i++)
+	{
+		apList[i] = m_apUnsorted[m_aiSlots[i]];
+		m_aiLastOrder[i] = apList[i]->m_iIndex;
+	}
+}
+
+// Returns false if it gave up. What's left is partly sorted, which the radix sort doesn't mind.
+bool CDepthSort::InsertionSort()
+{
+	size_t iSize = m_aiKeys.size();
+	size_t iMaxShifts = iSize * DEPTH_SORT_MAX_SHIFTS;
+	size_t iShifts = 0;
+
+	unsigned int* aiKeys = m_aiKeys.data();
+	unsigned int* aiSlots = m_aiSlots.data();
+
+	for (size_t i = 1; i < iSize; i++)
+	{
+		unsigned int iKey = aiKeys[i];
+		if (aiKeys[i-1] <= iKey)
+			continue;
+
+		unsigned int iSlot = aiSlots[i];
+
+		size_t j = i;
+		while (j > 0 && aiKeys[j-1] > iKey)
+		{
+			aiKeys[j] = aiKeys[j-1];
+			aiSlots[j] = aiSlots[j-1];
+			j--;
+		}
+
+		aiKeys[j] = iKey;
+		aiSlots[j] = iSlot;
+
+		iShifts += i - j;
+		if (iShifts > iMaxShifts)
+			return false;
+	}
+
+	return true;
+}
+
+// Least significant digit first, so each pass keeps the order of the one before it. Ties
+// stay in last frame's order, so things at the same distance don't swap back and forth.
+void CDepthSort::RadixSort()
+{
+	size_t iSize = m_aiKeys.size();
+	if (iSize < 2)
+		return;
+
+	m_aiKeysScratch.resize(iSize);
+	m_aiSlotsScratch.resize(iSize);
+
+	unsigned int aiCounts[DEPTH_SORT_RADIX_PASSES][DEPTH_SORT_RADIX_SIZE];
+	memset(aiCounts, 0, sizeof(aiCounts));
+
+	// Count every pass at once.
+	for (size_t i = 0; i < iSize; i++)
+	{
+		unsigned int iKey = m_aiKeys[i];
+		for (size_t j = 0; j < DEPTH_SORT_RADIX_PASSES; j++)
+			aiCounts[j][(iKey >> (j*DEPTH_SORT_RADIX_BITS)) & (DEPTH_SORT_RADIX_SIZE-1)]++;
+	}
+
+	for (size_t j = 0; j < DEPTH_SORT_RADIX_PASSES; j++)
+	{
+		unsigned int iShift = j*DEPTH_SORT_RADIX_BITS;
+		unsigned int* aiCount = aiCounts[j];
+
+		// Nothing to do if every key has the same digit, which is usual for the top bits.
+		if (aiCount[(m_aiKeys[0] >> iShift) & (DEPTH_SORT_RADIX_SIZE-1)] == iSize)
+			continue;
+
+		// Turn the counts into where each digit starts.
+		unsigned int iTotal = 0;
+		for (size_t k = 0; k < DEPTH_SORT_RADIX_SIZE; k++)
+		{
+			unsigned int iCount = aiCount[k];
+			aiCount[k] = iTotal;
+			iTotal += iCount;
+		}
+
+		const unsigned int* aiKeys = m_aiKeys.data();
+		const unsigned int* aiSlots = m_aiSlots.data();
+		unsigned int* aiKeysOut = m_aiKeysScratch.data();
+		unsigned int* aiSlotsOut = m_aiSlotsScratch.data();
+
+		for (size_t i = 0; i < iSize; i++)
+		{
+			unsigned int iOut = aiCount[(aiKeys[i] >> iShift) & (DEPTH_SORT_RADIX_SIZE-1)]++;
+			aiKeysOut[iOut] = aiKeys[i];
+			aiSlotsOut[iOut] = aiSlots[i];
+		}
+
+		m_aiKeys.swap(m_aiKeysScratch);
+		m_aiSlots.swap(m_aiSlotsScratch);
+	}
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <vector>
+
+#include <vector.h>
+
+// Sorts a render list by distance from the camera, nearest first.
+//
+// Each character's distance is worked out once and sorted as a key, instead of being worked
+// out again for every comparison. The list hardly changes from one frame to the next, so it
+// starts from the order it came out in last frame and tries an insertion sort, which is next
+// to free on a list that's already almost sorted. If too much has moved it gives up on that
+// and radix sorts the keys. Everything is kept from frame to frame, so once the buffers are
+// big enough nothing gets allocated.
+class CDepthSort
+{
+public:
+	CDepthSort();
+
+public:
+	void                Sort(std::vector<class CCharacter*>& apList, const Vector& vecCamera);
+
+	// Whether the last sort got away with the insertion sort.
+	bool                WasCoherent() const { return m_bCoherent; }
+
+private:
+	bool                InsertionSort();
+	void                RadixSort();
+
+private:
+	// The list being sorted, as keys and where each one is in m_apUnsorted.
+	std::vector<unsigned int>       m_aiKeys;
+	std::vector<unsigned int>       m_aiSlots;
+	std::vector<unsigned int>       m_aiKeysScratch;
+	std::vector<unsigned int>       m_aiSlotsScratch;
+
+	std::vector<class CCharacter*>  m_apUnsorted;
+
+	// Entity indices in the order they came out last time.
+	std::vector<unsigned int>       m_aiLastOrder;
+
+	// By entity index, the last sort each one was in and where it was in the list.
+	std::vector<unsigned int>       m_aiListSort;
+	std::vector<unsigned int>       m_aiListSlot;
+	unsigned int                    m_iSort;
+
+	bool                            m_bCoherent;
+};
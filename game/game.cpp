@@ -20,11 +20,13 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <cstring>
 
 #include <algorithm>
+#include <chrono>
 
 #include <viewback.h>
 #include <viewback_util.h>
 
 #include <common_platform.h>
+#include <strutils.h>
 
 #include <mtrand.h>
 #include <math/collision.h>
@@ -36,8 +38,12 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <renderer/cvar.h>
 #include <renderer/renderer.h>
 #include <renderer/renderingcontext.h>
+#include <renderer/glstate.h>
+#include <renderer/vertexstream.h>
+#include <renderer/uniformblocks.h>
 
 #include "character.h"
+#include "monster.h"
 
 CGame::CGame(int argc, char** argv)
 	: CApplication(argc, argv)
@@ -46,13 +52,43 @@ CGame::CGame(int argc, char** argv)
 
 	m_iLastMouseX = m_iLastMouseY = -1;
 
+	m_iPendingRespawns = 0;
+	m_iMonsters = 0;
+
+	m_iCullJobs = 0;
+	m_iRecordJobs = 0;
+	m_flCharacterRecordTime = 0;
+	m_iInstanceBytesUploaded = 0;
+	m_iOcclusionFrame = 0;
+
+	m_bDedicatedServer = HasCommandLineSwitch("--server");
+	m_bClient = !m_bDedicatedServer && GetCommandLineSwitchValue("--connect");
+
 	memset(m_apEntityList, 0, sizeof(m_apEntityList));
 
+	// Backwards so the lowest slots get used first.
+	m_aiFreeEntitySlots.reserve(MAX_CHARACTERS);
+	for (size_t i = MAX_CHARACTERS; i > 0; i--)
+		m_aiFreeEntitySlots.push_back(i-1);
+
 	InitializeWin32SocketsBullshit();
 
 	mtsrand(0);
 }
 
+CGame::~CGame()
+{
+	// CApplication's destructor takes the GL context down with it, so let go of our names first.
+	m_oOcclusionQueries.Destroy();
+	m_oWeightedBuffer.Destroy();
+
+	for (size_t i = 0; i < m_aInstanceGroups.size(); i++)
+		m_aInstanceGroups[i].m_oInstances.Destroy();
+
+	for (size_t i = 0; i < m_aWeightedInstanceGroups.size(); i++)
+		m_aWeightedInstanceGroups[i].m_oInstances.Destroy();
+}
+
 void vb_command(const char* text)
 {
 	CCommand::Run(text);
@@ -72,11 +108,207 @@ CCommand test("test", test_callback);
 
 float g_player_speed = 15;
 int g_monsters = 3;
+float g_monster_respawn_time = 2;
+
+// Client/server only. Lag is added to everything each side sends, so the round trip is twice this.
+float g_net_fake_lag = 0;
+float g_net_interpolation = 0.1f;
+
+// Frames per second for the world stream, and how much of a core its encoder can have.
+float g_worldstream_rate = 10;
+float g_worldstream_budget = 0.25f;
+
+// Draw opaque boxes with one instanced draw call per texture instead of one each. Turn it off to compare.
+int g_instanced_characters = 1;
+
+// Don't draw characters that are hidden behind something. Turn it off to compare.
+int g_occlusion_culling = 1;
+
+// Draw billboards with one draw call per texture, built on the GPU. Turn it off to compare.
+int g_batched_sprites = 1;
+
+// Blend transparent characters in any order with weighted blended transparency, instead of sorting
+// them and drawing them back to front. Turn it on to compare.
+int g_weighted_transparency = 0;
+
+// The slider only goes up to 10. Use this to see how the game copes with lots of monsters.
+void monsters_callback(class CCommand* pCommand, std::vector<std::string>& asTokens, const std::string& sCommand)
+{
+	if (asTokens.size() < 2)
+	{
+		vb_console_append(tsprintf("monsters: %d\n", g_monsters).c_str());
+		return;
+	}
+
+	g_monsters = atoi(asTokens[1].c_str());
+}
+
+CCommand monsters("monsters", monsters_callback);
+
+// Fill the world up with crates, eg "spawn_props 10000 500", to see how drawing holds up with lots of static stuff around.
+void spawn_props_callback(class CCommand* pCommand, std::vector<std::string>& asTokens, const std::string& sCommand)
+{
+	if (asTokens.size() < 2)
+	{
+		vb_console_append("spawn_props <count> [radius]\n");
+		return;
+	}
+
+	float flRadius = 500;
+	if (asTokens.size() > 2)
+		flRadius = (float)atof(asTokens[2].c_str());
+
+	Game()->SpawnProps(atoi(asTokens[1].c_str()), flRadius);
+}
+
+CCommand spawn_props("spawn_props", spawn_props_callback);
+
+// Compares what it costs to change some state for one draw and put it back, eg "bench_render_state 100000".
+void bench_render_state_callback(class CCommand* pCommand, std::vector<std::string>& asTokens, const std::string& sCommand)
+{
+	if (Game()->IsDedicatedServer())
+		return;
+
+	int iCount = 100000;
+	if (asTokens.size() > 1)
+		iCount = std::max(atoi(asTokens[1].c_str()), 1);
+
+	CRenderer* pRenderer = Game()->GetRenderer();
+
+	CRenderingContext r(pRenderer);
+	r.UseProgram("model");
+
+	Matrix4x4 mTransform;
+	mTransform.SetTranslation(Vector(1, 2, 3));
+
+	typedef std::chrono::steady_clock clock;
+
+	// What DrawCharacters used to do for every character.
+	clock::time_point tStart = clock::now();
+	for (int i = 0; i < iCount; i++)
+	{
+		CRenderingContext c(pRenderer, true);
+		c.SetBlend(BLEND_NONE);
+		c.SetAlpha(1);
+		c.LoadTransform(mTransform);
+	}
+	clock::time_point tContext = clock::now();
+
+	for (int i = 0; i < iCount; i++)
+	{
+		CRenderingContext::CStateScope oScope(&r);
+		r.SetBlend(BLEND_NONE);
+		r.SetAlpha(1);
+		r.LoadTransform(mTransform);
+	}
+	clock::time_point tStateScope = clock::now();
+
+	for (int i = 0; i < iCount; i++)
+	{
+		CRenderingContext::CTransformScope oScope(&r);
+		r.LoadTransform(mTransform);
+	}
+	clock::time_point tTransformScope = clock::now();
+
+	float flContext = std::chrono::duration<float, std::nano>(tContext - tStart).count() / iCount;
+	float flStateScope = std::chrono::duration<float, std::nano>(tStateScope - tContext).count() / iCount;
+	float flTransformScope = std::chrono::duration<float, std::nano>(tTransformScope - tStateScope).count() / iCount;
+
+	vb_console_append(tsprintf("Per draw: context %.1fns, state scope %.1fns, transform scope %.1fns\n", flContext, flStateScope, flTransformScope).c_str());
+}
+
+CCommand bench_render_state("bench_render_state", bench_render_state_callback);
+
+// Compares what it costs to send vertices the old immediate mode way and with a vertex format, eg "bench_vertex_submit 100000".
+void bench_vertex_submit_callback(class CCommand* pCommand, std::vector<std::string>& asTokens, const std::string& sCommand)
+{
+	if (Game()->IsDedicatedServer())
+		return;
+
+	typedef CVertexFormat<VertexPosition, VertexNormal, VertexTexCoord0> CFormat;
+
+	// By default as many as fit in the stream buffer in one go, so that's what gets measured.
+	int iVertices = (int)(CVertexStream::GetMaxMapSize() / CFormat::GetLayout().m_iStride);
+	if (asTokens.size() > 1)
+		iVertices = std::max(atoi(asTokens[1].c_str()), 3);
+
+	// Whole triangles only.
+	iVertices -= iVertices%3;
+
+	CRenderingContext r(Game()->GetRenderer());
+	r.UseProgram("model");
+
+	// Everything at one point so the triangles don't cover anything.
+	Vector vecPosition(0, -1000, 0);
+	Vector vecNormal(0, 1, 0);
+	Vector2D vecTexCoord(0.5f, 0.5f);
+
+	typedef std::chrono::steady_clock clock;
+
+	clock::time_point tStart = clock::now();
+
+	size_t iStreamed = CVertexStream::GetBytesStreamed();
+
+	r.BeginRenderTris();
+	for (int i = 0; i < iVertices; i++)
+	{
+		r.Normal(vecNormal);
+		r.TexCoord(vecTexCoord);
+		r.Vertex(vecPosition);
+	}
+
+	clock::time_point tImmediateSubmit = clock::now();
+
+	r.EndRender();
+
+	clock::time_point tImmediate = clock::now();
+
+	bool bImmediateStreamed = CVertexStream::GetBytesStreamed() != iStreamed;
+	iStreamed = CVertexStream::GetBytesStreamed();
+
+	CVertexWriter<CFormat> oWriter = r.BeginRenderFormat<CFormat>(PRIMITIVE_TRIANGLES, iVertices);
+	for (int i = 0; i < iVertices; i++)
+		oWriter.Vertex(vecPosition, vecNormal, vecTexCoord);
+
+	clock::time_point tFormatSubmit = clock::now();
+
+	r.EndRenderFormat();
+
+	clock::time_point tFormat = clock::now();
+
+	bool bFormatStreamed = CVertexStream::GetBytesStreamed() != iStreamed;
+
+	float flImmediateSubmit = std::chrono::duration<float, std::nano>(tImmediateSubmit - tStart).count() / iVertices;
+	float flImmediate = std::chrono::duration<float, std::nano>(tImmediate - tStart).count() / iVertices;
+	float flFormatSubmit = std::chrono::duration<float, std::nano>(tFormatSubmit - tImmediate).count() / iVertices;
+	float flFormat = std::chrono::duration<float, std::nano>(tFormat - tImmediate).count() / iVertices;
+
+	vb_console_append(tsprintf("Per vertex: immediate %.2fns (%.2fns with draw), vertex format %.2fns (%.2fns with draw)\n", flImmediateSubmit, flImmediate, flFormatSubmit, flFormat).c_str());
+
+	// Too big for the stream buffer, so these went through the client memory fallback instead.
+	if (!bImmediateStreamed || !bFormatStreamed)
+		vb_console_append(tsprintf("Didn't fit in the stream buffer (%s%s%s), those numbers are for drawing from client memory\n", bImmediateStreamed?"":"immediate", (!bImmediateStreamed && !bFormatStreamed)?", ":"", bFormatStreamed?"":"vertex format").c_str());
+}
+
+CCommand bench_vertex_submit("bench_vertex_submit", bench_vertex_submit_callback);
 
 void CGame::Load()
 {
-	m_iMonsterTexture = GetRenderer()->LoadTextureIntoGL("monster.png");
-	m_iCrateTexture = GetRenderer()->LoadTextureIntoGL("crate.png");
+	// A dedicated server has nothing to draw with. Its characters go without textures.
+	if (!m_bDedicatedServer)
+	{
+		m_iMonsterTexture = GetRenderer()->LoadTextureIntoGL("monster.png");
+		m_iCrateTexture = GetRenderer()->LoadTextureIntoGL("crate.png");
+
+		// --render-threads 1 does it all on the GL thread, to see how well it scales.
+		size_t iRenderThreads = 0;
+		if (GetCommandLineSwitchValue("--render-threads"))
+			iRenderThreads = std::max(atoi(GetCommandLineSwitchValue("--render-threads")), 1);
+
+		m_oRenderWorkers.Initialize(iRenderThreads);
+	}
+	else
+		m_iMonsterTexture = m_iCrateTexture = 0;
 
 	vb_util_add_channel("Player speed", VB_DATATYPE_FLOAT, NULL);
 	vb_util_set_range_s("Player speed", 0, 400);
@@ -89,12 +321,74 @@ void CGame::Load()
 
 	vb_util_add_control_slider_int_address("Number of monsters", 0, 10, 1, &g_monsters);
 
+	vb_util_add_control_slider_float_address("Monster respawn time", 0, 10, 0, &g_monster_respawn_time);
+
+	vb_util_add_channel("Behaviors resumed", VB_DATATYPE_FLOAT, NULL);
+
+	vb_util_add_channel("Draw time", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("GL state calls issued", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("GL state calls elided", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Vertex bytes streamed", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Vertex stream waits", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Uniform block uploads", VB_DATATYPE_FLOAT, NULL);
+
+	vb_util_add_control_slider_int_address("Instanced characters", 0, 1, 1, &g_instanced_characters);
+	vb_util_add_control_slider_int_address("Batched sprites", 0, 1, 1, &g_batched_sprites);
+	vb_util_add_control_slider_int_address("Weighted transparency", 0, 1, 1, &g_weighted_transparency);
+	vb_util_add_control_slider_int_address("Occlusion culling", 0, 1, 1, &g_occlusion_culling);
+	vb_util_add_channel("Occlusion culled", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("LOD full", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("LOD impostor", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("LOD fogged out", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Occlusion queries", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Character draw calls", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Instance data uploaded", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Character state changes unsorted", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Character state changes sorted", VB_DATATYPE_FLOAT, NULL);
+
+	vb_util_add_channel("Loaded chunks", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Terrain draw calls", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Terrain nodes", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Entities", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Render list time", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Character record time", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Transparent sort time", VB_DATATYPE_FLOAT, NULL);
+
+	vb_util_add_control_slider_float_address("Fake lag", 0, 0.5f, 0, &g_net_fake_lag);
+	vb_util_add_control_slider_float_address("Interpolation delay", 0, 0.5f, 0, &g_net_interpolation);
+	vb_util_add_channel("Server tick time", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Snapshot size", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Server bandwidth", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Client bandwidth", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("Interpolation buffer", VB_DATATYPE_FLOAT, NULL);
+
+	vb_util_add_control_slider_float_address("World stream rate", 0, 60, 0, &g_worldstream_rate);
+	vb_util_add_control_slider_float_address("World stream budget", 0, 1, 0, &g_worldstream_budget);
+	vb_util_add_channel("World stream frame size", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("World stream encode time", VB_DATATYPE_FLOAT, NULL);
+	vb_util_add_channel("World stream frames dropped", VB_DATATYPE_FLOAT, NULL);
+
+	// Whoever's simulating has the world to stream. A client only has a copy.
+	if (!m_bClient)
+	{
+		unsigned short iStreamPort = WORLDSTREAM_DEFAULT_PORT;
+		if (GetCommandLineSwitchValue("--stream-port"))
+			iStreamPort = (unsigned short)atoi(GetCommandLineSwitchValue("--stream-port"));
+
+		if (!m_oWorldStream.Initialize(iStreamPort))
+			DebugPrint(tsprintf("Couldn't open the world stream on port %d.\n", iStreamPort).c_str());
+	}
+
 	vb_util_server_create("Roguelike Test");
 }
 
 // This method gets called when the user presses a key
 bool CGame::KeyPress(int c)
 {
+	// A client doesn't have a player until the first snapshot comes in.
+	if (!m_hPlayer)
+		return CApplication::KeyPress(c);
+
 	if (c == 'W')
 	{
 		m_hPlayer->m_vecMovementGoal.x = g_player_speed;
@@ -117,7 +411,10 @@ bool CGame::KeyPress(int c)
 	}
 	else if (c == ' ')
 	{
-		m_hPlayer->m_vecVelocity.y = 7;
+		if (m_bClient)
+			m_oClient.QueueJump();
+		else
+			m_hPlayer->m_vecVelocity.y = 7;
 		return true;
 	}
 	else if (c == 256)
@@ -132,6 +429,12 @@ bool CGame::KeyPress(int c)
 // This method gets called when the player releases a key.
 void CGame::KeyRelease(int c)
 {
+	if (!m_hPlayer)
+	{
+		CApplication::KeyRelease(c);
+		return;
+	}
+
 	if (c == 'W')
 	{
 		m_hPlayer->m_vecMovementGoal.x = 0;
@@ -156,6 +459,9 @@ void CGame::KeyRelease(int c)
 // http://www.youtube.com/watch?v=c4b9lCfSDQM
 void CGame::Update(float dt)
 {
+	// Fire off anything that was waiting for this moment to come around.
+	m_oTimers.Advance(GetTime());
+
 	Vector x0 = m_hPlayer->GetGlobalOrigin();
 
 	// The approach function http://www.youtube.com/watch?v=qJq7I2DLGzI
@@ -179,10 +485,11 @@ void CGame::Update(float dt)
 	m_hPlayer->SetTranslation(m_hPlayer->GetGlobalOrigin() + m_hPlayer->m_vecVelocity * dt);
 	m_hPlayer->m_vecVelocity = m_hPlayer->m_vecVelocity + m_hPlayer->m_vecGravity * dt;
 
-	// Make sure the player doesn't fall through the floor. The y dimension is up/down, and the floor is at 0.
+	// Make sure the player doesn't fall through the floor. The y dimension is up/down, and the floor is the terrain.
 	Vector vecTranslation = m_hPlayer->GetGlobalOrigin();
-	if (vecTranslation.y < 0)
-		m_hPlayer->SetTranslation(Vector(vecTranslation.x, 0, vecTranslation.z));
+	float flGround = CTerrain::GetHeight(vecTranslation.x, vecTranslation.z);
+	if (vecTranslation.y < flGround)
+		m_hPlayer->SetTranslation(Vector(vecTranslation.x, flGround, vecTranslation.z));
 
 	// Grab the player's translation and make a translation only matrix. http://www.youtube.com/watch?v=iCazI3nKBf0
 	Vector vecPosition = m_hPlayer->GetGlobalOrigin();
@@ -209,100 +516,127 @@ void CGame::Update(float dt)
 	vb_data_send_float_s("Player speed", m_hPlayer->m_vecVelocity.Length2D());
 	//vb_data_set_control_slider_float_value("Player speed", player_speed.GetFloat());
 
-	std::vector<CCharacter*> monsters;
+	// Bring in the parts of the world around the player and throw away the parts he's left behind.
+	m_oWorld.Update(m_hPlayer->GetGlobalOrigin());
 
-	float flMonsterSpeed = 0.5f;
-	for (size_t i = 0; i < MAX_CHARACTERS; i++)
+	vb_data_send_float_s("Loaded chunks", (float)m_oWorld.GetNumChunks());
+	vb_data_send_float_s("Terrain draw calls", (float)m_oTerrain.GetNumDrawCalls());
+	vb_data_send_float_s("Terrain nodes", (float)m_oTerrain.GetNumNodes());
+	vb_data_send_float_s("Entities", (float)(MAX_CHARACTERS - m_aiFreeEntitySlots.size()));
+
+	// Monsters run their behaviors here. Only the ones that have something to do get looked at.
+	m_oBehaviors.Run(dt);
+
+	vb_data_send_float_s("Behaviors resumed", (float)m_oBehaviors.GetNumResumedLastRun());
+
+	// Too many monsters, get rid of some. Newest ones go first.
+	for (size_t i = MAX_CHARACTERS; i > 0 && (int)m_iMonsters > g_monsters; i--)
 	{
-		CCharacter* pCharacter = GetCharacterIndex(i);
+		CCharacter* pCharacter = GetCharacterIndex(i-1);
 		if (!pCharacter)
 			continue;
 
 		if (!pCharacter->m_bEnemyAI)
 			continue;
 
-		monsters.push_back(pCharacter);
+		RemoveCharacter(pCharacter);
+	}
 
-		// Update position and movement. http://www.youtube.com/watch?v=c4b9lCfSDQM
-		if ((m_hPlayer->GetGlobalOrigin() - pCharacter->GetGlobalOrigin()).Length() < 1)
-			continue;
+	// Monsters that are waiting to respawn count against the total, otherwise they'd pop right back in.
+	while ((int)(m_iMonsters + m_iPendingRespawns) < g_monsters)
+	{
+		if (!SpawnMonster())
+			break;
+	}
 
-		pCharacter->m_vecVelocity = (m_hPlayer->GetGlobalOrigin() - pCharacter->GetGlobalOrigin()).Normalized() * flMonsterSpeed;
+	// Send the world out to any tools that are watching, now that everything's moved.
+	m_oWorldStream.SetRate(g_worldstream_rate);
+	m_oWorldStream.SetBudget(g_worldstream_budget);
+	m_oWorldStream.Update(GetTime());
 
-		pCharacter->SetTranslation(pCharacter->GetGlobalOrigin() + pCharacter->m_vecVelocity * dt);
-	}
+	vb_data_send_float_s("World stream frame size", (float)m_oWorldStream.GetLastFrameSize());
+	vb_data_send_float_s("World stream encode time", m_oWorldStream.GetLastEncodeTime() * 1000);
+	vb_data_send_float_s("World stream frames dropped", (float)m_oWorldStream.GetFramesDropped());
+}
+
+// Make a new monster on the ground at vecOrigin and start it thinking.
+CCharacter* CGame::CreateMonster(const Vector& vecOrigin)
+{
+	CCharacter* pNew = CreateMonsterCharacter();
+	if (!pNew)
+		return nullptr;
+
+	pNew->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), Vector(vecOrigin.x, CTerrain::GetHeight(vecOrigin.x, vecOrigin.z), vecOrigin.z));
+
+	m_oBehaviors.Start<CMonsterBehavior>(pNew);
+
+	return pNew;
+}
+
+// Just the body of a monster, with no brain.
+CCharacter* CGame::CreateMonsterCharacter()
+{
+	CCharacter* pNew = CreateCharacter();
+	if (!pNew)
+		return nullptr;
+
+	pNew->SetAABBSize(AABB(Vector(-1, 0, -1), Vector(1, 2, 1)));
+	pNew->SetBillboardTexture(GetMonsterTexture());
+	pNew->m_bEnemyAI = true;
+	pNew->m_bTakesDamage = true;
+
+	m_iMonsters++;
+
+	return pNew;
+}
 
-	while ((int)monsters.size() > g_monsters)
+// Spawn a baddy at one of the spawners in the world, or in a random spot near the player if there aren't any.
+CCharacter* CGame::SpawnMonster()
+{
+	Vector vecSpawn;
+	if (!m_oWorld.PickSpawnPoint(vecSpawn))
 	{
-		RemoveCharacter(monsters.back());
-		monsters.pop_back();
+		vecSpawn = m_hPlayer->GetGlobalOrigin() + Vector((float)(rand() % 20) - 10, 0, (float)(rand() % 20) - 10);
 	}
 
-	while ((int)monsters.size() < g_monsters)
-	{
-		// Spawn another baddy to take this guy's place.
-		CCharacter* pNew = Game()->CreateCharacter();
+	return CreateMonster(vecSpawn);
+}
 
-		// Position the new monster in a random spot near the player.
-		pNew->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), Vector((float)(rand() % 20) - 10, 0, (float)(rand() % 20) - 10));
+// Bring a new monster in after a delay to take the place of one that died.
+void CGame::ScheduleMonsterRespawn()
+{
+	m_iPendingRespawns++;
+	m_oTimers.Schedule(nullptr, g_monster_respawn_time, &CGame::RespawnMonster);
+}
 
-		pNew->m_aabbSize.vecMin = Vector(-1, 0, -1);
-		pNew->m_aabbSize.vecMax = Vector(1, 2, 1);
-		pNew->m_iBillboardTexture = Game()->GetMonsterTexture();
-		pNew->m_bEnemyAI = true;
-		pNew->m_bTakesDamage = true;
+void CGame::RespawnMonster(CCharacter* pCharacter, size_t iData)
+{
+	TAssert(Game()->m_iPendingRespawns);
+	Game()->m_iPendingRespawns--;
 
-		monsters.push_back(pNew);
-	}
+	// If the number of monsters was turned down in the meantime Update() will remove the extra.
+	Game()->SpawnMonster();
 }
 
-// The Game Loop http://www.youtube.com/watch?v=c4b9lCfSDQM
-void CGame::GameLoop()
+CCharacter* CGame::CreateProp(const Vector& vecOrigin)
 {
-	m_hPlayer = CreateCharacter();
+	CCharacter* pProp = CreateCharacter();
+	if (!pProp)
+		return nullptr;
 
-	// Initialize the box's position etc
-	m_hPlayer->SetGlobalOrigin(Point(0, 0, 0));
-	m_hPlayer->m_vecMovement = Vector(0, 0, 0);
-	m_hPlayer->m_vecMovementGoal = Vector(0, 0, 0);
-	m_hPlayer->m_vecVelocity = Vector(0, 0, 0);
-	m_hPlayer->m_vecGravity = Vector(0, -10, 0);
-	m_hPlayer->m_clrRender = Color(0.8f, 0.4f, 0.2f, 1.0f);
-	m_hPlayer->m_bHitByTraces = false;
-	m_hPlayer->m_aabbSize = AABB(-Vector(0.5f, 0, 0.5f), Vector(0.5f, 2, 0.5f));
-	m_hPlayer->m_bTakesDamage = true;
-
-	Vector vecMonsterMin = Vector(-1, 0, -1);
-	Vector vecMonsterMax = Vector(1, 2, 1);
-
-	CCharacter* pTarget1 = CreateCharacter();
-	pTarget1->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), Vector(6, 0, 6));
-	pTarget1->m_aabbSize.vecMin = vecMonsterMin;
-	pTarget1->m_aabbSize.vecMax = vecMonsterMax;
-	pTarget1->m_iBillboardTexture = m_iMonsterTexture;
-	pTarget1->m_bEnemyAI = true;
-	pTarget1->m_bTakesDamage = true;
-
-	CCharacter* pTarget2 = CreateCharacter();
-	pTarget2->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), Vector(6, 0, -6));
-	pTarget2->m_aabbSize.vecMin = vecMonsterMin;
-	pTarget2->m_aabbSize.vecMax = vecMonsterMax;
-	pTarget2->m_iBillboardTexture = m_iMonsterTexture;
-	pTarget2->m_bEnemyAI = true;
-	pTarget2->m_bTakesDamage = true;
-
-	CCharacter* pTarget3 = CreateCharacter();
-	pTarget3->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), Vector(-6, 0, 8));
-	pTarget3->m_aabbSize.vecMin = vecMonsterMin;
-	pTarget3->m_aabbSize.vecMax = vecMonsterMax;
-	pTarget3->m_iBillboardTexture = m_iMonsterTexture;
-	pTarget3->m_bEnemyAI = true;
-	pTarget3->m_bTakesDamage = true;
-
-	Vector vecPropMin = Vector(-1, 0, -1);
-	Vector vecPropMax = Vector(1, 2, 1);
-
-	for (int i = 0; i < 8; i++)
+	pProp->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), vecOrigin);
+	pProp->SetAABBSize(AABB(Vector(-1, 0, -1), Vector(1, 2, 1)));
+	pProp->m_clrRender = Color(0.4f, 0.8f, 0.2f, 1.0f);
+	pProp->SetTexture(m_iCrateTexture);
+	pProp->m_bStatic = true;
+
+	return pProp;
+}
+
+// Scatter some crates around in a circle about the origin.
+void CGame::SpawnProps(size_t iCount, float flRadius)
+{
+	for (size_t i = 0; i < iCount; i++)
 	{
 		float rand1 = (float)(mtrand()%1000)/1000; // [0, 1]
 		float rand2 = (float)(mtrand()%1000)/1000; // [0, 1]
@@ -311,19 +645,94 @@ void CGame::GameLoop()
 		float radius = sqrt(rand2);
 
 		Vector position = Vector(radius * cos(theta), 0, radius * sin(theta));
-		position = position * 50;
+		position = position * flRadius;
+		position.y = CTerrain::GetHeight(position.x, position.z);
 
-		CCharacter* pProp = CreateCharacter();
-		pProp->SetTransform(Vector(1, 1, 1), 0, Vector(0, 1, 0), position);
-		pProp->m_aabbSize.vecMin = vecPropMin;
-		pProp->m_aabbSize.vecMax = vecPropMax;
-		pProp->m_clrRender = Color(0.4f, 0.8f, 0.2f, 1.0f);
-		pProp->m_iTexture = m_iCrateTexture;
+		if (!CreateProp(position))
+			return;
 	}
+}
 
-	CRenderingContext c(GetRenderer());
-	c.RenderBox(Vector(-1, 0, -1), Vector(1, 2, 1));
-	c.CreateVBO(m_iMeshVB, m_iMeshSize);
+CCharacter* CGame::CreatePlayer()
+{
+	CCharacter* pPlayer = CreateCharacter();
+	if (!pPlayer)
+		return nullptr;
+
+	// Initialize the box's position etc
+	pPlayer->SetGlobalOrigin(Point(0, CTerrain::GetHeight(0, 0), 0));
+	pPlayer->m_vecMovement = Vector(0, 0, 0);
+	pPlayer->m_vecMovementGoal = Vector(0, 0, 0);
+	pPlayer->m_vecVelocity = Vector(0, 0, 0);
+	pPlayer->m_vecGravity = Vector(0, -10, 0);
+	pPlayer->m_clrRender = Color(0.8f, 0.4f, 0.2f, 1.0f);
+	pPlayer->m_bHitByTraces = false;
+	pPlayer->SetAABBSize(AABB(-Vector(0.5f, 0, 0.5f), Vector(0.5f, 2, 0.5f)));
+	pPlayer->m_bTakesDamage = true;
+
+	return pPlayer;
+}
+
+CCharacter* CGame::CreateRemoteCharacter(net_entity_t eKind)
+{
+	switch (eKind)
+	{
+	case NET_ENTITY_PLAYER:
+		return CreatePlayer();
+
+	case NET_ENTITY_MONSTER:
+		return CreateMonsterCharacter();
+
+	case NET_ENTITY_PROP:
+	default:
+	{
+		// Snapshots move it around, so it's not static here.
+		CCharacter* pProp = CreateProp(Vector(0, 0, 0));
+		if (pProp)
+			pProp->m_bStatic = false;
+		return pProp;
+	}
+	}
+}
+
+void CGame::ApplyClientInput(const CClientInput& oInput)
+{
+	if (!m_hPlayer)
+		return;
+
+	m_hPlayer->m_vecMovementGoal = oInput.m_vecMovementGoal;
+	m_hPlayer->SetLocalView(oInput.m_angView);
+
+	if (oInput.m_iJumps)
+		m_hPlayer->m_vecVelocity.y = 7;
+
+	for (size_t i = 0; i < oInput.m_iShots; i++)
+		Shoot();
+}
+
+// The Game Loop http://www.youtube.com/watch?v=c4b9lCfSDQM
+void CGame::GameLoop()
+{
+	if (m_bDedicatedServer)
+	{
+		ServerLoop();
+		return;
+	}
+
+	if (m_bClient)
+	{
+		ClientLoop();
+		return;
+	}
+
+	m_hPlayer = CreatePlayer();
+
+	CreateMonster(Vector(6, 0, 6));
+	CreateMonster(Vector(6, 0, -6));
+	CreateMonster(Vector(-6, 0, 8));
+
+	// Props and spawners come and go with the world chunks as the player moves around.
+	m_oWorld.Initialize();
 
 	float flPreviousTime = 0;
 	float flCurrentTime = Application()->GetTime();
@@ -358,7 +767,160 @@ void CGame::GameLoop()
 
 		Update(dt);
 
+		float flDrawStart = GetTime();
+
+		CGLState::ResetCounters();
+		CVertexStream::ResetCounters();
+		CUniformBlocks::ResetCounters();
+
 		Draw();
+
+		// In milliseconds.
+		vb_data_send_float_s("Draw time", (GetTime() - flDrawStart) * 1000);
+
+		vb_data_send_float_s("GL state calls issued", (float)CGLState::GetCallsIssued());
+		vb_data_send_float_s("GL state calls elided", (float)CGLState::GetCallsElided());
+		vb_data_send_float_s("Vertex bytes streamed", (float)CVertexStream::GetBytesStreamed());
+		vb_data_send_float_s("Vertex stream waits", (float)CVertexStream::GetFenceWaits());
+		vb_data_send_float_s("Uniform block uploads", (float)CUniformBlocks::GetUploads());
+	}
+}
+
+static unsigned short GetNetPort()
+{
+	const char* pszPort = Game()->GetCommandLineSwitchValue("--port");
+	if (pszPort)
+		return (unsigned short)atoi(pszPort);
+
+	return NET_DEFAULT_PORT;
+}
+
+// Simulate at a fixed rate with no window. Whoever connects gets a snapshot every tick.
+void CGame::ServerLoop()
+{
+	unsigned short iPort = GetNetPort();
+	if (!m_oServer.Initialize(iPort))
+	{
+		DebugPrint(tsprintf("Couldn't listen on port %d.\n", iPort).c_str());
+		return;
+	}
+
+	m_hPlayer = CreatePlayer();
+
+	CreateMonster(Vector(6, 0, 6));
+	CreateMonster(Vector(6, 0, -6));
+	CreateMonster(Vector(-6, 0, 8));
+
+	m_oWorld.Initialize();
+
+	float flNextTick = GetTime();
+
+	float flBandwidthTime = flNextTick;
+	size_t iBandwidthBytes = 0;
+
+	while (true)
+	{
+		float flTime = GetTime();
+		if (flTime < flNextTick)
+		{
+			SleepMS((size_t)((flNextTick - flTime) * 1000));
+			continue;
+		}
+
+		// If we've fallen way behind don't try to make it all up at once.
+		if (flTime - flNextTick > SERVER_TICK_INTERVAL * 5)
+			flNextTick = flTime;
+
+		flNextTick += SERVER_TICK_INTERVAL;
+
+		vb_server_update((vb_uint64)(flTime * 1000));
+
+		m_oServer.SetFakeLag(g_net_fake_lag);
+
+		if (m_oServer.ReadInput(flTime, m_oClientInput))
+			ApplyClientInput(m_oClientInput);
+
+		float flTickStart = GetTime();
+
+		// Every tick is the same length no matter how long the last one took, so the simulation doesn't depend on the frame rate.
+		Update(SERVER_TICK_INTERVAL);
+
+		m_oServer.SendSnapshot(m_hPlayer, flTime);
+
+		// In milliseconds.
+		vb_data_send_float_s("Server tick time", (GetTime() - flTickStart) * 1000);
+		vb_data_send_float_s("Snapshot size", (float)m_oServer.GetLastSnapshotSize());
+
+		// In kilobytes per second.
+		if (flTime - flBandwidthTime >= 1)
+		{
+			vb_data_send_float_s("Server bandwidth", (m_oServer.GetBytesSent() - iBandwidthBytes) / 1024.0f / (flTime - flBandwidthTime));
+			iBandwidthBytes = m_oServer.GetBytesSent();
+			flBandwidthTime = flTime;
+		}
 	}
 }
 
+// Draw whatever the server sends. Nothing is simulated here.
+void CGame::ClientLoop()
+{
+	const char* pszHost = GetCommandLineSwitchValue("--connect");
+	unsigned short iPort = GetNetPort();
+	if (!m_oClient.Connect(pszHost, iPort))
+	{
+		DebugPrint(tsprintf("Couldn't connect to %s:%d.\n", pszHost, iPort).c_str());
+		return;
+	}
+
+	float flBandwidthTime = GetTime();
+	size_t iBandwidthBytes = 0;
+
+	float frame_start_time = 0;
+
+	while (true)
+	{
+		{
+			double next_frame_time = frame_start_time + (1.0f / 60);
+			double time_to_sleep_seconds = next_frame_time - GetTime();
+			if (time_to_sleep_seconds > 0.001)
+				SleepMS((size_t)(time_to_sleep_seconds * 1000));
+		}
+
+		frame_start_time = GetTime();
+
+		float flTime = GetTime();
+
+		vb_server_update((vb_uint64)(flTime * 1000));
+
+		// Puffs and tracers still go away on their own timers.
+		m_oTimers.Advance(flTime);
+
+		m_oClient.SetFakeLag(g_net_fake_lag);
+		m_oClient.Update(flTime, g_net_interpolation);
+
+		if (!m_oClient.IsConnected())
+		{
+			DebugPrint("Lost the connection to the server.\n");
+			return;
+		}
+
+		m_hPlayer = m_oClient.GetPlayer();
+
+		// In milliseconds.
+		vb_data_send_float_s("Interpolation buffer", m_oClient.GetInterpolationBuffer() * 1000);
+
+		// In kilobytes per second.
+		if (flTime - flBandwidthTime >= 1)
+		{
+			vb_data_send_float_s("Client bandwidth", (m_oClient.GetBytesReceived() - iBandwidthBytes) / 1024.0f / (flTime - flBandwidthTime));
+			iBandwidthBytes = m_oClient.GetBytesReceived();
+			flBandwidthTime = flTime;
+		}
+
+		// Nothing to look at until the first snapshot shows up.
+		if (m_hPlayer)
+			Draw();
+		else
+			SwapBuffers();
+	}
+}
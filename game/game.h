@@ -26,12 +26,51 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <math/graph.h>
 
 #include <renderer/application.h>
+#include <renderer/commandlist.h>
+#include <renderer/framebuffer.h>
+#include <renderer/instancebuffer.h>
+#include <renderer/occlusionqueries.h>
+#include <renderer/renderqueue.h>
+#include <renderer/spritebatch.h>
 
 #include "handle.h"
+#include "timers.h"
+#include "behavior.h"
+#include "depthsort.h"
+#include "renderset.h"
+#include "rendertree.h"
+#include "world.h"
+#include "terrain.h"
+#include "server.h"
+#include "client.h"
+#include "worldstream.h"
+#include "workers.h"
 
 using std::vector;
 
-#define MAX_CHARACTERS 1000
+#define MAX_CHARACTERS 16384
+
+// Fog starts this far from the camera and everything past the end is nothing but fog. The shaders
+// get these from here, and characters all the way past the end aren't drawn at all.
+#define FOG_MIN     10.0f
+#define FOG_MAX     50.0f
+#define FOG_COLOR   Vector4D(0.76f, 0.8f, 0.85f, 1.0f)
+
+// Boxes this far away are mostly fog, so they're drawn as a flat sprite with their texture instead.
+#define LOD_IMPOSTOR_DISTANCE  (FOG_MIN + (FOG_MAX - FOG_MIN) * 0.6f)
+// How far past the switch a character has to go to switch back, so that it doesn't flicker.
+#define LOD_HYSTERESIS         2.0f
+
+typedef enum
+{
+	LOD_FULL,
+	LOD_IMPOSTOR,
+	LOD_TOTAL,
+} lod_t;
+
+// How long effects stay around, in seconds.
+#define PUFF_LIFETIME   0.3f
+#define TRACER_LIFETIME 0.1f
 
 // CGame is the "application" class. It creates the window and handles user input.
 // It extends CApplication, which does all of the dirty work. All we have to do
@@ -58,8 +97,50 @@ class CGame : public CApplication
 		float flTimeCreated;
 	};
 
+	// All of the opaque boxes with the same texture. They're drawn with one instanced draw call.
+	class CInstanceGroup
+	{
+	public:
+		size_t          m_iTexture;
+		size_t          m_iInstances;   // Added so far this frame
+		CInstanceBuffer m_oInstances;
+	};
+
+	// All of the billboards with the same texture. They're drawn with one instanced draw call,
+	// and the vertex shader turns them to face the camera.
+	class CSpriteGroup
+	{
+	public:
+		size_t       m_iTexture;
+		float        m_flDistance;   // To the farthest sprite
+		CSpriteBatch m_oSprites;
+	};
+
+	// A slice of a render set for one worker to cull, or the static render tree.
+	class CCullJob
+	{
+	public:
+		const CRenderSet*        m_pSet;     // nullptr for the static render tree
+		size_t                   m_iFirst;
+		size_t                   m_iLast;
+		std::vector<CCharacter*> m_apVisible;
+	};
+
+	// A run of sorted render queue packets for one worker to record, or a single instance group
+	// or sprite group that the GL thread draws itself.
+	class CRecordJob
+	{
+	public:
+		size_t       m_iFirstPacket;
+		size_t       m_iLastPacket;
+		size_t       m_iInstanceGroup;   // ~0 if this isn't an instance group
+		size_t       m_iSpriteGroup;     // ~0 if this isn't a sprite group
+		CCommandList m_oCommands;
+	};
+
 public:
 	CGame(int argc, char** argv);
+	~CGame();
 
 public:
 	void Load();
@@ -72,44 +153,169 @@ public:
 	bool TraceLine(const Vector& v0, const Vector& v1, Vector& vecIntersection, class CCharacter*& pHit);
 
 	void MakePuff(const Point& vecPuff);
-	const vector<CPuff>& GetPuffs() const { return m_aPuffs; }
+	const std::deque<CPuff>& GetPuffs() const { return m_aPuffs; }
 
 	void MakeBulletTracer(const Point& vecStart, const Point& vecEnd);
-	const vector<CBulletTracer>& GetTracers() const { return m_aTracers; }
+	const std::deque<CBulletTracer>& GetTracers() const { return m_aTracers; }
+
+	void Shoot();
 
 	void Update(float dt);
 	void Draw();
-	void DrawCharacters(const std::vector<CCharacter*>& apRenderList, bool bTransparent);
-	void MergeSortTransparentRenderList();
+	void ApplyRenderJournal();
+	// Returns how many draw calls it made.
+	size_t DrawCharacters(const std::vector<CCharacter*>& apRenderList, bool bTransparent);
+	void   UpdateInstanceGroups(std::vector<CInstanceGroup>& aGroups, const std::vector<CCharacter*>& apRenderList, bool bSprites);
+	void   UpdateSpriteGroups(const std::vector<CCharacter*>& apRenderList);
+	void   CullRenderSets();
+	void   SelectLODs();
+	void   CullOccluded();
+	void   IssueOcclusionQueries();
+	void SortTransparentRenderList();
+	// Returns false if it can't, and then they have to be sorted and drawn the old way.
+	bool   SetupWeightedTransparency();
+	// Returns how many draw calls it made.
+	size_t DrawWeightedTransparency(const std::vector<CCharacter*>& apRenderList);
+	void SetFrameUniforms();
 	void GameLoop();
+	void ServerLoop();
+	void ClientLoop();
+
+	// Run with --server to simulate without a window, and --connect <host> to draw what a server sends.
+	bool IsDedicatedServer() const { return m_bDedicatedServer; }
+	bool IsClient() const { return m_bClient; }
+
+	// The server side of the client's input.
+	void ApplyClientInput(const CClientInput& oInput);
 
 	CCharacter* CreateCharacter();
 	void        RemoveCharacter(CCharacter* pCharacter);
 	CCharacter* GetCharacterIndex(size_t i);
 
+	void        CaptureSnapshot(CSnapshot& oSnapshot);
+
+	// Let the render lists know that a character has moved or changed how it's drawn.
+	void        MarkRenderDirty(CCharacter* pCharacter);
+
+	CCharacter* CreateMonster(const Vector& vecOrigin);
+	CCharacter* SpawnMonster();
+	void        ScheduleMonsterRespawn();
+
+	CCharacter* CreateProp(const Vector& vecOrigin);
+	void        SpawnProps(size_t iCount, float flRadius);
+
+	CCharacter* CreatePlayer();
+
+	// The client's copy of something on the server. It looks right but doesn't think.
+	CCharacter* CreateRemoteCharacter(net_entity_t eKind);
+
+	CCharacter* GetPlayer() { return m_hPlayer; }
+
+	CGameServer&        GetServer() { return m_oServer; }
+	CGameClient&        GetClient() { return m_oClient; }
+
+	CTimerWheel&        GetTimers() { return m_oTimers; }
+	CBehaviorScheduler& GetBehaviors() { return m_oBehaviors; }
+	CWorld&             GetWorld() { return m_oWorld; }
+	CTerrain&           GetTerrain() { return m_oTerrain; }
+
 	size_t      GetMonsterTexture() { return m_iMonsterTexture; }
 
+private:
+	static void ExpirePuff(CCharacter* pCharacter, size_t iData);
+	static void ExpireTracer(CCharacter* pCharacter, size_t iData);
+	static void RespawnMonster(CCharacter* pCharacter, size_t iData);
+
+	CCharacter* CreateMonsterCharacter();
+
+	void        RemoveFromRenderSet(CCharacter* pCharacter);
+
+	static void CullJob(void* pData, size_t iJob);
+	static void RecordJob(void* pData, size_t iJob);
+
 private:
 	int m_iLastMouseX;
 	int m_iLastMouseY;
 
 	CFrustum m_oFrameFrustum;
+	Vector   m_vecSunlight;
+
+	// Every puff lives for the same amount of time, so they expire in the order
+	// they were created. Same for tracers.
+	std::deque<CPuff> m_aPuffs;
+	std::deque<CBulletTracer> m_aTracers;
+
+	CTimerWheel m_oTimers;
+	size_t      m_iPendingRespawns;
 
-	vector<CPuff> m_aPuffs;
-	vector<CBulletTracer> m_aTracers;
+	CBehaviorScheduler m_oBehaviors;
+	size_t      m_iMonsters;
+
+	CWorld      m_oWorld;
+	CTerrain    m_oTerrain;
+
+	bool        m_bDedicatedServer;
+	bool        m_bClient;
+	CGameServer m_oServer;
+	CGameClient m_oClient;
+	CClientInput m_oClientInput;
+
+	CWorldStream m_oWorldStream;
 
 	size_t m_iMonsterTexture;
 	size_t m_iCrateTexture;
 
 	CCharacter*              m_apEntityList[MAX_CHARACTERS];
+	std::vector<size_t>      m_aiFreeEntitySlots;
+
+	// Characters that have been removed. Their memory gets reused for the next ones created.
+	std::vector<CCharacter*> m_apCharacterPool;
+
+	// Every drawable character lives in one of these. Changes get written to the
+	// journal as they happen and applied once at the start of the next frame.
+	CRenderSet               m_oRenderOpaqueSet;
+	CRenderSet               m_oRenderTransparentSet;
+	// Opaque characters that don't move go here instead, so that they don't all get tested every frame.
+	CRenderTree              m_oRenderStaticTree;
+	std::vector<size_t>      m_aiRenderJournal;
+	std::vector<size_t>      m_aiRenderJournalApplying;
+
+	// What survived culling this frame.
 	std::vector<CCharacter*> m_apRenderOpaqueList;
 	std::vector<CCharacter*> m_apRenderTransparentList;
+	CDepthSort               m_oTransparentSort;
+
+	// Culling and recording character draws are split up between these. Only the GL thread
+	// talks to GL. Jobs are kept from frame to frame so their memory gets reused.
+	CWorkerPool              m_oRenderWorkers;
+	std::vector<CCullJob>    m_aCullJobs;
+	size_t                   m_iCullJobs;
+	std::vector<CRecordJob>  m_aRecordJobs;
+	size_t                   m_iRecordJobs;
+	float                    m_flCharacterRecordTime;   // This frame, in seconds
+	size_t                   m_iInstanceBytesUploaded;  // This frame
+
+	// In the frustum but behind something when we last looked. They aren't drawn, but they're still
+	// checked every frame to see if they've come out.
+	std::vector<CCharacter*> m_apRenderOccludedList;
+	COcclusionQueries        m_oOcclusionQueries;   // One for each entity index
+	size_t                   m_iOcclusionFrame;
+
+	// Kept from frame to frame so that only instances that changed get uploaded again.
+	std::vector<CInstanceGroup> m_aInstanceGroups;
+	std::vector<CInstanceGroup> m_aWeightedInstanceGroups;   // Transparent ones, for weighted transparency
+
+	// Transparent characters get added up in here in any order, and then put on the screen all at once.
+	CFrameBuffer                m_oWeightedBuffer;
+
+	// Filled in again for each pass.
+	std::vector<CSpriteGroup>   m_aSpriteGroups;
+
+	CRenderQueue             m_oRenderOpaqueQueue;
+	CRenderQueue             m_oRenderTransparentQueue;
 
 	// This is the player character
 	CHandle m_hPlayer;
-
-	size_t m_iMeshVB;
-	size_t m_iMeshSize;
 };
 
 inline CGame* Game()
@@ -36,15 +36,27 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 
 #include <renderer/renderer.h>
 #include <renderer/renderingcontext.h>
+#include <renderer/shaders.h>
+#include <renderer/uniformblocks.h>
 
 #include "character.h"
 
+extern int g_instanced_characters;
+extern int g_batched_sprites;
+extern int g_occlusion_culling;
+extern int g_weighted_transparency;
+
 void CGame::MakePuff(const Point& p)
 {
 	m_aPuffs.push_back(CPuff());
 
 	m_aPuffs.back().vecOrigin = p;
 	m_aPuffs.back().flTimeCreated = GetTime();
+
+	m_oTimers.Schedule(nullptr, PUFF_LIFETIME, &CGame::ExpirePuff);
+
+	if (m_bDedicatedServer)
+		m_oServer.AddPuff(p);
 }
 
 void CGame::MakeBulletTracer(const Point& s, const Point& e)
@@ -54,6 +66,24 @@ void CGame::MakeBulletTracer(const Point& s, const Point& e)
 	m_aTracers.back().vecStart = s;
 	m_aTracers.back().vecEnd = e;
 	m_aTracers.back().flTimeCreated = GetTime();
+
+	m_oTimers.Schedule(nullptr, TRACER_LIFETIME, &CGame::ExpireTracer);
+
+	if (m_bDedicatedServer)
+		m_oServer.AddTracer(s, e);
+}
+
+// Puffs all have the same lifetime so the one expiring is always the oldest.
+void CGame::ExpirePuff(CCharacter* pCharacter, size_t iData)
+{
+	TAssert(Game()->m_aPuffs.size());
+	Game()->m_aPuffs.pop_front();
+}
+
+void CGame::ExpireTracer(CCharacter* pCharacter, size_t iData)
+{
+	TAssert(Game()->m_aTracers.size());
+	Game()->m_aTracers.pop_front();
 }
 
 // This method is called every time the player moves the mouse
@@ -101,24 +131,11 @@ bool CGame::MouseInput(int iButton, tinker_mouse_state_t iState)
 {
 	if (iButton == TINKER_KEY_MOUSE_LEFT && iState == TINKER_MOUSE_PRESSED)
 	{
-		Vector v0 = m_hPlayer->GetGlobalOrigin() + Vector(0, 1, 0);
-		Vector v1 = m_hPlayer->GetGlobalOrigin() + Vector(0, 1, 0) + m_hPlayer->GetGlobalView() * 100;
-
-		Vector vecIntersection;
-		CCharacter* pHit = nullptr;
-		if (TraceLine(v0, v1, vecIntersection, pHit))
-		{
-			MakePuff(vecIntersection);
-			MakeBulletTracer(v0, vecIntersection);
-
-			if (pHit)
-			{
-				pHit->m_flShotTime = Game()->GetTime();
-				pHit->TakeDamage(1);
-			}
-		}
+		// The server does the shooting for a client.
+		if (m_bClient)
+			m_oClient.QueueShot();
 		else
-			MakeBulletTracer(v0, v1);
+			Shoot();
 
 		return true;
 	}
@@ -126,6 +143,35 @@ bool CGame::MouseInput(int iButton, tinker_mouse_state_t iState)
 	return false;
 }
 
+void CGame::Shoot()
+{
+	if (!m_hPlayer)
+		return;
+
+	Vector v0 = m_hPlayer->GetGlobalOrigin() + Vector(0, 1, 0);
+	Vector v1 = m_hPlayer->GetGlobalOrigin() + Vector(0, 1, 0) + m_hPlayer->GetGlobalView() * 100;
+
+	Vector vecIntersection;
+	CCharacter* pHit = nullptr;
+	if (TraceLine(v0, v1, vecIntersection, pHit))
+	{
+		MakePuff(vecIntersection);
+		MakeBulletTracer(v0, vecIntersection);
+
+		if (pHit)
+		{
+			pHit->StartShotEffect();
+
+			if (m_bDedicatedServer)
+				m_oServer.AddShot(pHit);
+
+			pHit->TakeDamage(1);
+		}
+	}
+	else
+		MakeBulletTracer(v0, v1);
+}
+
 // Trace a line through the world to simulate, eg, a bullet http://www.youtube.com/watch?v=USjbg5QXk3g
 bool CGame::TraceLine(const Vector& v0, const Vector& v1, Vector& vecIntersection, CCharacter*& pHit)
 {
@@ -160,9 +206,8 @@ bool CGame::TraceLine(const Vector& v0, const Vector& v1, Vector& vecIntersectio
 		}
 	}
 
-	// Intersect with the floor.
-	// Line-Plane Intersection algorithm: http://youtu.be/fIu_8b2n8ZM
-	if (LinePlaneIntersection(Vector(0, 1, 0), Vector(0, 0, 0), v0, v1, vecTestIntersection, flTestFraction) && flTestFraction < flLowestFraction)
+	// Intersect with the ground.
+	if (CTerrain::TraceLine(v0, v1, vecTestIntersection, flTestFraction) && flTestFraction < flLowestFraction)
 	{
 		vecIntersection = vecTestIntersection;
 		flLowestFraction = flTestFraction;
@@ -185,8 +230,10 @@ void CGame::Draw()
 
 	CRenderer* pRenderer = GetRenderer();
 
-	// Tell the renderer how to set up the camera.
-	pRenderer->SetCameraPosition(m_hPlayer->GetGlobalOrigin() - vecForward * 6 + vecUp * 3 - vecRight * 0.5f);
+	// Tell the renderer how to set up the camera. Keep it from going into the hills behind the player.
+	Vector vecCamera = m_hPlayer->GetGlobalOrigin() - vecForward * 6 + vecUp * 3 - vecRight * 0.5f;
+	vecCamera.y = std::max(vecCamera.y, CTerrain::GetHeight(vecCamera.x, vecCamera.z) + 0.5f);
+	pRenderer->SetCameraPosition(vecCamera);
 	pRenderer->SetCameraDirection(vecForward);
 	pRenderer->SetCameraUp(Vector(0, 1, 0));
 	pRenderer->SetCameraFOV(90);
@@ -211,63 +258,46 @@ void CGame::Draw()
 	r.UseProgram("model");
 
 	// Set the sunlight direction. The y component is -1 so the light is pointing down.
-	Vector vecSunlight = Vector(1, -1, 1).Normalized();
+	m_vecSunlight = Vector(1, -1, 1).Normalized();
 
 	// Uncomment this code to make the sunlight rotate:
-	//Vector vecSunlight = Vector(cos(Game()->GetTime()), -1, sin(Game()->GetTime())).Normalized();
+	//m_vecSunlight = Vector(cos(Game()->GetTime()), -1, sin(Game()->GetTime())).Normalized();
 
-	r.SetUniform("vecSunlight", vecSunlight);
+	// The camera, the sun and the fog are the same for every program, so they're sent once for all of them.
+	SetFrameUniforms();
 
-	r.SetUniform("bLighted", false);
 	r.SetUniform("bDiffuse", false);
+	r.SetUniform("bLighted", true);
 
-	// Render the ground.
-	r.SetUniform("vecColor", Vector4D(0.6f, 0.7f, 0.9f, 1));
-	r.SetUniform("vecCameraPosition", GetRenderer()->GetCameraPosition());
-	r.BeginRenderTriFan();
-	r.Normal(Vector(0, 1, 0));
-	r.Tangent(Vector(1, 0, 0));
-	r.Bitangent(Vector(0, 0, 1));
-	r.TexCoord(Vector2D(0, 1));
-	r.Vertex(Vector(-30, 0, -30));
-	r.TexCoord(Vector2D(0, 0));
-	r.Vertex(Vector(-30, 0, 30));
-	r.TexCoord(Vector2D(1, 0));
-	r.Vertex(Vector(30, 0, 30));
-	r.TexCoord(Vector2D(1, 1));
-	r.Vertex(Vector(30, 0, -30));
-	r.EndRender();
+	// Render the ground. Light it, or you can't see the hills.
+	{
+		CRenderingContext c(pRenderer, true);
 
-	r.SetUniform("bLighted", true);
+		c.SetUniform("vecColor", Vector4D(0.6f, 0.7f, 0.9f, 1));
+		m_oTerrain.Draw(&c, m_oFrameFrustum, GetRenderer()->GetCameraPosition());
+	}
 
-	// Prepare a list of entities to render.
-	m_apRenderOpaqueList.clear();
-	m_apRenderTransparentList.clear();
+	float flRenderListStart = GetTime();
 
-	for (size_t i = 0; i < MAX_CHARACTERS; i++)
-	{
-		CCharacter* pCharacter = GetCharacterIndex(i);
-		if (!pCharacter)
-			continue;
+	// Bring the render sets up to date with whatever changed since last frame.
+	ApplyRenderJournal();
 
-		// We need to scale the AABB using the character's scale values before we can use it to calculate our center/radius.
-		AABB aabbSizeWithScaling = pCharacter->m_aabbSize * pCharacter->m_vecScaling;
-		Vector vecCharacterCenter = pCharacter->GetGlobalOrigin() + aabbSizeWithScaling.GetCenter();
-		float flCharacterRadius = aabbSizeWithScaling.GetRadius();
+	// Prepare a list of entities to render.
+	CullRenderSets();
+	SelectLODs();
+	CullOccluded();
 
-		// If the entity is outside the viewing frustum then the player can't see it - don't draw it.
-		// http://youtu.be/4p-E_31XOPM
-		if (!m_oFrameFrustum.SphereIntersection(vecCharacterCenter, flCharacterRadius))
-			continue;
+	// In milliseconds.
+	vb_data_send_float_s("Render list time", (GetTime() - flRenderListStart) * 1000);
 
-		if (pCharacter->m_bDrawTransparent)
-			m_apRenderTransparentList.push_back(pCharacter);
-		else
-			m_apRenderOpaqueList.push_back(pCharacter);
-	}
+	m_flCharacterRecordTime = 0;
+	m_iInstanceBytesUploaded = 0;
 
 	// Draw all opaque characters first.
-	DrawCharacters(m_apRenderOpaqueList, false);
+	size_t iCharacterDrawCalls = DrawCharacters(m_apRenderOpaqueList, false);
+
+	// Now that everything that can hide something is in the depth buffer.
+	IssueOcclusionQueries();
 
 	for (size_t i = 0; i < MAX_CHARACTERS; i++)
 	{
@@ -288,51 +318,61 @@ void CGame::Draw()
 		r.RenderBox(vecIndicatorOrigin - Vector(1, 1, 1)*flBoxSize, vecIndicatorOrigin + Vector(1, 1, 1)*flBoxSize);
 	}
 
-	// Sort the transparent render list so that we paint the items farther from the camera first. http://youtu.be/fEjZrwDKdi8
-	MergeSortTransparentRenderList();
+	if (g_weighted_transparency && SetupWeightedTransparency())
+	{
+		// Transparent characters in whatever order they're in, batched like the opaque ones.
+		iCharacterDrawCalls += DrawWeightedTransparency(m_apRenderTransparentList);
+	}
+	else
+	{
+		// Sort the transparent render list so that we paint the items farther from the camera first. http://youtu.be/fEjZrwDKdi8
+		SortTransparentRenderList();
+
+		// Now draw all transparent characters, sorted by distance from the camera.
+		iCharacterDrawCalls += DrawCharacters(m_apRenderTransparentList, true);
+	}
 
-	// Now draw all transparent characters, sorted by distance from the camera.
-	DrawCharacters(m_apRenderTransparentList, true);
+	vb_data_send_float_s("Character draw calls", (float)iCharacterDrawCalls);
+	vb_data_send_float_s("Instance data uploaded", (float)m_iInstanceBytesUploaded);
+	vb_data_send_float_s("Character record time", m_flCharacterRecordTime * 1000);
+	vb_data_send_float_s("Character state changes unsorted", (float)(m_oRenderOpaqueQueue.GetStateChangesSubmitted() + m_oRenderTransparentQueue.GetStateChangesSubmitted()));
+	vb_data_send_float_s("Character state changes sorted", (float)(m_oRenderOpaqueQueue.GetStateChangesSorted() + m_oRenderTransparentQueue.GetStateChangesSorted()));
 
 	r.SetUniform("bDiffuse", false);
 
-	// Render any bullet tracers that may have been created.
-	float flBulletTracerTime = 0.1f;
-	for (size_t i = 0; i < Game()->GetTracers().size(); i++)
+	// Render any bullet tracers that may have been created. Expired ones have already been removed by their timers.
+	// They're all the same color, so they all go in one draw.
+	if (Game()->GetTracers().size())
 	{
-		if (Game()->GetTime() < Game()->GetTracers()[i].flTimeCreated + flBulletTracerTime)
+		typedef CVertexFormat<VertexPosition, VertexNormal> CTracerFormat;
+
+		r.SetUniform("vecColor", Vector4D(1, 0.9f, 0, 1));
+
+		CVertexWriter<CTracerFormat> oWriter = r.BeginRenderFormat<CTracerFormat>(PRIMITIVE_LINES, Game()->GetTracers().size()*2);
+		for (size_t i = 0; i < Game()->GetTracers().size(); i++)
 		{
-			Vector vecStart = Game()->GetTracers()[i].vecStart;
-			Vector vecEnd = Game()->GetTracers()[i].vecEnd;
-
-			r.SetUniform("vecColor", Vector4D(1, 0.9f, 0, 1));
-			r.BeginRenderLines();
-			r.Normal(Vector(0, 1, 0));
-			r.Vertex(vecStart);
-			r.Vertex(vecEnd);
-			r.EndRender();
+			oWriter.Vertex(Game()->GetTracers()[i].vecStart, Vector(0, 1, 0));
+			oWriter.Vertex(Game()->GetTracers()[i].vecEnd, Vector(0, 1, 0));
 		}
+		r.EndRenderFormat();
 	}
 
 	// Render any puffs that may have been created.
-	float flPuffTime = 0.3f;
 	for (size_t i = 0; i < Game()->GetPuffs().size(); i++)
 	{
-		if (Game()->GetTime() < Game()->GetPuffs()[i].flTimeCreated + flPuffTime)
-		{
-			float flTimeCreated = Game()->GetPuffs()[i].flTimeCreated;
-			float flTimeOver = Game()->GetPuffs()[i].flTimeCreated + flPuffTime;
-			float flStartSize = 0.2f;
-			float flEndSize = 2.0f;
+		float flTimeCreated = Game()->GetPuffs()[i].flTimeCreated;
+		float flTimeOver = Game()->GetPuffs()[i].flTimeCreated + PUFF_LIFETIME;
+		float flStartSize = 0.2f;
+		float flEndSize = 2.0f;
 
-			float flSize = Remap(Game()->GetTime(), flTimeCreated, flTimeOver, flStartSize, flEndSize);
+		// Timers fire on tick boundaries so a puff can be a hair past its lifetime. Clamp it.
+		float flSize = RemapClamp(Game()->GetTime(), flTimeCreated, flTimeOver, flStartSize, flEndSize);
 
-			Vector vecOrigin = Game()->GetPuffs()[i].vecOrigin;
+		Vector vecOrigin = Game()->GetPuffs()[i].vecOrigin;
 
-			int iOrange = (int)Remap(Game()->GetTime(), flTimeCreated, flTimeOver, 0, 255);
-			r.SetUniform("vecColor", Color(255, iOrange, 0, 255));
-			r.RenderBox(vecOrigin - Vector(1, 1, 1)*flSize, vecOrigin + Vector(1, 1, 1)*flSize);
-		}
+		int iOrange = (int)RemapClamp(Game()->GetTime(), flTimeCreated, flTimeOver, 0, 255);
+		r.SetUniform("vecColor", Color(255, iOrange, 0, 255));
+		r.RenderBox(vecOrigin - Vector(1, 1, 1)*flSize, vecOrigin + Vector(1, 1, 1)*flSize);
 	}
 
 	pRenderer->FinishRendering(&r);
@@ -341,197 +381,969 @@ void CGame::Draw()
 	Application()->SwapBuffers();
 }
 
-void CGame::DrawCharacters(const std::vector<CCharacter*>& apRenderList, bool bTransparent)
+void CGame::MarkRenderDirty(CCharacter* pCharacter)
 {
-	CRenderer* pRenderer = GetRenderer();
+	// Nothing ever gets drawn, so nothing would ever empty the journal.
+	if (m_bDedicatedServer)
+		return;
 
-	// Loop through all characters, render them one at a time.
-	// Start at the back of the list so that transparent entities use the painter's algorithm.
-	for (size_t i = apRenderList.size() - 1; i < apRenderList.size(); i--)
+	if (pCharacter->m_bRenderDirty)
+		return;
+
+	pCharacter->m_bRenderDirty = true;
+	m_aiRenderJournal.push_back(pCharacter->m_iIndex);
+}
+
+// Go through everything that changed since last frame and update its spot in the render sets.
+void CGame::ApplyRenderJournal()
+{
+	m_aiRenderJournalApplying.swap(m_aiRenderJournal);
+	m_aiRenderJournal.clear();
+
+	for (size_t i = 0; i < m_aiRenderJournalApplying.size(); i++)
 	{
-		CCharacter* pCharacter = apRenderList[i];
+		CCharacter* pCharacter = GetCharacterIndex(m_aiRenderJournalApplying[i]);
 
-		CRenderingContext c(pRenderer, true);
+		// Removed since, or it's somebody new in the same spot and we've done him already.
+		if (!pCharacter || !pCharacter->m_bRenderDirty)
+			continue;
 
-		c.SetBlend(BLEND_NONE);
-		c.SetAlpha(1);
+		pCharacter->m_bRenderDirty = false;
 
-		// Set the color of the box to be rendered.
-		c.SetUniform("vecColor", pCharacter->m_clrRender);
+		AABB aabbBounds = pCharacter->GetRenderBounds();
+		bool bStatic = pCharacter->m_bStatic && !pCharacter->m_bDrawTransparent;
 
-		if (pCharacter->m_iBillboardTexture)
+		// Switched between opaque and transparent, move him over. Nothing in the static tree
+		// can be updated in place, so it comes out and goes back in at the end.
+		if (pCharacter->m_iRenderSlot != ~0 && (pCharacter->m_bRenderStatic || bStatic || pCharacter->m_bRenderTransparent != pCharacter->m_bDrawTransparent))
+			RemoveFromRenderSet(pCharacter);
+
+		if (bStatic)
 		{
-			c.SetBackCulling(false);
-			c.SetUniform("bDiffuse", true);
+			pCharacter->m_iRenderSlot = m_oRenderStaticTree.Add(pCharacter, aabbBounds);
+			pCharacter->m_bRenderTransparent = false;
+			pCharacter->m_bRenderStatic = true;
+			continue;
+		}
 
-			// Create a billboard by creating basis vectors. https://www.youtube.com/watch?v=puOTwCrEm7Q
-			Vector vecForward, vecRight, vecUp;
-			vecForward = pCharacter->GetGlobalOrigin() - pRenderer->GetCameraPosition();
-			vecRight = -Vector(0, 1, 0).Cross(vecForward).Normalized();
-			vecUp = vecForward.Cross(-vecRight).Normalized();
+		CRenderSet& oSet = pCharacter->m_bDrawTransparent ? m_oRenderTransparentSet : m_oRenderOpaqueSet;
+
+		if (pCharacter->m_iRenderSlot == ~0)
+		{
+			pCharacter->m_iRenderSlot = oSet.Add(pCharacter, aabbBounds);
+			pCharacter->m_bRenderTransparent = pCharacter->m_bDrawTransparent;
+			pCharacter->m_bRenderStatic = false;
+		}
+		else
+			oSet.Update(pCharacter->m_iRenderSlot, aabbBounds);
+
+		// We don't hear about it when a move parent moves, so look at these again next frame.
+		if (pCharacter->HasMoveParent())
+			MarkRenderDirty(pCharacter);
+	}
+
+	m_aiRenderJournalApplying.clear();
+}
+
+void CGame::RemoveFromRenderSet(CCharacter* pCharacter)
+{
+	if (pCharacter->m_iRenderSlot == ~0)
+		return;
+
+	if (pCharacter->m_bRenderStatic)
+		m_oRenderStaticTree.Remove(pCharacter->m_iRenderSlot);
+	else if (pCharacter->m_bRenderTransparent)
+		m_oRenderTransparentSet.Remove(pCharacter->m_iRenderSlot);
+	else
+		m_oRenderOpaqueSet.Remove(pCharacter->m_iRenderSlot);
+
+	pCharacter->m_iRenderSlot = ~0;
+}
+
+// Render queue payloads below this are character indices. The rest are instance groups and then sprite groups.
+#define INSTANCE_GROUP_PAYLOAD MAX_CHARACTERS
+#define SPRITE_GROUP_PAYLOAD   (2*MAX_CHARACTERS)
+
+// How much goes in each worker job. Small enough that there's a few jobs per thread when
+// there's a lot to do, so that one slow job doesn't hold everybody else up.
+#define CULL_JOB_SLOTS     4096
+#define RECORD_JOB_PACKETS 512
+
+// What RecordJob() needs to know about the frame.
+class CRecordFrame
+{
+public:
+	CGame*              m_pGame;
+	const CRenderQueue* m_pQueue;
+	CShader*            m_pShader;
+	size_t              m_iColorUniform;
+	size_t              m_iDiffuseUniform;
+	Vector              m_vecCamera;
+};
+
+void CGame::CullRenderSets()
+{
+	// Cut both sets up into slices and cull them all at once.
+	m_iCullJobs = 0;
+
+	const CRenderSet* apSets[2] = { &m_oRenderOpaqueSet, &m_oRenderTransparentSet };
+	for (size_t i = 0; i < 2; i++)
+	{
+		for (size_t iFirst = 0; iFirst < apSets[i]->GetSize(); iFirst += CULL_JOB_SLOTS)
+		{
+			if (m_aCullJobs.size() <= m_iCullJobs)
+				m_aCullJobs.resize(m_iCullJobs+1);
 
-			if (pCharacter->m_bDrawTransparent)
+			CCullJob& oJob = m_aCullJobs[m_iCullJobs++];
+			oJob.m_pSet = apSets[i];
+			oJob.m_iFirst = iFirst;
+			oJob.m_iLast = std::min(iFirst + CULL_JOB_SLOTS, apSets[i]->GetSize());
+		}
+	}
+
+	// The static tree is one job. Walking down it only costs as much as what's visible.
+	m_oRenderStaticTree.Build();
+
+	if (m_aCullJobs.size() <= m_iCullJobs)
+		m_aCullJobs.resize(m_iCullJobs+1);
+
+	m_aCullJobs[m_iCullJobs++].m_pSet = nullptr;
+
+	m_oRenderWorkers.Run(m_iCullJobs, &CGame::CullJob, this);
+
+	// Put the slices back together in order, so the lists come out the same as culling them in one go.
+	m_apRenderOpaqueList.clear();
+	m_apRenderTransparentList.clear();
+
+	for (size_t i = 0; i < m_iCullJobs; i++)
+	{
+		const CCullJob& oJob = m_aCullJobs[i];
+		std::vector<CCharacter*>& apList = (oJob.m_pSet == &m_oRenderTransparentSet) ? m_apRenderTransparentList : m_apRenderOpaqueList;
+		apList.insert(apList.end(), oJob.m_apVisible.begin(), oJob.m_apVisible.end());
+	}
+}
+
+void CGame::SetFrameUniforms()
+{
+	CUniformBlocks::SetFrame(GetRenderer()->GetCameraPosition(), GetTime(), m_vecSunlight, FOG_MIN, FOG_MAX, FOG_COLOR);
+}
+
+// Drop whatever is so far into the fog that it would come out the color of the fog anyway,
+// and pick how to draw the rest.
+void CGame::SelectLODs()
+{
+	Vector vecCamera = GetRenderer()->GetCameraPosition();
+
+	size_t aiLODs[LOD_TOTAL] = {};
+	size_t iFogged = 0;
+
+	std::vector<CCharacter*>* apLists[2] = { &m_apRenderOpaqueList, &m_apRenderTransparentList };
+	for (size_t i = 0; i < 2; i++)
+	{
+		std::vector<CCharacter*>& apList = *apLists[i];
+
+		size_t iKept = 0;
+		for (size_t j = 0; j < apList.size(); j++)
+		{
+			CCharacter* pCharacter = apList[j];
+
+			AABB aabbBounds = pCharacter->GetRenderBounds();
+			float flDistance = (aabbBounds.GetCenter() - vecCamera).Length();
+
+			if (flDistance - aabbBounds.GetRadius() > FOG_MAX)
 			{
-				c.SetAlpha(0.6f);
-				c.SetBlend(BLEND_ALPHA);
+				iFogged++;
+				continue;
 			}
 
-			c.LoadTransform(pCharacter->GetGlobalTransform());
-			c.Translate(Vector(0, pCharacter->m_aabbSize.GetHeight() / 2, 0)); // Move the character up so his feet don't stick in the ground.
-			pCharacter->ShotEffect(&c);
-			c.RenderBillboard(pCharacter->m_iBillboardTexture, pCharacter->m_aabbSize.vecMax.x, vecUp, vecRight);
+			if (pCharacter->m_eLOD == LOD_FULL && flDistance > LOD_IMPOSTOR_DISTANCE + LOD_HYSTERESIS)
+				pCharacter->m_eLOD = LOD_IMPOSTOR;
+			else if (pCharacter->m_eLOD == LOD_IMPOSTOR && flDistance < LOD_IMPOSTOR_DISTANCE - LOD_HYSTERESIS)
+				pCharacter->m_eLOD = LOD_FULL;
+
+			aiLODs[pCharacter->m_eLOD]++;
+
+			apList[iKept++] = pCharacter;
 		}
-		else
-		{
-			c.SetUniform("bDiffuse", false);
 
-			// The transform matrix holds all transformations for the player. Just pass it through to the renderer.
-			// http://youtu.be/7pe1xYzFCvA
-			c.Transform(pCharacter->GetGlobalTransform());
+		apList.resize(iKept);
+	}
 
-			if (pCharacter->m_bDrawTransparent)
+	vb_data_send_float_s("LOD full", (float)aiLODs[LOD_FULL]);
+	vb_data_send_float_s("LOD impostor", (float)aiLODs[LOD_IMPOSTOR]);
+	vb_data_send_float_s("LOD fogged out", (float)iFogged);
+}
+
+// An occluded character has to come back occluded this many times in a row before it's hidden, so
+// that anything right on the edge doesn't flicker. It's shown again as soon as one comes back visible.
+#define OCCLUSION_HIDE_RESULTS     3
+
+// Hidden characters get checked every frame. Ones that are showing only get checked every this many
+// frames, spread out so that about the same number get checked each frame.
+#define OCCLUSION_VISIBLE_INTERVAL 4
+
+// Take whatever is hidden behind something out of the render lists, going by the occlusion queries
+// from earlier frames. Nothing waits for a query. Ones that aren't back yet keep what we had.
+void CGame::CullOccluded()
+{
+	m_iOcclusionFrame++;
+	m_apRenderOccludedList.clear();
+
+	if (!g_occlusion_culling)
+		return;
+
+	if (m_oOcclusionQueries.GetNumQueries() < MAX_CHARACTERS)
+		m_oOcclusionQueries.SetNumQueries(MAX_CHARACTERS);
+
+	std::vector<CCharacter*>* apLists[2] = { &m_apRenderOpaqueList, &m_apRenderTransparentList };
+	for (size_t i = 0; i < 2; i++)
+	{
+		std::vector<CCharacter*>& apList = *apLists[i];
+
+		size_t iKept = 0;
+		for (size_t j = 0; j < apList.size(); j++)
+		{
+			CCharacter* pCharacter = apList[j];
+
+			// It wasn't in view last frame, so whatever we knew about it is out of date.
+			if (pCharacter->m_iOcclusionFrame != m_iOcclusionFrame-1)
 			{
-				c.SetAlpha(0.6f);
-				c.SetBlend(BLEND_ALPHA);
+				m_oOcclusionQueries.Discard(pCharacter->m_iIndex);
+				pCharacter->m_bOccluded = false;
+				pCharacter->m_iOccludedResults = 0;
 			}
 
-			if (pCharacter->m_iTexture)
+			pCharacter->m_iOcclusionFrame = m_iOcclusionFrame;
+
+			bool bVisible;
+			if (m_oOcclusionQueries.GetResult(pCharacter->m_iIndex, bVisible))
 			{
-				c.SetUniform("bDiffuse", true);
-				c.BindTexture(pCharacter->m_iTexture);
+				if (bVisible)
+				{
+					pCharacter->m_bOccluded = false;
+					pCharacter->m_iOccludedResults = 0;
+				}
+				else if (++pCharacter->m_iOccludedResults >= OCCLUSION_HIDE_RESULTS)
+				{
+					pCharacter->m_bOccluded = true;
+					pCharacter->m_iOccludedResults = OCCLUSION_HIDE_RESULTS;
+				}
 			}
 
-			// Render the player-box
-			c.RenderBox(pCharacter->m_aabbSize.vecMin, pCharacter->m_aabbSize.vecMax);
+			if (pCharacter->m_bOccluded)
+				m_apRenderOccludedList.push_back(pCharacter);
+			else
+				apList[iKept++] = pCharacter;
 		}
+
+		apList.resize(iKept);
 	}
+
+	vb_data_send_float_s("Occlusion culled", (float)m_apRenderOccludedList.size());
 }
 
-// Sort our render list using the divide and conquer technique knows as Merge Sort.
-// http://youtu.be/fEjZrwDKdi8
-void MergeSortRenderSubList(std::vector<CCharacter*>& apRenderList, size_t iStart, size_t iEnd)
+// Draw the boxes of anything that needs checking, with nothing written anywhere, and count what
+// would have shown. The results get picked up by CullOccluded() a frame or so from now.
+void CGame::IssueOcclusionQueries()
 {
-	// iStart is the index of the first index that we are to sort. iEnd is the index+1 of the last index we are to sort.
-	size_t iLength = iEnd - iStart;
+	if (!g_occlusion_culling)
+		return;
+
+	CRenderingContext c(GetRenderer(), true);
+
+	c.SetDepthMask(false);
+	// A character that was just drawn is right where its box is, so let those through.
+	c.SetDepthFunction(DF_LEQUAL);
 
-	if (iLength <= 1)
+	Vector vecCamera = GetRenderer()->GetCameraPosition();
+	// Close enough to the box for the near plane to cut into it.
+	Vector vecNear(0.5f, 0.5f, 0.5f);
+
+	m_oOcclusionQueries.BeginPass();
+
+	const std::vector<CCharacter*>* apLists[3] = { &m_apRenderOccludedList, &m_apRenderOpaqueList, &m_apRenderTransparentList };
+	for (size_t i = 0; i < 3; i++)
 	{
-		// We are in a base case of one item. We're sorted! Return.
-		return;
+		const std::vector<CCharacter*>& apList = *apLists[i];
+		bool bShowing = (i > 0);
+
+		for (size_t j = 0; j < apList.size(); j++)
+		{
+			CCharacter* pCharacter = apList[j];
+
+			if (bShowing && (pCharacter->m_iIndex + m_iOcclusionFrame) % OCCLUSION_VISIBLE_INTERVAL)
+				continue;
+
+			// Still waiting on the last one.
+			if (m_oOcclusionQueries.IsPending(pCharacter->m_iIndex))
+				continue;
+
+			AABB aabbBounds = pCharacter->GetRenderBounds();
+
+			// The box would get clipped away, but we're right on top of it so it's visible anyway.
+			if (vecCamera.x > aabbBounds.vecMin.x - vecNear.x && vecCamera.y > aabbBounds.vecMin.y - vecNear.y && vecCamera.z > aabbBounds.vecMin.z - vecNear.z &&
+				vecCamera.x < aabbBounds.vecMax.x + vecNear.x && vecCamera.y < aabbBounds.vecMax.y + vecNear.y && vecCamera.z < aabbBounds.vecMax.z + vecNear.z)
+			{
+				pCharacter->m_bOccluded = false;
+				pCharacter->m_iOccludedResults = 0;
+				continue;
+			}
+
+			// A little bigger, so that it isn't hidden by the character it's around.
+			Vector vecGrow = (aabbBounds.vecMax - aabbBounds.vecMin) * 0.01f + Vector(0.01f, 0.01f, 0.01f);
+
+			m_oOcclusionQueries.Begin(pCharacter->m_iIndex);
+			c.RenderBox(aabbBounds.vecMin - vecGrow, aabbBounds.vecMax + vecGrow);
+			m_oOcclusionQueries.End();
+		}
 	}
-	else if (iLength == 2)
-	{
-		// We are in a base case of two items. If the first one is bigger than the second, swap them.
-		float flLeftDistanceSqr = (apRenderList[iStart]->GetGlobalOrigin() - Game()->GetRenderer()->GetCameraPosition()).LengthSqr();
-		float flRightDistanceSqr = (apRenderList[iStart + 1]->GetGlobalOrigin() - Game()->GetRenderer()->GetCameraPosition()).LengthSqr();
 
-		// We can compare square distances just like regular distances, and they're faster to calculate. http://www.youtube.com/watch?v=DxmGxkhhluU
-		if (flLeftDistanceSqr > flRightDistanceSqr)
-			std::swap(apRenderList[iStart], apRenderList[iStart + 1]);
+	m_oOcclusionQueries.EndPass();
+
+	vb_data_send_float_s("Occlusion queries", (float)m_oOcclusionQueries.GetQueriesIssued());
+}
+
+void CGame::CullJob(void* pData, size_t iJob)
+{
+	CGame* pGame = (CGame*)pData;
+	CCullJob& oJob = pGame->m_aCullJobs[iJob];
+
+	oJob.m_apVisible.clear();
 
-		// Now we're sorted!
+	if (oJob.m_pSet)
+		oJob.m_pSet->Cull(pGame->m_oFrameFrustum, oJob.m_apVisible, oJob.m_iFirst, oJob.m_iLast);
+	else
+		pGame->m_oRenderStaticTree.Cull(pGame->m_oFrameFrustum, oJob.m_apVisible);
+}
+
+// Billboards, and boxes far enough away to be drawn as one, are drawn in the sprite groups when
+// sprites are batched. This is the texture they're drawn with, or 0 if it's drawn as a box.
+static size_t GetSpriteTexture(const CCharacter* pCharacter)
+{
+	if (pCharacter->m_iBillboardTexture)
+		return pCharacter->m_iBillboardTexture;
+
+	if (pCharacter->m_eLOD == LOD_IMPOSTOR)
+		return pCharacter->m_iTexture;
+
+	return 0;
+}
+
+// Runs on a worker. It works everything out and writes it into the job's command list, and
+// leaves GL alone. Anything that's the same as the last draw in the list isn't written again.
+void CGame::RecordJob(void* pData, size_t iJob)
+{
+	CRecordFrame* pFrame = (CRecordFrame*)pData;
+	CGame* pGame = pFrame->m_pGame;
+	CRecordJob& oJob = pGame->m_aRecordJobs[iJob];
+
+	if (oJob.m_iInstanceGroup != ~0 || oJob.m_iSpriteGroup != ~0)
 		return;
+
+	CCommandList& oCommands = oJob.m_oCommands;
+	oCommands.Clear();
+	oCommands.RecordProgram(pFrame->m_pShader);
+
+	// Each list is played back with culling on.
+	bool bCull = true;
+	Vector4D vecColor;
+	bool bColor = false;
+	int iDiffuse = -1;
+	size_t iBoundTexture = 0;
+
+	for (size_t i = oJob.m_iFirstPacket; i < oJob.m_iLastPacket; i++)
+	{
+		CCharacter* pCharacter = pGame->GetCharacterIndex(pFrame->m_pQueue->GetPacket(i).m_iPayload);
+
+		// Set the color of the box to be rendered.
+		Vector4D vecCharacterColor(pCharacter->m_clrRender);
+		if (!bColor || !(vecCharacterColor == vecColor))
+		{
+			oCommands.RecordUniform(pFrame->m_iColorUniform, vecCharacterColor);
+			vecColor = vecCharacterColor;
+			bColor = true;
+		}
+
+		bool bBillboard = !!pCharacter->m_iBillboardTexture;
+		size_t iTexture = bBillboard ? pCharacter->m_iBillboardTexture : pCharacter->m_iTexture;
+
+		// Billboards are seen from both sides.
+		if (bCull == bBillboard)
+		{
+			bCull = !bBillboard;
+			oCommands.RecordBackCulling(bCull);
+		}
+
+		if (iDiffuse != !!iTexture)
+		{
+			iDiffuse = !!iTexture;
+			oCommands.RecordUniform(pFrame->m_iDiffuseUniform, iDiffuse);
+		}
+
+		if (iTexture && iTexture != iBoundTexture)
+		{
+			oCommands.RecordTexture(iTexture);
+			iBoundTexture = iTexture;
+		}
+
+		if (bBillboard)
+		{
+			// Create a billboard by creating basis vectors. https://www.youtube.com/watch?v=puOTwCrEm7Q
+			Vector vecForward, vecRight, vecUp;
+			vecForward = pCharacter->GetGlobalOrigin() - pFrame->m_vecCamera;
+			vecRight = -Vector(0, 1, 0).Cross(vecForward).Normalized();
+			vecUp = vecForward.Cross(-vecRight).Normalized();
+
+			Matrix4x4 mTransform = pCharacter->GetGlobalTransform();
+			mTransform.AddTranslation(Vector(0, pCharacter->m_aabbSize.GetHeight() / 2, 0)); // Move the character up so his feet don't stick in the ground.
+			pCharacter->ShotEffect(mTransform);
+
+			// The same transform that RenderBillboard() would have made.
+			float flRadius = pCharacter->m_aabbSize.vecMax.x;
+			vecUp = vecUp * flRadius;
+			vecRight = vecRight * flRadius;
+			mTransform *= Matrix4x4(vecRight, vecUp, vecRight.Cross(vecUp));
+
+			oCommands.RecordMesh(MESH_QUAD, mTransform);
+		}
+		else
+		{
+			// The transform matrix holds all transformations for the player. Just pass it through to the renderer.
+			// http://youtu.be/7pe1xYzFCvA
+			// Then the same transform that RenderBox() would have made, the box mesh stretched over the AABB.
+			const AABB& aabbSize = pCharacter->m_aabbSize;
+			Matrix4x4 mBox;
+			mBox.SetScale(aabbSize.vecMax - aabbSize.vecMin);
+			mBox.SetTranslation(aabbSize.vecMin);
+
+			oCommands.RecordMesh(MESH_BOX, pCharacter->GetGlobalTransform() * mBox);
+		}
 	}
+}
 
-	// We aren't in a base case yet. Split the list in two.
-	size_t iMiddle = (iStart + iEnd) / 2;
+size_t CGame::DrawCharacters(const std::vector<CCharacter*>& apRenderList, bool bTransparent)
+{
+	CRenderer* pRenderer = GetRenderer();
+
+	// Draw() has the model shader going. Look these up once instead of by name for every character.
+	CShader* pShader = CShaderLibrary::GetShader("model");
+	size_t iColorUniform = pShader->FindUniform("vecColor");
+	size_t iDiffuseUniform = pShader->FindUniform("bDiffuse");
+
+	CShader* pInstancedShader = CShaderLibrary::GetShader("instanced");
+	size_t iInstancedDiffuseUniform = pInstancedShader ? pInstancedShader->FindUniform("bDiffuse") : ~0;
+
+	CShader* pSpriteShader = CShaderLibrary::GetShader("sprite");
+
+	// Transparent ones have to be drawn back to front one at a time, so only opaque boxes can be instanced.
+	bool bInstanced = !bTransparent && g_instanced_characters && pInstancedShader;
+
+	// Sprites within a batch are drawn in the order they're added, so transparent ones can be batched too.
+	// A whole batch sorts as one draw against everything else though.
+	bool bSprites = g_batched_sprites && pSpriteShader;
 
-	// Sort the two sub-lists by calling this function recursively.
-	MergeSortRenderSubList(apRenderList, iStart, iMiddle);
-	MergeSortRenderSubList(apRenderList, iMiddle, iEnd);
+	if (bInstanced)
+		UpdateInstanceGroups(m_aInstanceGroups, apRenderList, bSprites);
 
-	// Merge the two sub-lists together by plucking off the lowest element.
-	// First make a copy of the list.
-	std::vector<CCharacter*> apRenderListCopy = apRenderList;
+	if (bSprites)
+		UpdateSpriteGroups(apRenderList);
 
-	size_t iLeft = iStart;
-	size_t iRight = iMiddle;
-	size_t iOutput = iStart;
-	while (true)
+	// Everything goes into the queue first and gets drawn in the order it sorts into,
+	// which keeps draws with the same program and texture together.
+	CRenderQueue& oQueue = bTransparent ? m_oRenderTransparentQueue : m_oRenderOpaqueQueue;
+	oQueue.Clear();
+
+	Vector vecCamera = pRenderer->GetCameraPosition();
+	blendtype_t eBlend = bTransparent ? BLEND_ALPHA : BLEND_NONE;
+
+	// Submit from the back of the list, which is the order they used to be drawn in. Draws with
+	// the same key stay in submission order, so there's a fair comparison of state changes.
+	for (size_t i = apRenderList.size() - 1; i < apRenderList.size(); i--)
 	{
-		float flLeftDistanceSqr = (apRenderListCopy[iLeft]->GetGlobalOrigin() - Game()->GetRenderer()->GetCameraPosition()).LengthSqr();
-		float flRightDistanceSqr = 0;
-		if (iRight != iEnd)
-			flRightDistanceSqr = (apRenderListCopy[iRight]->GetGlobalOrigin() - Game()->GetRenderer()->GetCameraPosition()).LengthSqr();
+		CCharacter* pCharacter = apRenderList[i];
 
-		// We can compare square distances just like regular distances, and they're faster to calculate. http://www.youtube.com/watch?v=DxmGxkhhluU
-		bool bUseLeft = flLeftDistanceSqr < flRightDistanceSqr;
-		if (iRight == iEnd)
-			bUseLeft = true;
-		else if (iLeft == iMiddle)
-			bUseLeft = false;
+		// Drawn with its instance group.
+		if (bInstanced && !pCharacter->m_iBillboardTexture)
+			continue;
 
-		if (bUseLeft)
-			apRenderList[iOutput++] = apRenderListCopy[iLeft++];
+		// Drawn with its sprite group.
+		if (bSprites && GetSpriteTexture(pCharacter))
+			continue;
+
+		size_t iTexture = pCharacter->m_iBillboardTexture ? pCharacter->m_iBillboardTexture : pCharacter->m_iTexture;
+		float flDistance = (pCharacter->GetGlobalOrigin() - vecCamera).Length();
+
+		if (bTransparent)
+			oQueue.Submit(CRenderQueue::TransparentKey(pShader->m_iProgram, iTexture, eBlend, flDistance), pCharacter->m_iIndex);
 		else
-			apRenderList[iOutput++] = apRenderListCopy[iRight++];
+			oQueue.Submit(CRenderQueue::OpaqueKey(pShader->m_iProgram, iTexture, eBlend, flDistance), pCharacter->m_iIndex);
+	}
+
+	if (bInstanced)
+	{
+		for (size_t i = 0; i < m_aInstanceGroups.size(); i++)
+		{
+			if (m_aInstanceGroups[i].m_iInstances)
+				oQueue.Submit(CRenderQueue::OpaqueKey(pInstancedShader->m_iProgram, m_aInstanceGroups[i].m_iTexture, eBlend, 0), INSTANCE_GROUP_PAYLOAD + i);
+		}
+	}
+
+	if (bSprites)
+	{
+		for (size_t i = 0; i < m_aSpriteGroups.size(); i++)
+		{
+			const CSpriteGroup& oGroup = m_aSpriteGroups[i];
+			if (!oGroup.m_oSprites.GetNumSprites())
+				continue;
+
+			if (bTransparent)
+				oQueue.Submit(CRenderQueue::TransparentKey(pSpriteShader->m_iProgram, oGroup.m_iTexture, eBlend, oGroup.m_flDistance), SPRITE_GROUP_PAYLOAD + i);
+			else
+				oQueue.Submit(CRenderQueue::OpaqueKey(pSpriteShader->m_iProgram, oGroup.m_iTexture, eBlend, 0), SPRITE_GROUP_PAYLOAD + i);
+		}
+	}
+
+	oQueue.Sort();
+
+	float flRecordStart = GetTime();
+
+	// Split the sorted packets up into runs for the workers to record. Instance groups and sprite groups
+	// are drawn straight from their buffers, so each one is a job of its own that nobody records.
+	m_iRecordJobs = 0;
+	for (size_t i = 0; i < oQueue.GetNumPackets(); i++)
+	{
+		unsigned int iPayload = oQueue.GetPacket(i).m_iPayload;
+		bool bGroup = iPayload >= INSTANCE_GROUP_PAYLOAD;
+
+		CRecordJob* pLastJob = m_iRecordJobs ? &m_aRecordJobs[m_iRecordJobs-1] : nullptr;
+		if (!bGroup && pLastJob && pLastJob->m_iInstanceGroup == ~0 && pLastJob->m_iSpriteGroup == ~0 && pLastJob->m_iLastPacket - pLastJob->m_iFirstPacket < RECORD_JOB_PACKETS)
+		{
+			pLastJob->m_iLastPacket++;
+			continue;
+		}
+
+		if (m_aRecordJobs.size() <= m_iRecordJobs)
+			m_aRecordJobs.resize(m_iRecordJobs+1);
+
+		CRecordJob& oJob = m_aRecordJobs[m_iRecordJobs++];
+		oJob.m_iFirstPacket = i;
+		oJob.m_iLastPacket = i+1;
+		oJob.m_iInstanceGroup = (bGroup && iPayload < SPRITE_GROUP_PAYLOAD) ? iPayload - INSTANCE_GROUP_PAYLOAD : ~0;
+		oJob.m_iSpriteGroup = (iPayload >= SPRITE_GROUP_PAYLOAD) ? iPayload - SPRITE_GROUP_PAYLOAD : ~0;
+	}
+
+	CRecordFrame oFrame;
+	oFrame.m_pGame = this;
+	oFrame.m_pQueue = &oQueue;
+	oFrame.m_pShader = pShader;
+	oFrame.m_iColorUniform = iColorUniform;
+	oFrame.m_iDiffuseUniform = iDiffuseUniform;
+	oFrame.m_vecCamera = vecCamera;
 
-		// If we're reached the end of both sub-lists, break from the loop.
-		if (iLeft == iMiddle && iRight == iEnd)
-			break;
+	m_oRenderWorkers.Run(m_iRecordJobs, &CGame::RecordJob, &oFrame);
+
+	m_flCharacterRecordTime += GetTime() - flRecordStart;
+
+	// Everything from here on is the GL thread playing back what the workers made, in the same
+	// order that the queue sorted it into however many threads there are.
+	CRenderingContext c(pRenderer, true);
+
+	if (bInstanced)
+	{
+		// The instanced program is a variant of the model program, so it needs the same lighting.
+		c.UseProgram(pInstancedShader);
+		c.SetUniform("bLighted", true);
+		c.UseProgram(pShader);
+	}
+
+	if (bSprites)
+	{
+		// The sprite program is too, and it needs to know how fast to spin the sprites that were shot.
+		c.UseProgram(pSpriteShader);
+		c.SetUniform("bLighted", true);
+		c.SetUniform("flSpriteSpinSpeed", (float)SHOT_EFFECT_SPEED);
+		c.UseProgram(pShader);
 	}
 
-	// Our sub-list is sorted! Return.
+	c.SetBlend(eBlend);
+	c.SetAlpha(bTransparent ? 0.6f : 1);
+	c.SetBackCulling(true);
+
+	for (size_t i = 0; i < m_iRecordJobs; i++)
+	{
+		CRecordJob& oJob = m_aRecordJobs[i];
+
+		if (oJob.m_iSpriteGroup != ~0)
+		{
+			if (c.m_pShader != pSpriteShader)
+				c.UseProgram(pSpriteShader);
+
+			CRenderingContext::CStateScope oScope(&c);
+
+			// Billboards are seen from both sides.
+			c.SetBackCulling(false);
+
+			CSpriteGroup& oGroup = m_aSpriteGroups[oJob.m_iSpriteGroup];
+			c.BindTexture(oGroup.m_iTexture);
+			c.RenderSprites(oGroup.m_oSprites);
+			continue;
+		}
+
+		if (oJob.m_iInstanceGroup == ~0)
+		{
+			// Switch outside of the replay so that it doesn't switch back and forth between runs.
+			if (c.m_pShader != pShader)
+				c.UseProgram(pShader);
+
+			c.Replay(oJob.m_oCommands);
+			continue;
+		}
+
+		if (c.m_pShader != pInstancedShader)
+			c.UseProgram(pInstancedShader);
+
+		CRenderingContext::CStateScope oScope(&c);
+
+		CInstanceGroup& oGroup = m_aInstanceGroups[oJob.m_iInstanceGroup];
+
+		c.SetUniform(iInstancedDiffuseUniform, !!oGroup.m_iTexture);
+		if (oGroup.m_iTexture)
+			c.BindTexture(oGroup.m_iTexture);
+
+		c.RenderMeshInstanced(MESH_BOX, oGroup.m_oInstances);
+	}
+
+	return oQueue.GetNumPackets();
 }
 
-void CGame::MergeSortTransparentRenderList()
+void CGame::UpdateSpriteGroups(const std::vector<CCharacter*>& apRenderList)
 {
-	MergeSortRenderSubList(m_apRenderTransparentList, 0, m_apRenderTransparentList.size());
+	for (size_t i = 0; i < m_aSpriteGroups.size(); i++)
+	{
+		m_aSpriteGroups[i].m_oSprites.Clear();
+		m_aSpriteGroups[i].m_flDistance = 0;
+	}
+
+	Vector vecCamera = GetRenderer()->GetCameraPosition();
+
+	// Added from the back of the list, the order they'd have been submitted in. That keeps
+	// transparent ones back to front within their group.
+	size_t iGroup = ~0;
+	for (size_t i = apRenderList.size() - 1; i < apRenderList.size(); i--)
+	{
+		CCharacter* pCharacter = apRenderList[i];
+
+		size_t iTexture = GetSpriteTexture(pCharacter);
+		if (!iTexture)
+			continue;
+
+		// There's only ever a few textures, and neighbors in the list usually share one.
+		if (iGroup == ~0 || m_aSpriteGroups[iGroup].m_iTexture != iTexture)
+		{
+			iGroup = ~0;
+			for (size_t j = 0; j < m_aSpriteGroups.size(); j++)
+			{
+				if (m_aSpriteGroups[j].m_iTexture == iTexture)
+				{
+					iGroup = j;
+					break;
+				}
+			}
+
+			if (iGroup == ~0)
+			{
+				m_aSpriteGroups.push_back(CSpriteGroup());
+				iGroup = m_aSpriteGroups.size()-1;
+				m_aSpriteGroups[iGroup].m_iTexture = iTexture;
+				m_aSpriteGroups[iGroup].m_flDistance = 0;
+			}
+		}
+
+		CSpriteGroup& oGroup = m_aSpriteGroups[iGroup];
+
+		Vector vecCenter;
+		float flSize;
+		if (pCharacter->m_iBillboardTexture)
+		{
+			// Move the character up so his feet don't stick in the ground.
+			vecCenter = pCharacter->GetGlobalTransform() * Vector(0, pCharacter->m_aabbSize.GetHeight() / 2, 0);
+			flSize = pCharacter->m_aabbSize.vecMax.x;
+		}
+		else
+		{
+			// An impostor for a box, a square about as big as the box looks from here.
+			Vector vecSize = pCharacter->m_aabbSize.vecMax - pCharacter->m_aabbSize.vecMin;
+			vecCenter = pCharacter->GetGlobalTransform() * pCharacter->m_aabbSize.GetCenter();
+			flSize = std::max(std::max(vecSize.x, vecSize.z), vecSize.y) / 2;
+		}
+
+		oGroup.m_flDistance = std::max(oGroup.m_flDistance, (pCharacter->GetGlobalOrigin() - vecCamera).Length());
+		oGroup.m_oSprites.AddSprite(vecCenter, flSize, Vector4D(pCharacter->m_clrRender), pCharacter->m_flShotTime);
+	}
 }
 
-// Create a character and add him into our entity list.
-// Entity list explained here: http://youtu.be/V6vq0PRFKgk
-CCharacter* CGame::CreateCharacter()
+void CGame::UpdateInstanceGroups(std::vector<CInstanceGroup>& aGroups, const std::vector<CCharacter*>& apRenderList, bool bSprites)
 {
-	size_t iSpot = ~0;
+	for (size_t i = 0; i < aGroups.size(); i++)
+		aGroups[i].m_iInstances = 0;
 
-	// Find a spot in my entity list that's empty.
-	for (size_t i = 0; i < MAX_CHARACTERS; i++)
+	// Characters come out of the render set in the same order every frame, so most of them
+	// land in the same instance as last frame and don't need to be uploaded again.
+	size_t iGroup = ~0;
+	for (size_t i = 0; i < apRenderList.size(); i++)
 	{
-		if (!m_apEntityList[i])
+		CCharacter* pCharacter = apRenderList[i];
+
+		if (pCharacter->m_iBillboardTexture)
+			continue;
+
+		// Drawn with the sprite groups.
+		if (bSprites && GetSpriteTexture(pCharacter))
+			continue;
+
+		// There's only ever a few textures, and neighbors in the list usually share one.
+		if (iGroup == ~0 || aGroups[iGroup].m_iTexture != pCharacter->m_iTexture)
 		{
-			iSpot = i;
-			break;
+			iGroup = ~0;
+			for (size_t j = 0; j < aGroups.size(); j++)
+			{
+				if (aGroups[j].m_iTexture == pCharacter->m_iTexture)
+				{
+					iGroup = j;
+					break;
+				}
+			}
+
+			if (iGroup == ~0)
+			{
+				aGroups.push_back(CInstanceGroup());
+				iGroup = aGroups.size()-1;
+				aGroups[iGroup].m_iTexture = pCharacter->m_iTexture;
+				aGroups[iGroup].m_iInstances = 0;
+			}
 		}
+
+		CInstanceGroup& oGroup = aGroups[iGroup];
+
+		size_t iInstance = oGroup.m_iInstances++;
+		if (oGroup.m_oInstances.GetNumInstances() < oGroup.m_iInstances)
+			oGroup.m_oInstances.SetNumInstances(oGroup.m_iInstances);
+
+		// The same transform that RenderBox() would have made, the box mesh stretched over the AABB.
+		const AABB& aabbSize = pCharacter->m_aabbSize;
+		Matrix4x4 mBox;
+		mBox.SetScale(aabbSize.vecMax - aabbSize.vecMin);
+		mBox.SetTranslation(aabbSize.vecMin);
+
+		oGroup.m_oInstances.SetInstance(iInstance, pCharacter->GetGlobalTransform() * mBox, Vector4D(pCharacter->m_clrRender));
+	}
+
+	for (size_t i = 0; i < aGroups.size(); i++)
+	{
+		CInstanceGroup& oGroup = aGroups[i];
+
+		oGroup.m_oInstances.SetNumInstances(oGroup.m_iInstances);
+		oGroup.m_oInstances.Upload();
+		m_iInstanceBytesUploaded += oGroup.m_oInstances.GetBytesUploaded();
+	}
+}
+
+void CGame::SortTransparentRenderList()
+{
+	float flSortStart = GetTime();
+
+	m_oTransparentSort.Sort(m_apRenderTransparentList, GetRenderer()->GetCameraPosition());
+
+	// In milliseconds.
+	vb_data_send_float_s("Transparent sort time", (GetTime() - flSortStart) * 1000);
+}
+
+bool CGame::SetupWeightedTransparency()
+{
+	if (!CShaderLibrary::GetShader("weightedinstanced") || !CShaderLibrary::GetShader("weightedsprite") || !CShaderLibrary::GetShader("weightedcomposite"))
+		return false;
+
+	// The sums need more range than a byte, and the depth is copied in from the screen so it has to be the same size.
+	return m_oWeightedBuffer.Create(GetWindowWidth(), GetWindowHeight(), 2, FB_TEXTURE_HALF_FLOAT|FB_DEPTH);
+}
+
+// Weighted blended transparency. Nothing gets sorted. Every transparent box and billboard is added
+// into m_oWeightedBuffer in any order with a weight for how near it is, and then the weighted
+// average goes over the screen in one pass. It's an approximation, but it's close where it matters.
+size_t CGame::DrawWeightedTransparency(const std::vector<CCharacter*>& apRenderList)
+{
+	CRenderer* pRenderer = GetRenderer();
+
+	CShader* pInstancedShader = CShaderLibrary::GetShader("weightedinstanced");
+	CShader* pSpriteShader = CShaderLibrary::GetShader("weightedsprite");
+	CShader* pCompositeShader = CShaderLibrary::GetShader("weightedcomposite");
+
+	size_t iInstancedDiffuseUniform = pInstancedShader->FindUniform("bDiffuse");
+
+	// Order doesn't matter, so everything can go in a batch. Billboards and impostors go in the sprite groups.
+	UpdateInstanceGroups(m_aWeightedInstanceGroups, apRenderList, true);
+	UpdateSpriteGroups(apRenderList);
+
+	CRenderingContext c(pRenderer, true);
+
+	m_oWeightedBuffer.CopyScreenDepth();
+	m_oWeightedBuffer.Clear(0, Vector4D(0, 0, 0, 1));
+	m_oWeightedBuffer.Clear(1, Vector4D(0, 0, 0, 0));
+
+	// Tested against what's already been drawn, but they don't hide each other.
+	c.SetBlend(BLEND_WEIGHTED);
+	c.SetDepthMask(false);
+	c.SetDepthTest(true);
+	c.SetBackCulling(true);
+
+	size_t iDrawCalls = 0;
+
+	c.UseProgram(pInstancedShader);
+	c.SetUniform("bLighted", true);
+
+	for (size_t i = 0; i < m_aWeightedInstanceGroups.size(); i++)
+	{
+		CInstanceGroup& oGroup = m_aWeightedInstanceGroups[i];
+		if (!oGroup.m_iInstances)
+			continue;
+
+		c.SetUniform(iInstancedDiffuseUniform, !!oGroup.m_iTexture);
+		if (oGroup.m_iTexture)
+			c.BindTexture(oGroup.m_iTexture);
+
+		c.RenderMeshInstanced(MESH_BOX, oGroup.m_oInstances);
+		iDrawCalls++;
 	}
 
-	if (iSpot == ~0)
+	c.UseProgram(pSpriteShader);
+	c.SetUniform("bLighted", true);
+	c.SetUniform("flSpriteSpinSpeed", (float)SHOT_EFFECT_SPEED);
+
+	// Billboards are seen from both sides.
+	c.SetBackCulling(false);
+
+	for (size_t i = 0; i < m_aSpriteGroups.size(); i++)
+	{
+		CSpriteGroup& oGroup = m_aSpriteGroups[i];
+		if (!oGroup.m_oSprites.GetNumSprites())
+			continue;
+
+		c.BindTexture(oGroup.m_iTexture);
+		c.RenderSprites(oGroup.m_oSprites);
+		iDrawCalls++;
+	}
+
+	CFrameBuffer::BindScreen();
+
+	// Whatever didn't show through gets covered by the average, so it goes on with regular alpha blending.
+	c.UseProgram(pCompositeShader);
+	c.SetBlend(BLEND_ALPHA);
+	c.SetUniform("iWeight", 1);
+	c.BindTexture(m_oWeightedBuffer.GetTexture(1), 1);
+
+	pRenderer->RenderMapFullscreen(m_oWeightedBuffer.GetTexture(0));
+	iDrawCalls++;
+
+	c.BindTexture(0, 1);
+
+	return iDrawCalls;
+}
+
+// Create a character and add him into our entity list.
+// Entity list explained here: http://youtu.be/V6vq0PRFKgk
+CCharacter* CGame::CreateCharacter()
+{
+	if (!m_aiFreeEntitySlots.size())
 		// Couldn't find a spot for the new guy! Return null instead.
 		return nullptr;
 
-	m_apEntityList[iSpot] = new CCharacter();
+	// Grab a spot in my entity list that's empty.
+	size_t iSpot = m_aiFreeEntitySlots.back();
+	m_aiFreeEntitySlots.pop_back();
+
+	TAssert(!m_apEntityList[iSpot]);
+
+	// Reuse the memory of somebody who was removed if we can. The world streams
+	// characters in and out all the time and this keeps us off the heap.
+	if (m_apCharacterPool.size())
+	{
+		m_apEntityList[iSpot] = new (m_apCharacterPool.back()) CCharacter();
+		m_apCharacterPool.pop_back();
+	}
+	else
+		m_apEntityList[iSpot] = new CCharacter();
 
 	static int iParity = 0;
 	m_apEntityList[iSpot]->m_iParity = iParity++;
 	m_apEntityList[iSpot]->m_iIndex = iSpot;
 
+	// Get him into the render sets.
+	MarkRenderDirty(m_apEntityList[iSpot]);
+
 	return m_apEntityList[iSpot];
 }
 
 // Remove a character from the entity list.
 void CGame::RemoveCharacter(CCharacter* pCharacter)
 {
-	size_t iSpot = ~0;
+	size_t iSpot = pCharacter->m_iIndex;
 
-	// Find a spot in my entity list that's empty.
-	for (size_t i = 0; i < MAX_CHARACTERS; i++)
+	if (iSpot >= MAX_CHARACTERS || m_apEntityList[iSpot] != pCharacter)
+		// Couldn't find this guy in our entity list! Do nothing.
+		return;
+
+	m_oBehaviors.Stop(pCharacter);
+
+	RemoveFromRenderSet(pCharacter);
+
+	if (pCharacter->m_bEnemyAI)
 	{
-		if (m_apEntityList[i] == pCharacter)
-		{
-			iSpot = i;
-			break;
-		}
+		TAssert(m_iMonsters);
+		m_iMonsters--;
 	}
 
-	if (iSpot == ~0)
-		// Couldn't find this guy in our entity list! Do nothing.
-		return;
+	// Hang on to the memory for the next character that gets created.
+	pCharacter->~CCharacter();
+	m_apCharacterPool.push_back(pCharacter);
 
-	delete m_apEntityList[iSpot];
 	m_apEntityList[iSpot] = nullptr;
+	m_aiFreeEntitySlots.push_back(iSpot);
 }
 
 CCharacter* CGame::GetCharacterIndex(size_t i)
 {
 	return m_apEntityList[i];
 }
+
+// Fill in the entities of a snapshot with everybody as they are right now.
+void CGame::CaptureSnapshot(CSnapshot& oSnapshot)
+{
+	oSnapshot.m_aEntities.clear();
+
+	// Entity slots are walked in order so the list comes out sorted.
+	for (size_t i = 0; i < MAX_CHARACTERS; i++)
+	{
+		CCharacter* pCharacter = m_apEntityList[i];
+		if (!pCharacter)
+			continue;
+
+		net_entity_t eKind;
+		if (pCharacter == m_hPlayer)
+			eKind = NET_ENTITY_PLAYER;
+		else if (pCharacter->m_bEnemyAI)
+			eKind = NET_ENTITY_MONSTER;
+		else
+			eKind = NET_ENTITY_PROP;
+
+		unsigned char iFlags = 0;
+		if (pCharacter->m_iBehavior != ~0)
+			iFlags |= ENTITY_STATE_THINKING;
+		if (pCharacter->m_flShotTime >= 0)
+			iFlags |= ENTITY_STATE_SHOT;
+
+		Matrix4x4 mTransform = pCharacter->GetGlobalTransform();
+
+		oSnapshot.m_aEntities.push_back(CEntityState());
+		oSnapshot.m_aEntities.back().Set(i, pCharacter->m_iParity, eKind, mTransform.GetTranslation(), mTransform.GetForwardVector(), pCharacter->m_iHealth, iFlags);
+	}
+}
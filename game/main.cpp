@@ -26,9 +26,14 @@ int main(int argc, char* argv[])
 	// Create a game
 	CGame game(argc, argv);
 
-	// Open the game's window
-	game.OpenWindow(1000, 564, false, false);
-	game.SetMouseCursorEnabled(false);
+	// Open the game's window. A dedicated server doesn't get one.
+	if (game.IsDedicatedServer())
+		game.OpenHeadless();
+	else
+	{
+		game.OpenWindow(1000, 564, false, false);
+		game.SetMouseCursorEnabled(false);
+	}
 
 	game.Load();
 
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "monster.h"
+
+#include "game.h"
+#include "character.h"
+
+CMonsterBehavior::CMonsterBehavior()
+{
+	m_iPath = ~0;
+	m_iWaypoint = 0;
+	m_flRepathTime = 0;
+}
+
+CMonsterBehavior::~CMonsterBehavior()
+{
+	if (m_iPath != ~0)
+		Game()->GetBehaviors().ReleasePath(m_iPath);
+}
+
+CBehaviorWait CMonsterBehavior::Resume(CCharacter* pCharacter, float dt)
+{
+	// Locals don't survive a BEHAVIOR_AWAIT, anything we need to keep is a member.
+	BEHAVIOR_BEGIN();
+
+	while (true)
+	{
+		// Sleep until the player comes close enough to notice. Costs nothing while we wait.
+		BEHAVIOR_AWAIT(UntilWithinRange(Game()->GetPlayer(), MONSTER_AGGRO_RANGE, MONSTER_MAX_CLOSING_SPEED));
+
+		while (IsChasing(pCharacter))
+		{
+			if (NeedsPath())
+			{
+				RequestPath(pCharacter);
+				BEHAVIOR_AWAIT(UntilPathReady(m_iPath));
+			}
+
+			FollowPath(pCharacter, dt);
+
+			BEHAVIOR_AWAIT(NextTick());
+		}
+	}
+
+	BEHAVIOR_END();
+}
+
+bool CMonsterBehavior::IsChasing(CCharacter* pCharacter) const
+{
+	CCharacter* pPlayer = Game()->GetPlayer();
+	if (!pPlayer)
+		return false;
+
+	return (pPlayer->GetGlobalOrigin() - pCharacter->GetGlobalOrigin()).Length() < MONSTER_LOSE_RANGE;
+}
+
+bool CMonsterBehavior::NeedsPath() const
+{
+	if (m_iPath == ~0)
+		return true;
+
+	if (Game()->GetTime() > m_flRepathTime)
+		return true;
+
+	return m_iWaypoint >= Game()->GetBehaviors().GetPath(m_iPath)->m_avecWaypoints.size();
+}
+
+void CMonsterBehavior::RequestPath(CCharacter* pCharacter)
+{
+	CBehaviorScheduler& oBehaviors = Game()->GetBehaviors();
+
+	if (m_iPath != ~0)
+		oBehaviors.ReleasePath(m_iPath);
+
+	m_iPath = oBehaviors.RequestPath(pCharacter->GetGlobalOrigin(), Game()->GetPlayer()->GetGlobalOrigin());
+	m_iWaypoint = 0;
+	m_flRepathTime = Game()->GetTime() + MONSTER_REPATH_TIME;
+}
+
+void CMonsterBehavior::FollowPath(CCharacter* pCharacter, float dt)
+{
+	Vector vecOrigin = pCharacter->GetGlobalOrigin();
+
+	// Close enough, stand here.
+	if ((Game()->GetPlayer()->GetGlobalOrigin() - vecOrigin).Length() < MONSTER_ATTACK_RANGE)
+		return;
+
+	const std::vector<Vector>& avecWaypoints = Game()->GetBehaviors().GetPath(m_iPath)->m_avecWaypoints;
+
+	while (m_iWaypoint < avecWaypoints.size() && (avecWaypoints[m_iWaypoint] - vecOrigin).Length() < MONSTER_ATTACK_RANGE)
+		m_iWaypoint++;
+
+	// Ran out of path, we'll get a new one next tick.
+	if (m_iWaypoint >= avecWaypoints.size())
+		return;
+
+	// Update position and movement. http://www.youtube.com/watch?v=c4b9lCfSDQM
+	pCharacter->m_vecVelocity = (avecWaypoints[m_iWaypoint] - vecOrigin).Normalized() * MONSTER_SPEED;
+
+	// Walk over the hills rather than through them.
+	Vector vecNew = vecOrigin + pCharacter->m_vecVelocity * dt;
+	vecNew.y = CTerrain::GetHeight(vecNew.x, vecNew.z);
+
+	pCharacter->SetTranslation(vecNew);
+}
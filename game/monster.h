@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "behavior.h"
+
+#define MONSTER_SPEED             0.5f
+#define MONSTER_AGGRO_RANGE       30.0f  // Monsters notice the player inside this range...
+#define MONSTER_LOSE_RANGE        45.0f  // ...and give up on them outside this one.
+#define MONSTER_ATTACK_RANGE      1.0f
+#define MONSTER_REPATH_TIME       1.0f
+
+// Nothing in the game closes distance faster than this. Monsters use it to work out
+// how long they can sleep before the player could possibly be in range.
+#define MONSTER_MAX_CLOSING_SPEED 25.0f
+
+// Sleeps until the player comes near, then chases them down until they get away.
+class CMonsterBehavior : public CBehavior
+{
+public:
+	CMonsterBehavior();
+	virtual ~CMonsterBehavior();
+
+public:
+	virtual CBehaviorWait Resume(class CCharacter* pCharacter, float dt);
+
+private:
+	bool    IsChasing(class CCharacter* pCharacter) const;
+	bool    NeedsPath() const;
+	void    RequestPath(class CCharacter* pCharacter);
+	void    FollowPath(class CCharacter* pCharacter, float dt);
+
+private:
+	size_t  m_iPath;
+	size_t  m_iWaypoint;
+	float   m_flRepathTime;
+};
@@ -0,0 +1,399 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "netchannel.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <common.h>
+
+// Anything bigger than this is garbage, or somebody who isn't us on the other end.
+#define NET_MAX_MESSAGE_SIZE (4*1024*1024)
+
+#define NET_INVALID_SOCKET (~(size_t)0)
+
+CNetMessage::CNetMessage()
+{
+	m_iReadPosition = 0;
+	m_bOverflowed = false;
+}
+
+void CNetMessage::WriteByte(unsigned char i)
+{
+	m_aiData.push_back(i);
+}
+
+void CNetMessage::WriteShort(unsigned short i)
+{
+	m_aiData.push_back(i & 0xFF);
+	m_aiData.push_back(i >> 8);
+}
+
+void CNetMessage::WriteLong(unsigned int i)
+{
+	m_aiData.push_back(i & 0xFF);
+	m_aiData.push_back((i >> 8) & 0xFF);
+	m_aiData.push_back((i >> 16) & 0xFF);
+	m_aiData.push_back(i >> 24);
+}
+
+void CNetMessage::WriteFloat(float fl)
+{
+	unsigned int i;
+	memcpy(&i, &fl, sizeof(i));
+	WriteLong(i);
+}
+
+void CNetMessage::WriteVarInt(int i)
+{
+	// Zigzag so that small negative numbers are small too, then seven bits at a time.
+	unsigned int u = ((unsigned int)i << 1) ^ (unsigned int)(i >> 31);
+
+	while (u >= 0x80)
+	{
+		m_aiData.push_back((unsigned char)(u | 0x80));
+		u >>= 7;
+	}
+
+	m_aiData.push_back((unsigned char)u);
+}
+
+unsigned char CNetMessage::ReadByte()
+{
+	if (m_iReadPosition >= m_aiData.size())
+	{
+		m_bOverflowed = true;
+		return 0;
+	}
+
+	return m_aiData[m_iReadPosition++];
+}
+
+unsigned short CNetMessage::ReadShort()
+{
+	unsigned short i = ReadByte();
+	i |= ReadByte() << 8;
+	return i;
+}
+
+unsigned int CNetMessage::ReadLong()
+{
+	unsigned int i = ReadByte();
+	i |= ReadByte() << 8;
+	i |= ReadByte() << 16;
+	i |= (unsigned int)ReadByte() << 24;
+	return i;
+}
+
+float CNetMessage::ReadFloat()
+{
+	unsigned int i = ReadLong();
+	float fl;
+	memcpy(&fl, &i, sizeof(fl));
+	return fl;
+}
+
+int CNetMessage::ReadVarInt()
+{
+	unsigned int u = 0;
+	for (int iShift = 0; iShift < 35; iShift += 7)
+	{
+		unsigned char i = ReadByte();
+		u |= (unsigned int)(i & 0x7F) << iShift;
+
+		if (!(i & 0x80))
+			break;
+	}
+
+	return (int)(u >> 1) ^ -(int)(u & 1);
+}
+
+void CNetMessage::Clear()
+{
+	m_aiData.clear();
+	m_iReadPosition = 0;
+	m_bOverflowed = false;
+}
+
+#ifdef _WIN32
+#define MSG_NOSIGNAL 0
+
+static void CloseSocketHandle(size_t iSocket)
+{
+	closesocket((SOCKET)iSocket);
+}
+
+static bool WouldBlock()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+static void CloseSocketHandle(size_t iSocket)
+{
+	close((int)iSocket);
+}
+
+static bool WouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+#endif
+
+static void SetNonBlocking(size_t iSocket)
+{
+#ifdef _WIN32
+	u_long iNonBlocking = 1;
+	ioctlsocket((SOCKET)iSocket, FIONBIO, &iNonBlocking);
+#else
+	fcntl((int)iSocket, F_SETFL, fcntl((int)iSocket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	// Snapshots are small and we want them out now, not batched up with the next one.
+	int iNoDelay = 1;
+	setsockopt((int)iSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&iNoDelay, sizeof(iNoDelay));
+}
+
+CNetChannel::CNetChannel()
+{
+	m_iListenSocket = NET_INVALID_SOCKET;
+	m_iSocket = NET_INVALID_SOCKET;
+	m_flFakeLag = 0;
+	m_iBytesSent = 0;
+	m_iBytesReceived = 0;
+}
+
+CNetChannel::~CNetChannel()
+{
+	Disconnect();
+	CloseSocket(m_iListenSocket);
+}
+
+bool CNetChannel::Listen(unsigned short iPort)
+{
+	CloseSocket(m_iListenSocket);
+
+	size_t iSocket = (size_t)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (iSocket == NET_INVALID_SOCKET)
+		return false;
+
+	int iReuse = 1;
+	setsockopt((int)iSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&iReuse, sizeof(iReuse));
+
+	sockaddr_in oAddress;
+	memset(&oAddress, 0, sizeof(oAddress));
+	oAddress.sin_family = AF_INET;
+	oAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+	oAddress.sin_port = htons(iPort);
+
+	if (bind((int)iSocket, (sockaddr*)&oAddress, sizeof(oAddress)) != 0 || listen((int)iSocket, 1) != 0)
+	{
+		CloseSocket(iSocket);
+		return false;
+	}
+
+	SetNonBlocking(iSocket);
+
+	m_iListenSocket = iSocket;
+	return true;
+}
+
+bool CNetChannel::Accept()
+{
+	if (m_iListenSocket == NET_INVALID_SOCKET)
+		return false;
+
+	size_t iSocket = (size_t)accept((int)m_iListenSocket, nullptr, nullptr);
+	if (iSocket == NET_INVALID_SOCKET)
+		return false;
+
+	// One client at a time. Whoever connects last wins.
+	Disconnect();
+
+	SetNonBlocking(iSocket);
+	m_iSocket = iSocket;
+
+	return true;
+}
+
+bool CNetChannel::Connect(const std::string& sHost, unsigned short iPort)
+{
+	Disconnect();
+
+	addrinfo oHints;
+	memset(&oHints, 0, sizeof(oHints));
+	oHints.ai_family = AF_INET;
+	oHints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* pResult = nullptr;
+	if (getaddrinfo(sHost.c_str(), nullptr, &oHints, &pResult) != 0 || !pResult)
+		return false;
+
+	sockaddr_in oAddress;
+	memcpy(&oAddress, pResult->ai_addr, sizeof(oAddress));
+	oAddress.sin_port = htons(iPort);
+	freeaddrinfo(pResult);
+
+	size_t iSocket = (size_t)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (iSocket == NET_INVALID_SOCKET)
+		return false;
+
+	// Block for the connect itself. It's a local socket, it won't take long.
+	if (connect((int)iSocket, (sockaddr*)&oAddress, sizeof(oAddress)) != 0)
+	{
+		CloseSocket(iSocket);
+		return false;
+	}
+
+	SetNonBlocking(iSocket);
+	m_iSocket = iSocket;
+
+	return true;
+}
+
+void CNetChannel::Disconnect()
+{
+	CloseSocket(m_iSocket);
+
+	m_aPending.clear();
+	m_aiSendBuffer.clear();
+	m_aiReceiveBuffer.clear();
+}
+
+bool CNetChannel::IsConnected() const
+{
+	return m_iSocket != NET_INVALID_SOCKET;
+}
+
+void CNetChannel::Send(const CNetMessage& oMessage, float flTime)
+{
+	if (!IsConnected())
+		return;
+
+	m_aPending.push_back(CPendingMessage());
+	CPendingMessage& oPending = m_aPending.back();
+	oPending.flReleaseTime = flTime + m_flFakeLag;
+
+	// Length first so the other side knows where the message ends.
+	size_t iSize = oMessage.m_aiData.size();
+	oPending.aiData.reserve(iSize + 4);
+	oPending.aiData.push_back(iSize & 0xFF);
+	oPending.aiData.push_back((iSize >> 8) & 0xFF);
+	oPending.aiData.push_back((iSize >> 16) & 0xFF);
+	oPending.aiData.push_back((iSize >> 24) & 0xFF);
+	oPending.aiData.insert(oPending.aiData.end(), oMessage.m_aiData.begin(), oMessage.m_aiData.end());
+}
+
+void CNetChannel::Flush(float flTime)
+{
+	if (!IsConnected())
+		return;
+
+	// Everything's held for the same amount of time so they come due in order.
+	while (m_aPending.size() && m_aPending.front().flReleaseTime <= flTime)
+	{
+		m_aiSendBuffer.insert(m_aiSendBuffer.end(), m_aPending.front().aiData.begin(), m_aPending.front().aiData.end());
+		m_aPending.pop_front();
+	}
+
+	size_t iWritten = 0;
+	while (iWritten < m_aiSendBuffer.size())
+	{
+		int iResult = send((int)m_iSocket, (const char*)&m_aiSendBuffer[iWritten], (int)(m_aiSendBuffer.size() - iWritten), MSG_NOSIGNAL);
+		if (iResult > 0)
+		{
+			iWritten += iResult;
+			continue;
+		}
+
+		if (iResult < 0 && WouldBlock())
+			break;
+
+		Disconnect();
+		return;
+	}
+
+	m_iBytesSent += iWritten;
+	m_aiSendBuffer.erase(m_aiSendBuffer.begin(), m_aiSendBuffer.begin() + iWritten);
+}
+
+bool CNetChannel::Receive(CNetMessage& oMessage)
+{
+	if (!IsConnected())
+		return false;
+
+	char aiBuffer[16*1024];
+	while (true)
+	{
+		int iResult = recv((int)m_iSocket, aiBuffer, sizeof(aiBuffer), 0);
+		if (iResult > 0)
+		{
+			m_iBytesReceived += iResult;
+			m_aiReceiveBuffer.insert(m_aiReceiveBuffer.end(), aiBuffer, aiBuffer + iResult);
+			continue;
+		}
+
+		if (iResult < 0 && WouldBlock())
+			break;
+
+		// Zero means the other side hung up.
+		Disconnect();
+		return false;
+	}
+
+	if (m_aiReceiveBuffer.size() < 4)
+		return false;
+
+	size_t iSize = m_aiReceiveBuffer[0] | (m_aiReceiveBuffer[1] << 8) | (m_aiReceiveBuffer[2] << 16) | ((size_t)m_aiReceiveBuffer[3] << 24);
+	if (iSize > NET_MAX_MESSAGE_SIZE)
+	{
+		TAssert(iSize <= NET_MAX_MESSAGE_SIZE);
+		Disconnect();
+		return false;
+	}
+
+	if (m_aiReceiveBuffer.size() < iSize + 4)
+		return false;
+
+	oMessage.Clear();
+	oMessage.m_aiData.assign(m_aiReceiveBuffer.begin() + 4, m_aiReceiveBuffer.begin() + 4 + iSize);
+	m_aiReceiveBuffer.erase(m_aiReceiveBuffer.begin(), m_aiReceiveBuffer.begin() + 4 + iSize);
+
+	return true;
+}
+
+void CNetChannel::CloseSocket(size_t& iSocket)
+{
+	if (iSocket == NET_INVALID_SOCKET)
+		return;
+
+	CloseSocketHandle(iSocket);
+	iSocket = NET_INVALID_SOCKET;
+}
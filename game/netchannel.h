@@ -0,0 +1,115 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// A message being written or read. Everything goes over the wire little endian.
+class CNetMessage
+{
+public:
+	CNetMessage();
+
+public:
+	void                WriteByte(unsigned char i);
+	void                WriteShort(unsigned short i);
+	void                WriteLong(unsigned int i);
+	void                WriteFloat(float fl);
+	// Small numbers take fewer bytes. Good for deltas, which are usually small.
+	void                WriteVarInt(int i);
+
+	unsigned char       ReadByte();
+	unsigned short      ReadShort();
+	unsigned int        ReadLong();
+	float               ReadFloat();
+	int                 ReadVarInt();
+
+	// Reading past the end doesn't crash, it gives zeroes and sets this.
+	bool                IsOverflowed() const { return m_bOverflowed; }
+	bool                IsAtEnd() const { return m_iReadPosition >= m_aiData.size(); }
+
+	void                Clear();
+
+	size_t              GetSize() const { return m_aiData.size(); }
+	size_t              GetRemaining() const { return m_iReadPosition < m_aiData.size() ? m_aiData.size() - m_iReadPosition : 0; }
+
+public:
+	std::vector<unsigned char> m_aiData;
+
+private:
+	size_t              m_iReadPosition;
+	bool                m_bOverflowed;
+};
+
+// A connection between the server and a client. It's a TCP socket with the byte
+// stream cut up into messages. Nothing here ever blocks.
+class CNetChannel
+{
+	class CPendingMessage
+	{
+	public:
+		float                      flReleaseTime;
+		std::vector<unsigned char> aiData;
+	};
+
+public:
+	CNetChannel();
+	~CNetChannel();
+
+public:
+	// Server side. Listen() opens the port and Accept() picks up a client if one is waiting.
+	bool                Listen(unsigned short iPort);
+	bool                Accept();
+
+	// Client side.
+	bool                Connect(const std::string& sHost, unsigned short iPort);
+
+	void                Disconnect();
+	bool                IsConnected() const;
+
+	// Messages are held for the fake lag and then go out on a Flush().
+	void                Send(const CNetMessage& oMessage, float flTime);
+	void                Flush(float flTime);
+
+	// Returns false when there isn't a whole message waiting.
+	bool                Receive(CNetMessage& oMessage);
+
+	// Holds outgoing messages this long so we can see what latency does to us without a real network.
+	void                SetFakeLag(float flSeconds) { m_flFakeLag = flSeconds; }
+
+	size_t              GetBytesSent() const { return m_iBytesSent; }
+	size_t              GetBytesReceived() const { return m_iBytesReceived; }
+
+private:
+	void                CloseSocket(size_t& iSocket);
+
+private:
+	size_t              m_iListenSocket;
+	size_t              m_iSocket;
+
+	float               m_flFakeLag;
+
+	std::deque<CPendingMessage> m_aPending;
+	std::vector<unsigned char>  m_aiSendBuffer;
+	std::vector<unsigned char>  m_aiReceiveBuffer;
+
+	size_t              m_iBytesSent;
+	size_t              m_iBytesReceived;
+};
@@ -0,0 +1,117 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "renderset.h"
+
+#include <algorithm>
+
+#include <common.h>
+
+#include <math/frustum.h>
+
+#include "character.h"
+
+// How many slots get culled at a time, so the visible indices fit on the stack.
+#define CULL_BATCH_SLOTS 256
+
+size_t CRenderSet::Add(CCharacter* pCharacter, const AABB& aabbBounds)
+{
+	for (size_t i = 0; i < 3; i++)
+	{
+		m_aflMins[i].push_back(0);
+		m_aflMaxs[i].push_back(0);
+	}
+
+	m_aiCullPlanes.push_back(0);
+	m_apCharacters.push_back(pCharacter);
+
+	SetBounds(m_apCharacters.size()-1, aabbBounds);
+
+	return m_apCharacters.size()-1;
+}
+
+void CRenderSet::Update(size_t iSlot, const AABB& aabbBounds)
+{
+	TAssert(iSlot < m_apCharacters.size());
+
+	SetBounds(iSlot, aabbBounds);
+}
+
+void CRenderSet::SetBounds(size_t iSlot, const AABB& aabbBounds)
+{
+	m_aflMins[0][iSlot] = aabbBounds.vecMin.x;
+	m_aflMins[1][iSlot] = aabbBounds.vecMin.y;
+	m_aflMins[2][iSlot] = aabbBounds.vecMin.z;
+	m_aflMaxs[0][iSlot] = aabbBounds.vecMax.x;
+	m_aflMaxs[1][iSlot] = aabbBounds.vecMax.y;
+	m_aflMaxs[2][iSlot] = aabbBounds.vecMax.z;
+}
+
+void CRenderSet::Remove(size_t iSlot)
+{
+	TAssert(iSlot < m_apCharacters.size());
+
+	size_t iLast = m_apCharacters.size()-1;
+	if (iSlot != iLast)
+	{
+		for (size_t i = 0; i < 3; i++)
+		{
+			m_aflMins[i][iSlot] = m_aflMins[i][iLast];
+			m_aflMaxs[i][iSlot] = m_aflMaxs[i][iLast];
+		}
+
+		m_aiCullPlanes[iSlot] = m_aiCullPlanes[iLast];
+		m_apCharacters[iSlot] = m_apCharacters[iLast];
+		m_apCharacters[iSlot]->m_iRenderSlot = iSlot;
+	}
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		m_aflMins[i].pop_back();
+		m_aflMaxs[i].pop_back();
+	}
+
+	m_aiCullPlanes.pop_back();
+	m_apCharacters.pop_back();
+}
+
+void CRenderSet::Cull(CFrustum& oFrustum, std::vector<CCharacter*>& apVisible) const
+{
+	Cull(oFrustum, apVisible, 0, m_apCharacters.size());
+}
+
+void CRenderSet::Cull(CFrustum& oFrustum, std::vector<CCharacter*>& apVisible, size_t iFirst, size_t iLast) const
+{
+	TAssert(iLast <= m_apCharacters.size());
+
+	unsigned int aiVisible[CULL_BATCH_SLOTS];
+
+	for (size_t iBatch = iFirst; iBatch < iLast; iBatch += CULL_BATCH_SLOTS)
+	{
+		size_t iSlots = std::min((size_t)CULL_BATCH_SLOTS, iLast - iBatch);
+
+		const float* apflMins[3] = { &m_aflMins[0][iBatch], &m_aflMins[1][iBatch], &m_aflMins[2][iBatch] };
+		const float* apflMaxs[3] = { &m_aflMaxs[0][iBatch], &m_aflMaxs[1][iBatch], &m_aflMaxs[2][iBatch] };
+
+		// If the entity is outside the viewing frustum then the player can't see it - don't draw it.
+		// http://youtu.be/4p-E_31XOPM
+		size_t iVisible = oFrustum.AABBIntersection(apflMins, apflMaxs, iSlots, aiVisible, &m_aiCullPlanes[iBatch]);
+
+		for (size_t i = 0; i < iVisible; i++)
+			apVisible.push_back(m_apCharacters[iBatch + aiVisible[i]]);
+	}
+}
@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <vector.h>
+#include <aabb.h>
+
+// A list of things to draw that's kept up to date as characters change, rather than
+// being rebuilt every frame. Each coordinate of the bounding boxes is packed into its
+// own array so that culling can run straight down them, four at a time, without
+// touching the characters.
+class CRenderSet
+{
+public:
+	// Returns the slot the character went into.
+	size_t              Add(class CCharacter* pCharacter, const AABB& aabbBounds);
+	void                Update(size_t iSlot, const AABB& aabbBounds);
+	// The last character in the set is moved into the hole, so its slot changes.
+	void                Remove(size_t iSlot);
+
+	// Add everything that touches the frustum to apVisible.
+	void                Cull(class CFrustum& oFrustum, std::vector<class CCharacter*>& apVisible) const;
+	// Just slots [iFirst, iLast), so that a big set can be split up between threads.
+	void                Cull(class CFrustum& oFrustum, std::vector<class CCharacter*>& apVisible, size_t iFirst, size_t iLast) const;
+
+	size_t              GetSize() const { return m_apCharacters.size(); }
+
+private:
+	void                SetBounds(size_t iSlot, const AABB& aabbBounds);
+
+private:
+	std::vector<float>              m_aflMins[3];
+	std::vector<float>              m_aflMaxs[3];
+	std::vector<class CCharacter*>  m_apCharacters;
+
+	// The frustum plane that culled each slot last time. It's only a hint to culling, so Cull() keeps it
+	// up to date. Jobs culling different slots at the same time never touch the same ones.
+	mutable std::vector<unsigned char> m_aiCullPlanes;
+};
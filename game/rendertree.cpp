@@ -0,0 +1,238 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rendertree.h"
+
+#include <algorithm>
+
+#include <common.h>
+
+#include <math/frustum.h>
+
+#include "character.h"
+
+// Don't rebuild for fewer loose ends than this unless they're a good part of the tree.
+#define RENDER_TREE_MIN_REBUILD 256
+
+#define CULL_BATCH_SLOTS 256
+
+CRenderTree::CRenderTree()
+{
+	m_iBuilt = 0;
+	m_iRemoved = 0;
+}
+
+size_t CRenderTree::Add(CCharacter* pCharacter, const AABB& aabbBounds)
+{
+	m_aflMins[0].push_back(aabbBounds.vecMin.x);
+	m_aflMins[1].push_back(aabbBounds.vecMin.y);
+	m_aflMins[2].push_back(aabbBounds.vecMin.z);
+	m_aflMaxs[0].push_back(aabbBounds.vecMax.x);
+	m_aflMaxs[1].push_back(aabbBounds.vecMax.y);
+	m_aflMaxs[2].push_back(aabbBounds.vecMax.z);
+
+	m_aiCullPlanes.push_back(0);
+	m_apCharacters.push_back(pCharacter);
+
+	return m_apCharacters.size()-1;
+}
+
+void CRenderTree::Remove(size_t iSlot)
+{
+	TAssert(iSlot < m_apCharacters.size());
+	TAssert(m_apCharacters[iSlot]);
+
+	m_apCharacters[iSlot] = nullptr;
+	m_iRemoved++;
+}
+
+void CRenderTree::Build()
+{
+	size_t iLoose = m_apCharacters.size() - m_iBuilt + m_iRemoved;
+	if (!iLoose)
+		return;
+
+	if (iLoose < RENDER_TREE_MIN_REBUILD && iLoose*4 < m_apCharacters.size())
+		return;
+
+	std::vector<size_t> aiSlots;
+	aiSlots.reserve(m_apCharacters.size() - m_iRemoved);
+	for (size_t i = 0; i < m_apCharacters.size(); i++)
+	{
+		if (m_apCharacters[i])
+			aiSlots.push_back(i);
+	}
+
+	m_aNodes.clear();
+	if (aiSlots.size())
+	{
+		m_aNodes.push_back(CNode());
+		BuildNode(0, aiSlots, 0, aiSlots.size());
+	}
+
+	// Put everything in the order the tree wants it, and let everybody know where they ended up.
+	std::vector<float> aflMins[3], aflMaxs[3];
+	for (size_t j = 0; j < 3; j++)
+	{
+		aflMins[j].resize(aiSlots.size());
+		aflMaxs[j].resize(aiSlots.size());
+	}
+
+	std::vector<CCharacter*> apCharacters(aiSlots.size());
+	std::vector<unsigned char> aiCullPlanes(aiSlots.size());
+
+	for (size_t i = 0; i < aiSlots.size(); i++)
+	{
+		size_t iSlot = aiSlots[i];
+		for (size_t j = 0; j < 3; j++)
+		{
+			aflMins[j][i] = m_aflMins[j][iSlot];
+			aflMaxs[j][i] = m_aflMaxs[j][iSlot];
+		}
+
+		apCharacters[i] = m_apCharacters[iSlot];
+		apCharacters[i]->m_iRenderSlot = i;
+		aiCullPlanes[i] = m_aiCullPlanes[iSlot];
+	}
+
+	for (size_t j = 0; j < 3; j++)
+	{
+		m_aflMins[j].swap(aflMins[j]);
+		m_aflMaxs[j].swap(aflMaxs[j]);
+	}
+
+	m_apCharacters.swap(apCharacters);
+	m_aiCullPlanes.swap(aiCullPlanes);
+
+	m_iBuilt = m_apCharacters.size();
+	m_iRemoved = 0;
+}
+
+// Fills in node iNode with slots [iFirst, iLast) of aiSlots, and whatever goes under it.
+void CRenderTree::BuildNode(size_t iNode, std::vector<size_t>& aiSlots, size_t iFirst, size_t iLast)
+{
+	size_t iSlot = aiSlots[iFirst];
+	AABB aabbBounds(Vector(m_aflMins[0][iSlot], m_aflMins[1][iSlot], m_aflMins[2][iSlot]), Vector(m_aflMaxs[0][iSlot], m_aflMaxs[1][iSlot], m_aflMaxs[2][iSlot]));
+	AABB aabbCenters(aabbBounds.GetCenter(), aabbBounds.GetCenter());
+
+	for (size_t i = iFirst+1; i < iLast; i++)
+	{
+		iSlot = aiSlots[i];
+		Vector vecMin(m_aflMins[0][iSlot], m_aflMins[1][iSlot], m_aflMins[2][iSlot]);
+		Vector vecMax(m_aflMaxs[0][iSlot], m_aflMaxs[1][iSlot], m_aflMaxs[2][iSlot]);
+		Vector vecCenter = (vecMin + vecMax)/2;
+
+		aabbBounds.Expand(vecMin);
+		aabbBounds.Expand(vecMax);
+		aabbCenters.Expand(vecCenter);
+	}
+
+	CNode& oNode = m_aNodes[iNode];
+	oNode.m_aabbBounds = aabbBounds;
+	oNode.m_iFirst = iFirst;
+	oNode.m_iCount = iLast - iFirst;
+	oNode.m_iChildren = ~0;
+
+	if (iLast - iFirst <= RENDER_TREE_LEAF_SIZE)
+		return;
+
+	// Split down the middle of whichever way the characters are most spread out.
+	Vector vecSpread = aabbCenters.vecMax - aabbCenters.vecMin;
+	int iAxis = 0;
+	if (vecSpread.y > vecSpread.x)
+		iAxis = 1;
+	if (vecSpread.z > std::max(vecSpread.x, vecSpread.y))
+		iAxis = 2;
+
+	const float* aflMins = m_aflMins[iAxis].data();
+	const float* aflMaxs = m_aflMaxs[iAxis].data();
+
+	size_t iMiddle = (iFirst + iLast)/2;
+	std::nth_element(aiSlots.begin() + iFirst, aiSlots.begin() + iMiddle, aiSlots.begin() + iLast, [aflMins, aflMaxs](size_t l, size_t r) {
+		return aflMins[l] + aflMaxs[l] < aflMins[r] + aflMaxs[r];
+	});
+
+	// Both children go next to each other. Adding them can move the nodes, so oNode is no good after this.
+	size_t iChildren = m_aNodes.size();
+	oNode.m_iChildren = iChildren;
+	m_aNodes.push_back(CNode());
+	m_aNodes.push_back(CNode());
+
+	BuildNode(iChildren, aiSlots, iFirst, iMiddle);
+	BuildNode(iChildren+1, aiSlots, iMiddle, iLast);
+}
+
+void CRenderTree::Cull(const CFrustum& oFrustum, std::vector<CCharacter*>& apVisible) const
+{
+	if (m_aNodes.size())
+		CullNode(oFrustum, 0, FRUSTUM_ALL_PLANES, apVisible);
+
+	// Added since the last build.
+	CullSlots(oFrustum, m_iBuilt, m_apCharacters.size(), apVisible);
+}
+
+void CRenderTree::CullNode(const CFrustum& oFrustum, size_t iNode, unsigned int iPlanes, std::vector<CCharacter*>& apVisible) const
+{
+	const CNode& oNode = m_aNodes[iNode];
+
+	frustum_test_t eTest = oFrustum.AABBTest(oNode.m_aabbBounds.vecMin, oNode.m_aabbBounds.vecMax, iPlanes);
+
+	if (eTest == FRUSTUM_OUTSIDE)
+		return;
+
+	if (eTest == FRUSTUM_INSIDE)
+	{
+		for (size_t i = oNode.m_iFirst; i < oNode.m_iFirst + oNode.m_iCount; i++)
+		{
+			if (m_apCharacters[i])
+				apVisible.push_back(m_apCharacters[i]);
+		}
+
+		return;
+	}
+
+	if (oNode.m_iChildren == ~0)
+	{
+		CullSlots(oFrustum, oNode.m_iFirst, oNode.m_iFirst + oNode.m_iCount, apVisible);
+		return;
+	}
+
+	CullNode(oFrustum, oNode.m_iChildren, iPlanes, apVisible);
+	CullNode(oFrustum, oNode.m_iChildren+1, iPlanes, apVisible);
+}
+
+void CRenderTree::CullSlots(const CFrustum& oFrustum, size_t iFirst, size_t iLast, std::vector<CCharacter*>& apVisible) const
+{
+	unsigned int aiVisible[CULL_BATCH_SLOTS];
+
+	for (size_t iBatch = iFirst; iBatch < iLast; iBatch += CULL_BATCH_SLOTS)
+	{
+		size_t iSlots = std::min((size_t)CULL_BATCH_SLOTS, iLast - iBatch);
+
+		const float* apflMins[3] = { &m_aflMins[0][iBatch], &m_aflMins[1][iBatch], &m_aflMins[2][iBatch] };
+		const float* apflMaxs[3] = { &m_aflMaxs[0][iBatch], &m_aflMaxs[1][iBatch], &m_aflMaxs[2][iBatch] };
+
+		size_t iVisible = oFrustum.AABBIntersection(apflMins, apflMaxs, iSlots, aiVisible, &m_aiCullPlanes[iBatch]);
+
+		for (size_t i = 0; i < iVisible; i++)
+		{
+			CCharacter* pCharacter = m_apCharacters[iBatch + aiVisible[i]];
+			if (pCharacter)
+				apVisible.push_back(pCharacter);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <vector.h>
+#include <aabb.h>
+
+// Leaves hold about this many characters. They're culled four at a time, so a leaf
+// that's partly in the frustum doesn't cost much more than testing the leaf itself.
+#define RENDER_TREE_LEAF_SIZE   32
+
+// A tree of boxes around the characters that never move, like props. It's kept from frame
+// to frame, and culling goes down it from the top. Anything in a node that's outside the
+// frustum is skipped and anything in a node that's all the way inside is drawn, so only
+// the leaves along the edge of the frustum have their characters tested one by one.
+//
+// Rebuilding it is slow, so it isn't done every time something changes. Characters added
+// since the last build sit at the end and are culled one by one, and removed ones leave a
+// hole until the next build. Build() rebuilds once there's enough of either.
+class CRenderTree
+{
+	class CNode
+	{
+	public:
+		AABB    m_aabbBounds;
+		size_t  m_iFirst;       // Every character under this node is in slots [first, first+count)
+		size_t  m_iCount;
+		size_t  m_iChildren;    // The first of two, or ~0 for a leaf
+	};
+
+public:
+	CRenderTree();
+
+public:
+	// Returns the slot the character went into. Slots change when the tree is built.
+	size_t              Add(class CCharacter* pCharacter, const AABB& aabbBounds);
+	void                Remove(size_t iSlot);
+
+	// Rebuild the tree if enough has changed since the last time. Don't cull while this is going.
+	void                Build();
+
+	// Add everything that touches the frustum to apVisible.
+	void                Cull(const class CFrustum& oFrustum, std::vector<class CCharacter*>& apVisible) const;
+
+	size_t              GetSize() const { return m_apCharacters.size() - m_iRemoved; }
+	size_t              GetNumNodes() const { return m_aNodes.size(); }
+
+private:
+	void                BuildNode(size_t iNode, std::vector<size_t>& aiSlots, size_t iFirst, size_t iLast);
+
+	void                CullNode(const class CFrustum& oFrustum, size_t iNode, unsigned int iPlanes, std::vector<class CCharacter*>& apVisible) const;
+	void                CullSlots(const class CFrustum& oFrustum, size_t iFirst, size_t iLast, std::vector<class CCharacter*>& apVisible) const;
+
+private:
+	std::vector<CNode>              m_aNodes;
+
+	// Slots are in tree order up to m_iBuilt, so every node's characters are next to each other.
+	std::vector<float>              m_aflMins[3];
+	std::vector<float>              m_aflMaxs[3];
+	std::vector<class CCharacter*>  m_apCharacters;    // nullptr where one was removed
+	mutable std::vector<unsigned char> m_aiCullPlanes;  // Same as in CRenderSet
+
+	size_t                          m_iBuilt;
+	size_t                          m_iRemoved;
+};
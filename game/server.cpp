@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "server.h"
+
+#include <algorithm>
+
+#include <common.h>
+
+#include "game.h"
+#include "character.h"
+
+static_assert(SNAPSHOT_MAX_ENTITIES == MAX_CHARACTERS, "Snapshots have to be able to carry every character.");
+
+CGameServer::CGameServer()
+{
+	m_iTick = 0;
+	m_iAckTick = 0;
+	m_iLastSnapshotSize = 0;
+	m_iLastSnapshotEntities = 0;
+}
+
+bool CGameServer::Initialize(unsigned short iPort)
+{
+	return m_oChannel.Listen(iPort);
+}
+
+bool CGameServer::ReadInput(float flTime, CClientInput& oInput)
+{
+	if (m_oChannel.Accept())
+	{
+		// Somebody new. They don't have anything, so start them off with everything.
+		m_iAckTick = 0;
+	}
+
+	bool bReceived = false;
+	unsigned int iJumps = 0;
+	unsigned int iShots = 0;
+
+	CNetMessage oMessage;
+	while (m_oChannel.Receive(oMessage))
+	{
+		if (oMessage.ReadByte() != NET_MESSAGE_INPUT)
+			continue;
+
+		oInput.Decode(oMessage);
+		if (oMessage.IsOverflowed())
+			continue;
+
+		// Jumps and shots add up. For everything else only the latest counts.
+		iJumps += oInput.m_iJumps;
+		iShots += oInput.m_iShots;
+
+		if (oInput.m_iAckTick > m_iAckTick && oInput.m_iAckTick <= m_iTick)
+			m_iAckTick = oInput.m_iAckTick;
+
+		bReceived = true;
+	}
+
+	oInput.m_iJumps = (unsigned char)std::min(iJumps, 255u);
+	oInput.m_iShots = (unsigned char)std::min(iShots, 255u);
+
+	m_oChannel.Flush(flTime);
+
+	return bReceived;
+}
+
+void CGameServer::SendSnapshot(CCharacter* pPlayer, float flTime)
+{
+	m_iTick++;
+
+	CSnapshot& oSnapshot = m_oHistory.Add(m_iTick);
+	oSnapshot.m_flTime = flTime;
+	oSnapshot.m_iPlayer = pPlayer ? (unsigned short)pPlayer->m_iIndex : 0xFFFF;
+	oSnapshot.m_aEvents.swap(m_aEvents);
+	m_aEvents.clear();
+
+	Game()->CaptureSnapshot(oSnapshot);
+
+	if (!m_oChannel.IsConnected())
+		return;
+
+	// If the client hasn't acked anything we still have, it gets the whole world again. Same if the ack
+	// is so old that the client may have thrown the baseline away by the time this gets there.
+	const CSnapshot* pBaseline = nullptr;
+	if (m_iTick - m_iAckTick < SNAPSHOT_HISTORY/2)
+		pBaseline = m_oHistory.Find(m_iAckTick);
+
+	m_oMessage.Clear();
+	oSnapshot.Encode(pBaseline, m_oMessage);
+
+	m_iLastSnapshotSize = m_oMessage.GetSize();
+	m_iLastSnapshotEntities = oSnapshot.m_aEntities.size();
+
+	m_oChannel.Send(m_oMessage, flTime);
+	m_oChannel.Flush(flTime);
+}
+
+void CGameServer::AddPuff(const Vector& vecOrigin)
+{
+	m_aEvents.push_back(CNetEvent());
+	m_aEvents.back().m_iEvent = NET_EVENT_PUFF;
+	m_aEvents.back().m_iIndex = 0;
+	m_aEvents.back().m_vecStart = vecOrigin;
+}
+
+void CGameServer::AddTracer(const Vector& vecStart, const Vector& vecEnd)
+{
+	m_aEvents.push_back(CNetEvent());
+	m_aEvents.back().m_iEvent = NET_EVENT_TRACER;
+	m_aEvents.back().m_iIndex = 0;
+	m_aEvents.back().m_vecStart = vecStart;
+	m_aEvents.back().m_vecEnd = vecEnd;
+}
+
+void CGameServer::AddShot(CCharacter* pCharacter)
+{
+	m_aEvents.push_back(CNetEvent());
+	m_aEvents.back().m_iEvent = NET_EVENT_SHOT;
+	m_aEvents.back().m_iIndex = (unsigned short)pCharacter->m_iIndex;
+}
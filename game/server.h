@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "netchannel.h"
+#include "snapshot.h"
+
+#define SERVER_TICK_RATE     20
+#define SERVER_TICK_INTERVAL (1.0f/SERVER_TICK_RATE)
+
+// The simulation side of a client/server game. It runs headless, takes input
+// from one client and sends it a snapshot of the world every tick.
+class CGameServer
+{
+public:
+	CGameServer();
+
+public:
+	bool                Initialize(unsigned short iPort);
+
+	// Gathers up everything the client has sent since the last tick. Returns false if there wasn't anything.
+	bool                ReadInput(float flTime, CClientInput& oInput);
+
+	// Take a snapshot of the world as it is now and send the client whatever it doesn't have yet.
+	void                SendSnapshot(class CCharacter* pPlayer, float flTime);
+
+	// Things that happened this tick that the client should see.
+	void                AddPuff(const Vector& vecOrigin);
+	void                AddTracer(const Vector& vecStart, const Vector& vecEnd);
+	void                AddShot(class CCharacter* pCharacter);
+
+	bool                IsConnected() const { return m_oChannel.IsConnected(); }
+
+	size_t              GetLastSnapshotSize() const { return m_iLastSnapshotSize; }
+	size_t              GetLastSnapshotEntities() const { return m_iLastSnapshotEntities; }
+	size_t              GetBytesSent() const { return m_oChannel.GetBytesSent(); }
+
+	void                SetFakeLag(float flSeconds) { m_oChannel.SetFakeLag(flSeconds); }
+
+private:
+	CNetChannel         m_oChannel;
+
+	unsigned int        m_iTick;
+	unsigned int        m_iAckTick;
+
+	CSnapshotHistory    m_oHistory;
+	std::vector<CNetEvent> m_aEvents;
+
+	CNetMessage         m_oMessage;
+
+	size_t              m_iLastSnapshotSize;
+	size_t              m_iLastSnapshotEntities;
+};
@@ -0,0 +1,489 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "snapshot.h"
+
+#include <algorithm>
+
+#include <maths.h>
+#include <common.h>
+
+// Which parts of an entity are in the message.
+#define ENTITY_FIELD_NEW 0x01  // Somebody we haven't seen in this slot. Everything is sent whole.
+#define ENTITY_FIELD_X   0x02
+#define ENTITY_FIELD_Y   0x04
+#define ENTITY_FIELD_Z   0x08
+#define ENTITY_FIELD_YAW   0x10
+#define ENTITY_FIELD_STATE 0x20  // Health and flags.
+
+#define ENTITY_FIELD_ALL (ENTITY_FIELD_NEW|ENTITY_FIELD_X|ENTITY_FIELD_Y|ENTITY_FIELD_Z|ENTITY_FIELD_YAW|ENTITY_FIELD_STATE)
+
+static int QuantizePosition(float fl)
+{
+	return (int)floor(fl * SNAPSHOT_POSITION_SCALE + 0.5f);
+}
+
+static float UnquantizePosition(int i)
+{
+	return (float)i / SNAPSHOT_POSITION_SCALE;
+}
+
+static void WritePosition(CNetMessage& oMessage, const Vector& vec)
+{
+	oMessage.WriteVarInt(QuantizePosition(vec.x));
+	oMessage.WriteVarInt(QuantizePosition(vec.y));
+	oMessage.WriteVarInt(QuantizePosition(vec.z));
+}
+
+static Vector ReadPosition(CNetMessage& oMessage)
+{
+	float x = UnquantizePosition(oMessage.ReadVarInt());
+	float y = UnquantizePosition(oMessage.ReadVarInt());
+	float z = UnquantizePosition(oMessage.ReadVarInt());
+	return Vector(x, y, z);
+}
+
+void CEntityState::Set(size_t iIndex, size_t iParity, net_entity_t eKind, const Vector& vecOrigin, const Vector& vecForward, int iHealth, unsigned char iFlags)
+{
+	m_iIndex = (unsigned short)iIndex;
+	m_iParity = (unsigned short)iParity;
+	m_iKind = (unsigned char)eKind;
+
+	m_aiOrigin[0] = QuantizePosition(vecOrigin.x);
+	m_aiOrigin[1] = QuantizePosition(vecOrigin.y);
+	m_aiOrigin[2] = QuantizePosition(vecOrigin.z);
+
+	m_iHealth = (unsigned char)std::max(0, std::min(iHealth, 255));
+	m_iFlags = iFlags;
+
+	// Characters only ever turn about the up axis, so the yaw is all we need.
+	float flYaw = atan2(vecForward.z, vecForward.x) * 180 / (float)M_PI;
+	if (flYaw < 0)
+		flYaw += 360;
+
+	m_iYaw = (unsigned short)((int)(flYaw / 360 * 65536 + 0.5f) & 0xFFFF);
+}
+
+Vector CEntityState::GetOrigin() const
+{
+	return Vector(UnquantizePosition(m_aiOrigin[0]), UnquantizePosition(m_aiOrigin[1]), UnquantizePosition(m_aiOrigin[2]));
+}
+
+float CEntityState::GetYaw() const
+{
+	return (float)m_iYaw / 65536 * 360;
+}
+
+CSnapshot::CSnapshot()
+{
+	m_iTick = 0;
+	m_flTime = 0;
+	m_iPlayer = 0xFFFF;
+}
+
+void CSnapshot::Encode(const CSnapshot* pBaseline, CNetMessage& oMessage) const
+{
+	static const std::vector<CEntityState> aEmpty;
+	const std::vector<CEntityState>& aBaseline = pBaseline ? pBaseline->m_aEntities : aEmpty;
+
+	oMessage.WriteByte(NET_MESSAGE_SNAPSHOT);
+	oMessage.WriteLong(m_iTick);
+	oMessage.WriteLong(pBaseline ? pBaseline->m_iTick : 0);
+	oMessage.WriteFloat(m_flTime);
+	oMessage.WriteShort(m_iPlayer);
+
+	// Walk the two sorted lists together. Anything only in the baseline is gone, anything
+	// only in the new one is new, and anything in both gets whatever fields changed.
+	CNetMessage oChanged;
+	CNetMessage oRemoved;
+	size_t iChanged = 0;
+	size_t iRemoved = 0;
+	int iLastChanged = -1;
+	int iLastRemoved = -1;
+
+	size_t iCurrent = 0;
+	size_t iBase = 0;
+	while (iCurrent < m_aEntities.size() || iBase < aBaseline.size())
+	{
+		if (iCurrent == m_aEntities.size() || (iBase < aBaseline.size() && aBaseline[iBase].m_iIndex < m_aEntities[iCurrent].m_iIndex))
+		{
+			oRemoved.WriteVarInt(aBaseline[iBase].m_iIndex - iLastRemoved);
+			iLastRemoved = aBaseline[iBase].m_iIndex;
+			iRemoved++;
+			iBase++;
+			continue;
+		}
+
+		const CEntityState& oEntity = m_aEntities[iCurrent];
+		const CEntityState* pBase = nullptr;
+		if (iBase < aBaseline.size() && aBaseline[iBase].m_iIndex == oEntity.m_iIndex)
+		{
+			// Somebody else in the same slot is new, not a change.
+			if (aBaseline[iBase].IsSameEntity(oEntity))
+				pBase = &aBaseline[iBase];
+
+			iBase++;
+		}
+
+		iCurrent++;
+
+		unsigned char iFields;
+		if (pBase)
+		{
+			iFields = 0;
+			if (oEntity.m_aiOrigin[0] != pBase->m_aiOrigin[0])
+				iFields |= ENTITY_FIELD_X;
+			if (oEntity.m_aiOrigin[1] != pBase->m_aiOrigin[1])
+				iFields |= ENTITY_FIELD_Y;
+			if (oEntity.m_aiOrigin[2] != pBase->m_aiOrigin[2])
+				iFields |= ENTITY_FIELD_Z;
+			if (oEntity.m_iYaw != pBase->m_iYaw)
+				iFields |= ENTITY_FIELD_YAW;
+			if (oEntity.m_iHealth != pBase->m_iHealth || oEntity.m_iFlags != pBase->m_iFlags)
+				iFields |= ENTITY_FIELD_STATE;
+
+			// Props sit still. Most of the world costs nothing once the client has it.
+			if (!iFields)
+				continue;
+		}
+		else
+			iFields = ENTITY_FIELD_ALL;
+
+		oChanged.WriteVarInt(oEntity.m_iIndex - iLastChanged);
+		iLastChanged = oEntity.m_iIndex;
+		iChanged++;
+
+		oChanged.WriteByte(iFields);
+
+		if (iFields & ENTITY_FIELD_NEW)
+		{
+			oChanged.WriteShort(oEntity.m_iParity);
+			oChanged.WriteByte(oEntity.m_iKind);
+		}
+
+		// Positions are sent as the difference from the baseline, which is usually a few steps.
+		for (size_t i = 0; i < 3; i++)
+		{
+			if (iFields & (ENTITY_FIELD_X << i))
+				oChanged.WriteVarInt(oEntity.m_aiOrigin[i] - (pBase ? pBase->m_aiOrigin[i] : 0));
+		}
+
+		if (iFields & ENTITY_FIELD_YAW)
+			oChanged.WriteShort(oEntity.m_iYaw);
+
+		if (iFields & ENTITY_FIELD_STATE)
+		{
+			oChanged.WriteByte(oEntity.m_iHealth);
+			oChanged.WriteByte(oEntity.m_iFlags);
+		}
+	}
+
+	oMessage.WriteVarInt((int)iRemoved);
+	oMessage.m_aiData.insert(oMessage.m_aiData.end(), oRemoved.m_aiData.begin(), oRemoved.m_aiData.end());
+
+	oMessage.WriteVarInt((int)iChanged);
+	oMessage.m_aiData.insert(oMessage.m_aiData.end(), oChanged.m_aiData.begin(), oChanged.m_aiData.end());
+
+	oMessage.WriteVarInt((int)m_aEvents.size());
+	for (size_t i = 0; i < m_aEvents.size(); i++)
+	{
+		const CNetEvent& oEvent = m_aEvents[i];
+
+		oMessage.WriteByte(oEvent.m_iEvent);
+
+		switch (oEvent.m_iEvent)
+		{
+		case NET_EVENT_PUFF:
+			WritePosition(oMessage, oEvent.m_vecStart);
+			break;
+
+		case NET_EVENT_TRACER:
+			WritePosition(oMessage, oEvent.m_vecStart);
+			WritePosition(oMessage, oEvent.m_vecEnd);
+			break;
+
+		case NET_EVENT_SHOT:
+			oMessage.WriteShort(oEvent.m_iIndex);
+			break;
+		}
+	}
+}
+
+bool CSnapshot::Decode(CNetMessage& oMessage, const CSnapshotHistory& oHistory)
+{
+	m_iTick = oMessage.ReadLong();
+	unsigned int iBaselineTick = oMessage.ReadLong();
+	m_flTime = oMessage.ReadFloat();
+	m_iPlayer = oMessage.ReadShort();
+
+	const CSnapshot* pBaseline = nullptr;
+	if (iBaselineTick)
+	{
+		pBaseline = oHistory.Find(iBaselineTick);
+
+		// We threw it away already. Can't happen as long as the server only uses ticks we've acked.
+		if (!pBaseline)
+			return false;
+	}
+
+	static const std::vector<CEntityState> aEmpty;
+	const std::vector<CEntityState>& aBaseline = pBaseline ? pBaseline->m_aEntities : aEmpty;
+
+	// Every count takes at least a byte per entry, so anything bigger than what's left is garbage.
+	// Check before reserving so a bad packet can't make us allocate the world.
+	size_t iRemoved = oMessage.ReadVarInt();
+	if (iRemoved > SNAPSHOT_MAX_ENTITIES || iRemoved > oMessage.GetRemaining())
+		return false;
+
+	std::vector<unsigned short> aiRemoved;
+	aiRemoved.reserve(iRemoved);
+	int iLastRemoved = -1;
+	for (size_t i = 0; i < iRemoved && !oMessage.IsOverflowed(); i++)
+	{
+		iLastRemoved += oMessage.ReadVarInt();
+		aiRemoved.push_back((unsigned short)iLastRemoved);
+	}
+
+	size_t iChanged = oMessage.ReadVarInt();
+	if (iChanged > SNAPSHOT_MAX_ENTITIES || iChanged > oMessage.GetRemaining())
+		return false;
+
+	m_aEntities.clear();
+	m_aEntities.reserve(aBaseline.size() + iChanged);
+
+	// Same walk as the encoder. Every index comes in ascending order.
+	size_t iBase = 0;
+	size_t iNextRemoved = 0;
+	int iLastChanged = -1;
+
+	for (size_t i = 0; i <= iChanged && !oMessage.IsOverflowed(); i++)
+	{
+		// When we're out of changes, copy over the rest of the baseline.
+		int iIndex = 0x10000;
+		if (i < iChanged)
+		{
+			iLastChanged += oMessage.ReadVarInt();
+			iIndex = iLastChanged;
+		}
+
+		// Whatever's in the baseline before this one didn't change.
+		for (; iBase < aBaseline.size() && aBaseline[iBase].m_iIndex <= iIndex; iBase++)
+		{
+			while (iNextRemoved < aiRemoved.size() && aiRemoved[iNextRemoved] < aBaseline[iBase].m_iIndex)
+				iNextRemoved++;
+
+			if (iNextRemoved < aiRemoved.size() && aiRemoved[iNextRemoved] == aBaseline[iBase].m_iIndex)
+				continue;
+
+			m_aEntities.push_back(aBaseline[iBase]);
+		}
+
+		if (i == iChanged)
+			break;
+
+		unsigned char iFields = oMessage.ReadByte();
+
+		// The baseline copy of this one, if there is one, was just pushed.
+		bool bHaveBase = m_aEntities.size() && m_aEntities.back().m_iIndex == iIndex;
+
+		if (iFields & ENTITY_FIELD_NEW)
+		{
+			if (!bHaveBase)
+				m_aEntities.push_back(CEntityState());
+
+			CEntityState& oEntity = m_aEntities.back();
+			oEntity.m_iIndex = (unsigned short)iIndex;
+			oEntity.m_iParity = oMessage.ReadShort();
+			oEntity.m_iKind = oMessage.ReadByte();
+			oEntity.m_aiOrigin[0] = oEntity.m_aiOrigin[1] = oEntity.m_aiOrigin[2] = 0;
+			oEntity.m_iYaw = 0;
+			oEntity.m_iHealth = 0;
+			oEntity.m_iFlags = 0;
+		}
+		else if (!bHaveBase)
+		{
+			// A change to something we don't have. The stream is broken.
+			TAssert(bHaveBase);
+			return false;
+		}
+
+		CEntityState& oEntity = m_aEntities.back();
+
+		for (size_t j = 0; j < 3; j++)
+		{
+			if (iFields & (ENTITY_FIELD_X << j))
+				oEntity.m_aiOrigin[j] += oMessage.ReadVarInt();
+		}
+
+		if (iFields & ENTITY_FIELD_YAW)
+			oEntity.m_iYaw = oMessage.ReadShort();
+
+		if (iFields & ENTITY_FIELD_STATE)
+		{
+			oEntity.m_iHealth = oMessage.ReadByte();
+			oEntity.m_iFlags = oMessage.ReadByte();
+		}
+	}
+
+	size_t iEvents = oMessage.ReadVarInt();
+	m_aEvents.clear();
+	for (size_t i = 0; i < iEvents && !oMessage.IsOverflowed(); i++)
+	{
+		m_aEvents.push_back(CNetEvent());
+		CNetEvent& oEvent = m_aEvents.back();
+
+		oEvent.m_iEvent = oMessage.ReadByte();
+		oEvent.m_iIndex = 0;
+
+		switch (oEvent.m_iEvent)
+		{
+		case NET_EVENT_PUFF:
+			oEvent.m_vecStart = ReadPosition(oMessage);
+			break;
+
+		case NET_EVENT_TRACER:
+			oEvent.m_vecStart = ReadPosition(oMessage);
+			oEvent.m_vecEnd = ReadPosition(oMessage);
+			break;
+
+		case NET_EVENT_SHOT:
+			oEvent.m_iIndex = oMessage.ReadShort();
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return !oMessage.IsOverflowed();
+}
+
+const CEntityState* CSnapshot::FindEntity(size_t iIndex) const
+{
+	size_t iLow = 0;
+	size_t iHigh = m_aEntities.size();
+	while (iLow < iHigh)
+	{
+		size_t iMiddle = (iLow + iHigh) / 2;
+		if (m_aEntities[iMiddle].m_iIndex < iIndex)
+			iLow = iMiddle + 1;
+		else
+			iHigh = iMiddle;
+	}
+
+	if (iLow < m_aEntities.size() && m_aEntities[iLow].m_iIndex == iIndex)
+		return &m_aEntities[iLow];
+
+	return nullptr;
+}
+
+// FNV-1a. It's quick and it's plenty to catch a decoder that's gone wrong.
+static void HashBytes(unsigned int& iHash, unsigned int iValue, size_t iBytes)
+{
+	for (size_t i = 0; i < iBytes; i++)
+	{
+		iHash ^= (iValue >> (i*8)) & 0xFF;
+		iHash *= 16777619;
+	}
+}
+
+unsigned int CSnapshot::GetChecksum() const
+{
+	unsigned int iHash = 2166136261u;
+
+	for (size_t i = 0; i < m_aEntities.size(); i++)
+	{
+		const CEntityState& oEntity = m_aEntities[i];
+
+		HashBytes(iHash, oEntity.m_iIndex, 2);
+		HashBytes(iHash, oEntity.m_iParity, 2);
+		HashBytes(iHash, oEntity.m_iKind, 1);
+		HashBytes(iHash, oEntity.m_aiOrigin[0], 4);
+		HashBytes(iHash, oEntity.m_aiOrigin[1], 4);
+		HashBytes(iHash, oEntity.m_aiOrigin[2], 4);
+		HashBytes(iHash, oEntity.m_iYaw, 2);
+		HashBytes(iHash, oEntity.m_iHealth, 1);
+		HashBytes(iHash, oEntity.m_iFlags, 1);
+	}
+
+	return iHash;
+}
+
+CSnapshotHistory::CSnapshotHistory()
+{
+	m_iLatestTick = 0;
+}
+
+CSnapshot& CSnapshotHistory::Add(unsigned int iTick)
+{
+	TAssert(iTick);
+
+	CSnapshot& oSnapshot = m_aSnapshots[iTick % SNAPSHOT_HISTORY];
+	oSnapshot.m_iTick = iTick;
+
+	if (iTick > m_iLatestTick)
+		m_iLatestTick = iTick;
+
+	return oSnapshot;
+}
+
+const CSnapshot* CSnapshotHistory::Find(unsigned int iTick) const
+{
+	if (!iTick)
+		return nullptr;
+
+	const CSnapshot& oSnapshot = m_aSnapshots[iTick % SNAPSHOT_HISTORY];
+
+	// Overwritten by a newer one.
+	if (oSnapshot.m_iTick != iTick)
+		return nullptr;
+
+	return &oSnapshot;
+}
+
+CClientInput::CClientInput()
+{
+	m_iAckTick = 0;
+	m_vecMovementGoal = Vector(0, 0, 0);
+	m_iJumps = 0;
+	m_iShots = 0;
+}
+
+void CClientInput::Encode(CNetMessage& oMessage) const
+{
+	oMessage.WriteByte(NET_MESSAGE_INPUT);
+	oMessage.WriteLong(m_iAckTick);
+	oMessage.WriteFloat(m_vecMovementGoal.x);
+	oMessage.WriteFloat(m_vecMovementGoal.z);
+	oMessage.WriteFloat(m_angView.p);
+	oMessage.WriteFloat(m_angView.y);
+	oMessage.WriteByte(m_iJumps);
+	oMessage.WriteByte(m_iShots);
+}
+
+void CClientInput::Decode(CNetMessage& oMessage)
+{
+	m_iAckTick = oMessage.ReadLong();
+	m_vecMovementGoal.x = oMessage.ReadFloat();
+	m_vecMovementGoal.y = 0;
+	m_vecMovementGoal.z = oMessage.ReadFloat();
+	m_angView.p = oMessage.ReadFloat();
+	m_angView.y = oMessage.ReadFloat();
+	m_angView.r = 0;
+	m_iJumps = oMessage.ReadByte();
+	m_iShots = oMessage.ReadByte();
+}
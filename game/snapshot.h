@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <vector.h>
+#include <euler.h>
+
+#include "netchannel.h"
+
+#define NET_DEFAULT_PORT 26010
+
+// Positions go over the wire in fixed point, this many steps to the unit.
+#define SNAPSHOT_POSITION_SCALE 64
+
+// How many old snapshots both sides keep around to delta against.
+#define SNAPSHOT_HISTORY 64
+
+// The most entities a snapshot can carry. Same as MAX_CHARACTERS, which the game checks,
+// but kept here so the codec doesn't need the game to build.
+#define SNAPSHOT_MAX_ENTITIES 16384
+
+// The first byte of every message.
+typedef enum
+{
+	NET_MESSAGE_SNAPSHOT,
+	NET_MESSAGE_INPUT,
+	NET_MESSAGE_ACK,      // Just a tick. Tools that only watch send these instead of input.
+} net_message_t;
+
+// What a character is, so the client knows how to draw it.
+typedef enum
+{
+	NET_ENTITY_PLAYER,
+	NET_ENTITY_MONSTER,
+	NET_ENTITY_PROP,
+} net_entity_t;
+
+// Bits in CEntityState::m_iFlags.
+#define ENTITY_STATE_THINKING 0x01  // Has a behavior running.
+#define ENTITY_STATE_SHOT     0x02  // Shot effect is playing.
+
+typedef enum
+{
+	NET_EVENT_PUFF,
+	NET_EVENT_TRACER,
+	NET_EVENT_SHOT,
+} net_event_t;
+
+// One character as the client sees it.
+class CEntityState
+{
+public:
+	void                Set(size_t iIndex, size_t iParity, net_entity_t eKind, const Vector& vecOrigin, const Vector& vecForward, int iHealth, unsigned char iFlags);
+
+	Vector              GetOrigin() const;
+	float               GetYaw() const;
+
+	bool                IsSameEntity(const CEntityState& oOther) const { return m_iParity == oOther.m_iParity && m_iKind == oOther.m_iKind; }
+
+public:
+	unsigned short      m_iIndex;
+	unsigned short      m_iParity;
+	unsigned char       m_iKind;
+	int                 m_aiOrigin[3];
+	unsigned short      m_iYaw;
+	unsigned char       m_iHealth;
+	unsigned char       m_iFlags;
+};
+
+// Something that happened during a tick that the client needs to show.
+class CNetEvent
+{
+public:
+	unsigned char       m_iEvent;
+	unsigned short      m_iIndex;
+	Vector              m_vecStart;
+	Vector              m_vecEnd;
+};
+
+class CSnapshot
+{
+public:
+	CSnapshot();
+
+public:
+	// Sends only what changed since pBaseline. With no baseline everything goes.
+	void                Encode(const CSnapshot* pBaseline, CNetMessage& oMessage) const;
+
+	// The message says which baseline it was made against and it must be in the history.
+	// The message type byte must already have been read.
+	bool                Decode(CNetMessage& oMessage, const class CSnapshotHistory& oHistory);
+
+	const CEntityState* FindEntity(size_t iIndex) const;
+
+	// A hash of every entity. Tools use it to check that they decoded the same thing the server encoded.
+	unsigned int        GetChecksum() const;
+
+public:
+	unsigned int        m_iTick;         // Zero is never a real tick.
+	float               m_flTime;        // Server clock when it was taken.
+	unsigned short      m_iPlayer;       // Index of the client's own character.
+
+	// Sorted by index.
+	std::vector<CEntityState> m_aEntities;
+	std::vector<CNetEvent>    m_aEvents;
+};
+
+class CSnapshotHistory
+{
+public:
+	CSnapshotHistory();
+
+public:
+	CSnapshot&          Add(unsigned int iTick);
+	const CSnapshot*    Find(unsigned int iTick) const;
+
+	unsigned int        GetLatestTick() const { return m_iLatestTick; }
+
+private:
+	CSnapshot           m_aSnapshots[SNAPSHOT_HISTORY];
+	unsigned int        m_iLatestTick;
+};
+
+// What the client sends the server.
+class CClientInput
+{
+public:
+	CClientInput();
+
+public:
+	void                Encode(CNetMessage& oMessage) const;
+	void                Decode(CNetMessage& oMessage);
+
+public:
+	unsigned int        m_iAckTick;      // Latest snapshot the client has, so the server can delta against it.
+	Vector              m_vecMovementGoal;
+	EAngle              m_angView;
+	unsigned char       m_iJumps;        // Since the last input.
+	unsigned char       m_iShots;
+};
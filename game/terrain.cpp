@@ -0,0 +1,461 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "terrain.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <common.h>
+
+#include <math/frustum.h>
+
+#include <renderer/renderer.h>
+#include <renderer/renderingcontext.h>
+
+// Position, normal, texcoord
+#define TERRAIN_VERTEX_FLOATS   8
+#define TERRAIN_VERTEX_STRIDE   (TERRAIN_VERTEX_FLOATS*sizeof(float))
+
+CTerrain::CTerrain()
+{
+	m_iIBO = 0;
+	m_iIndices = 0;
+	m_iFrame = 0;
+	m_iBuildsLeft = 0;
+	m_iDrawCalls = 0;
+}
+
+void CTerrain::Draw(CRenderingContext* c, CFrustum& oFrustum, const Vector& vecCamera)
+{
+	m_iFrame++;
+	m_iBuildsLeft = TERRAIN_BUILDS_PER_FRAME;
+	m_iDrawCalls = 0;
+
+	// Every patch has the same layout, so they can all share one index buffer.
+	if (!m_iIBO)
+	{
+		std::vector<unsigned int> aiIndices;
+
+		for (int j = 0; j < TERRAIN_PATCH_QUADS; j++)
+		{
+			for (int i = 0; i < TERRAIN_PATCH_QUADS; i++)
+			{
+				unsigned int v00 = j*TERRAIN_PATCH_VERTS + i;
+				unsigned int v10 = v00 + 1;
+				unsigned int v01 = v00 + TERRAIN_PATCH_VERTS;
+				unsigned int v11 = v01 + 1;
+
+				// GetHeight() has to split the quads along the same diagonal.
+				aiIndices.push_back(v00);
+				aiIndices.push_back(v01);
+				aiIndices.push_back(v11);
+
+				aiIndices.push_back(v00);
+				aiIndices.push_back(v11);
+				aiIndices.push_back(v10);
+			}
+		}
+
+		// The skirt hangs down from each edge of the patch. Where a patch meets a
+		// neighbor at a different level of detail, the skirt fills in the gap.
+		unsigned int iSkirtStart = TERRAIN_PATCH_VERTS*TERRAIN_PATCH_VERTS;
+		for (int iEdge = 0; iEdge < 4; iEdge++)
+		{
+			for (int k = 0; k < TERRAIN_PATCH_QUADS; k++)
+			{
+				unsigned int iTop0, iTop1;
+				if (iEdge == 0)
+					iTop0 = k;
+				else if (iEdge == 1)
+					iTop0 = TERRAIN_PATCH_QUADS*TERRAIN_PATCH_VERTS + k;
+				else if (iEdge == 2)
+					iTop0 = k*TERRAIN_PATCH_VERTS;
+				else
+					iTop0 = k*TERRAIN_PATCH_VERTS + TERRAIN_PATCH_QUADS;
+
+				iTop1 = iTop0 + ((iEdge < 2)?1:TERRAIN_PATCH_VERTS);
+
+				unsigned int iSkirt0 = iSkirtStart + iEdge*TERRAIN_PATCH_VERTS + k;
+				unsigned int iSkirt1 = iSkirt0 + 1;
+
+				aiIndices.push_back(iTop0);
+				aiIndices.push_back(iTop1);
+				aiIndices.push_back(iSkirt1);
+
+				aiIndices.push_back(iTop0);
+				aiIndices.push_back(iSkirt1);
+				aiIndices.push_back(iSkirt0);
+			}
+		}
+
+		m_iIndices = aiIndices.size();
+		m_iIBO = CRenderer::LoadIndexDataIntoGL(aiIndices.size()*sizeof(unsigned int), aiIndices.data());
+	}
+
+	// Lay the roots out on a grid and draw the ones that are close enough to see.
+	float flRootSize = TERRAIN_PATCH_QUADS * TERRAIN_SPACING * (1<<(TERRAIN_LEVELS-1));
+	int iMinX = (int)floor((vecCamera.x - TERRAIN_DRAW_DISTANCE) / flRootSize);
+	int iMaxX = (int)floor((vecCamera.x + TERRAIN_DRAW_DISTANCE) / flRootSize);
+	int iMinZ = (int)floor((vecCamera.z - TERRAIN_DRAW_DISTANCE) / flRootSize);
+	int iMaxZ = (int)floor((vecCamera.z + TERRAIN_DRAW_DISTANCE) / flRootSize);
+
+	// Skirts are seen from both sides. Draw us in a context of our own and this goes away with it.
+	c->SetBackCulling(false);
+
+	for (int x = iMinX; x <= iMaxX; x++)
+	{
+		for (int z = iMinZ; z <= iMaxZ; z++)
+			DrawNode(c, oFrustum, vecCamera, TERRAIN_LEVELS-1, x, z);
+	}
+
+	if (m_iFrame % TERRAIN_EVICT_FRAMES == 0)
+		EvictNodes();
+}
+
+void CTerrain::DrawNode(CRenderingContext* c, CFrustum& oFrustum, const Vector& vecCamera, int iLevel, int iX, int iZ)
+{
+	if (!IsVisible(oFrustum, iLevel, iX, iZ))
+		return;
+
+	// The roots have to be there or there'd be a hole in the world. Everything else can wait.
+	CTerrainNode* pNode = GetNode(iLevel, iX, iZ, iLevel == TERRAIN_LEVELS-1);
+	if (!pNode)
+		return;
+
+	// Split nodes count too. Their children are no use without them next time the camera backs off.
+	pNode->m_iLastDrawnFrame = m_iFrame;
+
+	if (iLevel > 0 && ShouldSplit(vecCamera, iLevel, iX, iZ))
+	{
+		// Only split if every child we'd see is ready. Otherwise draw this node for now.
+		bool bChildrenReady = true;
+		for (int i = 0; i < 4; i++)
+		{
+			int iChildX = iX*2 + (i&1);
+			int iChildZ = iZ*2 + (i>>1);
+
+			if (!IsVisible(oFrustum, iLevel-1, iChildX, iChildZ))
+				continue;
+
+			if (!GetNode(iLevel-1, iChildX, iChildZ))
+				bChildrenReady = false;
+		}
+
+		if (bChildrenReady)
+		{
+			for (int i = 0; i < 4; i++)
+				DrawNode(c, oFrustum, vecCamera, iLevel-1, iX*2 + (i&1), iZ*2 + (i>>1));
+
+			return;
+		}
+	}
+
+	c->BeginRenderVertexArray(pNode->m_iVBO);
+	c->SetPositionBuffer((size_t)0, TERRAIN_VERTEX_STRIDE);
+	c->SetNormalsBuffer(3*sizeof(float), TERRAIN_VERTEX_STRIDE);
+	c->SetTexCoordBuffer(6*sizeof(float), TERRAIN_VERTEX_STRIDE);
+	c->EndRenderVertexArrayIndexed(m_iIBO, m_iIndices);
+
+	m_iDrawCalls++;
+}
+
+bool CTerrain::IsVisible(CFrustum& oFrustum, int iLevel, int iX, int iZ)
+{
+	Vector vecMin, vecMax;
+	GetNodeBounds(iLevel, iX, iZ, vecMin, vecMax);
+
+	return oFrustum.AABBIntersection(vecMin, vecMax);
+}
+
+bool CTerrain::ShouldSplit(const Vector& vecCamera, int iLevel, int iX, int iZ)
+{
+	Vector vecMin, vecMax;
+	GetNodeBounds(iLevel, iX, iZ, vecMin, vecMax);
+
+	// Distance from the camera to the closest point in the node's box.
+	Vector vecClosest;
+	vecClosest.x = std::max(vecMin.x, std::min(vecCamera.x, vecMax.x));
+	vecClosest.y = std::max(vecMin.y, std::min(vecCamera.y, vecMax.y));
+	vecClosest.z = std::max(vecMin.z, std::min(vecCamera.z, vecMax.z));
+
+	return (vecClosest - vecCamera).Length() < (vecMax.x - vecMin.x) * TERRAIN_LOD_DISTANCE;
+}
+
+CTerrainNode* CTerrain::GetNode(int iLevel, int iX, int iZ, bool bForceBuild)
+{
+	long long iKey = NodeKey(iLevel, iX, iZ);
+
+	std::map<long long, CTerrainNode>::iterator it = m_aNodes.find(iKey);
+	if (it != m_aNodes.end())
+		return &it->second;
+
+	if (!m_iBuildsLeft && !bForceBuild)
+		return nullptr;
+
+	if (m_iBuildsLeft)
+		m_iBuildsLeft--;
+
+	CTerrainNode& oNode = m_aNodes[iKey];
+	BuildNode(oNode, iLevel, iX, iZ);
+	return &oNode;
+}
+
+// Sample the heightfield and put the patch into a vertex buffer. This only happens
+// once, the node keeps its buffer until it's been out of sight for a while.
+void CTerrain::BuildNode(CTerrainNode& oNode, int iLevel, int iX, int iZ)
+{
+	int iStep = 1<<iLevel;
+	int iOriginX = iX * TERRAIN_PATCH_QUADS * iStep;
+	int iOriginZ = iZ * TERRAIN_PATCH_QUADS * iStep;
+
+	// One extra sample all the way around so we can find the normals on the edges.
+	const int iSamples = TERRAIN_PATCH_VERTS+2;
+	float aflHeights[iSamples*iSamples];
+
+	for (int j = 0; j < iSamples; j++)
+	{
+		for (int i = 0; i < iSamples; i++)
+			aflHeights[j*iSamples + i] = SampleHeight(iOriginX + (i-1)*iStep, iOriginZ + (j-1)*iStep);
+	}
+
+	std::vector<float> aflVerts;
+	aflVerts.reserve((TERRAIN_PATCH_VERTS*TERRAIN_PATCH_VERTS + 4*TERRAIN_PATCH_VERTS) * TERRAIN_VERTEX_FLOATS);
+
+	oNode.m_flMinHeight = TERRAIN_MAX_HEIGHT;
+	oNode.m_flMaxHeight = -TERRAIN_MAX_HEIGHT;
+
+	float flSpacing = iStep * TERRAIN_SPACING;
+
+	for (int j = 0; j < TERRAIN_PATCH_VERTS; j++)
+	{
+		for (int i = 0; i < TERRAIN_PATCH_VERTS; i++)
+		{
+			float* pflHeight = &aflHeights[(j+1)*iSamples + (i+1)];
+			float flHeight = *pflHeight;
+
+			oNode.m_flMinHeight = std::min(oNode.m_flMinHeight, flHeight);
+			oNode.m_flMaxHeight = std::max(oNode.m_flMaxHeight, flHeight);
+
+			// Central differences
+			Vector vecNormal(pflHeight[-1] - pflHeight[1], 2*flSpacing, pflHeight[-iSamples] - pflHeight[iSamples]);
+			vecNormal.Normalize();
+
+			aflVerts.push_back((iOriginX + i*iStep) * TERRAIN_SPACING);
+			aflVerts.push_back(flHeight);
+			aflVerts.push_back((iOriginZ + j*iStep) * TERRAIN_SPACING);
+			aflVerts.push_back(vecNormal.x);
+			aflVerts.push_back(vecNormal.y);
+			aflVerts.push_back(vecNormal.z);
+			aflVerts.push_back((float)i/TERRAIN_PATCH_QUADS);
+			aflVerts.push_back((float)j/TERRAIN_PATCH_QUADS);
+		}
+	}
+
+	// Copy each edge and drop it down to make the skirts. A coarser neighbor can be off
+	// by as much as the hills are tall over one of our quads, so go that far. There's no
+	// point going deeper than the whole range of heights though.
+	float flSkirtDepth = std::min(flSpacing * 2, TERRAIN_MAX_HEIGHT * 2);
+
+	for (int iEdge = 0; iEdge < 4; iEdge++)
+	{
+		for (int k = 0; k < TERRAIN_PATCH_VERTS; k++)
+		{
+			int iTop;
+			if (iEdge == 0)
+				iTop = k;
+			else if (iEdge == 1)
+				iTop = TERRAIN_PATCH_QUADS*TERRAIN_PATCH_VERTS + k;
+			else if (iEdge == 2)
+				iTop = k*TERRAIN_PATCH_VERTS;
+			else
+				iTop = k*TERRAIN_PATCH_VERTS + TERRAIN_PATCH_QUADS;
+
+			for (int f = 0; f < TERRAIN_VERTEX_FLOATS; f++)
+				aflVerts.push_back(aflVerts[iTop*TERRAIN_VERTEX_FLOATS + f]);
+
+			aflVerts[aflVerts.size() - TERRAIN_VERTEX_FLOATS + 1] -= flSkirtDepth;
+		}
+	}
+
+	oNode.m_iVBO = CRenderer::LoadVertexDataIntoGL(aflVerts.size()*sizeof(float), aflVerts.data());
+	oNode.m_iLastDrawnFrame = m_iFrame;
+}
+
+void CTerrain::EvictNodes()
+{
+	for (std::map<long long, CTerrainNode>::iterator it = m_aNodes.begin(); it != m_aNodes.end(); )
+	{
+		if (m_iFrame - it->second.m_iLastDrawnFrame < TERRAIN_EVICT_FRAMES)
+		{
+			it++;
+			continue;
+		}
+
+		CRenderer::UnloadVertexDataFromGL(it->second.m_iVBO);
+		m_aNodes.erase(it++);
+	}
+}
+
+void CTerrain::GetNodeBounds(int iLevel, int iX, int iZ, Vector& vecMin, Vector& vecMax)
+{
+	float flSize = TERRAIN_PATCH_QUADS * TERRAIN_SPACING * (1<<iLevel);
+
+	vecMin = Vector(iX * flSize, -TERRAIN_MAX_HEIGHT, iZ * flSize);
+	vecMax = Vector((iX+1) * flSize, TERRAIN_MAX_HEIGHT, (iZ+1) * flSize);
+
+	// If we've built it we know how tall it really is.
+	std::map<long long, CTerrainNode>::iterator it = m_aNodes.find(NodeKey(iLevel, iX, iZ));
+	if (it != m_aNodes.end())
+	{
+		vecMin.y = it->second.m_flMinHeight;
+		vecMax.y = it->second.m_flMaxHeight;
+	}
+}
+
+float CTerrain::GetHeight(float x, float z)
+{
+	float flGridX = x / TERRAIN_SPACING;
+	float flGridZ = z / TERRAIN_SPACING;
+
+	int iX = (int)floor(flGridX);
+	int iZ = (int)floor(flGridZ);
+
+	float fx = flGridX - iX;
+	float fz = flGridZ - iZ;
+
+	float h00 = SampleHeight(iX, iZ);
+	float h10 = SampleHeight(iX+1, iZ);
+	float h01 = SampleHeight(iX, iZ+1);
+	float h11 = SampleHeight(iX+1, iZ+1);
+
+	// Interpolate across whichever of the quad's two triangles we're in, so that
+	// we get exactly the surface that gets drawn up close.
+	if (fx >= fz)
+		return h00 + fx*(h10 - h00) + fz*(h11 - h10);
+	else
+		return h00 + fz*(h01 - h00) + fx*(h11 - h01);
+}
+
+#define TERRAIN_TRACE_STEP 0.5f
+
+bool CTerrain::TraceLine(const Vector& v0, const Vector& v1, Vector& vecIntersection, float& flFraction)
+{
+	// Nothing up there to hit.
+	if (v0.y > TERRAIN_MAX_HEIGHT && v1.y > TERRAIN_MAX_HEIGHT)
+		return false;
+
+	Vector vecDirection = v1 - v0;
+
+	// March along the line until we find ourselves under the ground...
+	int iSteps = (int)(vecDirection.Length() / TERRAIN_TRACE_STEP) + 1;
+
+	float flPrevious = 0;
+	for (int i = 0; i <= iSteps; i++)
+	{
+		float flCurrent = (float)i/iSteps;
+		Vector vecPoint = v0 + vecDirection * flCurrent;
+
+		if (vecPoint.y > GetHeight(vecPoint.x, vecPoint.z))
+		{
+			flPrevious = flCurrent;
+			continue;
+		}
+
+		if (i == 0)
+		{
+			// Started out underground.
+			vecIntersection = v0;
+			flFraction = 0;
+			return true;
+		}
+
+		// ...then narrow it down between the last point above and the first point below.
+		float flAbove = flPrevious;
+		float flBelow = flCurrent;
+		for (int j = 0; j < 10; j++)
+		{
+			float flMiddle = (flAbove + flBelow)/2;
+			Vector vecMiddle = v0 + vecDirection * flMiddle;
+
+			if (vecMiddle.y > GetHeight(vecMiddle.x, vecMiddle.z))
+				flAbove = flMiddle;
+			else
+				flBelow = flMiddle;
+		}
+
+		flFraction = flBelow;
+		vecIntersection = v0 + vecDirection * flBelow;
+		return true;
+	}
+
+	return false;
+}
+
+// Hash a lattice point into a value in [-1, 1].
+inline float LatticeValue(int x, int z)
+{
+	unsigned int h = (unsigned int)x * 374761393u + (unsigned int)z * 668265263u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+	return (float)(h & 0xFFFF) / 32767.5f - 1;
+}
+
+// Smoothly interpolated lattice values. http://en.wikipedia.org/wiki/Value_noise
+// iSeed keeps the octaves from all lining up with each other.
+inline float ValueNoise(int x, int z, int iPeriod, int iSeed)
+{
+	int iCellX = (x >= 0) ? x / iPeriod : -((-x - 1) / iPeriod) - 1;
+	int iCellZ = (z >= 0) ? z / iPeriod : -((-z - 1) / iPeriod) - 1;
+
+	float fx = (float)(x - iCellX*iPeriod) / iPeriod;
+	float fz = (float)(z - iCellZ*iPeriod) / iPeriod;
+
+	fx = fx*fx*(3 - 2*fx);
+	fz = fz*fz*(3 - 2*fz);
+
+	iCellX += iSeed;
+
+	float a = LatticeValue(iCellX, iCellZ);
+	float b = LatticeValue(iCellX+1, iCellZ);
+	float c = LatticeValue(iCellX, iCellZ+1);
+	float d = LatticeValue(iCellX+1, iCellZ+1);
+
+	return (a + (b - a)*fx) + ((c + (d - c)*fx) - (a + (b - a)*fx))*fz;
+}
+
+// The height at one of the heightfield's sample points.
+float CTerrain::SampleHeight(int x, int z)
+{
+	float flHeight = 0;
+	float flAmplitude = TERRAIN_HEIGHT;
+	int iPeriod = 256;
+
+	for (int i = 0; i < TERRAIN_OCTAVES; i++)
+	{
+		flHeight += ValueNoise(x, z, iPeriod, i*7919) * flAmplitude;
+		flAmplitude /= 2;
+		iPeriod /= 2;
+	}
+
+	return flHeight;
+}
+
+long long CTerrain::NodeKey(int iLevel, int iX, int iZ)
+{
+	return ((long long)iLevel << 56) | ((long long)(iX & 0xFFFFFFF) << 28) | (long long)(iZ & 0xFFFFFFF);
+}
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <map>
+
+#include <vector.h>
+
+// The terrain is a heightfield with one sample every TERRAIN_SPACING units. The heights
+// are made up from noise as they're needed, so it goes on forever without having to
+// be stored anywhere.
+#define TERRAIN_SPACING         1.0f
+#define TERRAIN_HEIGHT          12.0f   // Amplitude of the biggest hills.
+#define TERRAIN_OCTAVES         5
+#define TERRAIN_MAX_HEIGHT      (TERRAIN_HEIGHT*2)  // Every octave is half the one before, so it can never add up to more than this.
+
+// Every node in the quadtree is drawn as a patch of this many quads on a side, no
+// matter how big it is. Bigger nodes just space the samples out more.
+#define TERRAIN_PATCH_QUADS     32
+#define TERRAIN_PATCH_VERTS     (TERRAIN_PATCH_QUADS+1)
+
+// Level 0 nodes are the finest, one quad per sample. Each level up is twice as big.
+// The root of each tree covers 4096x4096 samples.
+#define TERRAIN_LEVELS          8
+
+// A node is split into its children when the camera is closer to it than this many times its size.
+#define TERRAIN_LOD_DISTANCE    2.0f
+
+#define TERRAIN_DRAW_DISTANCE   1000.0f
+#define TERRAIN_BUILDS_PER_FRAME 4
+
+// Nodes that haven't been drawn in this many frames give their buffers back.
+#define TERRAIN_EVICT_FRAMES    120
+
+class CTerrainNode
+{
+public:
+	size_t      m_iVBO;
+	float       m_flMinHeight;
+	float       m_flMaxHeight;
+	size_t      m_iLastDrawnFrame;
+};
+
+class CTerrain
+{
+public:
+	CTerrain();
+
+public:
+	// Leaves back face culling off, so give it a context of its own.
+	void            Draw(class CRenderingContext* c, class CFrustum& oFrustum, const Vector& vecCamera);
+
+	size_t          GetNumDrawCalls() const { return m_iDrawCalls; }
+	size_t          GetNumNodes() const { return m_aNodes.size(); }
+
+	// These only depend on the noise, so they're safe to call from any thread.
+	static float    GetHeight(float x, float z);
+	static bool     TraceLine(const Vector& v0, const Vector& v1, Vector& vecIntersection, float& flFraction);
+
+private:
+	void            DrawNode(class CRenderingContext* c, class CFrustum& oFrustum, const Vector& vecCamera, int iLevel, int iX, int iZ);
+	bool            IsVisible(class CFrustum& oFrustum, int iLevel, int iX, int iZ);
+	bool            ShouldSplit(const Vector& vecCamera, int iLevel, int iX, int iZ);
+
+	// Find a node, building it if there's any budget left this frame. Returns null if it isn't ready.
+	CTerrainNode*   GetNode(int iLevel, int iX, int iZ, bool bForceBuild = false);
+	void            BuildNode(CTerrainNode& oNode, int iLevel, int iX, int iZ);
+	void            EvictNodes();
+
+	void            GetNodeBounds(int iLevel, int iX, int iZ, Vector& vecMin, Vector& vecMax);
+
+	static float    SampleHeight(int x, int z);
+	static long long NodeKey(int iLevel, int iX, int iZ);
+
+private:
+	std::map<long long, CTerrainNode>   m_aNodes;
+
+	size_t          m_iIBO;
+	size_t          m_iIndices;
+
+	size_t          m_iFrame;
+	size_t          m_iBuildsLeft;
+	size_t          m_iDrawCalls;
+};
@@ -0,0 +1,291 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "timers.h"
+
+#include <cmath>
+
+#include <common.h>
+
+#include "game.h"
+#include "character.h"
+
+#define TIMER_FREE    0
+#define TIMER_PENDING 1
+#define TIMER_FIRING  2
+
+CTimerWheel::CTimerWheel()
+{
+	m_iFirstFree = ~0;
+	m_iCurrentTick = 0;
+	m_iPending = 0;
+	m_iFiredLastAdvance = 0;
+
+	for (size_t i = 0; i < TIMER_WHEEL_LEVELS; i++)
+	{
+		for (size_t j = 0; j < TIMER_WHEEL_SLOTS; j++)
+			m_aiSlots[i][j] = ~0;
+	}
+}
+
+CTimerHandle CTimerWheel::Schedule(CCharacter* pCharacter, float flDelay, TimerCallback pfnCallback, size_t iData)
+{
+	TAssert(pfnCallback);
+
+	size_t iTimer = AllocateTimer();
+	CTimer& oTimer = m_aTimers[iTimer];
+
+	// Always at least one tick away, so a timer never fires during the tick that scheduled it.
+	unsigned long long iDelayTicks = 1;
+	if (flDelay > 0)
+		iDelayTicks = (unsigned long long)ceil(flDelay * TIMER_TICKS_PER_SECOND);
+	if (iDelayTicks < 1)
+		iDelayTicks = 1;
+
+	oTimer.m_iExpireTick = m_iCurrentTick + iDelayTicks;
+	oTimer.m_hCharacter = pCharacter;
+	oTimer.m_bHasCharacter = !!pCharacter;
+	oTimer.m_pfnCallback = pfnCallback;
+	oTimer.m_iData = iData;
+	oTimer.m_iState = TIMER_PENDING;
+
+	Link(iTimer);
+
+	m_iPending++;
+
+	CTimerHandle hTimer;
+	hTimer.m_iIndex = iTimer;
+	hTimer.m_iParity = oTimer.m_iParity;
+	return hTimer;
+}
+
+bool CTimerWheel::Cancel(CTimerHandle& hTimer)
+{
+	bool bPending = IsPending(hTimer);
+
+	if (bPending)
+	{
+		CTimer& oTimer = m_aTimers[hTimer.m_iIndex];
+
+		// A timer that's already in the firing batch isn't in any slot. Freeing it
+		// changes its parity, which tells Advance() to skip it.
+		if (oTimer.m_iState == TIMER_PENDING)
+			Unlink(hTimer.m_iIndex);
+
+		FreeTimer(hTimer.m_iIndex);
+	}
+
+	hTimer.m_iIndex = ~0;
+
+	return bPending;
+}
+
+bool CTimerWheel::IsPending(const CTimerHandle& hTimer) const
+{
+	if (hTimer.m_iIndex >= m_aTimers.size())
+		return false;
+
+	const CTimer& oTimer = m_aTimers[hTimer.m_iIndex];
+	if (oTimer.m_iParity != hTimer.m_iParity)
+		return false;
+
+	return oTimer.m_iState != TIMER_FREE;
+}
+
+void CTimerWheel::Advance(float flTime)
+{
+	unsigned long long iTargetTick = (unsigned long long)(flTime * TIMER_TICKS_PER_SECOND);
+
+	m_ahFiring.clear();
+
+	while (m_iCurrentTick < iTargetTick)
+		Tick();
+
+	m_iFiredLastAdvance = 0;
+
+	// Fire everything that came due in one batch.
+	for (size_t i = 0; i < m_ahFiring.size(); i++)
+	{
+		CTimerHandle& hTimer = m_ahFiring[i];
+		CTimer& oTimer = m_aTimers[hTimer.m_iIndex];
+
+		// Cancelled by an earlier callback in this batch.
+		if (oTimer.m_iParity != hTimer.m_iParity || oTimer.m_iState != TIMER_FIRING)
+			continue;
+
+		CCharacter* pCharacter = nullptr;
+		if (oTimer.m_bHasCharacter)
+		{
+			pCharacter = oTimer.m_hCharacter;
+
+			// The character has been removed since this was scheduled. Drop it.
+			if (!pCharacter)
+			{
+				FreeTimer(hTimer.m_iIndex);
+				continue;
+			}
+		}
+
+		TimerCallback pfnCallback = oTimer.m_pfnCallback;
+		size_t iData = oTimer.m_iData;
+
+		// Free it before the call so that the callback can reschedule into the same slot.
+		FreeTimer(hTimer.m_iIndex);
+
+		pfnCallback(pCharacter, iData);
+		m_iFiredLastAdvance++;
+	}
+
+	m_ahFiring.clear();
+}
+
+size_t CTimerWheel::AllocateTimer()
+{
+	if (m_iFirstFree != ~0)
+	{
+		size_t iTimer = m_iFirstFree;
+		m_iFirstFree = m_aTimers[iTimer].m_iNext;
+		return iTimer;
+	}
+
+	m_aTimers.push_back(CTimer());
+	m_aTimers.back().m_iParity = 0;
+	m_aTimers.back().m_iState = TIMER_FREE;
+	return m_aTimers.size()-1;
+}
+
+void CTimerWheel::FreeTimer(size_t iTimer)
+{
+	CTimer& oTimer = m_aTimers[iTimer];
+
+	TAssert(oTimer.m_iState != TIMER_FREE);
+
+	oTimer.m_iState = TIMER_FREE;
+	oTimer.m_iParity++;
+	oTimer.m_iNext = m_iFirstFree;
+	m_iFirstFree = iTimer;
+
+	m_iPending--;
+}
+
+void CTimerWheel::Link(size_t iTimer)
+{
+	CTimer& oTimer = m_aTimers[iTimer];
+
+	unsigned long long iDelta = 0;
+	if (oTimer.m_iExpireTick > m_iCurrentTick)
+		iDelta = oTimer.m_iExpireTick - m_iCurrentTick;
+
+	// Anything past the end of the last level waits in the last level and gets
+	// re-cascaded until it's in range.
+	const unsigned long long iMaxDelta = (1ull << (TIMER_WHEEL_BITS*TIMER_WHEEL_LEVELS)) - 1;
+	unsigned long long iExpire = oTimer.m_iExpireTick;
+	if (iDelta > iMaxDelta)
+		iExpire = m_iCurrentTick + iMaxDelta;
+
+	// Find the finest level whose span covers this timer.
+	int iLevel = 0;
+	while (iLevel < TIMER_WHEEL_LEVELS-1 && iDelta >= (1ull << (TIMER_WHEEL_BITS*(iLevel+1))))
+		iLevel++;
+
+	size_t iSlot = (size_t)((iExpire >> (TIMER_WHEEL_BITS*iLevel)) & (TIMER_WHEEL_SLOTS-1));
+
+	oTimer.m_iLevel = (unsigned char)iLevel;
+	oTimer.m_iSlot = (unsigned char)iSlot;
+
+	// Push onto the front of the slot's list.
+	size_t& iHead = m_aiSlots[iLevel][iSlot];
+	oTimer.m_iPrev = ~0;
+	oTimer.m_iNext = iHead;
+	if (iHead != ~0)
+		m_aTimers[iHead].m_iPrev = iTimer;
+	iHead = iTimer;
+}
+
+void CTimerWheel::Unlink(size_t iTimer)
+{
+	CTimer& oTimer = m_aTimers[iTimer];
+
+	if (oTimer.m_iPrev != ~0)
+		m_aTimers[oTimer.m_iPrev].m_iNext = oTimer.m_iNext;
+	else
+		m_aiSlots[oTimer.m_iLevel][oTimer.m_iSlot] = oTimer.m_iNext;
+
+	if (oTimer.m_iNext != ~0)
+		m_aTimers[oTimer.m_iNext].m_iPrev = oTimer.m_iPrev;
+
+	oTimer.m_iNext = oTimer.m_iPrev = ~0;
+}
+
+// Take every timer out of the current slot of iLevel and put it back in. Now that
+// they're closer to coming due they'll land in a finer level.
+void CTimerWheel::Cascade(int iLevel)
+{
+	size_t iSlot = (size_t)((m_iCurrentTick >> (TIMER_WHEEL_BITS*iLevel)) & (TIMER_WHEEL_SLOTS-1));
+
+	size_t iTimer = m_aiSlots[iLevel][iSlot];
+	m_aiSlots[iLevel][iSlot] = ~0;
+
+	while (iTimer != ~0)
+	{
+		size_t iNext = m_aTimers[iTimer].m_iNext;
+		Link(iTimer);
+		iTimer = iNext;
+	}
+}
+
+void CTimerWheel::Tick()
+{
+	m_iCurrentTick++;
+
+	// When a level wraps around, bring down the timers from the next level up.
+	for (int i = 1; i < TIMER_WHEEL_LEVELS; i++)
+	{
+		if (m_iCurrentTick & ((1ull << (TIMER_WHEEL_BITS*i)) - 1))
+			break;
+
+		Cascade(i);
+	}
+
+	size_t iSlot = (size_t)(m_iCurrentTick & (TIMER_WHEEL_SLOTS-1));
+
+	size_t iTimer = m_aiSlots[0][iSlot];
+	m_aiSlots[0][iSlot] = ~0;
+
+	while (iTimer != ~0)
+	{
+		CTimer& oTimer = m_aTimers[iTimer];
+		size_t iNext = oTimer.m_iNext;
+
+		if (oTimer.m_iExpireTick > m_iCurrentTick)
+		{
+			// Was clamped to the range of the wheel, still not due yet.
+			Link(iTimer);
+		}
+		else
+		{
+			oTimer.m_iState = TIMER_FIRING;
+
+			CTimerHandle hTimer;
+			hTimer.m_iIndex = iTimer;
+			hTimer.m_iParity = oTimer.m_iParity;
+			m_ahFiring.push_back(hTimer);
+		}
+
+		iTimer = iNext;
+	}
+}
@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "handle.h"
+
+// Called when a timer comes due. pCharacter is the character the timer was scheduled
+// for, or null if the timer doesn't belong to any character.
+typedef void (*TimerCallback)(class CCharacter* pCharacter, size_t iData);
+
+// Identifies a scheduled timer. Works like CHandle: the parity changes every time
+// a timer slot is reused, so a stale handle never cancels somebody else's timer.
+class CTimerHandle
+{
+public:
+	CTimerHandle()
+	{
+		m_iIndex = ~0;
+		m_iParity = 0;
+	}
+
+public:
+	size_t m_iIndex;
+	size_t m_iParity;
+};
+
+#define TIMER_TICKS_PER_SECOND 100
+#define TIMER_WHEEL_BITS       6
+#define TIMER_WHEEL_SLOTS      (1<<TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS     4
+
+// A hierarchical timing wheel. Each level is a ring of slots holding linked lists of
+// timers. Level 0 has one slot per tick, each slot of level 1 covers a whole turn of
+// level 0, and so on. Timers far in the future sit in a coarse level and get moved
+// ("cascaded") down into a finer level as their time approaches. Scheduling and
+// cancelling are O(1) and a tick with nothing due costs next to nothing, so things
+// that are waiting on a timer don't have to be looked at every frame.
+class CTimerWheel
+{
+	class CTimer
+	{
+	public:
+		size_t          m_iNext;
+		size_t          m_iPrev;
+		size_t          m_iParity;
+		unsigned char   m_iLevel;
+		unsigned char   m_iSlot;
+		unsigned char   m_iState;
+
+		unsigned long long m_iExpireTick;
+
+		CHandle         m_hCharacter;
+		bool            m_bHasCharacter;
+		TimerCallback   m_pfnCallback;
+		size_t          m_iData;
+	};
+
+public:
+	CTimerWheel();
+
+public:
+	// Schedule pfnCallback to be called flDelay seconds from now. If pCharacter is not
+	// null the timer is tied to that character and is dropped if the character is
+	// removed before it fires.
+	CTimerHandle    Schedule(class CCharacter* pCharacter, float flDelay, TimerCallback pfnCallback, size_t iData = 0);
+	bool            Cancel(CTimerHandle& hTimer);
+	bool            IsPending(const CTimerHandle& hTimer) const;
+
+	// Fire every timer that has come due by flTime. Due timers are collected first
+	// and then fired together, so callbacks are free to schedule or cancel timers.
+	void            Advance(float flTime);
+
+	size_t          GetNumPending() const { return m_iPending; }
+	size_t          GetNumFiredLastAdvance() const { return m_iFiredLastAdvance; }
+
+private:
+	size_t          AllocateTimer();
+	void            FreeTimer(size_t iTimer);
+
+	void            Link(size_t iTimer);
+	void            Unlink(size_t iTimer);
+	void            Cascade(int iLevel);
+	void            Tick();
+
+private:
+	std::vector<CTimer>       m_aTimers;
+	size_t                    m_iFirstFree;
+
+	size_t                    m_aiSlots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+	unsigned long long        m_iCurrentTick;
+	size_t                    m_iPending;
+	size_t                    m_iFiredLastAdvance;
+
+	std::vector<CTimerHandle> m_ahFiring;
+};
@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "workers.h"
+
+#include <common.h>
+
+CWorkerPool::CWorkerPool()
+{
+	m_bQuit = false;
+	m_iRun = 0;
+	m_pfnJob = nullptr;
+	m_pData = nullptr;
+	m_iJobs = 0;
+	m_iJobsDone = 0;
+	m_iWorkersBusy = 0;
+	m_iNextJob = 0;
+}
+
+CWorkerPool::~CWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_oMutex);
+		m_bQuit = true;
+	}
+
+	m_oWakeWorkers.notify_all();
+
+	for (size_t i = 0; i < m_aThreads.size(); i++)
+		m_aThreads[i].join();
+}
+
+void CWorkerPool::Initialize(size_t iThreads)
+{
+	TAssert(!m_aThreads.size());
+
+	// Can be zero if the hardware won't say.
+	if (!iThreads)
+		iThreads = std::thread::hardware_concurrency();
+
+	for (size_t i = 1; i < iThreads; i++)
+		m_aThreads.push_back(std::thread(&CWorkerPool::WorkerThread, this));
+}
+
+void CWorkerPool::Run(size_t iJobs, WorkerJob pfnJob, void* pData)
+{
+	if (!iJobs)
+		return;
+
+	// Nobody to share with.
+	if (!m_aThreads.size() || iJobs == 1)
+	{
+		for (size_t i = 0; i < iJobs; i++)
+			pfnJob(pData, i);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> oLock(m_oMutex);
+
+		// A worker that woke up too late for the last run could still be on its way out of it.
+		m_oWorkersDone.wait(oLock, [this] { return !m_iWorkersBusy; });
+
+		m_pfnJob = pfnJob;
+		m_pData = pData;
+		m_iJobs = iJobs;
+		m_iJobsDone = 0;
+		m_iNextJob = 0;
+		m_iRun++;
+	}
+
+	m_oWakeWorkers.notify_all();
+
+	size_t iDone = DoJobs(pfnJob, pData, iJobs);
+
+	std::unique_lock<std::mutex> oLock(m_oMutex);
+	m_iJobsDone += iDone;
+	m_oWorkersDone.wait(oLock, [this] { return m_iJobsDone == m_iJobs; });
+}
+
+void CWorkerPool::WorkerThread()
+{
+	unsigned int iLastRun = 0;
+
+	while (true)
+	{
+		WorkerJob pfnJob;
+		void* pData;
+		size_t iJobs;
+
+		{
+			std::unique_lock<std::mutex> oLock(m_oMutex);
+			m_oWakeWorkers.wait(oLock, [this, iLastRun] { return m_bQuit || m_iRun != iLastRun; });
+
+			if (m_bQuit)
+				return;
+
+			iLastRun = m_iRun;
+			pfnJob = m_pfnJob;
+			pData = m_pData;
+			iJobs = m_iJobs;
+			m_iWorkersBusy++;
+		}
+
+		size_t iDone = DoJobs(pfnJob, pData, iJobs);
+
+		{
+			std::lock_guard<std::mutex> oLock(m_oMutex);
+			m_iJobsDone += iDone;
+			m_iWorkersBusy--;
+		}
+
+		m_oWorkersDone.notify_all();
+	}
+}
+
+size_t CWorkerPool::DoJobs(WorkerJob pfnJob, void* pData, size_t iJobs)
+{
+	size_t iDone = 0;
+
+	while (true)
+	{
+		size_t iJob = m_iNextJob++;
+		if (iJob >= iJobs)
+			break;
+
+		pfnJob(pData, iJob);
+		iDone++;
+	}
+
+	return iDone;
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef void (*WorkerJob)(void* pData, size_t iJob);
+
+// A few threads that are kept around to split up the work of a frame. Run() hands out
+// jobs 0 to n-1, helps with them itself, and only returns once they're all done. There's
+// no telling which thread gets which job, so each job should only write to its own output.
+// Put the outputs back together in job order and the result is the same however many
+// threads there are.
+class CWorkerPool
+{
+public:
+	CWorkerPool();
+	~CWorkerPool();
+
+public:
+	// The thread that calls Run() counts as one of them. Zero means as many as the hardware has.
+	void            Initialize(size_t iThreads = 0);
+
+	void            Run(size_t iJobs, WorkerJob pfnJob, void* pData);
+
+	// Counting the thread that calls Run().
+	size_t          GetNumThreads() const { return m_aThreads.size() + 1; }
+
+private:
+	void            WorkerThread();
+	size_t          DoJobs(WorkerJob pfnJob, void* pData, size_t iJobs);
+
+private:
+	std::vector<std::thread>    m_aThreads;
+
+	// Everything below is shared with the workers and is protected by m_oMutex.
+	std::mutex                  m_oMutex;
+	std::condition_variable     m_oWakeWorkers;
+	std::condition_variable     m_oWorkersDone;
+	bool                        m_bQuit;
+
+	unsigned int                m_iRun;         // Goes up by one every Run(), so a worker knows it has something new.
+	WorkerJob                   m_pfnJob;
+	void*                       m_pData;
+	size_t                      m_iJobs;
+	size_t                      m_iJobsDone;
+	size_t                      m_iWorkersBusy; // Workers that have taken this run's job and might still be in it.
+
+	// The only thing touched without the lock.
+	std::atomic<size_t>         m_iNextJob;
+};
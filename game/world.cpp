@@ -0,0 +1,372 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "world.h"
+
+#include <algorithm>
+
+#include <common.h>
+
+#include "game.h"
+#include "character.h"
+#include "terrain.h"
+
+CWorld::CWorld()
+{
+	m_iCenterX = m_iCenterZ = 0;
+	m_bHaveCenter = false;
+	m_bQuit = false;
+}
+
+CWorld::~CWorld()
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_oMutex);
+		m_bQuit = true;
+	}
+
+	m_oWakeLoader.notify_one();
+
+	if (m_oLoader.joinable())
+		m_oLoader.join();
+
+	for (size_t i = 0; i < m_apLoaded.size(); i++)
+		delete m_apLoaded[i];
+
+	for (std::map<long long, CChunk>::iterator it = m_aChunks.begin(); it != m_aChunks.end(); it++)
+		delete it->second.m_pContents;
+}
+
+void CWorld::Initialize()
+{
+	m_oLoader = std::thread(&CWorld::LoaderThread, this);
+}
+
+void CWorld::Update(const Vector& vecPlayer)
+{
+	int iX = ChunkCoordinate(vecPlayer.x);
+	int iZ = ChunkCoordinate(vecPlayer.z);
+
+	// Only need to look at which chunks should be around when the player crosses into a new one.
+	if (!m_bHaveCenter || iX != m_iCenterX || iZ != m_iCenterZ)
+	{
+		m_bHaveCenter = true;
+		m_iCenterX = iX;
+		m_iCenterZ = iZ;
+
+		UnloadChunks(iX, iZ);
+		LoadChunks(iX, iZ);
+	}
+
+	CollectLoadedContents();
+	InstantiateChunks();
+}
+
+bool CWorld::PickSpawnPoint(Vector& vecSpawn)
+{
+	size_t iSpawners = 0;
+	for (std::map<long long, CChunk>::iterator it = m_aChunks.begin(); it != m_aChunks.end(); it++)
+	{
+		if (it->second.m_eState == CHUNK_LOADED)
+			iSpawners += it->second.m_pContents->m_avecSpawners.size();
+	}
+
+	if (!iSpawners)
+		return false;
+
+	size_t iPick = rand() % iSpawners;
+	for (std::map<long long, CChunk>::iterator it = m_aChunks.begin(); it != m_aChunks.end(); it++)
+	{
+		if (it->second.m_eState != CHUNK_LOADED)
+			continue;
+
+		const std::vector<Vector>& avecSpawners = it->second.m_pContents->m_avecSpawners;
+		if (iPick < avecSpawners.size())
+		{
+			vecSpawn = avecSpawners[iPick];
+			return true;
+		}
+
+		iPick -= avecSpawners.size();
+	}
+
+	return false;
+}
+
+class CChunkDistance
+{
+public:
+	long long m_iKey;
+	int       m_iDistance;
+
+	bool operator<(const CChunkDistance& r) const { return m_iDistance < r.m_iDistance; }
+};
+
+void CWorld::LoadChunks(int iCenterX, int iCenterZ)
+{
+	std::vector<CChunkDistance> aNew;
+
+	for (int x = iCenterX - WORLD_LOAD_RADIUS; x <= iCenterX + WORLD_LOAD_RADIUS; x++)
+	{
+		for (int z = iCenterZ - WORLD_LOAD_RADIUS; z <= iCenterZ + WORLD_LOAD_RADIUS; z++)
+		{
+			long long iKey = ChunkKey(x, z);
+			if (m_aChunks.find(iKey) != m_aChunks.end())
+				continue;
+
+			CChunk& oChunk = m_aChunks[iKey];
+			oChunk.m_iX = x;
+			oChunk.m_iZ = z;
+			oChunk.m_eState = CHUNK_REQUESTED;
+			oChunk.m_pContents = nullptr;
+			oChunk.m_iNextProp = 0;
+
+			CChunkDistance oNew;
+			oNew.m_iKey = iKey;
+			oNew.m_iDistance = (x - iCenterX)*(x - iCenterX) + (z - iCenterZ)*(z - iCenterZ);
+			aNew.push_back(oNew);
+		}
+	}
+
+	// The ones closest to the player are the ones he'll see first.
+	std::sort(aNew.begin(), aNew.end());
+
+	{
+		std::lock_guard<std::mutex> oLock(m_oMutex);
+
+		// Don't bother the loader with chunks that were unloaded before it got around to them.
+		for (size_t i = 0; i < m_aiLoadRequests.size(); )
+		{
+			if (m_aChunks.find(m_aiLoadRequests[i]) == m_aChunks.end())
+				m_aiLoadRequests.erase(m_aiLoadRequests.begin() + i);
+			else
+				i++;
+		}
+
+		for (size_t i = 0; i < aNew.size(); i++)
+			m_aiLoadRequests.push_back(aNew[i].m_iKey);
+	}
+
+	m_oWakeLoader.notify_one();
+}
+
+void CWorld::UnloadChunks(int iCenterX, int iCenterZ)
+{
+	for (std::map<long long, CChunk>::iterator it = m_aChunks.begin(); it != m_aChunks.end(); )
+	{
+		int iDistanceX = abs(it->second.m_iX - iCenterX);
+		int iDistanceZ = abs(it->second.m_iZ - iCenterZ);
+
+		if (iDistanceX <= WORLD_UNLOAD_RADIUS && iDistanceZ <= WORLD_UNLOAD_RADIUS)
+		{
+			it++;
+			continue;
+		}
+
+		UnloadChunk(it->second);
+		m_aChunks.erase(it++);
+	}
+}
+
+void CWorld::UnloadChunk(CChunk& oChunk)
+{
+	for (size_t i = 0; i < oChunk.m_ahProps.size(); i++)
+	{
+		CCharacter* pProp = oChunk.m_ahProps[i];
+		if (pProp)
+			Game()->RemoveCharacter(pProp);
+	}
+
+	oChunk.m_ahProps.clear();
+
+	// Don't leave InstantiateChunks() a key that points at nothing, or at a later chunk that reuses it.
+	std::vector<long long>::iterator it = std::find(m_aiInstantiating.begin(), m_aiInstantiating.end(), ChunkKey(oChunk.m_iX, oChunk.m_iZ));
+	if (it != m_aiInstantiating.end())
+		m_aiInstantiating.erase(it);
+
+	// If it's still out on the loader thread, its contents get thrown away when they come back.
+	delete oChunk.m_pContents;
+	oChunk.m_pContents = nullptr;
+}
+
+void CWorld::CollectLoadedContents()
+{
+	std::vector<CChunkContents*> apLoaded;
+
+	{
+		std::lock_guard<std::mutex> oLock(m_oMutex);
+		apLoaded.swap(m_apLoaded);
+	}
+
+	for (size_t i = 0; i < apLoaded.size(); i++)
+	{
+		CChunkContents* pContents = apLoaded[i];
+		long long iKey = ChunkKey(pContents->m_iX, pContents->m_iZ);
+
+		std::map<long long, CChunk>::iterator it = m_aChunks.find(iKey);
+		if (it == m_aChunks.end() || it->second.m_eState != CHUNK_REQUESTED)
+		{
+			// Player has moved on since this was asked for.
+			delete pContents;
+			continue;
+		}
+
+		it->second.m_pContents = pContents;
+		it->second.m_eState = CHUNK_INSTANTIATING;
+		it->second.m_iNextProp = 0;
+
+		m_aiInstantiating.push_back(iKey);
+	}
+}
+
+void CWorld::InstantiateChunks()
+{
+	size_t iBudget = WORLD_INSTANTIATE_PER_FRAME;
+
+	while (iBudget && m_aiInstantiating.size())
+	{
+		std::map<long long, CChunk>::iterator it = m_aChunks.find(m_aiInstantiating.front());
+		if (it == m_aChunks.end() || it->second.m_eState != CHUNK_INSTANTIATING || !it->second.m_pContents)
+		{
+			// Unloaded before it finished coming in, or it's already been dealt with.
+			m_aiInstantiating.erase(m_aiInstantiating.begin());
+			continue;
+		}
+
+		CChunk& oChunk = it->second;
+		const std::vector<Vector>& avecProps = oChunk.m_pContents->m_avecProps;
+
+		while (iBudget && oChunk.m_iNextProp < avecProps.size())
+		{
+			CCharacter* pProp = Game()->CreateProp(avecProps[oChunk.m_iNextProp]);
+
+			// No room in the entity list right now. Try again next frame.
+			if (!pProp)
+				return;
+
+			CHandle hProp;
+			hProp = pProp;
+			oChunk.m_ahProps.push_back(hProp);
+
+			oChunk.m_iNextProp++;
+			iBudget--;
+		}
+
+		if (oChunk.m_iNextProp < avecProps.size())
+			break;
+
+		oChunk.m_eState = CHUNK_LOADED;
+		m_aiInstantiating.erase(m_aiInstantiating.begin());
+	}
+}
+
+void CWorld::LoaderThread()
+{
+	std::unique_lock<std::mutex> oLock(m_oMutex);
+
+	while (true)
+	{
+		while (!m_bQuit && !m_aiLoadRequests.size())
+			m_oWakeLoader.wait(oLock);
+
+		if (m_bQuit)
+			return;
+
+		long long iKey = m_aiLoadRequests.front();
+		m_aiLoadRequests.pop_front();
+
+		// Don't hold the lock while we work, the main thread needs it to hand us more.
+		oLock.unlock();
+
+		CChunkContents* pContents = GenerateChunk((int)(iKey >> 32), (int)(iKey & 0xFFFFFFFF));
+
+		oLock.lock();
+
+		m_apLoaded.push_back(pContents);
+	}
+}
+
+// A little random number generator of our own. mtrand() has one state for the whole
+// program, this way every chunk gets its own numbers and the loader thread doesn't
+// share anything with the main thread.
+inline unsigned int ChunkRandom(unsigned int& iState)
+{
+	iState ^= iState << 13;
+	iState ^= iState >> 17;
+	iState ^= iState << 5;
+	return iState;
+}
+
+inline float ChunkRandomFloat(unsigned int& iState)
+{
+	return (float)(ChunkRandom(iState)%1000)/1000; // [0, 1]
+}
+
+CChunkContents* CWorld::GenerateChunk(int iX, int iZ)
+{
+	CChunkContents* pContents = new CChunkContents();
+	pContents->m_iX = iX;
+	pContents->m_iZ = iZ;
+
+	// Hash the coordinates into a seed so the chunk comes out the same every time.
+	unsigned int iState = ((unsigned int)iX * 73856093) ^ ((unsigned int)iZ * 19349663);
+	if (!iState)
+		iState = 1;
+
+	// Stir it a bit, neighboring chunks have very similar seeds.
+	for (int i = 0; i < 4; i++)
+		ChunkRandom(iState);
+
+	float flMargin = 2;
+	float flRange = WORLD_CHUNK_SIZE - flMargin*2;
+	Vector vecCorner(iX * WORLD_CHUNK_SIZE + flMargin, 0, iZ * WORLD_CHUNK_SIZE + flMargin);
+
+	size_t iProps = ChunkRandom(iState) % 4;
+	for (size_t i = 0; i < iProps; i++)
+	{
+		Vector vecProp = vecCorner + Vector(ChunkRandomFloat(iState) * flRange, 0, ChunkRandomFloat(iState) * flRange);
+
+		// Keep the spot where the player starts clear.
+		if (vecProp.Length2D() < 5)
+			continue;
+
+		vecProp.y = CTerrain::GetHeight(vecProp.x, vecProp.z);
+
+		pContents->m_avecProps.push_back(vecProp);
+	}
+
+	if (ChunkRandom(iState) % 3 == 0)
+	{
+		Vector vecSpawner = vecCorner + Vector(ChunkRandomFloat(iState) * flRange, 0, ChunkRandomFloat(iState) * flRange);
+		vecSpawner.y = CTerrain::GetHeight(vecSpawner.x, vecSpawner.z);
+		pContents->m_avecSpawners.push_back(vecSpawner);
+	}
+
+	return pContents;
+}
+
+long long CWorld::ChunkKey(int iX, int iZ)
+{
+	// Shifting a negative number is undefined, so put the bits together unsigned.
+	unsigned long long iKey = ((unsigned long long)(unsigned int)iX << 32) | (unsigned int)iZ;
+	return (long long)iKey;
+}
+
+int CWorld::ChunkCoordinate(float flPosition)
+{
+	return (int)floor(flPosition / WORLD_CHUNK_SIZE);
+}
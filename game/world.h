@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <vector.h>
+
+#include "handle.h"
+
+#define WORLD_CHUNK_SIZE            32.0f
+
+// Chunks this many chunks from the player's chunk get loaded, and they aren't unloaded
+// until they're further away than the unload radius. The gap between the two keeps
+// chunks from flickering in and out when the player walks back and forth over a border.
+#define WORLD_LOAD_RADIUS           2
+#define WORLD_UNLOAD_RADIUS         3
+
+// How many entities a frame may bring in. Whatever's left over waits for the next frame.
+#define WORLD_INSTANTIATE_PER_FRAME 32
+
+// What's in a chunk. Made up on the loader thread from nothing but the chunk's
+// coordinates, so the same chunk always comes back the same.
+class CChunkContents
+{
+public:
+	int                 m_iX;
+	int                 m_iZ;
+
+	std::vector<Vector> m_avecProps;
+	std::vector<Vector> m_avecSpawners;
+};
+
+typedef enum
+{
+	CHUNK_REQUESTED,      // Waiting on the loader thread.
+	CHUNK_INSTANTIATING,  // Contents are here, entities are coming in a few at a time.
+	CHUNK_LOADED,
+} chunk_state_t;
+
+class CChunk
+{
+public:
+	int                   m_iX;
+	int                   m_iZ;
+	chunk_state_t         m_eState;
+
+	CChunkContents*       m_pContents;
+	size_t                m_iNextProp;
+	std::vector<CHandle>  m_ahProps;
+};
+
+// The world is cut up into square chunks. The ones near the player are kept loaded and
+// the rest are thrown away, so no matter how far the player goes only a fixed number
+// of chunks and their entities are ever around.
+class CWorld
+{
+public:
+	CWorld();
+	~CWorld();
+
+public:
+	void            Initialize();
+
+	// Load and unload chunks around vecPlayer and bring in a few more entities.
+	void            Update(const Vector& vecPlayer);
+
+	// Pick a monster spawner in some loaded chunk. Returns false if there aren't any.
+	bool            PickSpawnPoint(Vector& vecSpawn);
+
+	size_t          GetNumChunks() const { return m_aChunks.size(); }
+
+private:
+	void            LoadChunks(int iCenterX, int iCenterZ);
+	void            UnloadChunks(int iCenterX, int iCenterZ);
+	void            UnloadChunk(CChunk& oChunk);
+
+	void            CollectLoadedContents();
+	void            InstantiateChunks();
+
+	void            LoaderThread();
+	static CChunkContents* GenerateChunk(int iX, int iZ);
+
+	static long long ChunkKey(int iX, int iZ);
+	static int      ChunkCoordinate(float flPosition);
+
+private:
+	std::map<long long, CChunk>     m_aChunks;
+
+	int                             m_iCenterX;
+	int                             m_iCenterZ;
+	bool                            m_bHaveCenter;
+
+	// Chunks that have contents but still have entities to bring in, nearest first.
+	std::vector<long long>          m_aiInstantiating;
+
+	// Everything below is shared with the loader thread and is protected by m_oMutex.
+	std::thread                     m_oLoader;
+	std::mutex                      m_oMutex;
+	std::condition_variable         m_oWakeLoader;
+	bool                            m_bQuit;
+
+	std::deque<long long>           m_aiLoadRequests;
+	std::vector<CChunkContents*>    m_apLoaded;
+};
@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "worldstream.h"
+
+#include <common.h>
+
+#include "game.h"
+#include "character.h"
+
+// How often the encoder wakes up to look for a tool connecting or acking when there's nothing to send.
+#define WORLDSTREAM_POLL_MS 20
+
+CWorldStream::CWorldStream()
+{
+	m_bInitialized = false;
+	m_flRate = 10;
+	m_flNextCapture = 0;
+	m_iTick = 0;
+
+	m_bQuit = false;
+	m_bConnected = false;
+	m_flBudget = 0.25f;
+	m_bCaptured = false;
+	m_tEncoderReady = std::chrono::steady_clock::now();
+
+	m_iLastFrameSize = 0;
+	m_flLastEncodeTime = 0;
+	m_iFramesDropped = 0;
+
+	m_iAckTick = 0;
+}
+
+CWorldStream::~CWorldStream()
+{
+	{
+		std::lock_guard<std::mutex> oLock(m_oMutex);
+		m_bQuit = true;
+	}
+
+	m_oWakeEncoder.notify_one();
+
+	if (m_oEncoder.joinable())
+		m_oEncoder.join();
+}
+
+bool CWorldStream::Initialize(unsigned short iPort)
+{
+	if (!m_oChannel.Listen(iPort))
+		return false;
+
+	m_bInitialized = true;
+	m_oEncoder = std::thread(&CWorldStream::EncoderThread, this);
+
+	return true;
+}
+
+void CWorldStream::SetBudget(float flBudget)
+{
+	std::lock_guard<std::mutex> oLock(m_oMutex);
+	m_flBudget = flBudget;
+}
+
+void CWorldStream::Update(float flTime)
+{
+	if (!m_bInitialized)
+		return;
+
+	if (flTime < m_flNextCapture || m_flRate <= 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> oLock(m_oMutex);
+
+		// Nobody's watching. Don't bother.
+		if (!m_bConnected)
+			return;
+
+		// The encoder is still busy with the last one or is over its budget. Skip this
+		// frame, the next one will carry whatever changed in the meantime.
+		if (m_bCaptured || std::chrono::steady_clock::now() < m_tEncoderReady)
+		{
+			m_iFramesDropped++;
+			m_flNextCapture = flTime + 1 / m_flRate;
+			return;
+		}
+
+		m_oCaptured.m_iTick = ++m_iTick;
+		m_oCaptured.m_flTime = flTime;
+		m_oCaptured.m_iPlayer = Game()->GetPlayer() ? (unsigned short)Game()->GetPlayer()->m_iIndex : 0xFFFF;
+		m_oCaptured.m_aEvents.clear();
+		Game()->CaptureSnapshot(m_oCaptured);
+
+		m_bCaptured = true;
+	}
+
+	m_oWakeEncoder.notify_one();
+
+	m_flNextCapture = flTime + 1 / m_flRate;
+}
+
+size_t CWorldStream::GetLastFrameSize()
+{
+	std::lock_guard<std::mutex> oLock(m_oMutex);
+	return m_iLastFrameSize;
+}
+
+float CWorldStream::GetLastEncodeTime()
+{
+	std::lock_guard<std::mutex> oLock(m_oMutex);
+	return m_flLastEncodeTime;
+}
+
+size_t CWorldStream::GetFramesDropped()
+{
+	std::lock_guard<std::mutex> oLock(m_oMutex);
+	return m_iFramesDropped;
+}
+
+void CWorldStream::EncoderThread()
+{
+	CNetMessage oMessage;
+
+	std::unique_lock<std::mutex> oLock(m_oMutex);
+
+	while (!m_bQuit)
+	{
+		if (!m_bCaptured)
+			m_oWakeEncoder.wait_for(oLock, std::chrono::milliseconds(WORLDSTREAM_POLL_MS));
+
+		if (m_bQuit)
+			break;
+
+		// Take the frame, if there is one, and let go of the lock while we work on it.
+		CSnapshot* pSnapshot = nullptr;
+		if (m_bCaptured)
+		{
+			pSnapshot = &m_oHistory.Add(m_oCaptured.m_iTick);
+			pSnapshot->m_flTime = m_oCaptured.m_flTime;
+			pSnapshot->m_iPlayer = m_oCaptured.m_iPlayer;
+			pSnapshot->m_aEntities.swap(m_oCaptured.m_aEntities);
+			pSnapshot->m_aEvents.clear();
+			m_bCaptured = false;
+		}
+
+		float flBudget = m_flBudget;
+
+		oLock.unlock();
+
+		if (m_oChannel.Accept())
+		{
+			// A new tool. It doesn't have anything yet.
+			m_iAckTick = 0;
+		}
+
+		while (m_oChannel.Receive(oMessage))
+		{
+			if (oMessage.ReadByte() != NET_MESSAGE_ACK)
+				continue;
+
+			unsigned int iAck = oMessage.ReadLong();
+			if (!oMessage.IsOverflowed() && iAck > m_iAckTick && iAck <= m_oHistory.GetLatestTick())
+				m_iAckTick = iAck;
+		}
+
+		size_t iFrameSize = 0;
+		std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+		if (pSnapshot && m_oChannel.IsConnected())
+		{
+			// Deltas only go against something the tool has told us it has.
+			const CSnapshot* pBaseline = nullptr;
+			if (pSnapshot->m_iTick - m_iAckTick < SNAPSHOT_HISTORY/2)
+				pBaseline = m_oHistory.Find(m_iAckTick);
+
+			oMessage.Clear();
+			pSnapshot->Encode(pBaseline, oMessage);
+
+			// So the tool can tell it decoded the same thing we had.
+			oMessage.WriteLong(pSnapshot->GetChecksum());
+
+			iFrameSize = oMessage.GetSize();
+			m_oChannel.Send(oMessage, 0);
+		}
+
+		m_oChannel.Flush(0);
+
+		std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now();
+		float flEncodeTime = std::chrono::duration<float>(tEnd - tStart).count();
+
+		oLock.lock();
+
+		m_bConnected = m_oChannel.IsConnected();
+
+		if (pSnapshot)
+		{
+			m_iLastFrameSize = iFrameSize;
+			m_flLastEncodeTime = flEncodeTime;
+
+			// Rest long enough that the time we just spent is only our share.
+			if (flBudget > 0)
+				m_tEncoderReady = tEnd + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(flEncodeTime / flBudget - flEncodeTime));
+		}
+	}
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "netchannel.h"
+#include "snapshot.h"
+
+#define WORLDSTREAM_DEFAULT_PORT 26011
+
+// Streams every character's position and state to an outside tool, so crowds and AI
+// can be watched live. The main thread only copies the world out. Encoding and
+// sending happen on a thread of their own, which is held to a slice of one core.
+class CWorldStream
+{
+public:
+	CWorldStream();
+	~CWorldStream();
+
+public:
+	bool                Initialize(unsigned short iPort);
+
+	// Call once a frame. Takes a copy of the world if one is due and the encoder is ready for it.
+	void                Update(float flTime);
+
+	// Frames per second to send. The CPU budget can hold it below this.
+	void                SetRate(float flRate) { m_flRate = flRate; }
+
+	// Fraction of one core the encoder may use, eg 0.1 for a tenth.
+	void                SetBudget(float flBudget);
+
+	size_t              GetLastFrameSize();
+	float               GetLastEncodeTime();  // In seconds.
+	size_t              GetFramesDropped();
+
+private:
+	void                EncoderThread();
+
+private:
+	bool                m_bInitialized;
+
+	float               m_flRate;
+	float               m_flNextCapture;
+	unsigned int        m_iTick;
+
+	// Everything below is shared with the encoder thread and is protected by m_oMutex.
+	std::thread                 m_oEncoder;
+	std::mutex                  m_oMutex;
+	std::condition_variable     m_oWakeEncoder;
+	bool                        m_bQuit;
+
+	bool                        m_bConnected;
+	float                       m_flBudget;
+
+	// Handed over by the main thread. Only one at a time, the next waits until this one's been taken.
+	CSnapshot                   m_oCaptured;
+	bool                        m_bCaptured;
+
+	// The encoder doesn't want another frame until then.
+	std::chrono::steady_clock::time_point m_tEncoderReady;
+
+	size_t                      m_iLastFrameSize;
+	float                       m_flLastEncodeTime;
+	size_t                      m_iFramesDropped;
+
+	// Only touched by the encoder thread.
+	CNetChannel                 m_oChannel;
+	CSnapshotHistory            m_oHistory;
+	unsigned int                m_iAckTick;
+};
@@ -72,6 +72,18 @@ public:
 		return ((vecMax-vecMin)/2).Length();
 	}
 
+	// Grow the box just enough to hold this point too.
+	void Expand(const Vector& v)
+	{
+		if (v.x < vecMin.x) vecMin.x = v.x;
+		if (v.y < vecMin.y) vecMin.y = v.y;
+		if (v.z < vecMin.z) vecMin.z = v.z;
+
+		if (v.x > vecMax.x) vecMax.x = v.x;
+		if (v.y > vecMax.y) vecMax.y = v.y;
+		if (v.z > vecMax.z) vecMax.z = v.z;
+	}
+
 public:
 	Vector vecMin;
 	Vector vecMax;
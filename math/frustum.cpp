@@ -19,6 +19,11 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 
 #include "matrix.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
 CFrustum::CFrustum(const Matrix4x4& m)
 {
 	// I'll explain all this junk in a future video.
@@ -72,3 +77,149 @@ bool CFrustum::SphereIntersection(const Vector& vecCenter, float flRadius)
 	// on the "positive" side for all of them. Thus the entity is inside or touching the frustum.
 	return true;
 }
+
+bool CFrustum::AABBIntersection(const Vector& vecMin, const Vector& vecMax) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		// The corner of the box farthest along the plane normal. If even that one is behind the plane then so is the whole box.
+		Vector vecPositive(p[i].n.x > 0 ? vecMax.x : vecMin.x, p[i].n.y > 0 ? vecMax.y : vecMin.y, p[i].n.z > 0 ? vecMax.z : vecMin.z);
+
+		if (vecPositive.Dot(p[i].n) + p[i].d < 0)
+			return false;
+	}
+
+	return true;
+}
+
+frustum_test_t CFrustum::AABBTest(const Vector& vecMin, const Vector& vecMax, unsigned int& iPlanes) const
+{
+	frustum_test_t eResult = FRUSTUM_INSIDE;
+
+	for (int i = 0; i < 6; i++)
+	{
+		if (!(iPlanes & (1<<i)))
+			continue;
+
+		// The corners farthest along and farthest against the plane normal.
+		Vector vecPositive(p[i].n.x > 0 ? vecMax.x : vecMin.x, p[i].n.y > 0 ? vecMax.y : vecMin.y, p[i].n.z > 0 ? vecMax.z : vecMin.z);
+		Vector vecNegative(p[i].n.x > 0 ? vecMin.x : vecMax.x, p[i].n.y > 0 ? vecMin.y : vecMax.y, p[i].n.z > 0 ? vecMin.z : vecMax.z);
+
+		if (vecPositive.Dot(p[i].n) + p[i].d < 0)
+			return FRUSTUM_OUTSIDE;
+
+		if (vecNegative.Dot(p[i].n) + p[i].d < 0)
+			eResult = FRUSTUM_INTERSECTS;
+		else
+			iPlanes &= ~(1<<i);
+	}
+
+	return eResult;
+}
+
+// How far the farthest corner along the plane normal is in front of the plane.
+inline float PositiveVertexDistance(const CPlane& oPlane, const float* apflMins[3], const float* apflMaxs[3], size_t i)
+{
+	return (oPlane.n.x > 0 ? apflMaxs[0][i] : apflMins[0][i]) * oPlane.n.x +
+		(oPlane.n.y > 0 ? apflMaxs[1][i] : apflMins[1][i]) * oPlane.n.y +
+		(oPlane.n.z > 0 ? apflMaxs[2][i] : apflMins[2][i]) * oPlane.n.z + oPlane.d;
+}
+
+#ifdef FRUSTUM_SSE
+// The same for four boxes at once. Each box can have its own plane.
+inline __m128 PositiveVertexDistance(__m128 nx, __m128 ny, __m128 nz, __m128 d, const __m128 amMins[3], const __m128 amMaxs[3])
+{
+	__m128 mZero = _mm_setzero_ps();
+
+	__m128 mPositive = _mm_cmpgt_ps(nx, mZero);
+	__m128 x = _mm_or_ps(_mm_and_ps(mPositive, amMaxs[0]), _mm_andnot_ps(mPositive, amMins[0]));
+
+	mPositive = _mm_cmpgt_ps(ny, mZero);
+	__m128 y = _mm_or_ps(_mm_and_ps(mPositive, amMaxs[1]), _mm_andnot_ps(mPositive, amMins[1]));
+
+	mPositive = _mm_cmpgt_ps(nz, mZero);
+	__m128 z = _mm_or_ps(_mm_and_ps(mPositive, amMaxs[2]), _mm_andnot_ps(mPositive, amMins[2]));
+
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, nx), _mm_mul_ps(y, ny)), _mm_add_ps(_mm_mul_ps(z, nz), d));
+}
+#endif
+
+size_t CFrustum::AABBIntersection(const float* apflMins[3], const float* apflMaxs[3], size_t iBoxes, unsigned int* aiVisible, unsigned char* aiPlanes) const
+{
+	size_t iVisible = 0;
+	size_t i = 0;
+
+#ifdef FRUSTUM_SSE
+	__m128 mZero = _mm_setzero_ps();
+
+	for (; i + 4 <= iBoxes; i += 4)
+	{
+		__m128 amMins[3], amMaxs[3];
+		for (int j = 0; j < 3; j++)
+		{
+			amMins[j] = _mm_loadu_ps(apflMins[j] + i);
+			amMaxs[j] = _mm_loadu_ps(apflMaxs[j] + i);
+		}
+
+		// Each box tries the plane that it was outside of last time first.
+		const CPlane& p0 = p[aiPlanes[i]];
+		const CPlane& p1 = p[aiPlanes[i+1]];
+		const CPlane& p2 = p[aiPlanes[i+2]];
+		const CPlane& p3 = p[aiPlanes[i+3]];
+
+		__m128 mDistance = PositiveVertexDistance(
+			_mm_setr_ps(p0.n.x, p1.n.x, p2.n.x, p3.n.x), _mm_setr_ps(p0.n.y, p1.n.y, p2.n.y, p3.n.y),
+			_mm_setr_ps(p0.n.z, p1.n.z, p2.n.z, p3.n.z), _mm_setr_ps(p0.d, p1.d, p2.d, p3.d), amMins, amMaxs);
+
+		int iOutside = _mm_movemask_ps(_mm_cmplt_ps(mDistance, mZero));
+
+		// Then the rest of them, all four boxes against one plane at a time.
+		for (int k = 0; k < 6 && iOutside != 0xF; k++)
+		{
+			mDistance = PositiveVertexDistance(_mm_set1_ps(p[k].n.x), _mm_set1_ps(p[k].n.y), _mm_set1_ps(p[k].n.z), _mm_set1_ps(p[k].d), amMins, amMaxs);
+
+			int iOutsidePlane = _mm_movemask_ps(_mm_cmplt_ps(mDistance, mZero)) & ~iOutside;
+			if (!iOutsidePlane)
+				continue;
+
+			for (int j = 0; j < 4; j++)
+			{
+				if (iOutsidePlane & (1<<j))
+					aiPlanes[i+j] = (unsigned char)k;
+			}
+
+			iOutside |= iOutsidePlane;
+		}
+
+		// Write every index and only count the visible ones, so that the list comes out packed without branching.
+		for (int j = 0; j < 4; j++)
+		{
+			aiVisible[iVisible] = (unsigned int)(i+j);
+			iVisible += !(iOutside & (1<<j));
+		}
+	}
+#endif
+
+	// Whatever's left over that doesn't fill four.
+	for (; i < iBoxes; i++)
+	{
+		if (PositiveVertexDistance(p[aiPlanes[i]], apflMins, apflMaxs, i) < 0)
+			continue;
+
+		bool bOutside = false;
+		for (int k = 0; k < 6; k++)
+		{
+			if (PositiveVertexDistance(p[k], apflMins, apflMaxs, i) < 0)
+			{
+				aiPlanes[i] = (unsigned char)k;
+				bOutside = true;
+				break;
+			}
+		}
+
+		if (!bOutside)
+			aiVisible[iVisible++] = (unsigned int)i;
+	}
+
+	return iVisible;
+}
@@ -28,6 +28,15 @@ class Matrix4x4;
 #define FRUSTUM_UP    4
 #define FRUSTUM_DOWN  5
 
+#define FRUSTUM_ALL_PLANES 0x3F
+
+typedef enum
+{
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE,
+} frustum_test_t;
+
 // Frustum class defined by six planes enclosing the frustum. The normals face inward.
 class CFrustum
 {
@@ -37,6 +46,19 @@ public:
 
 public:
 	bool SphereIntersection(const Vector& vecCenter, float flRadius);
+	bool AABBIntersection(const Vector& vecMin, const Vector& vecMax) const;
+
+	// Whether the box is outside, partly inside or all the way inside. iPlanes has a bit for each plane
+	// to test. The planes that the box is all the way inside of are cleared, so that anything inside the
+	// box doesn't need to test them again.
+	frustum_test_t AABBTest(const Vector& vecMin, const Vector& vecMax, unsigned int& iPlanes) const;
+
+	// Culls a whole batch of boxes at once, four at a time. The boxes come as one array for each
+	// of min x y z in apflMins and max x y z in apflMaxs. The indices of the ones that touch the
+	// frustum are written to aiVisible, which needs room for all of them, and the count is returned.
+	// aiPlanes has the plane that rejected each box last time. That one is tried first, since
+	// something that was outside last frame is probably outside the same plane this frame.
+	size_t AABBIntersection(const float* apflMins[3], const float* apflMaxs[3], size_t iBoxes, unsigned int* aiVisible, unsigned char* aiPlanes) const;
 
 public:
 	CPlane p[6];
@@ -18,6 +18,7 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include "application.h"
 
 #include <time.h>
+#include <chrono>
 #include <GL3/gl3w.h>
 #include <GL/glfw.h>
 #include <iostream>
@@ -28,6 +29,7 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <common_platform.h>
 
 #include "renderer.h"
+#include "glstate.h"
 
 CApplication* CApplication::s_pApplication = NULL;
 
@@ -39,6 +41,7 @@ CApplication::CApplication(int argc, char** argv)
 		m_apszCommandLine.push_back(argv[i]);
 
 	m_bIsOpen = false;
+	m_bHeadless = false;
 	m_bMultisampling = true;
 
 	m_pRenderer = NULL;
@@ -117,8 +120,9 @@ void CApplication::OpenWindow(size_t iWidth, size_t iHeight, bool bFullscreen, b
 	if (0 != err)
 		exit(0);
 
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
+	CGLState::Invalidate();
+	CGLState::SetBackCulling(true);
+	CGLState::SetDepthTest(true);
 	glLineWidth(1.0);
 
 	m_bIsOpen = true;
@@ -127,6 +131,15 @@ void CApplication::OpenWindow(size_t iWidth, size_t iHeight, bool bFullscreen, b
 	m_pRenderer->Initialize();
 }
 
+void CApplication::OpenHeadless()
+{
+	m_bHeadless = true;
+	m_bIsOpen = true;
+
+	// Start the clock.
+	GetTime();
+}
+
 CApplication::~CApplication()
 {
 	ClearLowPeriodScheduler();
@@ -141,6 +154,13 @@ void CApplication::SwapBuffers()
 
 float CApplication::GetTime()
 {
+	// GLFW's timer needs a window. Without one keep our own.
+	if (m_bHeadless)
+	{
+		static std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - tStart).count();
+	}
+
 	return (float)glfwGetTime();
 }
 
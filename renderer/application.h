@@ -37,6 +37,7 @@ public:
 	void						SetMultisampling(bool bMultisampling) { m_bMultisampling = bMultisampling; }
 
 	void						OpenWindow(size_t iWidth, size_t iHeight, bool bFullscreen, bool bResizeable);
+	void						OpenHeadless();	// No window and no renderer, eg for a dedicated server.
 
 	virtual std::string         WindowTitle() { return "Viewback Test"; }
 	virtual std::string         AppDirectory() { return "VBTest"; }
@@ -110,6 +111,7 @@ protected:
 	size_t						m_iWindowHeight;
 	bool						m_bFullscreen;
 	bool						m_bIsOpen;
+	bool						m_bHeadless;
 
 	bool						m_bMultisampling;
 
@@ -0,0 +1,200 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "commandlist.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <common.h>
+
+#include <renderer/renderer.h>
+#include <renderer/shaders.h>
+
+CCommandList::CCommandList()
+{
+	m_iCommands = 0;
+	m_iVertexBytes = 0;
+	m_iBuffer = 0;
+}
+
+void CCommandList::Clear()
+{
+	Destroy();
+
+	m_aCommands.clear();
+	m_iCommands = 0;
+	m_aLayouts.clear();
+	m_aVertices.clear();
+	m_iVertexBytes = 0;
+}
+
+void CCommandList::Destroy()
+{
+	if (m_iBuffer)
+		CRenderer::UnloadVertexDataFromGL(m_iBuffer);
+
+	m_iBuffer = 0;
+}
+
+void CCommandList::Push(command_t eCommand, const void* pCommand, size_t iBytes)
+{
+	TAssert(iBytes < 65536);
+
+	CCommandHeader oHeader;
+	oHeader.m_iCommand = (unsigned short)eCommand;
+	oHeader.m_iBytes = (unsigned short)iBytes;
+
+	size_t iStart = m_aCommands.size();
+	m_aCommands.resize(iStart + sizeof(oHeader) + iBytes);
+	memcpy(&m_aCommands[iStart], &oHeader, sizeof(oHeader));
+	memcpy(&m_aCommands[iStart + sizeof(oHeader)], pCommand, iBytes);
+
+	m_iCommands++;
+}
+
+void CCommandList::RecordProgram(const CShader* pShader)
+{
+	CProgramCommand oCommand;
+	oCommand.m_iShader = CShaderLibrary::GetShaderIndex(pShader);
+	Push(COMMAND_PROGRAM, oCommand);
+}
+
+void CCommandList::RecordTexture(size_t iTexture, int iChannel)
+{
+	CTextureCommand oCommand;
+	oCommand.m_iTexture = iTexture;
+	oCommand.m_iChannel = iChannel;
+	Push(COMMAND_TEXTURE, oCommand);
+}
+
+void CCommandList::RecordBlend(blendtype_t eBlend)
+{
+	Push(COMMAND_BLEND, eBlend);
+}
+
+void CCommandList::RecordAlpha(float flAlpha)
+{
+	Push(COMMAND_ALPHA, flAlpha);
+}
+
+void CCommandList::RecordBackCulling(bool bCull)
+{
+	Push(COMMAND_BACK_CULLING, bCull);
+}
+
+void CCommandList::RecordUniform(size_t iUniform, int iValue)
+{
+	PushUniform(iUniform, UNIFORM_INT, &iValue, sizeof(iValue));
+}
+
+void CCommandList::RecordUniform(size_t iUniform, float flValue)
+{
+	PushUniform(iUniform, UNIFORM_FLOAT, &flValue, sizeof(flValue));
+}
+
+void CCommandList::RecordUniform(size_t iUniform, const Vector& vecValue)
+{
+	PushUniform(iUniform, UNIFORM_VECTOR, &vecValue.x, sizeof(float)*3);
+}
+
+void CCommandList::RecordUniform(size_t iUniform, const Vector4D& vecValue)
+{
+	PushUniform(iUniform, UNIFORM_VECTOR4D, &vecValue.x, sizeof(float)*4);
+}
+
+void CCommandList::RecordUniform(size_t iUniform, const Matrix4x4& mValue)
+{
+	PushUniform(iUniform, UNIFORM_MATRIX, (const float*)mValue, sizeof(float)*16);
+}
+
+void CCommandList::RecordMesh(primitive_mesh_t eMesh, const Matrix4x4& mTransform)
+{
+	CMeshCommand oCommand;
+	memcpy(oCommand.m_aflTransform, (const float*)mTransform, sizeof(oCommand.m_aflTransform));
+	oCommand.m_eMesh = eMesh;
+	Push(COMMAND_MESH, oCommand);
+}
+
+void CCommandList::PushUniform(size_t iUniform, uniform_value_t eType, const void* pValue, size_t iBytes)
+{
+	TAssert(iBytes <= sizeof(float)*16);
+
+	CUniformCommand oCommand;
+	oCommand.m_iUniform = iUniform;
+	oCommand.m_eType = eType;
+	memcpy(oCommand.m_aflValue, pValue, iBytes);
+
+	// Leave off the values that this type doesn't use.
+	Push(COMMAND_UNIFORM, &oCommand, offsetof(CUniformCommand, m_aflValue) + iBytes);
+}
+
+void* CCommandList::AddVertices(size_t iBytes, size_t& iOffset)
+{
+	TAssert(!m_iBuffer);	// Already uploaded. Clear() it to record again.
+
+	// Keep every draw's vertices 16 byte aligned, the same as the vertex stream does.
+	iOffset = (m_aVertices.size() + 15) & ~(size_t)15;
+	m_aVertices.resize(iOffset + iBytes);
+	m_iVertexBytes = m_aVertices.size();
+
+	return &m_aVertices[iOffset];
+}
+
+static bool LayoutsMatch(const CVertexLayout& a, const CVertexLayout& b)
+{
+	if (a.m_iAttributes != b.m_iAttributes || a.m_iStride != b.m_iStride)
+		return false;
+
+	for (size_t i = 0; i < a.m_iAttributes; i++)
+	{
+		if (a.m_aAttributes[i].m_eAttribute != b.m_aAttributes[i].m_eAttribute)
+			return false;
+		if (a.m_aAttributes[i].m_iComponents != b.m_aAttributes[i].m_iComponents)
+			return false;
+		if (a.m_aAttributes[i].m_iOffset != b.m_aAttributes[i].m_iOffset)
+			return false;
+	}
+
+	return true;
+}
+
+size_t CCommandList::AddLayout(const CVertexLayout& oLayout)
+{
+	// There's only ever a handful, one per format that was drawn with.
+	for (size_t i = 0; i < m_aLayouts.size(); i++)
+	{
+		if (LayoutsMatch(m_aLayouts[i], oLayout))
+			return i;
+	}
+
+	m_aLayouts.push_back(oLayout);
+	return m_aLayouts.size()-1;
+}
+
+void CCommandList::Upload()
+{
+	if (!m_aVertices.size())
+		return;
+
+	TAssert(!m_iBuffer);
+
+	m_iBuffer = CRenderer::LoadVertexDataIntoGL(m_aVertices.size(), (float*)m_aVertices.data());
+
+	// GL has them now.
+	std::vector<char>().swap(m_aVertices);
+}
@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_COMMANDLIST_H
+#define TINKER_COMMANDLIST_H
+
+#include <vector>
+
+#include <matrix.h>
+#include <vector4d.h>
+
+#include "render_common.h"
+#include "meshcache.h"
+#include "vertexformat.h"
+
+typedef enum
+{
+	COMMAND_PROGRAM,
+	COMMAND_TEXTURE,
+	COMMAND_BLEND,
+	COMMAND_ALPHA,
+	COMMAND_BACK_CULLING,
+	COMMAND_UNIFORM,
+	COMMAND_MESH,
+	COMMAND_VERTICES,
+} command_t;
+
+typedef enum
+{
+	UNIFORM_INT,
+	UNIFORM_FLOAT,
+	UNIFORM_VECTOR,
+	UNIFORM_VECTOR4D,
+	UNIFORM_MATRIX,
+} uniform_value_t;
+
+// Commands are plain data so that they can be copied in and out of a list as bytes.
+// Each one has this in front of it.
+class CCommandHeader
+{
+public:
+	unsigned short			m_iCommand;
+	unsigned short			m_iBytes;	// Of what follows, not counting this
+};
+
+class CProgramCommand
+{
+public:
+	size_t					m_iShader;	// Index in the shader library, which outlives a recompile where the pointer might not
+};
+
+class CTextureCommand
+{
+public:
+	size_t					m_iTexture;
+	int						m_iChannel;
+};
+
+class CUniformCommand
+{
+public:
+	size_t					m_iUniform;
+	uniform_value_t			m_eType;
+	float					m_aflValue[16];	// Only as many as the type needs are stored
+};
+
+class CMeshCommand
+{
+public:
+	float					m_aflTransform[16];
+	primitive_mesh_t		m_eMesh;
+};
+
+class CVerticesCommand
+{
+public:
+	float					m_aflTransform[16];
+	size_t					m_iLayout;
+	size_t					m_iOffset;	// In the list's vertex buffer
+	size_t					m_iVertices;
+	int						m_iDrawMode;
+};
+
+// Draws, state changes and uniform values recorded by a CRenderingContext so that
+// they can be played back any number of times without building them again. Nothing
+// in the list points anywhere, so it can be copied around freely. Vertices drawn
+// while recording go into one buffer that's uploaded when recording finishes.
+// It holds a GL name once it has vertices, so call Destroy() when it's done with.
+//
+// The Record functions can also be called directly. They only write into the list and
+// never touch GL, so other threads can each fill a list of their own to be replayed later.
+class CCommandList
+{
+	friend class CRenderingContext;
+
+public:
+							CCommandList();
+
+public:
+	// Forget everything so the list can be recorded again.
+	void					Clear();
+	void					Destroy();
+
+	bool					IsEmpty() const { return !m_iCommands; }
+	size_t					GetNumCommands() const { return m_iCommands; }
+	size_t					GetCommandBytes() const { return m_aCommands.size(); }
+	size_t					GetVertexBytes() const { return m_iVertexBytes; }
+	size_t					GetBuffer() const { return m_iBuffer; }
+
+	void					RecordProgram(const class CShader* pShader);
+	void					RecordTexture(size_t iTexture, int iChannel = 0);
+	void					RecordBlend(blendtype_t eBlend);
+	void					RecordAlpha(float flAlpha);
+	void					RecordBackCulling(bool bCull);
+	// Handles come from CShader::FindUniform on the program that will be in use when it's replayed.
+	void					RecordUniform(size_t iUniform, int iValue);
+	void					RecordUniform(size_t iUniform, float flValue);
+	void					RecordUniform(size_t iUniform, const Vector& vecValue);
+	void					RecordUniform(size_t iUniform, const Vector4D& vecValue);
+	void					RecordUniform(size_t iUniform, const Matrix4x4& mValue);
+	void					RecordMesh(primitive_mesh_t eMesh, const Matrix4x4& mTransform);
+
+private:
+	void					Push(command_t eCommand, const void* pCommand, size_t iBytes);
+	template <class T>
+	void					Push(command_t eCommand, const T& oCommand) { Push(eCommand, &oCommand, sizeof(T)); }
+
+	void					PushUniform(size_t iUniform, uniform_value_t eType, const void* pValue, size_t iBytes);
+
+	// Makes room for the vertices and returns where to write them. iOffset gets where they'll be in the buffer.
+	void*					AddVertices(size_t iBytes, size_t& iOffset);
+	size_t					AddLayout(const CVertexLayout& oLayout);
+
+	// Send all of the vertices to GL at once.
+	void					Upload();
+
+private:
+	std::vector<char>			m_aCommands;
+	size_t						m_iCommands;
+
+	std::vector<CVertexLayout>	m_aLayouts;
+
+	std::vector<char>			m_aVertices;	// Only until Upload()
+	size_t						m_iVertexBytes;
+	size_t						m_iBuffer;
+};
+
+#endif
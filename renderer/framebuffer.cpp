@@ -0,0 +1,213 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "framebuffer.h"
+
+#include <GL3/gl3w.h>
+
+#include <common.h>
+
+#include "renderer.h"
+#include "glstate.h"
+
+CFrameBuffer::CFrameBuffer()
+{
+	m_iFrameBuffer = 0;
+	for (size_t i = 0; i < FRAMEBUFFER_MAX_TARGETS; i++)
+		m_aiTextures[i] = 0;
+	m_iDepthBuffer = 0;
+
+	m_iWidth = 0;
+	m_iHeight = 0;
+	m_iTargets = 0;
+	m_iOptions = 0;
+}
+
+// CopyScreenDepth() blits, and a depth blit only works between buffers with the same depth
+// and stencil formats. The window only asks for at least 16 bits, so ask what it really got.
+static GLenum GetScreenDepthFormat(GLenum& eAttachment)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	GLint iDepthBits = 0;
+	GLint iStencilBits = 0;
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &iDepthBits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &iStencilBits);
+
+	eAttachment = GL_DEPTH_ATTACHMENT;
+
+	if (iStencilBits)
+	{
+		eAttachment = GL_DEPTH_STENCIL_ATTACHMENT;
+		return GL_DEPTH24_STENCIL8;
+	}
+
+	if (iDepthBits >= 32)
+		return GL_DEPTH_COMPONENT32;
+
+	if (iDepthBits >= 24)
+		return GL_DEPTH_COMPONENT24;
+
+	return GL_DEPTH_COMPONENT16;
+}
+
+bool CFrameBuffer::Create(size_t iWidth, size_t iHeight, size_t iTargets, unsigned int iOptions)
+{
+	TAssert(iTargets && iTargets <= FRAMEBUFFER_MAX_TARGETS);
+
+	if (m_iFrameBuffer && m_iWidth == iWidth && m_iHeight == iHeight && m_iTargets == iTargets && m_iOptions == iOptions)
+		return true;
+
+	Destroy();
+
+	m_iWidth = iWidth;
+	m_iHeight = iHeight;
+	m_iTargets = iTargets;
+	m_iOptions = iOptions;
+
+	GLenum eDepthAttachment = GL_DEPTH_ATTACHMENT;
+	GLenum eDepthFormat = GL_DEPTH_COMPONENT16;
+	if (iOptions & FB_DEPTH)
+		eDepthFormat = GetScreenDepthFormat(eDepthAttachment);
+
+	GLuint iFrameBuffer;
+	glGenFramebuffers(1, &iFrameBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, iFrameBuffer);
+
+	GLenum aeDrawBuffers[FRAMEBUFFER_MAX_TARGETS];
+
+	for (size_t i = 0; i < iTargets; i++)
+	{
+		GLuint iTexture;
+		glGenTextures(1, &iTexture);
+		m_aiTextures[i] = iTexture;
+
+		CGLState::BindTexture(0, iTexture);
+
+		if (iOptions & FB_TEXTURE_HALF_FLOAT)
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, (GLsizei)iWidth, (GLsizei)iHeight, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (GLsizei)iWidth, (GLsizei)iHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+		// No mipmaps, and GL won't sample it at all if it thinks it needs them.
+		GLint iFilter = (iOptions & FB_LINEAR) ? GL_LINEAR : GL_NEAREST;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, iFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, iFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0+(GLenum)i, GL_TEXTURE_2D, iTexture, 0);
+
+		aeDrawBuffers[i] = GL_COLOR_ATTACHMENT0+(GLenum)i;
+	}
+
+	CGLState::BindTexture(0, 0);
+
+	if (iOptions & FB_DEPTH)
+	{
+		// Same format as the screen's, or CopyScreenDepth() can't copy it over.
+		GLuint iDepthBuffer;
+		glGenRenderbuffers(1, &iDepthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, iDepthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, eDepthFormat, (GLsizei)iWidth, (GLsizei)iHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, eDepthAttachment, GL_RENDERBUFFER, iDepthBuffer);
+
+		m_iDepthBuffer = iDepthBuffer;
+	}
+
+	glDrawBuffers((GLsizei)iTargets, aeDrawBuffers);
+
+	GLenum eStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	m_iFrameBuffer = iFrameBuffer;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (eStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		DebugPrint("Frame buffer isn't complete.\n");
+		Destroy();
+		return false;
+	}
+
+	return true;
+}
+
+void CFrameBuffer::Destroy()
+{
+	for (size_t i = 0; i < FRAMEBUFFER_MAX_TARGETS; i++)
+	{
+		if (!m_aiTextures[i])
+			continue;
+
+		GLuint iTexture = (GLuint)m_aiTextures[i];
+		glDeleteTextures(1, &iTexture);
+		CGLState::TextureDeleted(m_aiTextures[i]);
+		m_aiTextures[i] = 0;
+	}
+
+	if (m_iDepthBuffer)
+	{
+		GLuint iDepthBuffer = (GLuint)m_iDepthBuffer;
+		glDeleteRenderbuffers(1, &iDepthBuffer);
+		m_iDepthBuffer = 0;
+	}
+
+	if (m_iFrameBuffer)
+	{
+		GLuint iFrameBuffer = (GLuint)m_iFrameBuffer;
+		glDeleteFramebuffers(1, &iFrameBuffer);
+		m_iFrameBuffer = 0;
+	}
+}
+
+void CFrameBuffer::Bind() const
+{
+	TAssert(m_iFrameBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)m_iFrameBuffer);
+}
+
+void CFrameBuffer::BindScreen()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void CFrameBuffer::Clear(size_t iTarget, const Vector4D& vecColor) const
+{
+	TAssert(iTarget < m_iTargets);
+
+	float aflColor[4] = { vecColor.x, vecColor.y, vecColor.z, vecColor.w };
+	glClearBufferfv(GL_COLOR, (GLint)iTarget, aflColor);
+}
+
+void CFrameBuffer::CopyScreenDepth() const
+{
+	TAssert(m_iDepthBuffer);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)m_iFrameBuffer);
+
+	// If the screen is multisampled this resolves it, and GL picks which sample's depth we get.
+	GLint iWidth = (GLint)m_iWidth;
+	GLint iHeight = (GLint)m_iHeight;
+	glBlitFramebuffer(0, 0, iWidth, iHeight, 0, 0, iWidth, iHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)m_iFrameBuffer);
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef TINKER_FRAMEBUFFER_H
+#define TINKER_FRAMEBUFFER_H
+
+#include <stddef.h>
+
+#include <vector4d.h>
+
+#define FRAMEBUFFER_MAX_TARGETS 4
+
+// Somewhere to draw besides the screen. Every target is a texture that a later pass can read,
+// and they're all drawn into at once, target i getting the shader's output at location i.
+// With FB_DEPTH there's a depth buffer too, which CopyScreenDepth() can fill from the screen
+// so that what's drawn here is hidden by what's already there. It holds GL names, so call
+// Destroy() when it's done with.
+class CFrameBuffer
+{
+public:
+							CFrameBuffer();
+
+public:
+	// Takes fb_options_e. Does nothing if it's already made the same way, so it's fine to call
+	// every frame with the window size. Returns false if GL won't draw into it.
+	bool					Create(size_t iWidth, size_t iHeight, size_t iTargets, unsigned int iOptions);
+	void					Destroy();
+
+	bool					IsValid() const { return !!m_iFrameBuffer; }
+
+	// Draws go here until BindScreen().
+	void					Bind() const;
+	static void				BindScreen();
+
+	void					Clear(size_t iTarget, const Vector4D& vecColor) const;
+
+	// Create() matches the screen's depth format, but the screen has to be the same size. Leaves this one bound.
+	void					CopyScreenDepth() const;
+
+	size_t					GetTexture(size_t iTarget) const { return m_aiTextures[iTarget]; }
+	size_t					GetWidth() const { return m_iWidth; }
+	size_t					GetHeight() const { return m_iHeight; }
+
+private:
+	size_t					m_iFrameBuffer;
+	size_t					m_aiTextures[FRAMEBUFFER_MAX_TARGETS];
+	size_t					m_iDepthBuffer;
+
+	size_t					m_iWidth;
+	size_t					m_iHeight;
+	size_t					m_iTargets;
+	unsigned int			m_iOptions;
+};
+
+#endif
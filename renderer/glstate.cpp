@@ -0,0 +1,256 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "glstate.h"
+
+#include <GL3/gl3w.h>
+
+#include <common.h>
+
+size_t CGLState::s_iProgram = ~0;
+size_t CGLState::s_iActiveTexture = ~0;
+size_t CGLState::s_aiTextures[GLSTATE_TEXTURE_UNITS][2];
+size_t CGLState::s_iArrayBuffer = ~0;
+size_t CGLState::s_iIndexBuffer = ~0;
+
+int CGLState::s_iBlendEnabled = -1;
+int CGLState::s_iBlendFunction = -1;
+int CGLState::s_iDepthMask = -1;
+int CGLState::s_iDepthTest = -1;
+int CGLState::s_iDepthFunction = -1;
+int CGLState::s_iCull = -1;
+int CGLState::s_iWinding = -1;
+int CGLState::s_aiViewport[4];
+bool CGLState::s_bViewportValid = false;
+
+size_t CGLState::s_iCallsIssued = 0;
+size_t CGLState::s_iCallsElided = 0;
+
+// Returns true if the state needs to be sent to GL.
+template <class T>
+inline bool ShadowState(T& oCurrent, T oNew, size_t& iIssued, size_t& iElided)
+{
+	if (oCurrent == oNew)
+	{
+		iElided++;
+		return false;
+	}
+
+	oCurrent = oNew;
+	iIssued++;
+	return true;
+}
+
+void CGLState::UseProgram(size_t iProgram)
+{
+	if (ShadowState(s_iProgram, iProgram, s_iCallsIssued, s_iCallsElided))
+		glUseProgram((GLuint)iProgram);
+}
+
+void CGLState::ActiveTexture(size_t iChannel)
+{
+	if (ShadowState(s_iActiveTexture, iChannel, s_iCallsIssued, s_iCallsElided))
+		glActiveTexture(GL_TEXTURE0+(GLenum)iChannel);
+}
+
+void CGLState::BindTexture(size_t iChannel, size_t iTexture, bool bMultisample)
+{
+	GLenum eTarget = bMultisample?GL_TEXTURE_2D_MULTISAMPLE:GL_TEXTURE_2D;
+
+	TAssert(iChannel < GLSTATE_TEXTURE_UNITS);
+	if (iChannel >= GLSTATE_TEXTURE_UNITS)
+	{
+		// Not shadowed. Make sure we don't think we know which unit is active afterwards.
+		glActiveTexture(GL_TEXTURE0+(GLenum)iChannel);
+		glBindTexture(eTarget, (GLuint)iTexture);
+		s_iActiveTexture = ~0;
+		s_iCallsIssued += 2;
+		return;
+	}
+
+	if (s_aiTextures[iChannel][bMultisample] == iTexture)
+	{
+		s_iCallsElided++;
+		return;
+	}
+
+	ActiveTexture(iChannel);
+
+	s_aiTextures[iChannel][bMultisample] = iTexture;
+	s_iCallsIssued++;
+	glBindTexture(eTarget, (GLuint)iTexture);
+}
+
+void CGLState::BindArrayBuffer(size_t iBuffer)
+{
+	if (ShadowState(s_iArrayBuffer, iBuffer, s_iCallsIssued, s_iCallsElided))
+		glBindBuffer(GL_ARRAY_BUFFER, (GLuint)iBuffer);
+}
+
+void CGLState::BindIndexBuffer(size_t iBuffer)
+{
+	if (ShadowState(s_iIndexBuffer, iBuffer, s_iCallsIssued, s_iCallsElided))
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)iBuffer);
+}
+
+void CGLState::SetBlend(blendtype_t eBlend)
+{
+	if (ShadowState(s_iBlendEnabled, (int)(eBlend != BLEND_NONE), s_iCallsIssued, s_iCallsElided))
+	{
+		// Every draw buffer, for frame buffers that draw into more than one.
+		if (eBlend)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+	}
+
+	// Leave the function alone while blending is off, chances are the next blend uses the same one.
+	if (!eBlend)
+		return;
+
+	if (ShadowState(s_iBlendFunction, (int)eBlend, s_iCallsIssued, s_iCallsElided))
+	{
+		if (eBlend == BLEND_ALPHA)
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		else if (eBlend == BLEND_ADDITIVE)
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		else if (eBlend == BLEND_BOTH)
+			glBlendFunc(GL_ONE, GL_ONE);
+		else if (eBlend == BLEND_WEIGHTED)
+			glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	}
+}
+
+void CGLState::SetDepthMask(bool bDepthMask)
+{
+	if (ShadowState(s_iDepthMask, (int)bDepthMask, s_iCallsIssued, s_iCallsElided))
+		glDepthMask(bDepthMask);
+}
+
+void CGLState::SetDepthTest(bool bDepthTest)
+{
+	if (ShadowState(s_iDepthTest, (int)bDepthTest, s_iCallsIssued, s_iCallsElided))
+	{
+		if (bDepthTest)
+			glEnable(GL_DEPTH_TEST);
+		else
+			glDisable(GL_DEPTH_TEST);
+	}
+}
+
+void CGLState::SetDepthFunction(depth_function_t eDepthFunction)
+{
+	// These are the only two the renderer has ever used.
+	if (eDepthFunction != DF_LEQUAL && eDepthFunction != DF_LESS)
+		return;
+
+	if (ShadowState(s_iDepthFunction, (int)eDepthFunction, s_iCallsIssued, s_iCallsElided))
+		glDepthFunc(eDepthFunction == DF_LEQUAL?GL_LEQUAL:GL_LESS);
+}
+
+void CGLState::SetBackCulling(bool bCull)
+{
+	if (ShadowState(s_iCull, (int)bCull, s_iCallsIssued, s_iCallsElided))
+	{
+		if (bCull)
+			glEnable(GL_CULL_FACE);
+		else
+			glDisable(GL_CULL_FACE);
+	}
+}
+
+void CGLState::SetWinding(bool bWinding)
+{
+	if (ShadowState(s_iWinding, (int)bWinding, s_iCallsIssued, s_iCallsElided))
+		glFrontFace(bWinding?GL_CCW:GL_CW);
+}
+
+void CGLState::SetViewport(int x, int y, int w, int h)
+{
+	if (s_bViewportValid && s_aiViewport[0] == x && s_aiViewport[1] == y && s_aiViewport[2] == w && s_aiViewport[3] == h)
+	{
+		s_iCallsElided++;
+		return;
+	}
+
+	s_aiViewport[0] = x;
+	s_aiViewport[1] = y;
+	s_aiViewport[2] = w;
+	s_aiViewport[3] = h;
+	s_bViewportValid = true;
+
+	s_iCallsIssued++;
+	glViewport(x, y, (GLsizei)w, (GLsizei)h);
+}
+
+void CGLState::TextureDeleted(size_t iTexture)
+{
+	for (size_t i = 0; i < GLSTATE_TEXTURE_UNITS; i++)
+	{
+		for (size_t j = 0; j < 2; j++)
+		{
+			if (s_aiTextures[i][j] == iTexture)
+				s_aiTextures[i][j] = 0;
+		}
+	}
+}
+
+void CGLState::BufferDeleted(size_t iBuffer)
+{
+	if (s_iArrayBuffer == iBuffer)
+		s_iArrayBuffer = 0;
+
+	if (s_iIndexBuffer == iBuffer)
+		s_iIndexBuffer = 0;
+}
+
+void CGLState::ProgramDeleted(size_t iProgram)
+{
+	// A program that's in use stays around until something else is used, so we can't say what's current.
+	if (s_iProgram == iProgram)
+		s_iProgram = ~0;
+}
+
+void CGLState::Invalidate()
+{
+	s_iProgram = ~0;
+	s_iActiveTexture = ~0;
+
+	for (size_t i = 0; i < GLSTATE_TEXTURE_UNITS; i++)
+	{
+		for (size_t j = 0; j < 2; j++)
+			s_aiTextures[i][j] = ~0;
+	}
+
+	s_iArrayBuffer = ~0;
+	s_iIndexBuffer = ~0;
+
+	s_iBlendEnabled = -1;
+	s_iBlendFunction = -1;
+	s_iDepthMask = -1;
+	s_iDepthTest = -1;
+	s_iDepthFunction = -1;
+	s_iCull = -1;
+	s_iWinding = -1;
+	s_bViewportValid = false;
+}
+
+void CGLState::ResetCounters()
+{
+	s_iCallsIssued = 0;
+	s_iCallsElided = 0;
+}
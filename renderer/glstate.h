@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_GLSTATE_H
+#define TINKER_GLSTATE_H
+
+#include <stddef.h>
+
+#include "render_common.h"
+
+#define GLSTATE_TEXTURE_UNITS 8
+
+// Shadows the GL state that the renderer changes all the time and only calls into
+// the driver when something actually changes. Everything that binds or toggles
+// these should go through here, or the shadow copy goes stale and changes get lost.
+// If some code has to touch the state behind its back, call Invalidate() afterwards.
+class CGLState
+{
+public:
+	static void				UseProgram(size_t iProgram);
+	static void				BindTexture(size_t iChannel, size_t iTexture, bool bMultisample = false);
+	static void				BindArrayBuffer(size_t iBuffer);
+	static void				BindIndexBuffer(size_t iBuffer);
+
+	static void				SetBlend(blendtype_t eBlend);
+	static void				SetDepthMask(bool bDepthMask);
+	static void				SetDepthTest(bool bDepthTest);
+	static void				SetDepthFunction(depth_function_t eDepthFunction);
+	static void				SetBackCulling(bool bCull);
+	static void				SetWinding(bool bWinding);
+	static void				SetViewport(int x, int y, int w, int h);
+
+	// GL unbinds deleted objects by itself and may hand the same name out again, so it has to hear about these.
+	static void				TextureDeleted(size_t iTexture);
+	static void				BufferDeleted(size_t iBuffer);
+	static void				ProgramDeleted(size_t iProgram);
+
+	// Forget everything. The next change of every kind goes through to GL.
+	static void				Invalidate();
+
+	static size_t			GetCallsIssued() { return s_iCallsIssued; }
+	static size_t			GetCallsElided() { return s_iCallsElided; }
+	static void				ResetCounters();
+
+private:
+	static void				ActiveTexture(size_t iChannel);
+
+private:
+	// ~0 or -1 means we don't know what GL has.
+	static size_t			s_iProgram;
+	static size_t			s_iActiveTexture;
+	static size_t			s_aiTextures[GLSTATE_TEXTURE_UNITS][2];
+	static size_t			s_iArrayBuffer;
+	static size_t			s_iIndexBuffer;
+
+	static int				s_iBlendEnabled;
+	static int				s_iBlendFunction;
+	static int				s_iDepthMask;
+	static int				s_iDepthTest;
+	static int				s_iDepthFunction;
+	static int				s_iCull;
+	static int				s_iWinding;
+	static int				s_aiViewport[4];
+	static bool				s_bViewportValid;
+
+	static size_t			s_iCallsIssued;
+	static size_t			s_iCallsElided;
+};
+
+#endif
@@ -0,0 +1,127 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "instancebuffer.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <GL3/gl3w.h>
+
+#include <common.h>
+
+#include "renderer.h"
+#include "glstate.h"
+
+CInstanceBuffer::CInstanceBuffer()
+{
+	m_iInstances = 0;
+	m_iBuffer = 0;
+	m_iCapacity = 0;
+	m_iUploaded = 0;
+	m_iDirtyStart = m_iDirtyEnd = 0;
+	m_iBytesUploaded = 0;
+}
+
+void CInstanceBuffer::SetNumInstances(size_t iInstances)
+{
+	if (iInstances > m_aInstances.size())
+		m_aInstances.resize(iInstances);
+
+	m_iInstances = iInstances;
+}
+
+void CInstanceBuffer::SetInstance(size_t iInstance, const Matrix4x4& mTransform, const Vector4D& vecColor)
+{
+	TAssert(iInstance < m_iInstances);
+
+	CInstanceData oData;
+	memcpy(oData.m_aflTransform, (const float*)mTransform, sizeof(oData.m_aflTransform));
+	oData.m_aflColor[0] = vecColor.x;
+	oData.m_aflColor[1] = vecColor.y;
+	oData.m_aflColor[2] = vecColor.z;
+	oData.m_aflColor[3] = vecColor.w;
+
+	CInstanceData& oInstance = m_aInstances[iInstance];
+
+	// Most things don't move most frames.
+	if (iInstance < m_iUploaded && memcmp(&oInstance, &oData, sizeof(oData)) == 0)
+		return;
+
+	oInstance = oData;
+
+	if (m_iDirtyStart == m_iDirtyEnd)
+	{
+		m_iDirtyStart = iInstance;
+		m_iDirtyEnd = iInstance+1;
+	}
+	else
+	{
+		m_iDirtyStart = std::min(m_iDirtyStart, iInstance);
+		m_iDirtyEnd = std::max(m_iDirtyEnd, iInstance+1);
+	}
+}
+
+void CInstanceBuffer::Upload()
+{
+	m_iBytesUploaded = 0;
+
+	if (m_iDirtyStart == m_iDirtyEnd)
+		return;
+
+	if (!m_iBuffer)
+	{
+		GLuint iBuffer;
+		glGenBuffers(1, &iBuffer);
+		m_iBuffer = iBuffer;
+	}
+
+	CGLState::BindArrayBuffer(m_iBuffer);
+
+	if (m_iDirtyEnd > m_iCapacity)
+	{
+		// Grow by doubling so that a slowly growing crowd doesn't reallocate every frame.
+		m_iCapacity = std::max(m_iDirtyEnd, m_iCapacity*2);
+
+		glBufferData(GL_ARRAY_BUFFER, m_iCapacity * sizeof(CInstanceData), nullptr, GL_DYNAMIC_DRAW);
+
+		m_iUploaded = 0;
+	}
+
+	// Anything between what GL has and the dirty range has to go too.
+	if (m_iDirtyEnd > m_iUploaded)
+		m_iDirtyStart = std::min(m_iDirtyStart, m_iUploaded);
+
+	m_iBytesUploaded = (m_iDirtyEnd - m_iDirtyStart) * sizeof(CInstanceData);
+	glBufferSubData(GL_ARRAY_BUFFER, m_iDirtyStart * sizeof(CInstanceData), m_iBytesUploaded, &m_aInstances[m_iDirtyStart]);
+
+	m_iUploaded = std::max(m_iUploaded, m_iDirtyEnd);
+	m_iDirtyStart = m_iDirtyEnd = 0;
+}
+
+void CInstanceBuffer::Destroy()
+{
+	if (m_iBuffer)
+		CRenderer::UnloadVertexDataFromGL(m_iBuffer);
+
+	m_aInstances.clear();
+	m_iInstances = 0;
+	m_iBuffer = 0;
+	m_iCapacity = 0;
+	m_iUploaded = 0;
+	m_iDirtyStart = m_iDirtyEnd = 0;
+}
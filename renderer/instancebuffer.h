@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_INSTANCEBUFFER_H
+#define TINKER_INSTANCEBUFFER_H
+
+#include <vector>
+
+#include <matrix.h>
+#include <vector4d.h>
+
+// What each instance of an instanced draw gets. It's laid out the way the
+// instanced shader reads it: four columns of transform and then the color.
+class CInstanceData
+{
+public:
+	float					m_aflTransform[16];
+	float					m_aflColor[4];
+};
+
+// Per-instance data for instanced draws. The GL buffer is kept from frame to frame
+// along with a copy on our side, and setting an instance to what it already was
+// costs nothing. Upload() only sends the range that changed since the last one.
+// It holds a GL name, so call Destroy() when it's done with. Copies share the buffer.
+class CInstanceBuffer
+{
+public:
+							CInstanceBuffer();
+
+public:
+	// Existing instances keep their values.
+	void					SetNumInstances(size_t iInstances);
+	size_t					GetNumInstances() const { return m_iInstances; }
+
+	void					SetInstance(size_t iInstance, const Matrix4x4& mTransform, const Vector4D& vecColor);
+
+	void					Upload();
+	void					Destroy();
+
+	size_t					GetBuffer() const { return m_iBuffer; }
+	size_t					GetBytesUploaded() const { return m_iBytesUploaded; }	// By the last Upload()
+
+private:
+	// Never shrinks, so that an instance dropped one frame and back the next still has its old copy to compare against.
+	std::vector<CInstanceData>	m_aInstances;
+	size_t					m_iInstances;
+
+	size_t					m_iBuffer;
+	size_t					m_iCapacity;	// How many instances the GL buffer has room for
+	size_t					m_iUploaded;	// GL has what we have for [0, this), apart from the dirty range
+
+	// Instances [start, end) are different from what GL has.
+	size_t					m_iDirtyStart;
+	size_t					m_iDirtyEnd;
+
+	size_t					m_iBytesUploaded;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "meshcache.h"
+
+#include <vector>
+
+#include <common.h>
+
+#include "renderer.h"
+
+CPrimitiveMesh CMeshCache::s_aMeshes[MESH_TOTAL];
+
+// Position, texture coordinate.
+static const float g_aflBoxFaces[6][6][5] =
+{
+	// The back face
+	{ {0, 0, 0, 0, 0}, {0, 0, 1, 1, 0}, {0, 1, 1, 1, 1}, {0, 0, 0, 0, 0}, {0, 1, 1, 1, 1}, {0, 1, 0, 0, 1} },
+	// The left face
+	{ {0, 0, 0, 0, 0}, {0, 1, 0, 0, 1}, {1, 1, 0, 1, 1}, {0, 0, 0, 0, 0}, {1, 1, 0, 1, 1}, {1, 0, 0, 1, 0} },
+	// The bottom face
+	{ {0, 0, 0, 0, 0}, {1, 0, 0, 1, 0}, {1, 0, 1, 1, 1}, {0, 0, 0, 0, 0}, {1, 0, 1, 1, 1}, {0, 0, 1, 0, 1} },
+	// The top face
+	{ {1, 1, 1, 0, 1}, {1, 1, 0, 0, 0}, {0, 1, 0, 1, 0}, {1, 1, 1, 0, 1}, {0, 1, 0, 1, 0}, {0, 1, 1, 1, 1} },
+	// The right face
+	{ {1, 1, 1, 0, 1}, {0, 1, 1, 1, 1}, {0, 0, 1, 1, 0}, {1, 1, 1, 0, 1}, {0, 0, 1, 1, 0}, {1, 0, 1, 0, 0} },
+	// The front face
+	{ {1, 1, 1, 0, 1}, {1, 0, 1, 0, 0}, {1, 0, 0, 1, 0}, {1, 1, 1, 0, 1}, {1, 0, 0, 1, 0}, {1, 1, 0, 1, 1} },
+};
+
+static const float g_aflBoxNormals[6][3] =
+{
+	{ -1, 0, 0 },
+	{ 0, 0, -1 },
+	{ 0, -1, 0 },
+	{ 0, 1, 0 },
+	{ 0, 0, 1 },
+	{ 1, 0, 0 },
+};
+
+// Position, texture coordinate. Same winding and texture coordinates as the old billboard triangle fan.
+static const float g_aflQuad[6][5] =
+{
+	{ -1, -1, 0, 0, 0 }, { 1, -1, 0, 1, 0 }, { 1, 1, 0, 1, 1 },
+	{ -1, -1, 0, 0, 0 }, { 1, 1, 0, 1, 1 }, { -1, 1, 0, 0, 1 },
+};
+
+void CMeshCache::LoadMeshes()
+{
+	std::vector<float> aflData;
+
+	// Box: position, normal, texture coordinate
+	aflData.reserve(6*6*8);
+	for (size_t i = 0; i < 6; i++)
+	{
+		for (size_t j = 0; j < 6; j++)
+		{
+			aflData.push_back(g_aflBoxFaces[i][j][0]);
+			aflData.push_back(g_aflBoxFaces[i][j][1]);
+			aflData.push_back(g_aflBoxFaces[i][j][2]);
+			aflData.push_back(g_aflBoxNormals[i][0]);
+			aflData.push_back(g_aflBoxNormals[i][1]);
+			aflData.push_back(g_aflBoxNormals[i][2]);
+			aflData.push_back(g_aflBoxFaces[i][j][3]);
+			aflData.push_back(g_aflBoxFaces[i][j][4]);
+		}
+	}
+
+	CPrimitiveMesh& oBox = s_aMeshes[MESH_BOX];
+	oBox.m_iVBO = CRenderer::LoadVertexDataIntoGL(aflData.size()*sizeof(float), aflData.data());
+	oBox.m_iVertices = 6*6;
+	oBox.m_iStride = 8*sizeof(float);
+	oBox.m_iNormalOffset = 3*sizeof(float);
+	oBox.m_iTexCoordOffset = 6*sizeof(float);
+
+	// Quad: position, texture coordinate
+	CPrimitiveMesh& oQuad = s_aMeshes[MESH_QUAD];
+	oQuad.m_iVBO = CRenderer::LoadVertexDataIntoGL(sizeof(g_aflQuad), (float*)&g_aflQuad[0][0]);
+	oQuad.m_iVertices = 6;
+	oQuad.m_iStride = 5*sizeof(float);
+	oQuad.m_iNormalOffset = ~0;
+	oQuad.m_iTexCoordOffset = 3*sizeof(float);
+
+	TAssert(oBox.m_iVBO && oQuad.m_iVBO);
+}
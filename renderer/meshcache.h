@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_MESHCACHE_H
+#define TINKER_MESHCACHE_H
+
+#include <stddef.h>
+
+typedef enum
+{
+	MESH_BOX,		// Unit cube from (0, 0, 0) to (1, 1, 1) with normals and texture coordinates
+	MESH_QUAD,		// Square from (-1, -1, 0) to (1, 1, 0) with texture coordinates and no normals
+	MESH_TOTAL,
+} primitive_mesh_t;
+
+class CPrimitiveMesh
+{
+public:
+	size_t					m_iVBO;
+	size_t					m_iVertices;
+	size_t					m_iStride;			// In bytes
+	size_t					m_iNormalOffset;	// In bytes, or ~0 if there are no normals
+	size_t					m_iTexCoordOffset;	// In bytes
+};
+
+// Simple shapes that get drawn all the time. They're put into vertex buffers once at
+// startup and drawn scaled and moved into place with the model transform.
+class CMeshCache
+{
+public:
+	static void					LoadMeshes();
+
+	static const CPrimitiveMesh&	GetMesh(primitive_mesh_t eMesh) { return s_aMeshes[eMesh]; }
+
+private:
+	static CPrimitiveMesh		s_aMeshes[MESH_TOTAL];
+};
+
+#endif
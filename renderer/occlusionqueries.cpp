@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "occlusionqueries.h"
+
+#include <GL3/gl3w.h>
+
+#include <common.h>
+
+COcclusionQueries::COcclusionQueries()
+{
+	m_iQueriesIssued = 0;
+}
+
+void COcclusionQueries::SetNumQueries(size_t iQueries)
+{
+	TAssert(iQueries >= m_aiQueries.size());
+
+	m_aiQueries.resize(iQueries, 0);
+	m_abPending.resize(iQueries, false);
+}
+
+void COcclusionQueries::BeginPass()
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	m_iQueriesIssued = 0;
+}
+
+void COcclusionQueries::EndPass()
+{
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void COcclusionQueries::Begin(size_t iQuery)
+{
+	TAssert(iQuery < m_aiQueries.size());
+
+	if (!m_aiQueries[iQuery])
+	{
+		GLuint iName;
+		glGenQueries(1, &iName);
+		m_aiQueries[iQuery] = iName;
+	}
+
+	glBeginQuery(GL_SAMPLES_PASSED, (GLuint)m_aiQueries[iQuery]);
+
+	m_abPending[iQuery] = true;
+	m_iQueriesIssued++;
+}
+
+void COcclusionQueries::End()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+}
+
+bool COcclusionQueries::GetResult(size_t iQuery, bool& bSamplesPassed)
+{
+	TAssert(iQuery < m_aiQueries.size());
+
+	if (!m_abPending[iQuery])
+		return false;
+
+	GLuint iAvailable = 0;
+	glGetQueryObjectuiv((GLuint)m_aiQueries[iQuery], GL_QUERY_RESULT_AVAILABLE, &iAvailable);
+	if (!iAvailable)
+		return false;
+
+	GLuint iSamples = 0;
+	glGetQueryObjectuiv((GLuint)m_aiQueries[iQuery], GL_QUERY_RESULT, &iSamples);
+
+	m_abPending[iQuery] = false;
+	bSamplesPassed = !!iSamples;
+
+	return true;
+}
+
+void COcclusionQueries::Destroy()
+{
+	for (size_t i = 0; i < m_aiQueries.size(); i++)
+	{
+		if (!m_aiQueries[i])
+			continue;
+
+		GLuint iName = (GLuint)m_aiQueries[i];
+		glDeleteQueries(1, &iName);
+	}
+
+	m_aiQueries.clear();
+	m_abPending.clear();
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_OCCLUSIONQUERIES_H
+#define TINKER_OCCLUSIONQUERIES_H
+
+#include <stddef.h>
+
+#include <vector>
+
+// A set of occlusion queries, each one counting whether anything drawn between Begin() and
+// End() passed the depth test. Results are only ever picked up once GL has them, which is a
+// frame or so after they were issued, so nothing waits on the GPU. It holds GL names, so call
+// Destroy() when it's done with.
+class COcclusionQueries
+{
+public:
+							COcclusionQueries();
+
+public:
+	// The query names are made the first time each one is used.
+	void					SetNumQueries(size_t iQueries);
+	size_t					GetNumQueries() const { return m_aiQueries.size(); }
+
+	// What gets drawn for the queries should only be counted, not seen.
+	// These turn color writes off and back on. Depth writes are up to the rendering context.
+	void					BeginPass();
+	void					EndPass();
+
+	void					Begin(size_t iQuery);
+	void					End();
+
+	// Issued and the result hasn't been picked up yet.
+	bool					IsPending(size_t iQuery) const { return m_abPending[iQuery]; }
+	// Returns false if the result isn't back yet. Never waits.
+	bool					GetResult(size_t iQuery, bool& bSamplesPassed);
+	// Whatever is on its way for this query is for something that's gone now.
+	void					Discard(size_t iQuery) { m_abPending[iQuery] = false; }
+
+	void					Destroy();
+
+	size_t					GetQueriesIssued() const { return m_iQueriesIssued; }	// Since the last BeginPass()
+
+private:
+	std::vector<size_t>		m_aiQueries;	// 0 until it's used
+	std::vector<bool>		m_abPending;
+
+	size_t					m_iQueriesIssued;
+};
+
+#endif
@@ -24,6 +24,7 @@ typedef enum
 	BLEND_ALPHA,		// Source image scaled by its alpha channel
 	BLEND_ADDITIVE,		// Source image values added to destination, scaled by its alpha channel
 	BLEND_BOTH,			// Source and destination images added, no scaling
+	BLEND_WEIGHTED,		// Colors added, no scaling. Alpha multiplied by one minus the source's alpha
 } blendtype_t;
 
 typedef enum
@@ -38,4 +39,15 @@ typedef enum
 	DF_ALWAYS,
 } depth_function_t;
 
+typedef enum
+{
+	PRIMITIVE_TRIANGLES,
+	PRIMITIVE_TRIANGLE_FAN,
+	PRIMITIVE_TRIANGLE_STRIP,
+	PRIMITIVE_LINES,
+	PRIMITIVE_LINE_LOOP,
+	PRIMITIVE_LINE_STRIP,
+	PRIMITIVE_POINTS,
+} primitive_t;
+
 #endif
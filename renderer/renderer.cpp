@@ -31,6 +31,10 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 
 #include "application.h"
 #include "renderingcontext.h"
+#include "glstate.h"
+#include "meshcache.h"
+#include "vertexstream.h"
+#include "uniformblocks.h"
 
 using namespace std;
 
@@ -58,6 +62,10 @@ void CRenderer::Initialize()
 	LoadShaders();
 	CShaderLibrary::CompileShaders(m_iScreenSamples);
 
+	CMeshCache::LoadMeshes();
+	CVertexStream::Initialize();
+	CUniformBlocks::Initialize();
+
 	WindowResize(m_iWidth, m_iHeight);
 
 	if (!CShaderLibrary::IsCompiled())
@@ -113,7 +121,7 @@ void CRenderer::StartRendering(class CRenderingContext* pContext)
 		m_aflProjection[i] = ((float*)pContext->GetProjection())[i];
 	}
 
-	glViewport(0, 0, (GLsizei)m_iWidth, (GLsizei)m_iHeight);
+	CGLState::SetViewport(0, 0, (int)m_iWidth, (int)m_iHeight);
 
 	if (m_iScreenSamples)
 		glEnable(GL_MULTISAMPLE);
@@ -123,6 +131,8 @@ void CRenderer::FinishRendering(class CRenderingContext* pContext)
 {
 	if (m_iScreenSamples)
 		glDisable(GL_MULTISAMPLE);
+
+	CVertexStream::EndFrame();
 }
 
 void CRenderer::RenderOffscreenBuffers(class CRenderingContext* pContext)
@@ -204,6 +214,10 @@ bool CRenderer::HardwareSupported()
 	if (!gl3wIsSupported(3, 0))
 		return false;
 
+	// Shaders read what they all share out of uniform blocks. That's 3.1, or an extension that every 3.0 driver has.
+	if (!glGetUniformBlockIndex || !glUniformBlockBinding || !glBindBufferBase)
+		return false;
+
 	// Compile a test shader. If it fails we don't support shaders.
 	const char* pszVertexShader =
 		"#version 130\n"
@@ -259,7 +273,7 @@ size_t CRenderer::LoadVertexDataIntoGL(size_t iSizeInBytes, float* aflVertices)
 
 	GLuint iVBO;
 	glGenBuffers(1, &iVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, iVBO);
+	CGLState::BindArrayBuffer(iVBO);
 
 	glBufferData(GL_ARRAY_BUFFER, iSizeInBytes, 0, GL_STATIC_DRAW);
 
@@ -270,12 +284,13 @@ size_t CRenderer::LoadVertexDataIntoGL(size_t iSizeInBytes, float* aflVertices)
 	if(iSizeInBytes != iSize)
 	{
 		glDeleteBuffers(1, &iVBO);
+		CGLState::BufferDeleted(iVBO);
 		assert(false);
 		// Data size is mismatch with input array
 		return 0;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CGLState::BindArrayBuffer(0);
 
 	return iVBO;
 }
@@ -284,7 +299,7 @@ size_t CRenderer::LoadIndexDataIntoGL(size_t iSizeInBytes, unsigned int* aiIndic
 {
 	GLuint iVBO;
 	glGenBuffers(1, &iVBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iVBO);
+	CGLState::BindIndexBuffer(iVBO);
 
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, iSizeInBytes, 0, GL_STATIC_DRAW);
 
@@ -295,17 +310,21 @@ size_t CRenderer::LoadIndexDataIntoGL(size_t iSizeInBytes, unsigned int* aiIndic
 	if(iSizeInBytes != iSize)
 	{
 		glDeleteBuffers(1, &iVBO);
+		CGLState::BufferDeleted(iVBO);
 		assert(false);
 		// Data size is mismatch with input array
 		return 0;
 	}
 
+	CGLState::BindIndexBuffer(0);
+
 	return iVBO;
 }
 
 void CRenderer::UnloadVertexDataFromGL(size_t iBuffer)
 {
 	glDeleteBuffers(1, (GLuint*)&iBuffer);
+	CGLState::BufferDeleted(iBuffer);
 }
 
 size_t CRenderer::LoadTextureIntoGL(string sFilename, int iClamp)
@@ -348,7 +367,7 @@ size_t CRenderer::LoadTextureIntoGL(unsigned char* pclrData, int x, int y, int i
 
 	GLuint iGLId;
 	glGenTextures(1, &iGLId);
-	glBindTexture(GL_TEXTURE_2D, iGLId);
+	CGLState::BindTexture(0, iGLId);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, bNearestFiltering?GL_NEAREST:GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, bNearestFiltering?GL_NEAREST:GL_LINEAR);
@@ -362,7 +381,7 @@ size_t CRenderer::LoadTextureIntoGL(unsigned char* pclrData, int x, int y, int i
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pclrData);
 	glGenerateMipmap(GL_TEXTURE_2D);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	CGLState::BindTexture(0, 0);
 
 	s_iTexturesLoaded++;
 
@@ -373,7 +392,7 @@ size_t CRenderer::LoadTextureIntoGL(Vector* pvecData, int x, int y, int iClamp,
 {
 	GLuint iGLId;
 	glGenTextures(1, &iGLId);
-	glBindTexture(GL_TEXTURE_2D, iGLId);
+	CGLState::BindTexture(0, iGLId);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -389,7 +408,7 @@ size_t CRenderer::LoadTextureIntoGL(Vector* pvecData, int x, int y, int iClamp,
 	if (bMipMaps)
 		glGenerateMipmap(GL_TEXTURE_2D);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	CGLState::BindTexture(0, 0);
 
 	s_iTexturesLoaded++;
 
@@ -399,6 +418,7 @@ size_t CRenderer::LoadTextureIntoGL(Vector* pvecData, int x, int y, int iClamp,
 void CRenderer::UnloadTextureFromGL(size_t iGLId)
 {
 	glDeleteTextures(1, (GLuint*)&iGLId);
+	CGLState::TextureDeleted(iGLId);
 	s_iTexturesLoaded--;
 }
 
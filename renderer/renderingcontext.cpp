@@ -26,21 +26,50 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <renderer/shaders.h>
 #include <renderer/application.h>
 #include <renderer/renderer.h>
+#include <renderer/glstate.h>
+#include <renderer/meshcache.h>
+#include <renderer/instancebuffer.h>
+#include <renderer/spritebatch.h>
+#include <renderer/vertexstream.h>
+#include <renderer/uniformblocks.h>
 
 using namespace std;
 
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
 vector<Vector2D> CRenderingContext::s_avecTexCoord;
 vector<vector<Vector2D> > CRenderingContext::s_aavecTexCoords;
 vector<Vector> CRenderingContext::s_avecNormals;
 vector<Vector> CRenderingContext::s_avecTangents;
 vector<Vector> CRenderingContext::s_avecBitangents;
 vector<Vector> CRenderingContext::s_avecVertices;
+const CVertexLayout* CRenderingContext::s_pFormatLayout = nullptr;
+size_t CRenderingContext::s_iFormatVertices = 0;
+size_t CRenderingContext::s_iFormatOffset = ~0;
+vector<char> CRenderingContext::s_aFormatScratch;
 
 vector<CRenderingContext::CRenderContext> CRenderingContext::s_aContexts;
 
+// Which parts of the state a CStateScope has saved.
+enum
+{
+	SCOPE_TRANSFORM      = (1<<0),
+	SCOPE_VIEWPORT       = (1<<1),
+	SCOPE_BLEND          = (1<<2),
+	SCOPE_ALPHA          = (1<<3),
+	SCOPE_DEPTH_MASK     = (1<<4),
+	SCOPE_DEPTH_TEST     = (1<<5),
+	SCOPE_DEPTH_FUNCTION = (1<<6),
+	SCOPE_CULL           = (1<<7),
+	SCOPE_WINDING        = (1<<8),
+	SCOPE_PROGRAM        = (1<<9),
+};
+
 CRenderingContext::CRenderingContext(CRenderer* pRenderer, bool bInherit)
 {
 	m_pRenderer = pRenderer;
+	m_pScope = nullptr;
+	m_pRecording = nullptr;
 
 	m_clrRender = ::Color(255, 255, 255, 255);
 
@@ -97,6 +126,9 @@ CRenderingContext::CRenderingContext(CRenderer* pRenderer, bool bInherit)
 
 CRenderingContext::~CRenderingContext()
 {
+	TAssert(!m_pScope);	// Close scopes before the context they're in.
+	TAssert(!m_pRecording);
+
 	s_aContexts.pop_back();
 
 	if (s_aContexts.size())
@@ -123,30 +155,161 @@ CRenderingContext::~CRenderingContext()
 	}
 	else
 	{
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		CGLState::BindTexture(0, 0);
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		if (m_pRenderer)
-			glViewport(0, 0, (GLsizei)m_pRenderer->m_iWidth, (GLsizei)m_pRenderer->m_iHeight);
+			CGLState::SetViewport(0, 0, (int)m_pRenderer->m_iWidth, (int)m_pRenderer->m_iHeight);
 		else
-			glViewport(0, 0, (GLsizei)Application()->GetWindowWidth(), (GLsizei)Application()->GetWindowHeight());
+			CGLState::SetViewport(0, 0, (int)Application()->GetWindowWidth(), (int)Application()->GetWindowHeight());
 
-		glUseProgram(0);
+		CGLState::UseProgram(0);
 
-		glDisablei(GL_BLEND, 0);
+		CGLState::SetBlend(BLEND_NONE);
 
-		glDepthMask(true);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glDepthFunc(GL_LESS);
+		CGLState::SetDepthMask(true);
+		CGLState::SetDepthTest(true);
+		CGLState::SetBackCulling(true);
+		CGLState::SetDepthFunction(DF_LESS);
 
-		glFrontFace(GL_CCW);
+		CGLState::SetWinding(true);
 	}
 }
 
+CRenderingContext::CStateScope::CStateScope(CRenderingContext* pContext)
+{
+	m_pContext = pContext;
+	m_pPrevious = pContext->m_pScope;
+	m_iContextDepth = s_aContexts.size();
+	m_iSaved = 0;
+
+	pContext->m_pScope = this;
+}
+
+CRenderingContext::CStateScope::~CStateScope()
+{
+	CRenderingContext* c = m_pContext;
+
+	TAssert(c->m_pScope == this);
+	TAssert(m_iContextDepth == s_aContexts.size());
+
+	// Nothing we put back here was ever seen by the scope outside of us, so don't let it save any of it.
+	c->m_pScope = nullptr;
+
+	if (m_iSaved & SCOPE_PROGRAM)
+		c->UseProgram(m_pShader);
+
+	if (m_iSaved & SCOPE_TRANSFORM)
+		c->LoadTransform(m_mTransformations);
+
+	if (m_iSaved & SCOPE_VIEWPORT)
+		c->SetViewport(m_aiViewport[0], m_aiViewport[1], m_aiViewport[2], m_aiViewport[3]);
+
+	if (m_iSaved & SCOPE_BLEND)
+		c->SetBlend(m_eBlend);
+
+	if (m_iSaved & SCOPE_ALPHA)
+		c->SetAlpha(m_flAlpha);
+
+	if (m_iSaved & SCOPE_DEPTH_MASK)
+		c->SetDepthMask(m_bDepthMask);
+
+	if (m_iSaved & SCOPE_DEPTH_TEST)
+		c->SetDepthTest(m_bDepthTest);
+
+	if (m_iSaved & SCOPE_DEPTH_FUNCTION)
+		c->SetDepthFunction(m_eDepthFunction);
+
+	if (m_iSaved & SCOPE_CULL)
+		c->SetBackCulling(m_bCull);
+
+	if (m_iSaved & SCOPE_WINDING)
+		c->SetWinding(m_bWinding);
+
+	c->m_pScope = m_pPrevious;
+}
+
+CRenderingContext::CTransformScope::CTransformScope(CRenderingContext* pContext)
+	: m_mTransformations(pContext->GetContext().m_mTransformations)
+{
+	m_pContext = pContext;
+}
+
+CRenderingContext::CTransformScope::~CTransformScope()
+{
+	CRenderContext& oContext = m_pContext->GetContext();
+
+	oContext.m_mTransformations = m_mTransformations;
+	oContext.m_bTransformUpdated = false;
+}
+
+void CRenderingContext::SaveScopeState(unsigned int iState)
+{
+	CStateScope* pScope = m_pScope;
+	if (!pScope || (pScope->m_iSaved & iState))
+		return;
+
+	// The scope belongs to the context that was on top when it was opened.
+	TAssert(pScope->m_iContextDepth == s_aContexts.size());
+
+	CRenderContext& oContext = GetContext();
+
+	switch (iState)
+	{
+	case SCOPE_TRANSFORM:
+		pScope->m_mTransformations = oContext.m_mTransformations;
+		break;
+
+	case SCOPE_VIEWPORT:
+		pScope->m_aiViewport[0] = oContext.m_iViewportX;
+		pScope->m_aiViewport[1] = oContext.m_iViewportY;
+		pScope->m_aiViewport[2] = oContext.m_iViewportWidth;
+		pScope->m_aiViewport[3] = oContext.m_iViewportHeight;
+		break;
+
+	case SCOPE_BLEND:
+		pScope->m_eBlend = oContext.m_eBlend;
+		break;
+
+	case SCOPE_ALPHA:
+		pScope->m_flAlpha = oContext.m_flAlpha;
+		break;
+
+	case SCOPE_DEPTH_MASK:
+		pScope->m_bDepthMask = oContext.m_bDepthMask;
+		break;
+
+	case SCOPE_DEPTH_TEST:
+		pScope->m_bDepthTest = oContext.m_bDepthTest;
+		break;
+
+	case SCOPE_DEPTH_FUNCTION:
+		pScope->m_eDepthFunction = oContext.m_eDepthFunction;
+		break;
+
+	case SCOPE_CULL:
+		pScope->m_bCull = oContext.m_bCull;
+		break;
+
+	case SCOPE_WINDING:
+		pScope->m_bWinding = oContext.m_bWinding;
+		break;
+
+	case SCOPE_PROGRAM:
+		pScope->m_pShader = m_pShader;
+		break;
+
+	default:
+		TUnimplemented();
+	}
+
+	pScope->m_iSaved |= iState;
+}
+
 void CRenderingContext::SetProjection(const Matrix4x4& m)
 {
+	TAssert(!m_pScope);	// Scopes don't put this back.
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mProjection = m;
@@ -155,6 +318,8 @@ void CRenderingContext::SetProjection(const Matrix4x4& m)
 
 void CRenderingContext::SetView(const Matrix4x4& m)
 {
+	TAssert(!m_pScope);	// Scopes don't put this back.
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mView = m;
@@ -163,6 +328,8 @@ void CRenderingContext::SetView(const Matrix4x4& m)
 
 void CRenderingContext::SetPosition(const Vector& vecPosition)
 {
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations.SetTranslation(vecPosition);
@@ -171,6 +338,8 @@ void CRenderingContext::SetPosition(const Vector& vecPosition)
 
 void CRenderingContext::Transform(const Matrix4x4& m)
 {
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations *= m;
@@ -179,6 +348,8 @@ void CRenderingContext::Transform(const Matrix4x4& m)
 
 void CRenderingContext::Translate(const Vector& vecTranslate)
 {
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations.AddTranslation(vecTranslate);
@@ -190,6 +361,8 @@ void CRenderingContext::Rotate(float flAngle, Vector vecAxis)
 	Matrix4x4 mRotation;
 	mRotation.SetRotation(flAngle, vecAxis);
 
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations *= mRotation;
@@ -198,6 +371,8 @@ void CRenderingContext::Rotate(float flAngle, Vector vecAxis)
 
 void CRenderingContext::Scale(float flX, float flY, float flZ)
 {
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations.AddScale(Vector(flX, flY, flZ));
@@ -206,6 +381,8 @@ void CRenderingContext::Scale(float flX, float flY, float flZ)
 
 void CRenderingContext::ResetTransformations()
 {
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations.Identity();
@@ -214,6 +391,8 @@ void CRenderingContext::ResetTransformations()
 
 void CRenderingContext::LoadTransform(const Matrix4x4& m)
 {
+	SaveScopeState(SCOPE_TRANSFORM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_mTransformations = m;
@@ -222,6 +401,8 @@ void CRenderingContext::LoadTransform(const Matrix4x4& m)
 
 void CRenderingContext::SetViewport(int x, int y, int w, int h)
 {
+	SaveScopeState(SCOPE_VIEWPORT);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_iViewportX = x;
@@ -232,61 +413,59 @@ void CRenderingContext::SetViewport(int x, int y, int w, int h)
 
 void CRenderingContext::SetBlend(blendtype_t eBlend)
 {
-	if (eBlend)
-	{
-		glEnablei(GL_BLEND, 0);
-
-		if (eBlend == BLEND_ALPHA)
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		else if (eBlend == BLEND_ADDITIVE)
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-		else if (eBlend == BLEND_BOTH)
-			glBlendFunc(GL_ONE, GL_ONE);
-	}
-	else
-		glDisablei(GL_BLEND, 0);
-
+	SaveScopeState(SCOPE_BLEND);
+	CGLState::SetBlend(eBlend);
 	GetContext().m_eBlend = eBlend;
+
+	if (m_pRecording)
+		m_pRecording->RecordBlend(eBlend);
+}
+
+void CRenderingContext::SetAlpha(float flAlpha)
+{
+	SaveScopeState(SCOPE_ALPHA);
+	GetContext().m_flAlpha = flAlpha;
+
+	if (m_pRecording)
+		m_pRecording->RecordAlpha(flAlpha);
 }
 
 void CRenderingContext::SetDepthMask(bool bDepthMask)
 {
-	glDepthMask(bDepthMask);
+	SaveScopeState(SCOPE_DEPTH_MASK);
+	CGLState::SetDepthMask(bDepthMask);
 	GetContext().m_bDepthMask = bDepthMask;
 }
 
 void CRenderingContext::SetDepthTest(bool bDepthTest)
 {
-	if (bDepthTest)
-		glEnable(GL_DEPTH_TEST);
-	else
-		glDisable(GL_DEPTH_TEST);
+	SaveScopeState(SCOPE_DEPTH_TEST);
+	CGLState::SetDepthTest(bDepthTest);
 	GetContext().m_bDepthTest = bDepthTest;
 }
 
 void CRenderingContext::SetDepthFunction(depth_function_t eDepthFunction)
 {
-	if (eDepthFunction == DF_LEQUAL)
-		glDepthFunc(GL_LEQUAL);
-	else if (eDepthFunction == DF_LESS)
-		glDepthFunc(GL_LESS);
-
+	SaveScopeState(SCOPE_DEPTH_FUNCTION);
+	CGLState::SetDepthFunction(eDepthFunction);
 	GetContext().m_eDepthFunction = eDepthFunction;
 }
 
 void CRenderingContext::SetBackCulling(bool bCull)
 {
-	if (bCull)
-		glEnable(GL_CULL_FACE);
-	else
-		glDisable(GL_CULL_FACE);
+	SaveScopeState(SCOPE_CULL);
+	CGLState::SetBackCulling(bCull);
 	GetContext().m_bCull = bCull;
+
+	if (m_pRecording)
+		m_pRecording->RecordBackCulling(bCull);
 }
 
 void CRenderingContext::SetWinding(bool bWinding)
 {
+	SaveScopeState(SCOPE_WINDING);
+	CGLState::SetWinding(bWinding);
 	GetContext().m_bWinding = bWinding;
-	glFrontFace(bWinding?GL_CCW:GL_CW);
 }
 
 void CRenderingContext::ClearColor(const ::Color& clrClear)
@@ -334,101 +513,15 @@ void CRenderingContext::RenderWireBox(const Vector& vecMins, const Vector& vecMa
 
 void CRenderingContext::RenderBox(const Vector& vecMins, const Vector& vecMaxs)
 {
-	Vector vecForward(vecMaxs.x - vecMins.x, 0, 0);
-	Vector vecUp(0, vecMaxs.y - vecMins.y, 0);
-	Vector vecRight(0, 0, vecMaxs.z - vecMins.z);
-
-	// The back face
-	BeginRenderTris();
-		Normal(Vector(-1, 0, 0));
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecRight);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp);
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp);
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecUp);
-
-		// The left face
-		Normal(Vector(0, 0, -1));
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins);
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecUp);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecUp + vecForward);
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecUp + vecForward);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecForward);
-
-		// The bottom face
-		Normal(Vector(0, -1, 0));
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecForward);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecForward + vecRight);
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecForward + vecRight);
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight);
-
-		// The top face
-		Normal(Vector(0, 1, 0));
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp + vecForward);
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins + vecUp + vecForward);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecUp);
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp + vecForward);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecUp);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp);
-
-		// The right face
-		Normal(Vector(0, 0, 1));
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp + vecForward);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecRight);
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp + vecForward);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecRight);
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins + vecForward + vecRight);
-
-		// The front face
-		Normal(Vector(1, 0, 0));
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp + vecForward);
-		TexCoord(0.0f, 0.0f);
-		Vertex(vecMins + vecForward + vecRight);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecForward);
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecMins + vecRight + vecUp + vecForward);
-		TexCoord(1.0f, 0.0f);
-		Vertex(vecMins + vecForward);
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecMins + vecForward + vecUp);
-	EndRender();
+	CTransformScope oScope(this);
+
+	// Stretch the unit box out to the size of this one and move it into place.
+	Matrix4x4 mBox;
+	mBox.SetScale(vecMaxs - vecMins);
+	mBox.SetTranslation(vecMins);
+	Transform(mBox);
+
+	RenderMesh(MESH_BOX);
 }
 
 void CRenderingContext::RenderBillboard(size_t iTexture, float flRadius, Vector vecUp, Vector vecRight)
@@ -440,26 +533,48 @@ void CRenderingContext::RenderBillboard(size_t iTexture, float flRadius, Vector
 
 	// The up and right vectors form an orthogonal basis for the plane that the billboarded sprite is in.
 	// That means we can use combinations of these two vectors to find the four vertices of the sprite.
+	// The quad mesh's x and y run from -1 to 1, so put right and up in the x and y of the transform.
 	// http://youtu.be/puOTwCrEm7Q
+	CTransformScope oScope(this);
+
+	Transform(Matrix4x4(vecRight, vecUp, vecRight.Cross(vecUp)));
 
-	// Pass the vertices of the billboarded sprite into the renderer in counter-clockwise order.
-	BeginRenderTriFan();
-		TexCoord(0.0f, 0.0f);
-		Vertex(-vecUp - vecRight);
+	RenderMesh(MESH_QUAD);
+}
 
-		TexCoord(1.0f, 0.0f);
-		Vertex(-vecUp + vecRight);
+void CRenderingContext::RenderMesh(primitive_mesh_t eMesh)
+{
+	if (m_pRecording)
+	{
+		m_pRecording->RecordMesh(eMesh, GetContext().m_mTransformations);
+		return;
+	}
 
-		TexCoord(1.0f, 1.0f);
-		Vertex(vecUp + vecRight);
+	const CPrimitiveMesh& oMesh = CMeshCache::GetMesh(eMesh);
 
-		TexCoord(0.0f, 1.0f);
-		Vertex(vecUp - vecRight);
-	EndRender();
+	TAssert(oMesh.m_iVBO);
+	if (!oMesh.m_iVBO)
+		return;
+
+	if (!m_pShader)
+	{
+		UseProgram("model");
+		if (!m_pShader)
+			return;
+	}
+
+	BeginRenderVertexArray(oMesh.m_iVBO);
+	SetPositionBuffer((size_t)0, oMesh.m_iStride);
+	if (oMesh.m_iNormalOffset != ~0)
+		SetNormalsBuffer(oMesh.m_iNormalOffset, oMesh.m_iStride);
+	SetTexCoordBuffer(oMesh.m_iTexCoordOffset, oMesh.m_iStride);
+	EndRenderVertexArray(oMesh.m_iVertices);
 }
 
 void CRenderingContext::UseProgram(const char* pszProgram)
 {
+	SaveScopeState(SCOPE_PROGRAM);
+
 	CRenderContext& oContext = GetContext();
 
 	strncpy(oContext.m_szProgram, pszProgram, PROGRAM_LEN);
@@ -471,78 +586,165 @@ void CRenderingContext::UseProgram(const char* pszProgram)
 
 void CRenderingContext::UseProgram(class CShader* pShader)
 {
+	SaveScopeState(SCOPE_PROGRAM);
+
 	CRenderContext& oContext = GetContext();
 
 	oContext.m_pShader = m_pShader = pShader;
 
+	if (m_pRecording)
+		m_pRecording->RecordProgram(pShader);
+
 	if (!m_pShader)
 	{
 		oContext.m_szProgram[0] = '\0';
 		m_iProgram = 0;
-		glUseProgram(0);
+		CGLState::UseProgram(0);
 		return;
 	}
 
 	strncpy(oContext.m_szProgram, pShader->m_sName.c_str(), PROGRAM_LEN);
 
 	m_iProgram = m_pShader->m_iProgram;
-	glUseProgram((GLuint)m_pShader->m_iProgram);
-
-	oContext.m_bProjectionUpdated = false;
-	oContext.m_bViewUpdated = false;
+	CGLState::UseProgram(m_pShader->m_iProgram);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, int iValue)
 {
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniform1i(iUniform, iValue);
+	if (m_pShader)
+		SetUniform(m_pShader->FindUniform(pszName), iValue);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, float flValue)
 {
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniform1f(iUniform, flValue);
+	if (m_pShader)
+		SetUniform(m_pShader->FindUniform(pszName), flValue);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, const Vector& vecValue)
 {
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniform3fv(iUniform, 1, &vecValue.x);
+	if (m_pShader)
+		SetUniform(m_pShader->FindUniform(pszName), vecValue);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, const Vector4D& vecValue)
 {
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniform4fv(iUniform, 1, vecValue);
+	if (m_pShader)
+		SetUniform(m_pShader->FindUniform(pszName), vecValue);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, const ::Color& clrValue)
 {
-	Vector4D vecValue(clrValue);  // Convert it to a vector so it's a 0-1 value and not a 0-255 value
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniform4fv(iUniform, 1, &vecValue.x);
+	if (m_pShader)
+		SetUniform(m_pShader->FindUniform(pszName), clrValue);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, const Matrix4x4& mValue)
 {
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniformMatrix4fv(iUniform, 1, false, mValue);
+	if (m_pShader)
+		SetUniform(m_pShader->FindUniform(pszName), mValue);
 }
 
 void CRenderingContext::SetUniform(const char* pszName, size_t iSize, const float* aflValues)
 {
-	int iUniform = glGetUniformLocation((GLuint)m_iProgram, pszName);
-	glUniform1fv(iUniform, iSize, aflValues);
+	if (!m_pShader)
+		return;
+
+	TAssert(!m_pRecording);	// Arrays don't get recorded.
+
+	size_t iUniform = m_pShader->FindUniform(pszName);
+	if (iUniform == ~0)
+		return;
+
+	// Arrays are too big to keep a copy of, always upload them.
+	CShader::CUniformLocation& oUniform = m_pShader->m_aUniformLocations[iUniform];
+	oUniform.m_bValueValid = false;
+	glUniform1fv(oUniform.m_iLocation, iSize, aflValues);
+}
+
+// Returns the uniform if the value needs uploading, or null if it's unknown or unchanged.
+static CShader::CUniformLocation* UpdateUniformValue(CShader* pShader, size_t iUniform, const void* pValue, size_t iBytes)
+{
+	TAssert(iBytes <= sizeof(float)*16);
+
+	if (!pShader || iUniform >= pShader->m_aUniformLocations.size())
+		return nullptr;
+
+	// Uniforms belong to the program, so what was uploaded last is still there even if other programs were used in between.
+	CShader::CUniformLocation& oUniform = pShader->m_aUniformLocations[iUniform];
+	if (oUniform.m_bValueValid && memcmp(oUniform.m_aflValue, pValue, iBytes) == 0)
+		return nullptr;
+
+	memcpy(oUniform.m_aflValue, pValue, iBytes);
+	oUniform.m_bValueValid = true;
+
+	return &oUniform;
+}
+
+void CRenderingContext::SetUniform(size_t iUniform, int iValue)
+{
+	if (m_pRecording)
+		m_pRecording->RecordUniform(iUniform, iValue);
+
+	CShader::CUniformLocation* pUniform = UpdateUniformValue(m_pShader, iUniform, &iValue, sizeof(iValue));
+	if (pUniform)
+		glUniform1i(pUniform->m_iLocation, iValue);
+}
+
+void CRenderingContext::SetUniform(size_t iUniform, float flValue)
+{
+	if (m_pRecording)
+		m_pRecording->RecordUniform(iUniform, flValue);
+
+	CShader::CUniformLocation* pUniform = UpdateUniformValue(m_pShader, iUniform, &flValue, sizeof(flValue));
+	if (pUniform)
+		glUniform1f(pUniform->m_iLocation, flValue);
+}
+
+void CRenderingContext::SetUniform(size_t iUniform, const Vector& vecValue)
+{
+	if (m_pRecording)
+		m_pRecording->RecordUniform(iUniform, vecValue);
+
+	CShader::CUniformLocation* pUniform = UpdateUniformValue(m_pShader, iUniform, &vecValue.x, sizeof(float)*3);
+	if (pUniform)
+		glUniform3fv(pUniform->m_iLocation, 1, &vecValue.x);
+}
+
+void CRenderingContext::SetUniform(size_t iUniform, const Vector4D& vecValue)
+{
+	if (m_pRecording)
+		m_pRecording->RecordUniform(iUniform, vecValue);
+
+	CShader::CUniformLocation* pUniform = UpdateUniformValue(m_pShader, iUniform, &vecValue.x, sizeof(float)*4);
+	if (pUniform)
+		glUniform4fv(pUniform->m_iLocation, 1, &vecValue.x);
+}
+
+void CRenderingContext::SetUniform(size_t iUniform, const ::Color& clrValue)
+{
+	SetUniform(iUniform, Vector4D(clrValue));  // Convert it to a vector so it's a 0-1 value and not a 0-255 value
+}
+
+void CRenderingContext::SetUniform(size_t iUniform, const Matrix4x4& mValue)
+{
+	if (m_pRecording)
+		m_pRecording->RecordUniform(iUniform, mValue);
+
+	CShader::CUniformLocation* pUniform = UpdateUniformValue(m_pShader, iUniform, (const float*)mValue, sizeof(float)*16);
+	if (pUniform)
+		glUniformMatrix4fv(pUniform->m_iLocation, 1, false, mValue);
 }
 
 void CRenderingContext::BindTexture(size_t iTexture, int iChannel, bool bMultisample)
 {
-	glActiveTexture(GL_TEXTURE0+iChannel);
+	if (m_pRecording)
+	{
+		TAssert(!bMultisample);
+		m_pRecording->RecordTexture(iTexture, iChannel);
+	}
 
-	if (bMultisample)
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, (GLuint)iTexture);
-	else
-		glBindTexture(GL_TEXTURE_2D, (GLuint)iTexture);
+	CGLState::BindTexture(iChannel, iTexture, bMultisample);
 }
 
 void CRenderingContext::SetColor(const ::Color& c)
@@ -733,6 +935,8 @@ void CRenderingContext::Vertex(const Vector& v)
 
 void CRenderingContext::EndRender()
 {
+	TAssert(!m_pRecording);	// Use BeginRenderFormat() for anything that's going in a command list.
+
 	if (!m_pShader)
 	{
 		UseProgram("model");
@@ -740,65 +944,386 @@ void CRenderingContext::EndRender()
 			return;
 	}
 
-	CRenderContext& oContext = GetContext();
+	UploadMatrices();
 
-	if (!oContext.m_bProjectionUpdated)
-		SetUniform("mProjection", oContext.m_mProjection);
+	size_t iVertices = s_avecVertices.size();
 
-	if (!oContext.m_bViewUpdated)
-		SetUniform("mView", oContext.m_mView);
+	// Only what the shader is going to read gets sent.
+	bool bTexCoords = false;
+	if (m_bTexCoord && s_aavecTexCoords.size() && s_aavecTexCoords[0].size() == iVertices)
+	{
+		for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
+		{
+			if (m_pShader->m_aiTexCoordAttributes[i] != ~0)
+				bTexCoords = true;
+		}
+	}
 
-	if (!oContext.m_bTransformUpdated)
-		SetUniform("mGlobal", oContext.m_mTransformations);
+	bool bNormals = m_bNormal && m_pShader->m_iNormalAttribute != ~0 && s_avecNormals.size() == iVertices;
+	bool bTangents = m_bTangents && m_pShader->m_iTangentAttribute != ~0 && m_pShader->m_iBitangentAttribute != ~0 && s_avecTangents.size() == iVertices && s_avecBitangents.size() == iVertices;
+
+	size_t iPositionBytes = iVertices * sizeof(Vector);
+	size_t iNormalBytes = bNormals ? iVertices * sizeof(Vector) : 0;
+	size_t iTexCoordBytes = bTexCoords ? iVertices * sizeof(Vector2D) : 0;
+	size_t iTangentBytes = bTangents ? iVertices * sizeof(Vector) : 0;
+
+	const void* pPositions = s_avecVertices.data();
+	const void* pNormals = s_avecNormals.data();
+	const void* pTexCoords = bTexCoords ? s_aavecTexCoords[0].data() : nullptr;
+	const void* pTangents = s_avecTangents.data();
+	const void* pBitangents = s_avecBitangents.data();
+
+	// Copy the arrays one after another into the stream buffer and draw them from there. If
+	// they don't fit they get drawn straight out of client memory like they used to.
+	size_t iOffset;
+	char* pStream = (char*)CVertexStream::Map(iPositionBytes + iNormalBytes + iTexCoordBytes + iTangentBytes*2, iOffset);
+	if (pStream)
+	{
+		memcpy(pStream, pPositions, iPositionBytes);
+		pPositions = BUFFER_OFFSET(iOffset);
+		pStream += iPositionBytes;
+		iOffset += iPositionBytes;
 
-	oContext.m_bProjectionUpdated = oContext.m_bViewUpdated = oContext.m_bTransformUpdated = true;
+		if (bNormals)
+		{
+			memcpy(pStream, pNormals, iNormalBytes);
+			pNormals = BUFFER_OFFSET(iOffset);
+			pStream += iNormalBytes;
+			iOffset += iNormalBytes;
+		}
 
-	if (m_bTexCoord)
+		if (bTexCoords)
+		{
+			memcpy(pStream, pTexCoords, iTexCoordBytes);
+			pTexCoords = BUFFER_OFFSET(iOffset);
+			pStream += iTexCoordBytes;
+			iOffset += iTexCoordBytes;
+		}
+
+		if (bTangents)
+		{
+			memcpy(pStream, pTangents, iTangentBytes);
+			pTangents = BUFFER_OFFSET(iOffset);
+			pStream += iTangentBytes;
+			iOffset += iTangentBytes;
+
+			memcpy(pStream, pBitangents, iTangentBytes);
+			pBitangents = BUFFER_OFFSET(iOffset);
+		}
+
+		CVertexStream::Unmap();
+	}
+	else
+		CGLState::BindArrayBuffer(0);
+
+	if (bTexCoords)
 	{
 		for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
 		{
 			if (m_pShader->m_aiTexCoordAttributes[i] != ~0)
 			{
 				glEnableVertexAttribArray(m_pShader->m_aiTexCoordAttributes[i]);
-				glVertexAttribPointer(m_pShader->m_aiTexCoordAttributes[i], 2, GL_FLOAT, false, 0, s_aavecTexCoords[0].data());
+				glVertexAttribPointer(m_pShader->m_aiTexCoordAttributes[i], 2, GL_FLOAT, false, 0, pTexCoords);
 			}
 		}
 	}
 
-	if (m_bNormal && m_pShader->m_iNormalAttribute != ~0)
+	if (bNormals)
 	{
 		glEnableVertexAttribArray(m_pShader->m_iNormalAttribute);
-		glVertexAttribPointer(m_pShader->m_iNormalAttribute, 3, GL_FLOAT, false, 0, s_avecNormals.data());
+		glVertexAttribPointer(m_pShader->m_iNormalAttribute, 3, GL_FLOAT, false, 0, pNormals);
 	}
 
-	if (m_bTangents && m_pShader->m_iTangentAttribute != ~0 && m_pShader->m_iBitangentAttribute != ~0)
+	if (bTangents)
 	{
 		glEnableVertexAttribArray(m_pShader->m_iTangentAttribute);
-		glVertexAttribPointer(m_pShader->m_iTangentAttribute, 3, GL_FLOAT, false, 0, s_avecTangents.data());
+		glVertexAttribPointer(m_pShader->m_iTangentAttribute, 3, GL_FLOAT, false, 0, pTangents);
 
 		glEnableVertexAttribArray(m_pShader->m_iBitangentAttribute);
-		glVertexAttribPointer(m_pShader->m_iBitangentAttribute, 3, GL_FLOAT, false, 0, s_avecBitangents.data());
+		glVertexAttribPointer(m_pShader->m_iBitangentAttribute, 3, GL_FLOAT, false, 0, pBitangents);
 	}
 
 	glEnableVertexAttribArray(m_pShader->m_iPositionAttribute);
-	glVertexAttribPointer(m_pShader->m_iPositionAttribute, 3, GL_FLOAT, false, 0, s_avecVertices.data());
+	glVertexAttribPointer(m_pShader->m_iPositionAttribute, 3, GL_FLOAT, false, 0, pPositions);
 
-	glDrawArrays(m_iDrawMode, 0, s_avecVertices.size());
+	glDrawArrays(m_iDrawMode, 0, iVertices);
 
-	glDisableVertexAttribArray(m_pShader->m_iPositionAttribute);
-	for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
+	DisableVertexAttributes();
+}
+
+static GLenum PrimitiveMode(primitive_t ePrimitive)
+{
+	switch (ePrimitive)
 	{
-		if (m_pShader->m_aiTexCoordAttributes[i] != ~0)
-			glDisableVertexAttribArray(m_pShader->m_aiTexCoordAttributes[i]);
+	case PRIMITIVE_TRIANGLES:		return GL_TRIANGLES;
+	case PRIMITIVE_TRIANGLE_FAN:	return GL_TRIANGLE_FAN;
+	case PRIMITIVE_TRIANGLE_STRIP:	return GL_TRIANGLE_STRIP;
+	case PRIMITIVE_LINES:			return GL_LINES;
+	case PRIMITIVE_LINE_LOOP:		return GL_LINE_LOOP;
+	case PRIMITIVE_LINE_STRIP:		return GL_LINE_STRIP;
+	case PRIMITIVE_POINTS:			return GL_POINTS;
+	}
+
+	TAssert(false);
+	return GL_TRIANGLES;
+}
+
+static size_t AttributeLocation(const CShader* pShader, vertex_attribute_t eAttribute)
+{
+	switch (eAttribute)
+	{
+	case VERTEX_POSITION:	return pShader->m_iPositionAttribute;
+	case VERTEX_NORMAL:		return pShader->m_iNormalAttribute;
+	case VERTEX_TANGENT:	return pShader->m_iTangentAttribute;
+	case VERTEX_BITANGENT:	return pShader->m_iBitangentAttribute;
+	case VERTEX_TEXCOORD0:	return pShader->m_aiTexCoordAttributes[0];
+	case VERTEX_TEXCOORD1:	return pShader->m_aiTexCoordAttributes[1];
+	case VERTEX_COLOR:		return pShader->m_iColorAttribute;
+	}
+
+	return ~0;
+}
+
+void* CRenderingContext::BeginRenderLayout(const CVertexLayout& oLayout, primitive_t ePrimitive, size_t iVertices)
+{
+	TAssert(!s_pFormatLayout);
+
+	s_pFormatLayout = &oLayout;
+	s_iFormatVertices = iVertices;
+	m_iDrawMode = PrimitiveMode(ePrimitive);
+
+	size_t iBytes = iVertices * oLayout.m_iStride;
+
+	// Recorded vertices go straight into the list and are uploaded with everything else at the end.
+	if (m_pRecording)
+		return m_pRecording->AddVertices(iBytes, s_iFormatOffset);
+
+	void* pData = CVertexStream::Map(iBytes, s_iFormatOffset);
+	if (pData)
+		return pData;
+
+	// No room in the stream. It'll get drawn out of client memory instead.
+	s_iFormatOffset = ~0;
+	if (s_aFormatScratch.size() < iBytes)
+		s_aFormatScratch.resize(iBytes);
+
+	return s_aFormatScratch.data();
+}
+
+void CRenderingContext::EndRenderFormat()
+{
+	TAssert(s_pFormatLayout);
+	if (!s_pFormatLayout)
+		return;
+
+	const CVertexLayout& oLayout = *s_pFormatLayout;
+	s_pFormatLayout = nullptr;
+
+	if (m_pRecording)
+	{
+		CVerticesCommand oCommand;
+		memcpy(oCommand.m_aflTransform, (const float*)GetContext().m_mTransformations, sizeof(oCommand.m_aflTransform));
+		oCommand.m_iLayout = m_pRecording->AddLayout(oLayout);
+		oCommand.m_iOffset = s_iFormatOffset;
+		oCommand.m_iVertices = s_iFormatVertices;
+		oCommand.m_iDrawMode = m_iDrawMode;
+		m_pRecording->Push(COMMAND_VERTICES, oCommand);
+		return;
+	}
+
+	// Unmap before anything else, the stream buffer is still bound.
+	const char* pBase;
+	if (s_iFormatOffset != ~0)
+	{
+		CVertexStream::Unmap();
+		pBase = BUFFER_OFFSET(s_iFormatOffset);
+	}
+	else
+	{
+		CGLState::BindArrayBuffer(0);
+		pBase = s_aFormatScratch.data();
+	}
+
+	if (!m_pShader)
+	{
+		UseProgram("model");
+		if (!m_pShader)
+			return;
+	}
+
+	DrawLayout(oLayout, pBase, s_iFormatVertices);
+}
+
+void CRenderingContext::DrawLayout(const CVertexLayout& oLayout, const char* pBase, size_t iVertices)
+{
+	UploadMatrices();
+
+	for (size_t i = 0; i < oLayout.m_iAttributes; i++)
+	{
+		const CVertexAttributeLayout& oAttribute = oLayout.m_aAttributes[i];
+
+		size_t iLocation = AttributeLocation(m_pShader, oAttribute.m_eAttribute);
+		if (iLocation == ~0)
+			continue;
+
+		glEnableVertexAttribArray(iLocation);
+		glVertexAttribPointer(iLocation, oAttribute.m_iComponents, GL_FLOAT, false, oLayout.m_iStride, pBase + oAttribute.m_iOffset);
+	}
+
+	glDrawArrays(m_iDrawMode, 0, iVertices);
+
+	DisableVertexAttributes();
+}
+
+void CRenderingContext::BeginRecording(CCommandList* pList)
+{
+	TAssert(!m_pRecording);
+	TAssert(pList);
+
+	pList->Clear();
+
+	// Everything gets recorded relative to this, so that it can be replayed anywhere.
+	m_mRecordingTransform = GetContext().m_mTransformations;
+	ResetTransformations();
+
+	m_pRecording = pList;
+}
+
+void CRenderingContext::EndRecording()
+{
+	TAssert(m_pRecording);
+	if (!m_pRecording)
+		return;
+
+	m_pRecording->Upload();
+	m_pRecording = nullptr;
+
+	LoadTransform(m_mRecordingTransform);
+}
+
+void CRenderingContext::Replay(const CCommandList& oList)
+{
+	TAssert(!m_pRecording);
+
+	CStateScope oScope(this);
+
+	Matrix4x4 mReplay = GetContext().m_mTransformations;
+
+	const char* pCommands = oList.m_aCommands.data();
+	const char* pEnd = pCommands + oList.m_aCommands.size();
+
+	while (pCommands < pEnd)
+	{
+		CCommandHeader oHeader;
+		memcpy(&oHeader, pCommands, sizeof(oHeader));
+		const char* pCommand = pCommands + sizeof(oHeader);
+		pCommands = pCommand + oHeader.m_iBytes;
+
+		switch (oHeader.m_iCommand)
+		{
+		case COMMAND_PROGRAM:
+		{
+			CProgramCommand oCommand;
+			memcpy(&oCommand, pCommand, sizeof(oCommand));
+			UseProgram(CShaderLibrary::GetShader(oCommand.m_iShader));
+			break;
+		}
+
+		case COMMAND_TEXTURE:
+		{
+			CTextureCommand oCommand;
+			memcpy(&oCommand, pCommand, sizeof(oCommand));
+			BindTexture(oCommand.m_iTexture, oCommand.m_iChannel);
+			break;
+		}
+
+		case COMMAND_BLEND:
+		{
+			blendtype_t eBlend;
+			memcpy(&eBlend, pCommand, sizeof(eBlend));
+			SetBlend(eBlend);
+			break;
+		}
+
+		case COMMAND_ALPHA:
+		{
+			float flAlpha;
+			memcpy(&flAlpha, pCommand, sizeof(flAlpha));
+			SetAlpha(flAlpha);
+			break;
+		}
+
+		case COMMAND_BACK_CULLING:
+		{
+			bool bCull;
+			memcpy(&bCull, pCommand, sizeof(bCull));
+			SetBackCulling(bCull);
+			break;
+		}
+
+		case COMMAND_UNIFORM:
+		{
+			CUniformCommand oCommand;
+			memcpy(&oCommand, pCommand, oHeader.m_iBytes);
+
+			switch (oCommand.m_eType)
+			{
+			case UNIFORM_INT:
+			{
+				int iValue;
+				memcpy(&iValue, oCommand.m_aflValue, sizeof(iValue));
+				SetUniform(oCommand.m_iUniform, iValue);
+				break;
+			}
+
+			case UNIFORM_FLOAT:
+				SetUniform(oCommand.m_iUniform, oCommand.m_aflValue[0]);
+				break;
+
+			case UNIFORM_VECTOR:
+				SetUniform(oCommand.m_iUniform, Vector(oCommand.m_aflValue[0], oCommand.m_aflValue[1], oCommand.m_aflValue[2]));
+				break;
+
+			case UNIFORM_VECTOR4D:
+				SetUniform(oCommand.m_iUniform, Vector4D(oCommand.m_aflValue[0], oCommand.m_aflValue[1], oCommand.m_aflValue[2], oCommand.m_aflValue[3]));
+				break;
+
+			case UNIFORM_MATRIX:
+				SetUniform(oCommand.m_iUniform, Matrix4x4(oCommand.m_aflValue));
+				break;
+			}
+			break;
+		}
+
+		case COMMAND_MESH:
+		{
+			CMeshCommand oCommand;
+			memcpy(&oCommand, pCommand, sizeof(oCommand));
+			LoadTransform(mReplay * Matrix4x4(oCommand.m_aflTransform));
+			RenderMesh(oCommand.m_eMesh);
+			break;
+		}
+
+		case COMMAND_VERTICES:
+		{
+			CVerticesCommand oCommand;
+			memcpy(&oCommand, pCommand, sizeof(oCommand));
+
+			if (!m_pShader)
+				break;
+
+			LoadTransform(mReplay * Matrix4x4(oCommand.m_aflTransform));
+			m_iDrawMode = oCommand.m_iDrawMode;
+			CGLState::BindArrayBuffer(oList.m_iBuffer);
+			DrawLayout(oList.m_aLayouts[oCommand.m_iLayout], BUFFER_OFFSET(oCommand.m_iOffset), oCommand.m_iVertices);
+			break;
+		}
+
+		default:
+			TUnimplemented();
+			return;
+		}
 	}
-	if (m_pShader->m_iNormalAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iNormalAttribute);
-	if (m_pShader->m_iTangentAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iTangentAttribute);
-	if (m_pShader->m_iBitangentAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iBitangentAttribute);
-	if (m_pShader->m_iColorAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iColorAttribute);
 }
 
 void CRenderingContext::CreateVBO(size_t& iVBO, size_t& iVBOSize)
@@ -860,12 +1385,11 @@ void CRenderingContext::CreateVBO(size_t& iVBO, size_t& iVBOSize)
 
 void CRenderingContext::BeginRenderVertexArray(size_t iBuffer)
 {
-	if (iBuffer)
-		glBindBuffer(GL_ARRAY_BUFFER, iBuffer);
+	// Zero means the Set*Buffer() calls will pass pointers to client memory. Nothing is unbound
+	// after drawing, so back to back draws out of the same buffer don't rebind it.
+	CGLState::BindArrayBuffer(iBuffer);
 }
 
-#define BUFFER_OFFSET(i) ((char *)NULL + (i))
-
 void CRenderingContext::SetPositionBuffer(float* pflBuffer, size_t iStride)
 {
 	TAssert(m_pShader->m_iPositionAttribute != ~0);
@@ -976,18 +1500,9 @@ void CRenderingContext::SetCustomIntBuffer(const char* pszName, size_t iSize, si
 
 void CRenderingContext::EndRenderVertexArray(size_t iVertices, bool bWireframe)
 {
-	CRenderContext& oContext = GetContext();
-
-	if (!oContext.m_bProjectionUpdated)
-		SetUniform("mProjection", oContext.m_mProjection);
-
-	if (!oContext.m_bViewUpdated)
-		SetUniform("mView", oContext.m_mView);
+	TAssert(!m_pRecording);
 
-	if (!oContext.m_bTransformUpdated)
-		SetUniform("mGlobal", oContext.m_mTransformations);
-
-	oContext.m_bProjectionUpdated = oContext.m_bViewUpdated = oContext.m_bTransformUpdated = true;
+	UploadMatrices();
 
 	if (bWireframe)
 	{
@@ -997,79 +1512,164 @@ void CRenderingContext::EndRenderVertexArray(size_t iVertices, bool bWireframe)
 	else
 		glDrawArrays(GL_TRIANGLES, 0, iVertices);
 
-	glDisableVertexAttribArray(m_pShader->m_iPositionAttribute);
-	for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
+	DisableVertexAttributes();
+}
+
+void CRenderingContext::EndRenderVertexArrayTriangles(size_t iTriangles, int* piIndices)
+{
+	TAssert(!m_pRecording);
+
+	UploadMatrices();
+
+	CGLState::BindIndexBuffer(0);
+	glDrawElements(GL_TRIANGLES, iTriangles*3, GL_UNSIGNED_INT, piIndices);
+
+	DisableVertexAttributes();
+}
+
+void CRenderingContext::EndRenderVertexArrayIndexed(size_t iBuffer, size_t iVertices)
+{
+	TAssert(!m_pRecording);
+
+	UploadMatrices();
+
+	CGLState::BindIndexBuffer(iBuffer);
+
+	bool bWireframe = false;
+	glDrawElements(bWireframe?GL_LINES:GL_TRIANGLES, iVertices, GL_UNSIGNED_INT, nullptr);
+
+	DisableVertexAttributes();
+}
+
+void CRenderingContext::RenderMeshInstanced(primitive_mesh_t eMesh, const CInstanceBuffer& oInstances)
+{
+	TAssert(!m_pRecording);
+
+	const CPrimitiveMesh& oMesh = CMeshCache::GetMesh(eMesh);
+
+	TAssert(oMesh.m_iVBO);
+	if (!oMesh.m_iVBO || !oInstances.GetNumInstances())
+		return;
+
+	TAssert(m_pShader && m_pShader->m_iInstanceTransformAttribute != ~0 && m_pShader->m_iInstanceColorAttribute != ~0);
+	if (!m_pShader || m_pShader->m_iInstanceTransformAttribute == ~0 || m_pShader->m_iInstanceColorAttribute == ~0)
+		return;
+
+	BeginRenderVertexArray(oMesh.m_iVBO);
+	SetPositionBuffer((size_t)0, oMesh.m_iStride);
+	if (oMesh.m_iNormalOffset != ~0)
+		SetNormalsBuffer(oMesh.m_iNormalOffset, oMesh.m_iStride);
+	SetTexCoordBuffer(oMesh.m_iTexCoordOffset, oMesh.m_iStride);
+
+	// The instance attributes come out of the instance buffer and only move on once per instance.
+	// The transform is a mat4 in the shader, which takes up one attribute for each column.
+	CGLState::BindArrayBuffer(oInstances.GetBuffer());
+
+	for (size_t i = 0; i < 4; i++)
 	{
-		if (m_pShader->m_aiTexCoordAttributes[i] != ~0)
-			glDisableVertexAttribArray(m_pShader->m_aiTexCoordAttributes[i]);
+		GLuint iAttribute = (GLuint)(m_pShader->m_iInstanceTransformAttribute + i);
+		glEnableVertexAttribArray(iAttribute);
+		glVertexAttribPointer(iAttribute, 4, GL_FLOAT, false, sizeof(CInstanceData), BUFFER_OFFSET(offsetof(CInstanceData, m_aflTransform) + i*4*sizeof(float)));
+		glVertexAttribDivisor(iAttribute, 1);
 	}
-	if (m_pShader->m_iNormalAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iNormalAttribute);
-	if (m_pShader->m_iTangentAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iTangentAttribute);
-	if (m_pShader->m_iBitangentAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iBitangentAttribute);
-	if (m_pShader->m_iColorAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iColorAttribute);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableVertexAttribArray(m_pShader->m_iInstanceColorAttribute);
+	glVertexAttribPointer(m_pShader->m_iInstanceColorAttribute, 4, GL_FLOAT, false, sizeof(CInstanceData), BUFFER_OFFSET(offsetof(CInstanceData, m_aflColor)));
+	glVertexAttribDivisor(m_pShader->m_iInstanceColorAttribute, 1);
+
+	UploadMatrices();
+
+	glDrawArraysInstanced(GL_TRIANGLES, 0, oMesh.m_iVertices, oInstances.GetNumInstances());
+
+	// Divisors stick to the attribute index whatever program is in use, so put them back for everybody else.
+	for (size_t i = 0; i < 4; i++)
+	{
+		GLuint iAttribute = (GLuint)(m_pShader->m_iInstanceTransformAttribute + i);
+		glVertexAttribDivisor(iAttribute, 0);
+		glDisableVertexAttribArray(iAttribute);
+	}
+
+	glVertexAttribDivisor(m_pShader->m_iInstanceColorAttribute, 0);
+	glDisableVertexAttribArray(m_pShader->m_iInstanceColorAttribute);
+
+	DisableVertexAttributes();
 }
 
-void CRenderingContext::EndRenderVertexArrayTriangles(size_t iTriangles, int* piIndices)
+void CRenderingContext::RenderSprites(const CSpriteBatch& oSprites)
 {
-	CRenderContext& oContext = GetContext();
+	TAssert(!m_pRecording);
 
-	if (!oContext.m_bProjectionUpdated)
-		SetUniform("mProjection", oContext.m_mProjection);
+	const CPrimitiveMesh& oMesh = CMeshCache::GetMesh(MESH_QUAD);
 
-	if (!oContext.m_bViewUpdated)
-		SetUniform("mView", oContext.m_mView);
+	TAssert(oMesh.m_iVBO);
+	if (!oMesh.m_iVBO || !oSprites.GetNumSprites())
+		return;
 
-	if (!oContext.m_bTransformUpdated)
-		SetUniform("mGlobal", oContext.m_mTransformations);
+	TAssert(m_pShader && m_pShader->m_iSpriteCenterAttribute != ~0 && m_pShader->m_iInstanceColorAttribute != ~0 && m_pShader->m_iSpriteShotTimeAttribute != ~0);
+	if (!m_pShader || m_pShader->m_iSpriteCenterAttribute == ~0 || m_pShader->m_iInstanceColorAttribute == ~0 || m_pShader->m_iSpriteShotTimeAttribute == ~0)
+		return;
 
-	oContext.m_bProjectionUpdated = oContext.m_bViewUpdated = oContext.m_bTransformUpdated = true;
+	BeginRenderVertexArray(oMesh.m_iVBO);
+	SetPositionBuffer((size_t)0, oMesh.m_iStride);
+	SetTexCoordBuffer(oMesh.m_iTexCoordOffset, oMesh.m_iStride);
 
-	glDrawElements(GL_TRIANGLES, iTriangles*3, GL_UNSIGNED_INT, piIndices);
+	// The sprites are different every frame, so they go through the stream buffer like immediate mode does.
+	size_t iBytes = oSprites.GetNumSprites() * sizeof(CSpriteData);
+	size_t iOffset;
+	const char* pSprites = (const char*)oSprites.GetSprites();
+	void* pStream = CVertexStream::Map(iBytes, iOffset);
+	if (pStream)
+	{
+		memcpy(pStream, pSprites, iBytes);
+		CVertexStream::Unmap();
+		pSprites = (const char*)BUFFER_OFFSET(iOffset);
+	}
+	else
+		CGLState::BindArrayBuffer(0);
 
-	glDisableVertexAttribArray(m_pShader->m_iPositionAttribute);
-	for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
+	GLuint aiAttributes[3] = { (GLuint)m_pShader->m_iSpriteCenterAttribute, (GLuint)m_pShader->m_iInstanceColorAttribute, (GLuint)m_pShader->m_iSpriteShotTimeAttribute };
+
+	glVertexAttribPointer(aiAttributes[0], 4, GL_FLOAT, false, sizeof(CSpriteData), pSprites + offsetof(CSpriteData, m_aflCenter));
+	glVertexAttribPointer(aiAttributes[1], 4, GL_FLOAT, false, sizeof(CSpriteData), pSprites + offsetof(CSpriteData, m_aflColor));
+	glVertexAttribPointer(aiAttributes[2], 1, GL_FLOAT, false, sizeof(CSpriteData), pSprites + offsetof(CSpriteData, m_flShotTime));
+
+	for (size_t i = 0; i < 3; i++)
 	{
-		if (m_pShader->m_aiTexCoordAttributes[i] != ~0)
-			glDisableVertexAttribArray(m_pShader->m_aiTexCoordAttributes[i]);
+		glEnableVertexAttribArray(aiAttributes[i]);
+		glVertexAttribDivisor(aiAttributes[i], 1);
 	}
-	if (m_pShader->m_iNormalAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iNormalAttribute);
-	if (m_pShader->m_iTangentAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iTangentAttribute);
-	if (m_pShader->m_iBitangentAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iBitangentAttribute);
-	if (m_pShader->m_iColorAttribute != ~0)
-		glDisableVertexAttribArray(m_pShader->m_iColorAttribute);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	UploadMatrices();
+
+	glDrawArraysInstanced(GL_TRIANGLES, 0, oMesh.m_iVertices, oSprites.GetNumSprites());
+
+	// Divisors stick to the attribute index whatever program is in use, so put them back for everybody else.
+	for (size_t i = 0; i < 3; i++)
+	{
+		glVertexAttribDivisor(aiAttributes[i], 0);
+		glDisableVertexAttribArray(aiAttributes[i]);
+	}
+
+	DisableVertexAttributes();
 }
 
-void CRenderingContext::EndRenderVertexArrayIndexed(size_t iBuffer, size_t iVertices)
+void CRenderingContext::UploadMatrices()
 {
 	CRenderContext& oContext = GetContext();
 
-	if (!oContext.m_bProjectionUpdated)
-		SetUniform("mProjection", oContext.m_mProjection);
-
-	if (!oContext.m_bViewUpdated)
-		SetUniform("mView", oContext.m_mView);
+	// Every program shares these, so they only need sending when this context changes them or
+	// another context might have. Even then it's only sent if it's different.
+	if (!oContext.m_bProjectionUpdated || !oContext.m_bViewUpdated)
+		CUniformBlocks::SetPass(oContext.m_mProjection, oContext.m_mView);
 
 	if (!oContext.m_bTransformUpdated)
-		SetUniform("mGlobal", oContext.m_mTransformations);
+		SetUniform(m_pShader->m_iGlobalUniform, oContext.m_mTransformations);
 
 	oContext.m_bProjectionUpdated = oContext.m_bViewUpdated = oContext.m_bTransformUpdated = true;
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
-
-	bool bWireframe = false;
-	glDrawElements(bWireframe?GL_LINES:GL_TRIANGLES, iVertices, GL_UNSIGNED_INT, nullptr);
-
+void CRenderingContext::DisableVertexAttributes()
+{
 	glDisableVertexAttribArray(m_pShader->m_iPositionAttribute);
 	for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
 	{
@@ -1084,9 +1684,6 @@ void CRenderingContext::EndRenderVertexArrayIndexed(size_t iBuffer, size_t iVert
 		glDisableVertexAttribArray(m_pShader->m_iBitangentAttribute);
 	if (m_pShader->m_iColorAttribute != ~0)
 		glDisableVertexAttribArray(m_pShader->m_iColorAttribute);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 void CRenderingContext::ReadPixels(size_t x, size_t y, size_t w, size_t h, Vector4D* pvecPixels)
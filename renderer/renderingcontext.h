@@ -26,6 +26,9 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <color.h>
 
 #include "render_common.h"
+#include "meshcache.h"
+#include "vertexformat.h"
+#include "commandlist.h"
 
 #define PROGRAM_LEN 32
 
@@ -64,6 +67,48 @@ protected:
 		bool				m_bWinding;
 	};
 
+public:
+	// A much cheaper way than a new CRenderingContext to change a few things for one draw.
+	// Only what gets changed while the scope is open is saved, and only that is put back
+	// when it closes. Projection and view aren't covered, set those on a real context.
+	class CStateScope
+	{
+		friend class CRenderingContext;
+
+	public:
+							CStateScope(CRenderingContext* pContext);
+							~CStateScope();
+
+	private:
+		CRenderingContext*	m_pContext;
+		CStateScope*		m_pPrevious;
+		size_t				m_iContextDepth;
+		unsigned int		m_iSaved;
+
+		Matrix4x4			m_mTransformations;
+		int					m_aiViewport[4];
+		blendtype_t			m_eBlend;
+		float				m_flAlpha;
+		bool				m_bDepthMask;
+		bool				m_bDepthTest;
+		depth_function_t	m_eDepthFunction;
+		bool				m_bCull;
+		bool				m_bWinding;
+		class CShader*		m_pShader;
+	};
+
+	// Just saves and restores the transformation, for the common "move it, draw it, put it back".
+	class CTransformScope
+	{
+	public:
+							CTransformScope(CRenderingContext* pContext);
+							~CTransformScope();
+
+	private:
+		CRenderingContext*	m_pContext;
+		Matrix4x4			m_mTransformations;
+	};
+
 public:
 							CRenderingContext(class CRenderer* pRenderer = nullptr, bool bInherit = false);	// Make bInherit true if you want to preserve and not clobber GL settings set previously
 	virtual					~CRenderingContext();
@@ -85,7 +130,7 @@ public:
 
 	void					SetViewport(int x, int y, int w, int h);
 	void					SetBlend(blendtype_t eBlend);
-	void					SetAlpha(float flAlpha) { GetContext().m_flAlpha = flAlpha; };
+	void					SetAlpha(float flAlpha);
 	void					SetDepthMask(bool bDepthMask);
 	void					SetDepthTest(bool bDepthTest);
 	void					SetDepthFunction(depth_function_t eDepthFunction);
@@ -105,6 +150,15 @@ public:
 
 	void					RenderBillboard(size_t iTexture, float flRadius, Vector vecUp, Vector vecRight);
 
+	// Draws one of the cached meshes with the current transform.
+	void					RenderMesh(primitive_mesh_t eMesh);
+	// Draws the mesh once for every instance in the buffer, each with its own transform and color.
+	// Needs a program that reads the instance attributes, like "instanced". The current transform isn't used.
+	void					RenderMeshInstanced(primitive_mesh_t eMesh, const class CInstanceBuffer& oInstances);
+	// Draws a quad for every sprite in the batch, all in one go. Needs a program that builds the
+	// sprites in the vertex shader, like "sprite". The current transform isn't used.
+	void					RenderSprites(const class CSpriteBatch& oSprites);
+
 	void					UseProgram(const char* pszProgram);
 	void					UseProgram(class CShader* pShader);		// Can save on the program name lookup
 	void					SetupMaterial();
@@ -117,6 +171,13 @@ public:
 	void					SetUniform(const char* pszName, const ::Color& clrColor);
 	void					SetUniform(const char* pszName, const Matrix4x4& mValue);
 	void					SetUniform(const char* pszName, size_t iSize, const float* aflValues);
+	// Handles come from CShader::FindUniform on the active shader. Setting a value the uniform already has does nothing.
+	void					SetUniform(size_t iUniform, int iValue);
+	void					SetUniform(size_t iUniform, float flValue);
+	void					SetUniform(size_t iUniform, const Vector& vecValue);
+	void					SetUniform(size_t iUniform, const Vector4D& vecValue);
+	void					SetUniform(size_t iUniform, const ::Color& clrColor);
+	void					SetUniform(size_t iUniform, const Matrix4x4& mValue);
 	void					BindTexture(size_t iTexture, int iChannel = 0, bool bMultisample = false);
 	void					BindBufferTexture(const CFrameBuffer& oBuffer, int iChannel = 0);
 	void					SetColor(const ::Color& c);	// Set the mesh's uniform color. Do this before BeginRender*
@@ -130,6 +191,15 @@ public:
 	void					BeginRenderLineStrip();
 	void					BeginRenderPoints(float flSize=1);
 	void					BeginRenderDebugLines();
+
+	// Immediate mode with a fixed, interleaved vertex format. Write exactly iVertices vertices with
+	// the writer and then call EndRenderFormat(). Don't draw anything else in between.
+	template <class Format>
+	CVertexWriter<Format>	BeginRenderFormat(primitive_t ePrimitive, size_t iVertices)
+	{
+		return CVertexWriter<Format>(BeginRenderLayout(Format::GetLayout(), ePrimitive, iVertices), iVertices);
+	}
+	void					EndRenderFormat();
 	void					TexCoord(float s, float t, int iChannel = 0);
 	void					TexCoord(const Vector2D& v, int iChannel = 0);
 	void					TexCoord(const Vector& v, int iChannel = 0);
@@ -156,6 +226,18 @@ public:
 	void					EndRenderVertexArrayTriangles(size_t iTriangles, int* piIndices);
 	void					EndRenderVertexArrayIndexed(size_t iBuffer, size_t iVertices);
 
+	// Between these, draws go into the list instead of being drawn. Program, texture, blend, alpha,
+	// back culling and uniform changes are recorded as well as made. Transforms are recorded relative
+	// to the one in place when recording began. Immediate mode and vertex arrays can't be recorded,
+	// use RenderMesh() and BeginRenderFormat() instead.
+	void					BeginRecording(CCommandList* pList);
+	void					EndRecording();
+	bool					IsRecording() const { return !!m_pRecording; }
+
+	// Play a recorded list back on top of the current transform, so set that first to move the
+	// whole list somewhere else. Program, blend, alpha, back culling and transform are put back afterwards.
+	void					Replay(const CCommandList& oList);
+
 	// Reads w*h RGBA pixels in float format
 	void					ReadPixels(size_t x, size_t y, size_t w, size_t h, Vector4D* pvecPixels);
 
@@ -164,12 +246,27 @@ public:
 protected:
 	inline CRenderContext&	GetContext() { return s_aContexts.back(); }
 
+	void					SaveScopeState(unsigned int iState);
+
+	void*					BeginRenderLayout(const CVertexLayout& oLayout, primitive_t ePrimitive, size_t iVertices);
+	// Points the attributes at vertices in the bound array buffer, or in client memory if none is bound, and draws them.
+	void					DrawLayout(const CVertexLayout& oLayout, const char* pBase, size_t iVertices);
+
+	// For the EndRender* functions, on either side of the draw.
+	void					UploadMatrices();
+	void					DisableVertexAttributes();
+
 public:
 	class CRenderer*		m_pRenderer;
 	class CShader*			m_pShader;
 
 	size_t					m_iProgram;
 
+	CStateScope*			m_pScope;
+
+	CCommandList*			m_pRecording;
+	Matrix4x4				m_mRecordingTransform;	// What it was before recording began
+
 	::Color					m_clrRender;
 
 	int						m_iDrawMode;
@@ -189,6 +286,12 @@ public:
 	static std::vector<Vector>      s_avecBitangents;
 	static std::vector<Vector>      s_avecVertices;
 
+	// What BeginRenderFormat() left for EndRenderFormat().
+	static const CVertexLayout*     s_pFormatLayout;
+	static size_t                   s_iFormatVertices;
+	static size_t                   s_iFormatOffset;	// In the vertex stream, or ~0 if it's in s_aFormatScratch
+	static std::vector<char>        s_aFormatScratch;
+
 	static std::vector<CRenderContext> s_aContexts;
 };
 
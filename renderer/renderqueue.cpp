@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "renderqueue.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <common.h>
+
+// Key layout. See the comment on CRenderQueue.
+#define KEY_PASS_SHIFT			62
+#define KEY_PROGRAM_BITS		8
+#define KEY_TEXTURE_BITS		16
+#define KEY_BLEND_BITS			4
+#define KEY_STATE_BITS			(KEY_PROGRAM_BITS+KEY_TEXTURE_BITS+KEY_BLEND_BITS)
+#define KEY_DISTANCE_BITS		24
+
+#define KEY_PASS_OPAQUE			0ull
+#define KEY_PASS_TRANSPARENT	1ull
+
+static unsigned int StateBits(size_t iProgram, size_t iTexture, blendtype_t eBlend)
+{
+	TAssert(iProgram < (1<<KEY_PROGRAM_BITS));
+	TAssert(iTexture < (1<<KEY_TEXTURE_BITS));
+
+	unsigned int iProgramBits = (unsigned int)iProgram & ((1<<KEY_PROGRAM_BITS)-1);
+	unsigned int iTextureBits = (unsigned int)iTexture & ((1<<KEY_TEXTURE_BITS)-1);
+	unsigned int iBlendBits = (unsigned int)eBlend & ((1<<KEY_BLEND_BITS)-1);
+
+	return (iProgramBits<<(KEY_TEXTURE_BITS+KEY_BLEND_BITS)) | (iTextureBits<<KEY_BLEND_BITS) | iBlendBits;
+}
+
+// Positive floats sort the same as their bits do as unsigned ints. The top bits are the exponent
+// and the start of the mantissa, so dropping the bottom ones keeps the order with a little less precision.
+static unsigned long long DistanceBits(float flDistance)
+{
+	if (!(flDistance > 0))
+		return 0;
+
+	unsigned int iBits;
+	memcpy(&iBits, &flDistance, sizeof(iBits));
+
+	return iBits >> (32-KEY_DISTANCE_BITS);
+}
+
+CRenderQueue::CRenderQueue()
+{
+	m_iStateChangesSubmitted = 0;
+	m_iStateChangesSorted = 0;
+}
+
+unsigned long long CRenderQueue::OpaqueKey(size_t iProgram, size_t iTexture, blendtype_t eBlend, float flDistance)
+{
+	unsigned long long iKey = KEY_PASS_OPAQUE << KEY_PASS_SHIFT;
+	iKey |= (unsigned long long)StateBits(iProgram, iTexture, eBlend) << KEY_DISTANCE_BITS;
+	iKey |= DistanceBits(flDistance);
+	return iKey;
+}
+
+unsigned long long CRenderQueue::TransparentKey(size_t iProgram, size_t iTexture, blendtype_t eBlend, float flDistance)
+{
+	unsigned long long iFarFirst = ((1ull<<KEY_DISTANCE_BITS)-1) - DistanceBits(flDistance);
+
+	unsigned long long iKey = KEY_PASS_TRANSPARENT << KEY_PASS_SHIFT;
+	iKey |= iFarFirst << KEY_STATE_BITS;
+	iKey |= StateBits(iProgram, iTexture, eBlend);
+	return iKey;
+}
+
+void CRenderQueue::Clear()
+{
+	m_aPackets.clear();
+}
+
+void CRenderQueue::Submit(unsigned long long iKey, unsigned int iPayload)
+{
+	m_aPackets.push_back(CDrawPacket());
+
+	CDrawPacket& oPacket = m_aPackets.back();
+	oPacket.m_iKey = iKey;
+	oPacket.m_iPayload = iPayload;
+
+	// The state is in a different place in the key for each pass. Only the pass bits and
+	// the distance are not state, and the distance is never more than KEY_DISTANCE_BITS wide.
+	if ((iKey >> KEY_PASS_SHIFT) == KEY_PASS_TRANSPARENT)
+		oPacket.m_iState = (unsigned int)(iKey & ((1ull<<KEY_STATE_BITS)-1));
+	else
+		oPacket.m_iState = (unsigned int)((iKey >> KEY_DISTANCE_BITS) & ((1ull<<KEY_STATE_BITS)-1));
+}
+
+void CRenderQueue::Sort()
+{
+	m_iStateChangesSubmitted = CountStateChanges();
+
+	size_t iPackets = m_aPackets.size();
+	if (iPackets > 1)
+	{
+		// Least significant byte first, eight passes. Count them all up front in one go.
+		size_t aiCounts[8][256];
+		memset(aiCounts, 0, sizeof(aiCounts));
+
+		for (size_t i = 0; i < iPackets; i++)
+		{
+			unsigned long long iKey = m_aPackets[i].m_iKey;
+			for (size_t j = 0; j < 8; j++)
+				aiCounts[j][(iKey >> (j*8)) & 0xFF]++;
+		}
+
+		m_aSortScratch.resize(iPackets);
+
+		CDrawPacket* pFrom = m_aPackets.data();
+		CDrawPacket* pTo = m_aSortScratch.data();
+
+		for (size_t j = 0; j < 8; j++)
+		{
+			size_t* piCounts = aiCounts[j];
+
+			// Every key has the same byte here. Lots of the high bytes are like that, skip them.
+			if (piCounts[(pFrom[0].m_iKey >> (j*8)) & 0xFF] == iPackets)
+				continue;
+
+			size_t iOffset = 0;
+			for (size_t k = 0; k < 256; k++)
+			{
+				size_t iCount = piCounts[k];
+				piCounts[k] = iOffset;
+				iOffset += iCount;
+			}
+
+			for (size_t i = 0; i < iPackets; i++)
+				pTo[piCounts[(pFrom[i].m_iKey >> (j*8)) & 0xFF]++] = pFrom[i];
+
+			std::swap(pFrom, pTo);
+		}
+
+		// Odd number of passes and the result is in the scratch buffer.
+		if (pFrom != m_aPackets.data())
+			m_aPackets.swap(m_aSortScratch);
+	}
+
+	m_iStateChangesSorted = CountStateChanges();
+}
+
+size_t CRenderQueue::CountStateChanges() const
+{
+	size_t iChanges = 0;
+	for (size_t i = 1; i < m_aPackets.size(); i++)
+	{
+		if (m_aPackets[i].m_iState != m_aPackets[i-1].m_iState)
+			iChanges++;
+	}
+
+	return iChanges;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_RENDERQUEUE_H
+#define TINKER_RENDERQUEUE_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "render_common.h"
+
+// A draw waiting in a render queue. The payload is whatever the submitter needs to
+// find the thing to draw again, usually an index.
+class CDrawPacket
+{
+public:
+	unsigned long long		m_iKey;
+	unsigned int			m_iState;		// Program, texture and blend, for counting state changes
+	unsigned int			m_iPayload;
+};
+
+// Draws get submitted in whatever order they turn up in, then sorted by key so that
+// they come out in an order that changes state as little as possible.
+//
+// Opaque keys, high bits to low: pass, program, texture, blend, distance.
+// Draws that share state end up together, and within that they're front to back.
+//
+// Transparent keys: pass, distance (far first), program, texture, blend.
+// Those have to be back to front to blend right, so state only breaks ties.
+class CRenderQueue
+{
+public:
+							CRenderQueue();
+
+public:
+	static unsigned long long	OpaqueKey(size_t iProgram, size_t iTexture, blendtype_t eBlend, float flDistance);
+	static unsigned long long	TransparentKey(size_t iProgram, size_t iTexture, blendtype_t eBlend, float flDistance);
+
+	void					Clear();
+	void					Submit(unsigned long long iKey, unsigned int iPayload);
+
+	// A radix sort, so it's stable. Draws with the same key stay in the order they were submitted.
+	void					Sort();
+
+	size_t					GetNumPackets() const { return m_aPackets.size(); }
+	const CDrawPacket&		GetPacket(size_t i) const { return m_aPackets[i]; }
+
+	// How many times state would change drawing the packets in the order they were submitted
+	// and in the order Sort() put them in.
+	size_t					GetStateChangesSubmitted() const { return m_iStateChangesSubmitted; }
+	size_t					GetStateChangesSorted() const { return m_iStateChangesSorted; }
+
+private:
+	size_t					CountStateChanges() const;
+
+private:
+	std::vector<CDrawPacket>	m_aPackets;
+	std::vector<CDrawPacket>	m_aSortScratch;
+
+	size_t					m_iStateChangesSubmitted;
+	size_t					m_iStateChangesSorted;
+};
+
+#endif
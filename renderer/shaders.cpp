@@ -28,6 +28,8 @@ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON A
 #include <strutils.h>
 
 #include <renderer/application.h>
+#include <renderer/glstate.h>
+#include <renderer/uniformblocks.h>
 #include <datamanager/data.h>
 #include <datamanager/dataserializer.h>
 
@@ -76,6 +78,7 @@ CShaderLibrary::~CShaderLibrary()
 		glDetachShader((GLuint)pShader->m_iProgram, (GLuint)pShader->m_iVShader);
 		glDetachShader((GLuint)pShader->m_iProgram, (GLuint)pShader->m_iFShader);
 		glDeleteProgram((GLuint)pShader->m_iProgram);
+		CGLState::ProgramDeleted(pShader->m_iProgram);
 		glDeleteShader((GLuint)pShader->m_iVShader);
 		glDeleteShader((GLuint)pShader->m_iFShader);
 	}
@@ -170,6 +173,8 @@ void CShaderLibrary::AddShader(const string& sFile)
 				oDefault.m_sValue = pUniform->GetValueString();
 			}
 		}
+		else if (pChild->GetKey() == "Define")
+			oShader.m_asDefines.push_back(pChild->GetValueString());
 	}
 }
 
@@ -270,6 +275,18 @@ CShader* CShaderLibrary::GetShader(size_t i)
 	return &Get()->m_aShaders[i];
 }
 
+size_t CShaderLibrary::GetShaderIndex(const CShader* pShader)
+{
+	if (!pShader || !Get()->m_aShaders.size())
+		return ~0;
+
+	size_t i = pShader - &Get()->m_aShaders[0];
+	if (i >= Get()->m_aShaders.size())
+		return ~0;
+
+	return i;
+}
+
 size_t CShaderLibrary::GetProgram(const string& sName)
 {
 	TAssert(Get());
@@ -291,6 +308,8 @@ CShader::CShader(const string& sName, const string& sVertexFile, const string& s
 	m_iVShader = 0;
 	m_iFShader = 0;
 	m_iProgram = 0;
+
+	m_iGlobalUniform = ~0;
 }
 
 bool CShader::Compile()
@@ -300,6 +319,9 @@ bool CShader::Compile()
 	if (CShaderLibrary::Get()->m_iSamples)
 		sShaderHeader += "#define USE_MULTISAMPLE_TEXTURES 1\n";
 
+	for (size_t i = 0; i < m_asDefines.size(); i++)
+		sShaderHeader += "#define " + m_asDefines[i] + " 1\n";
+
 	sShaderHeader += CShaderLibrary::GetShaderFunctions();
 
 	FILE* f = tfopen("shaders/" + m_sVertexFile + ".vs", "r");
@@ -309,8 +331,6 @@ bool CShader::Compile()
 		return false;
 
 	string sVertexShader = sShaderHeader;
-	sVertexShader += "uniform mat4x4 mProjection;\n";
-	sVertexShader += "uniform mat4x4 mView;\n";
 	sVertexShader += "uniform mat4x4 mGlobal;\n";
 
 	string sLine;
@@ -369,6 +389,10 @@ bool CShader::Compile()
 
 	glBindAttribLocation(iProgram, 0, "vecPosition");		// Force position at location 0. ATI cards won't work without this.
 
+	// These only take effect when the program is linked.
+	glBindFragDataLocation(iProgram, 0, "vecOutputColor");
+	glBindFragDataLocation(iProgram, 1, "vecOutputWeight");	// Only WEIGHTED shaders have it.
+
 	glAttachShader((GLuint)iProgram, (GLuint)iVShader);
 	glAttachShader((GLuint)iProgram, (GLuint)iFShader);
 	glLinkProgram((GLuint)iProgram);
@@ -398,6 +422,8 @@ bool CShader::Compile()
 	m_iVShader = iVShader;
 	m_iFShader = iFShader;
 
+	CUniformBlocks::BindProgram(m_iProgram);
+
 	m_iPositionAttribute = glGetAttribLocation(m_iProgram, "vecPosition");
 	m_iNormalAttribute = glGetAttribLocation(m_iProgram, "vecNormal");
 	m_iTangentAttribute = glGetAttribLocation(m_iProgram, "vecTangent");
@@ -405,14 +431,18 @@ bool CShader::Compile()
 	for (size_t i = 0; i < MAX_TEXTURE_CHANNELS; i++)
 		m_aiTexCoordAttributes[i] = glGetAttribLocation(m_iProgram, tsprintf("vecTexCoord%d", i).c_str());
 	m_iColorAttribute = glGetAttribLocation(m_iProgram, "vecVertexColor");
-
-	glBindFragDataLocation(m_iProgram, 0, "vecOutputColor");
+	m_iInstanceTransformAttribute = glGetAttribLocation(m_iProgram, "mInstanceGlobal");
+	m_iInstanceColorAttribute = glGetAttribLocation(m_iProgram, "vecInstanceColor");
+	m_iSpriteCenterAttribute = glGetAttribLocation(m_iProgram, "vecSpriteCenter");
+	m_iSpriteShotTimeAttribute = glGetAttribLocation(m_iProgram, "flSpriteShotTime");
 
 	TAssert(m_iPositionAttribute != ~0);
 
 	int iNumUniforms;
 	glGetProgramiv(m_iProgram, GL_ACTIVE_UNIFORMS, &iNumUniforms);
 
+	m_aUniformLocations.clear();
+
 	char szUniformName[256];
 	GLsizei iLength;
 	GLint iSize;
@@ -421,11 +451,26 @@ bool CShader::Compile()
 	{
 		glGetActiveUniform(m_iProgram, i, sizeof(szUniformName), &iLength, &iSize, &iType, szUniformName);
 
-		string sUniformName = szUniformName;
-		if (sUniformName == "mProjection")
-			continue;
-		if (sUniformName == "mView")
+		// Members of the blocks in header.si are set for every program at once by CUniformBlocks.
+		GLuint iUniform = (GLuint)i;
+		GLint iBlock;
+		glGetActiveUniformsiv(m_iProgram, 1, &iUniform, GL_UNIFORM_BLOCK_INDEX, &iBlock);
+		if (iBlock != -1)
 			continue;
+
+		string sUniformName = szUniformName;
+
+		// Arrays come back as "name[0]" but get set by their plain name.
+		size_t iBracket = sUniformName.find('[');
+		if (iBracket != string::npos)
+			sUniformName = sUniformName.substr(0, iBracket);
+
+		CUniformLocation oLocation;
+		oLocation.m_sName = sUniformName;
+		oLocation.m_iLocation = glGetUniformLocation(m_iProgram, szUniformName);
+		oLocation.m_bValueValid = false;
+		m_aUniformLocations.push_back(oLocation);
+
 		if (sUniformName == "mGlobal")
 			continue;
 
@@ -445,6 +490,8 @@ bool CShader::Compile()
 		}
 	}
 
+	m_iGlobalUniform = FindUniform("mGlobal");
+
 	for (auto it = m_aParameters.begin(); it != m_aParameters.end(); it++)
 	{
 		for (size_t j = 0; j < it->second.m_aActions.size(); j++)
@@ -541,6 +588,22 @@ void CShader::Destroy()
 	glDeleteShader((GLuint)m_iVShader);
 	glDeleteShader((GLuint)m_iFShader);
 	glDeleteProgram((GLuint)m_iProgram);
+	CGLState::ProgramDeleted(m_iProgram);
+
+	m_aUniformLocations.clear();
+	m_iGlobalUniform = ~0;
+}
+
+size_t CShader::FindUniform(const char* pszName) const
+{
+	// There's only ever a couple dozen of these, a straight search beats hashing the string.
+	for (size_t i = 0; i < m_aUniformLocations.size(); i++)
+	{
+		if (strcmp(m_aUniformLocations[i].m_sName.c_str(), pszName) == 0)
+			return i;
+	}
+
+	return ~0;
 }
 
 string CShader::FindType(const string& sName) const
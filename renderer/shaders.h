@@ -41,10 +41,14 @@ public:
 
 	size_t					FindTextureByUniform(const std::string& sUniform) const;
 
+	// Returns a handle that CRenderingContext::SetUniform can use instead of the name, or ~0 if the program doesn't have it.
+	size_t					FindUniform(const char* pszName) const;
+
 public:
 	std::string					m_sName;
 	std::string					m_sVertexFile;
 	std::string					m_sFragmentFile;
+	std::vector<std::string>	m_asDefines;	// Each gets #defined for both stages, so one .vs/.fs pair can build variants.
 	size_t					m_iVShader;
 	size_t					m_iFShader;
 	size_t					m_iProgram;
@@ -55,6 +59,10 @@ public:
 	size_t					m_iBitangentAttribute;
 	size_t					m_aiTexCoordAttributes[MAX_TEXTURE_CHANNELS];
 	size_t					m_iColorAttribute;
+	size_t					m_iInstanceTransformAttribute;	// A mat4, so it takes this location and the three after it.
+	size_t					m_iInstanceColorAttribute;
+	size_t					m_iSpriteCenterAttribute;
+	size_t					m_iSpriteShotTimeAttribute;
 
 	class CParameter
 	{
@@ -94,6 +102,21 @@ public:
 	std::map<std::string, CUniform>				m_asUniforms;	// What the hardware has. Values are types.
 	std::map<std::string, CParameter::CUniform>	m_aDefaults;	// Defaults for each uniform as specified by shader .txt (not GLSL)
 	std::vector<std::string>					m_asTextures;	// List of textures for purposes of assigning to channels and whatnot.
+
+	// Uniform locations are looked up once when the program is linked. The last value
+	// uploaded to each one is kept so that setting the same value again costs nothing.
+	class CUniformLocation
+	{
+	public:
+		std::string				m_sName;
+		int						m_iLocation;
+		bool					m_bValueValid;
+		float					m_aflValue[16];
+	};
+
+	std::vector<CUniformLocation>	m_aUniformLocations;
+
+	size_t					m_iGlobalUniform;	// Projection and view are in the Pass block, see CUniformBlocks.
 };
 
 class CShaderLibrary
@@ -109,6 +132,7 @@ public:
 
 	static CShader*			GetShader(const std::string& sName);
 	static CShader*			GetShader(size_t i);
+	static size_t			GetShaderIndex(const CShader* pShader);	// The i that GetShader(i) would give it back for, or ~0
 
 	static void				AddShader(const std::string& sFile);
 
@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_SPRITEBATCH_H
+#define TINKER_SPRITEBATCH_H
+
+#include <vector>
+
+#include <vector.h>
+#include <vector4d.h>
+
+// What each sprite of a sprite batch gets. The vertex shader turns the quad to
+// face the camera and spins it, so this is all that has to be sent.
+class CSpriteData
+{
+public:
+	float					m_aflCenter[4];		// The size goes in w
+	float					m_aflColor[4];
+	float					m_flShotTime;		// Negative if it's not spinning
+};
+
+// Sprites that all get drawn with one instanced draw. They move every frame, so unlike
+// CInstanceBuffer there's nothing to keep around. They're filled in each frame and
+// streamed to GL when they're drawn. Sprites are drawn in the order they were added.
+class CSpriteBatch
+{
+public:
+	void					Clear() { m_aSprites.clear(); }
+
+	void					AddSprite(const Vector& vecCenter, float flSize, const Vector4D& vecColor, float flShotTime);
+
+	size_t					GetNumSprites() const { return m_aSprites.size(); }
+	const CSpriteData*		GetSprites() const { return m_aSprites.data(); }
+
+private:
+	std::vector<CSpriteData>	m_aSprites;
+};
+
+#endif
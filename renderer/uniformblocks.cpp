@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "uniformblocks.h"
+
+#include <string.h>
+
+#include <GL3/gl3w.h>
+
+#include <common.h>
+
+// Laid out the way std140 lays out the Frame block in header.si. A vec3 takes up
+// 16 bytes unless a float comes after it, in which case the float goes in the gap.
+class CFrameUniforms
+{
+public:
+	float		m_aflCameraPosition[3];
+	float		m_flTime;
+	float		m_aflSunlight[3];
+	float		m_flFogMin;
+	float		m_aflFogColor[4];
+	float		m_flFogMax;
+	float		m_aflPadding[3];
+};
+
+size_t CUniformBlocks::s_iFrameBuffer = 0;
+size_t CUniformBlocks::s_iPassBuffer = 0;
+
+float CUniformBlocks::s_aflPass[32];
+bool CUniformBlocks::s_bPassValid = false;
+
+size_t CUniformBlocks::s_iUploads = 0;
+
+void CUniformBlocks::Initialize()
+{
+	GLuint aiBuffers[2];
+	glGenBuffers(2, aiBuffers);
+	s_iFrameBuffer = aiBuffers[0];
+	s_iPassBuffer = aiBuffers[1];
+
+	glBindBuffer(GL_UNIFORM_BUFFER, aiBuffers[0]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CFrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, aiBuffers[1]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(s_aflPass), nullptr, GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// They stay bound here for good.
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_FRAME, aiBuffers[0]);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_PASS, aiBuffers[1]);
+
+	s_bPassValid = false;
+}
+
+void CUniformBlocks::BindProgram(size_t iProgram)
+{
+	// Programs that don't use a block don't have it, and that's fine.
+	GLuint iFrame = glGetUniformBlockIndex((GLuint)iProgram, "Frame");
+	if (iFrame != GL_INVALID_INDEX)
+		glUniformBlockBinding((GLuint)iProgram, iFrame, UNIFORM_BLOCK_FRAME);
+
+	GLuint iPass = glGetUniformBlockIndex((GLuint)iProgram, "Pass");
+	if (iPass != GL_INVALID_INDEX)
+		glUniformBlockBinding((GLuint)iProgram, iPass, UNIFORM_BLOCK_PASS);
+}
+
+void CUniformBlocks::SetFrame(const Vector& vecCameraPosition, float flTime, const Vector& vecSunlight, float flFogMin, float flFogMax, const Vector4D& vecFogColor)
+{
+	TAssert(s_iFrameBuffer);
+
+	CFrameUniforms oFrame;
+	memset(&oFrame, 0, sizeof(oFrame));
+
+	oFrame.m_aflCameraPosition[0] = vecCameraPosition.x;
+	oFrame.m_aflCameraPosition[1] = vecCameraPosition.y;
+	oFrame.m_aflCameraPosition[2] = vecCameraPosition.z;
+	oFrame.m_flTime = flTime;
+	oFrame.m_aflSunlight[0] = vecSunlight.x;
+	oFrame.m_aflSunlight[1] = vecSunlight.y;
+	oFrame.m_aflSunlight[2] = vecSunlight.z;
+	oFrame.m_flFogMin = flFogMin;
+	oFrame.m_aflFogColor[0] = vecFogColor.x;
+	oFrame.m_aflFogColor[1] = vecFogColor.y;
+	oFrame.m_aflFogColor[2] = vecFogColor.z;
+	oFrame.m_aflFogColor[3] = vecFogColor.w;
+	oFrame.m_flFogMax = flFogMax;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, (GLuint)s_iFrameBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(oFrame), &oFrame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	s_iUploads++;
+}
+
+void CUniformBlocks::SetPass(const Matrix4x4& mProjection, const Matrix4x4& mView)
+{
+	TAssert(s_iPassBuffer);
+
+	// Most draws are for the same camera as the one before.
+	if (s_bPassValid && memcmp(&s_aflPass[0], (const float*)mProjection, sizeof(float)*16) == 0 && memcmp(&s_aflPass[16], (const float*)mView, sizeof(float)*16) == 0)
+		return;
+
+	memcpy(&s_aflPass[0], (const float*)mProjection, sizeof(float)*16);
+	memcpy(&s_aflPass[16], (const float*)mView, sizeof(float)*16);
+	s_bPassValid = true;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, (GLuint)s_iPassBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(s_aflPass), s_aflPass);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	s_iUploads++;
+}
+
+void CUniformBlocks::ResetCounters()
+{
+	s_iUploads = 0;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef TINKER_UNIFORMBLOCKS_H
+#define TINKER_UNIFORMBLOCKS_H
+
+#include <stddef.h>
+
+#include <vector.h>
+#include <vector4d.h>
+#include <matrix.h>
+
+// Where each block in header.si is bound. Every program gets the same ones when it's linked.
+#define UNIFORM_BLOCK_FRAME		0
+#define UNIFORM_BLOCK_PASS		1
+
+// The uniforms that are the same for every program, kept in uniform buffers that every shader
+// reads from through the blocks in header.si. They're sent to GL once for everybody instead of
+// once for each program that uses them, and switching programs doesn't send anything.
+//
+// The Frame block is the camera, the lights and the fog, set once a frame. The Pass block is
+// the projection and view, which CRenderingContext keeps up to date for whatever it's drawing.
+class CUniformBlocks
+{
+public:
+	static void				Initialize();
+
+	// Hook a newly linked program up to the blocks it uses.
+	static void				BindProgram(size_t iProgram);
+
+	static void				SetFrame(const Vector& vecCameraPosition, float flTime, const Vector& vecSunlight, float flFogMin, float flFogMax, const Vector4D& vecFogColor);
+
+	// Only sent if it's different from what's there.
+	static void				SetPass(const Matrix4x4& mProjection, const Matrix4x4& mView);
+
+	static size_t			GetUploads() { return s_iUploads; }
+	static void				ResetCounters();
+
+private:
+	static size_t			s_iFrameBuffer;
+	static size_t			s_iPassBuffer;
+
+	static float			s_aflPass[32];
+	static bool				s_bPassValid;
+
+	static size_t			s_iUploads;
+};
+
+#endif
@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_VERTEXFORMAT_H
+#define TINKER_VERTEXFORMAT_H
+
+#include <stddef.h>
+
+#include <common.h>
+#include <vector.h>
+#include <vector2d.h>
+#include <vector4d.h>
+
+typedef enum
+{
+	VERTEX_POSITION,
+	VERTEX_NORMAL,
+	VERTEX_TANGENT,
+	VERTEX_BITANGENT,
+	VERTEX_TEXCOORD0,
+	VERTEX_TEXCOORD1,
+	VERTEX_COLOR,
+} vertex_attribute_t;
+
+// One attribute of a vertex format. T is what gets passed in for it, all floats.
+template <vertex_attribute_t eAttribute, class T>
+class CVertexAttribute
+{
+public:
+	typedef T type;
+
+	enum
+	{
+		ATTRIBUTE = eAttribute,
+		COMPONENTS = sizeof(T)/sizeof(float),
+		BYTES = sizeof(T),
+	};
+};
+
+typedef CVertexAttribute<VERTEX_POSITION, Vector>		VertexPosition;
+typedef CVertexAttribute<VERTEX_NORMAL, Vector>			VertexNormal;
+typedef CVertexAttribute<VERTEX_TANGENT, Vector>		VertexTangent;
+typedef CVertexAttribute<VERTEX_BITANGENT, Vector>		VertexBitangent;
+typedef CVertexAttribute<VERTEX_TEXCOORD0, Vector2D>	VertexTexCoord0;
+typedef CVertexAttribute<VERTEX_TEXCOORD1, Vector2D>	VertexTexCoord1;
+typedef CVertexAttribute<VERTEX_COLOR, Vector4D>		VertexColor;
+
+// What the renderer needs to know to set up the attributes for a format. Formats make one of these for themselves.
+class CVertexAttributeLayout
+{
+public:
+	vertex_attribute_t		m_eAttribute;
+	size_t					m_iComponents;
+	size_t					m_iOffset;		// In bytes, from the start of the vertex
+};
+
+#define MAX_VERTEX_ATTRIBUTES 8
+
+class CVertexLayout
+{
+public:
+	CVertexAttributeLayout	m_aAttributes[MAX_VERTEX_ATTRIBUTES];
+	size_t					m_iAttributes;
+	size_t					m_iStride;		// In bytes
+};
+
+// Works out each attribute's offset as it goes. They're packed one after another in the order given.
+template <size_t iOffset, class... Attributes>
+class CVertexLayoutBuilder
+{
+public:
+	enum { STRIDE = iOffset };
+
+	static void Fill(CVertexAttributeLayout* pAttribute) {}
+};
+
+template <size_t iOffset, class Attribute, class... Rest>
+class CVertexLayoutBuilder<iOffset, Attribute, Rest...>
+{
+	typedef CVertexLayoutBuilder<iOffset + Attribute::BYTES, Rest...> CRest;
+
+public:
+	enum { STRIDE = CRest::STRIDE };
+
+	static void Fill(CVertexAttributeLayout* pAttribute)
+	{
+		pAttribute->m_eAttribute = (vertex_attribute_t)Attribute::ATTRIBUTE;
+		pAttribute->m_iComponents = Attribute::COMPONENTS;
+		pAttribute->m_iOffset = iOffset;
+		CRest::Fill(pAttribute+1);
+	}
+};
+
+// An interleaved vertex format, eg CVertexFormat<VertexPosition, VertexNormal, VertexTexCoord0>.
+// The layout is all worked out at compile time.
+template <class... Attributes>
+class CVertexFormat
+{
+public:
+	enum
+	{
+		ATTRIBUTES = sizeof...(Attributes),
+		STRIDE = CVertexLayoutBuilder<0, Attributes...>::STRIDE,
+	};
+
+	static_assert(ATTRIBUTES <= MAX_VERTEX_ATTRIBUTES, "Too many attributes in a vertex format. Raise MAX_VERTEX_ATTRIBUTES.");
+
+	static const CVertexLayout& GetLayout()
+	{
+		static CVertexLayout oLayout = BuildLayout();
+		return oLayout;
+	}
+
+private:
+	static CVertexLayout BuildLayout()
+	{
+		CVertexLayout oLayout;
+		CVertexLayoutBuilder<0, Attributes...>::Fill(oLayout.m_aAttributes);
+		oLayout.m_iAttributes = ATTRIBUTES;
+		oLayout.m_iStride = STRIDE;
+		return oLayout;
+	}
+};
+
+// Writes vertices of a format straight into wherever they're going, usually mapped GPU memory.
+// Vertex() takes one argument per attribute in the format, in the same order. Only writes,
+// never reads, because reading back from mapped memory is very slow.
+template <class Format>
+class CVertexWriter;
+
+template <class... Attributes>
+class CVertexWriter<CVertexFormat<Attributes...> >
+{
+public:
+	CVertexWriter(void* pData, size_t iVertices)
+	{
+		m_pflData = (float*)pData;
+		m_iVerticesLeft = iVertices;
+	}
+
+public:
+	void Vertex(const typename Attributes::type&... oValues)
+	{
+		TAssert(m_iVerticesLeft);
+		if (!m_iVerticesLeft)
+			return;
+
+		m_iVerticesLeft--;
+
+		Write(oValues...);
+	}
+
+	size_t GetVerticesLeft() const { return m_iVerticesLeft; }
+
+private:
+	void Write() {}
+
+	template <class T, class... Rest>
+	void Write(const T& oValue, const Rest&... oRest)
+	{
+		Put(oValue);
+		Write(oRest...);
+	}
+
+	void Put(const Vector& v)
+	{
+		m_pflData[0] = v.x;
+		m_pflData[1] = v.y;
+		m_pflData[2] = v.z;
+		m_pflData += 3;
+	}
+
+	void Put(const Vector2D& v)
+	{
+		m_pflData[0] = v.x;
+		m_pflData[1] = v.y;
+		m_pflData += 2;
+	}
+
+	void Put(const Vector4D& v)
+	{
+		m_pflData[0] = v.x;
+		m_pflData[1] = v.y;
+		m_pflData[2] = v.z;
+		m_pflData[3] = v.w;
+		m_pflData += 4;
+	}
+
+private:
+	float*					m_pflData;
+	size_t					m_iVerticesLeft;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "vertexstream.h"
+
+#include <GL3/gl3w.h>
+
+#include <common.h>
+
+#include "glstate.h"
+
+#define REGION_SIZE (CVertexStream::GetMaxMapSize())
+
+size_t CVertexStream::s_iBuffer = 0;
+size_t CVertexStream::s_iRegion = 0;
+size_t CVertexStream::s_iRegionUsed = 0;
+void* CVertexStream::s_apFences[VERTEXSTREAM_REGIONS];
+
+size_t CVertexStream::s_iBytesStreamed = 0;
+size_t CVertexStream::s_iFenceWaits = 0;
+
+void CVertexStream::Initialize()
+{
+	GLuint iBuffer;
+	glGenBuffers(1, &iBuffer);
+	s_iBuffer = iBuffer;
+
+	CGLState::BindArrayBuffer(s_iBuffer);
+	glBufferData(GL_ARRAY_BUFFER, VERTEXSTREAM_SIZE, nullptr, GL_STREAM_DRAW);
+
+	s_iRegion = 0;
+	s_iRegionUsed = 0;
+
+	for (size_t i = 0; i < VERTEXSTREAM_REGIONS; i++)
+		s_apFences[i] = nullptr;
+}
+
+void* CVertexStream::Map(size_t iBytes, size_t& iOffset)
+{
+	// Keep everything float aligned and then some.
+	size_t iAligned = (iBytes + 15) & ~(size_t)15;
+
+	if (!s_iBuffer || !iBytes || iAligned > REGION_SIZE)
+		return nullptr;
+
+	if (s_iRegionUsed + iAligned > REGION_SIZE)
+		NextRegion();
+
+	iOffset = s_iRegion*REGION_SIZE + s_iRegionUsed;
+
+	CGLState::BindArrayBuffer(s_iBuffer);
+
+	// Nothing in this region is still in use by the GPU, the fence took care of that. So there's no need to synchronize.
+	void* pData = glMapBufferRange(GL_ARRAY_BUFFER, iOffset, iBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+	TAssert(pData);
+	if (!pData)
+		return nullptr;
+
+	s_iRegionUsed += iAligned;
+	s_iBytesStreamed += iBytes;
+
+	return pData;
+}
+
+void CVertexStream::Unmap()
+{
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+void CVertexStream::EndFrame()
+{
+	// Nothing went in this frame, so nothing to fence.
+	if (!s_iRegionUsed)
+		return;
+
+	NextRegion();
+}
+
+void CVertexStream::ResetCounters()
+{
+	s_iBytesStreamed = 0;
+	s_iFenceWaits = 0;
+}
+
+void CVertexStream::NextRegion()
+{
+	// Fences are GL 3.2 or ARB_sync. If the driver doesn't have them the function pointers don't get loaded.
+	bool bFences = glFenceSync && glClientWaitSync && glDeleteSync;
+
+	if (bFences)
+	{
+		TAssert(!s_apFences[s_iRegion]);
+		s_apFences[s_iRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	s_iRegion = (s_iRegion+1)%VERTEXSTREAM_REGIONS;
+	s_iRegionUsed = 0;
+
+	if (s_apFences[s_iRegion])
+	{
+		GLsync pFence = (GLsync)s_apFences[s_iRegion];
+
+		// Usually the GPU is long done with it. If not, this is where we wait for it to catch up.
+		// The writes that follow are unsynchronized, so don't stop waiting until it really is done.
+		GLenum eResult = glClientWaitSync(pFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (eResult == GL_TIMEOUT_EXPIRED)
+			s_iFenceWaits++;
+
+		while (eResult == GL_TIMEOUT_EXPIRED)
+			eResult = glClientWaitSync(pFence, 0, 1000000000);
+
+		glDeleteSync(pFence);
+		s_apFences[s_iRegion] = nullptr;
+
+		// The wait itself went wrong, so there's no telling if the GPU is done. Start over on fresh
+		// storage. The old one stays around until the GPU is through with it.
+		if (eResult == GL_WAIT_FAILED)
+		{
+			TAssert(eResult != GL_WAIT_FAILED);
+			CGLState::BindArrayBuffer(s_iBuffer);
+			glBufferData(GL_ARRAY_BUFFER, VERTEXSTREAM_SIZE, nullptr, GL_STREAM_DRAW);
+		}
+	}
+	else if (!bFences && s_iRegion == 0)
+	{
+		// Let go of the old storage and get fresh. The driver keeps the old one around until the GPU is done with it.
+		CGLState::BindArrayBuffer(s_iBuffer);
+		glBufferData(GL_ARRAY_BUFFER, VERTEXSTREAM_SIZE, nullptr, GL_STREAM_DRAW);
+	}
+}
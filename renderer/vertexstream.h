@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TINKER_VERTEXSTREAM_H
+#define TINKER_VERTEXSTREAM_H
+
+#include <stddef.h>
+
+#define VERTEXSTREAM_SIZE		(4*1024*1024)
+#define VERTEXSTREAM_REGIONS	4		// How many frames the GPU can fall behind before we wait on it
+
+// One big vertex buffer that immediate mode drawing writes into, so the driver doesn't have to
+// copy vertex data out of client memory on every draw.
+//
+// The buffer is split into regions and used as a ring. Writes go one after another into the current
+// region and are mapped unsynchronized, which doesn't wait on the GPU. That's only safe because
+// a region gets a fence when we move off of it, and we wait on that fence before coming back to it.
+// Without fences the whole buffer is orphaned every time around instead.
+class CVertexStream
+{
+public:
+	static void				Initialize();
+
+	// Room for iBytes in the stream buffer, mapped for writing. iOffset is where it is in the
+	// buffer, to draw from. The buffer stays bound to GL_ARRAY_BUFFER, and has to be unmapped
+	// before drawing. Returns nullptr if there's no room, in which case draw from client memory.
+	static void*			Map(size_t iBytes, size_t& iOffset);
+	static void				Unmap();
+
+	// Moves on to the next region, so that each frame's data can be fenced separately.
+	static void				EndFrame();
+
+	static size_t			GetBuffer() { return s_iBuffer; }
+
+	// The most Map() will ever hand out at once. Anything bigger is drawn from client memory.
+	static size_t			GetMaxMapSize() { return VERTEXSTREAM_SIZE/VERTEXSTREAM_REGIONS; }
+
+	static size_t			GetBytesStreamed() { return s_iBytesStreamed; }
+	static size_t			GetFenceWaits() { return s_iFenceWaits; }
+	static void				ResetCounters();
+
+private:
+	static void				NextRegion();
+
+private:
+	static size_t			s_iBuffer;
+	static size_t			s_iRegion;
+	static size_t			s_iRegionUsed;	// In bytes
+	static void*			s_apFences[VERTEXSTREAM_REGIONS];
+
+	static size_t			s_iBytesStreamed;
+	static size_t			s_iFenceWaits;
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2013, Lunar Workshop, Inc.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software must display the following acknowledgement:
+   This product includes software developed by Lunar Workshop, Inc.
+4. Neither the name of the Lunar Workshop nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY LUNAR WORKSHOP INC ''AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LUNAR WORKSHOP BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// A little command line tool that watches the world stream. It decodes every frame,
+// checks it against the checksum the game sent along with it, and prints what it sees.
+//
+//   streamclient [--host <host>] [--port <port>] [--frames <n>]
+//
+// With --frames it quits after that many frames, and exits with 1 if any didn't check out.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <chrono>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+
+#include <game/netchannel.h>
+#include <game/snapshot.h>
+#include <game/worldstream.h>
+
+int main(int argc, char** argv)
+{
+	std::string sHost = "localhost";
+	unsigned short iPort = WORLDSTREAM_DEFAULT_PORT;
+	size_t iMaxFrames = 0;
+
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (strcmp(argv[i], "--host") == 0)
+			sHost = argv[++i];
+		else if (strcmp(argv[i], "--port") == 0)
+			iPort = (unsigned short)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--frames") == 0)
+			iMaxFrames = atoi(argv[++i]);
+	}
+
+#ifdef _WIN32
+	WSADATA wsadata;
+	WSAStartup(MAKEWORD(2, 0), &wsadata);
+#endif
+
+	CNetChannel oChannel;
+	if (!oChannel.Connect(sHost, iPort))
+	{
+		printf("Couldn't connect to %s:%d.\n", sHost.c_str(), iPort);
+		return 1;
+	}
+
+	CSnapshotHistory oHistory;
+	CNetMessage oMessage;
+	CNetMessage oAck;
+
+	size_t iFrames = 0;
+	size_t iBad = 0;
+	size_t iBytes = 0;
+
+	while (oChannel.IsConnected() && (!iMaxFrames || iFrames < iMaxFrames))
+	{
+		if (!oChannel.Receive(oMessage))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+
+		if (oMessage.ReadByte() != NET_MESSAGE_SNAPSHOT)
+			continue;
+
+		iBytes += oMessage.GetSize();
+
+		CSnapshot oSnapshot;
+		bool bDecoded = oSnapshot.Decode(oMessage, oHistory);
+		unsigned int iChecksum = oMessage.ReadLong();
+
+		iFrames++;
+
+		if (!bDecoded || oMessage.IsOverflowed() || iChecksum != oSnapshot.GetChecksum())
+		{
+			printf("Frame %u didn't decode right.\n", oSnapshot.m_iTick);
+			iBad++;
+			continue;
+		}
+
+		CSnapshot& oStored = oHistory.Add(oSnapshot.m_iTick);
+		oStored.m_flTime = oSnapshot.m_flTime;
+		oStored.m_iPlayer = oSnapshot.m_iPlayer;
+		oStored.m_aEntities.swap(oSnapshot.m_aEntities);
+
+		// Only ack what checked out, so the next delta is against something good.
+		oAck.Clear();
+		oAck.WriteByte(NET_MESSAGE_ACK);
+		oAck.WriteLong(oStored.m_iTick);
+		oChannel.Send(oAck, 0);
+		oChannel.Flush(0);
+
+		size_t aiKinds[3] = { 0, 0, 0 };
+		size_t iThinking = 0;
+		for (size_t i = 0; i < oStored.m_aEntities.size(); i++)
+		{
+			const CEntityState& oEntity = oStored.m_aEntities[i];
+			if (oEntity.m_iKind < 3)
+				aiKinds[oEntity.m_iKind]++;
+
+			if (oEntity.m_iFlags & ENTITY_STATE_THINKING)
+				iThinking++;
+		}
+
+		const CEntityState* pPlayer = oStored.FindEntity(oStored.m_iPlayer);
+		Vector vecPlayer = pPlayer ? pPlayer->GetOrigin() : Vector(0, 0, 0);
+
+		printf("Frame %u t=%.2f: %u monsters (%u thinking), %u props, player at (%.1f %.1f %.1f), %u bytes total\n",
+			oStored.m_iTick, oStored.m_flTime, (unsigned)aiKinds[NET_ENTITY_MONSTER], (unsigned)iThinking, (unsigned)aiKinds[NET_ENTITY_PROP],
+			vecPlayer.x, vecPlayer.y, vecPlayer.z, (unsigned)iBytes);
+	}
+
+	printf("%u frames, %u bad.\n", (unsigned)iFrames, (unsigned)iBad);
+
+	return iBad ? 1 : 0;
+}